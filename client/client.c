@@ -7,17 +7,87 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
 #include <ncurses.h>
 #include "message.h"
+#include "protocol.h"
 
 /**************** file-local functions ****************/
 
 static bool sendKeystrokes(void *arg);
+static bool handleTimeout(void *arg);
 static bool parseMessage(void *arg, const addr_t from, const char *message);
+static bool parseBinary(const char *message);
+static void handleOK(char icon);
+static void handleGrid(int nrows, int ncols);
+static void handleGold(int n, int p, int r);
+static void handleDisplay(const char *map, int stride);
+static void handleFrame(int seq, const char *grid, int stride);
+static bool handleQuit(const char *summary);
+static void handleError(const char *explanation);
+static void drawGold(int n, int p, int r);
+static void drawMap(const char *map, int stride);
+static void drawRow(int y, const char *row);
+static void drawPending(void);
+static void holdPending(void);
+static void predictKey(char key, int seq);
+static bool predictMove(char *map, char key);
+static void learnTerrain(const char *map);
+
+/**************** file-local constants ****************/
+
+// unchanged cells between two changed runs that we redraw anyway,
+// since moving the cursor costs about as much as writing them
+static const int runGap = 4;
+
+// longest we leave a frame undrawn because more messages were waiting
+static const float pendingTimeout = 0.1;
+
+// most moves we predict ahead of the server
+#define MaxPredictions 64
 
 // global bool to check if the client is player or spectator
 bool isPlayer = false;
 
+// global bool set once the server starts speaking the binary protocol
+static bool isBinary = false;
+
+// session token to echo in binary KEYs, once the server sends one
+static int token = 0;
+
+// number of rows and number of columns of the map
+static int NR = 0, NC = 0;
+
+// player ID (e.g. A, B, C etc.)
+static char letter;
+
+// what the map on screen shows now, NR rows of NC cells; NULL until GRID
+static char *frame = NULL;
+
+// the newest map and status not yet drawn, because newer ones were
+// already waiting; drawn when no more messages wait (see drawPending)
+static char *pendingMap = NULL;		// NR rows of NC cells
+static bool mapPending = false;
+static bool goldPending = false;
+static int pendingN, pendingP, pendingR;
+
+// frames received, and frames replaced by a newer one before being drawn
+static int framesReceived = 0, framesSkipped = 0;
+
+// with -p, a player in binary mode numbers its keys, and draws each
+// plain move at once; every FRAME from the server is then shown with
+// the moves it does not yet include done again on top of it
+static bool predict = false;
+static int keySeq = 0;			// number of the last key sent
+static int unpredictedSeq = 0;	// a sprint in flight, if not 0; we wait for it
+static char *predicted = NULL;	// NR rows of NC cells: newest frame + moves
+static char *terrain = NULL;	// what lies under each cell; '\0' if unknown
+static struct prediction {
+	int seq;				// number of the key
+	char key;				// the move
+} predictions[MaxPredictions];	// moves the server has not yet dealt with
+static int npredictions = 0;
+
 /***************** main *******************************/
 int main(const int argc, char *argv[]) {
     // initialize the message module
@@ -26,14 +96,19 @@ int main(const int argc, char *argv[]) {
     	return 1;
     }
     
-    // check arguments
-    if (argc != 3 && argc != 4) {
-    	fprintf(stderr, "Usage: ./client <hostname> <port> [playername]\n");
+    // check arguments; -p turns on prediction
+    int argi = 1;
+    if (argc > 1 && strcmp(argv[1], "-p") == 0) {
+    	predict = true;
+    	argi = 2;
+    }
+    if (argc - argi != 2 && argc - argi != 3) {
+    	fprintf(stderr, "Usage: ./client [-p] <hostname> <port> [playername]\n");
     	return 1;
     }
     
     // check for player/spectator
-    if (argc == 4) {
+    if (argc - argi == 3) {
     	isPlayer = true;
     }
     
@@ -44,8 +119,8 @@ int main(const int argc, char *argv[]) {
     keypad(stdscr, TRUE);
     
     // get hostname, port and server address from command line
-    const char *host = argv[1];
-    const char *port = argv[2];
+    const char *host = argv[argi];
+    const char *port = argv[argi + 1];
     addr_t server;
     if (!message_setAddr(host, port, &server)) {
     	fprintf(stderr, "Error: can't form address from %s %s\n", host, port);
@@ -55,19 +130,29 @@ int main(const int argc, char *argv[]) {
     // first, let server know whether client is joining as a player or a spectator
     if (isPlayer) {
     	char playermsg[20];
-    	sprintf(playermsg, "PLAY %s", argv[3]);
+    	sprintf(playermsg, "PLAY %s", argv[argi + 2]);
 	    fprintf(stderr, "Joining as player\n");
     	message_send(server, playermsg);
     } else {
 	    fprintf(stderr, "Joining as spectator\n");
     	message_send(server, "SPECTATE");
     }
+
+    // offer the binary protocol; servers that don't know it will ignore this
+    message_send(server, "PROTO BINARY");
     
     // Loop, waiting for input or for messages
     // We use the 'arg' parameter to carry a pointer to 'server'.
-    bool ok = message_loop(&server, 0, NULL, sendKeystrokes, parseMessage);
+    // Frames held back while newer messages wait are drawn on a timeout,
+    // which is set only while one is held back (see holdPending).
+    bool ok = message_loop(&server, pendingTimeout, handleTimeout, sendKeystrokes, parseMessage);
     
     // shut down the message module
+    fprintf(stderr, "Skipped %d of %d frames\n", framesSkipped, framesReceived);
+    free(frame);
+    free(pendingMap);
+    free(predicted);
+    free(terrain);
     message_done();
     fprintf(stderr, "Shutting down message module\n");
     
@@ -95,7 +180,8 @@ static bool sendKeystrokes(void *arg) {
     // ncurses reads character by character
     // we initialize a single int instead of char because ncurses accepts ASCII values
     int ch;
-    char message[6];
+    int seq = 0;
+    char message[PROTO_MAXHEADER];
 
     // read a line from ncurses display
     // capture until CTRL + C (ASCII 3)
@@ -104,116 +190,490 @@ static bool sendKeystrokes(void *arg) {
 	    fprintf(stderr, "Exiting ncurses...\n");
         endwin();
         return true;
+    } else if (isBinary) {
+        // binary message containing a client keystroke, numbered
+        // if we predict moves
+        seq = (predict && isPlayer) ? ++keySeq : 0;
+        proto_encodeKey(message, (char)ch, token, seq);
     } else {
         // message containing a client keystroke
         sprintf(message, "KEY %c", (char)ch);
     }
 
     // send as message to server
-    fprintf(stderr, "Sending message to server: %s\n", message);
+    fprintf(stderr, "Sending keystroke to server: %c\n", (char)ch);
     message_send(*serverp, message);
+    if (seq > 0) {
+        predictKey((char)ch, seq);
+    }
 
     // normal case: keep looping
     return false;
 }
 
+/**************** handleTimeout ****************/
+/* Draws any frame held back while more messages were waiting
+ * but which no message has replaced since.
+ * Return false, to keep looping.
+ */
+static bool handleTimeout(void *arg) {
+	drawPending();
+	return false;
+}
+
 /**************** parseMessage ****************/
 /* Receives message from server (GRID, GOLD, DISPLAY, QUIT, OK, ERROR)
  * Perform an action according to the message
  * Return true if any fatal error
  */
 static bool parseMessage(void *arg, const addr_t from, const char *message) {
-	// number of rows and number of columns
-	static int NR = 0, NC = 0;
-
-	// player ID (e.g. A, B, C etc.)
-	static char letter;
+	// binary messages are decoded separately; see protocol.h
+	if (proto_type(message) != 0) {
+		isBinary = true;
+		return parseBinary(message);
+	}
 
 	// if client receives a message "OK player id", assign player ID to letter
 	if (strncmp(message, "OK", 2) == 0) {
-		sscanf(message, "OK %c", &letter);
+		char icon;
+		if (sscanf(message, "OK %c", &icon) == 1) {
+			handleOK(icon);
+		}
 	}
 
 	// if client receives a message "GRID rows columns", assign those values to NR and NC
 	if (strncmp(message, "GRID", 4) == 0) {
-		sscanf(message, "GRID %d %d", &NR, &NC);
-		
-		int rows, cols;
-		while (1) {
-			// get currect dimensions of ncurses display
-			getmaxyx(stdscr, rows, cols);
-
-			// if the dimensions of display are equal or greater than NR and NC, exit while loop
-			if (rows >= NR+1 && cols >= NC+1) {
-				break;
-			}
-
-			// if the dimensions of display are smaller than NR and NC, tell client to resize window
-			mvprintw(0, 0, "Resize window for better results\n");
-            refresh();
-            napms(500);
+		int nrows, ncols;
+		if (sscanf(message, "GRID %d %d", &nrows, &ncols) == 2) {
+			handleGrid(nrows, ncols);
 		}
-
-		refresh();
 	}
 
 	// if client receives a message "GOLD received unclaimed total", assign those values to n, r and p
 	if (strncmp(message, "GOLD", 4) == 0) {
-		clear();
 		int n, p, r;
-		sscanf(message, "GOLD %d %d %d", &n, &p, &r);
+		if (sscanf(message, "GOLD %d %d %d", &n, &p, &r) == 3) {
+			handleGold(n, p, r);
+		}
+	}
+
+	// if client receives a message "DISPLAY string", display the string (map)
+	if (strncmp(message, "DISPLAY", 7) == 0) {
+		// rows are separated by newlines; ignore a map too short for the grid
+		size_t len = strlen(message);
+		if (len >= 8 && len - 8 >= (size_t)NR * (NC + 1)) {
+			handleFrame(0, message + 8, NC + 1);
+		}
+	}
+
+	// if client receives a message "QUIT summary", display the received summary
+	if (strncmp(message, "QUIT", 4) == 0) {
+		return handleQuit(message + 5);
+	}
 
-		// if the client is a player, display game status for a player
-		if (isPlayer) { 
-			mvprintw(0, 0, "Player %c has %d nuggets (%d nuggets unclaimed).", letter, p, r);
-			if (n > 0) {
-				mvprintw(0, 50, "GOLD received: %d  ", n);
+	// if client receives a message "ERROR explanation", display the explanation in the upper right corner
+	if (strncmp(message, "ERROR", 5) == 0) {
+		handleError(message + 6);
+	}
+
+    return false;
+}
+
+/**************** parseBinary ****************/
+/* Decodes a binary message from the server and performs the same
+ * action as for its text equivalent
+ * Return true if the message loop should exit
+ */
+static bool parseBinary(const char *message) {
+	char icon;
+	int n, p, r;
+	const char *text;
+
+	switch (proto_type(message)) {
+		case PROTO_OK:
+			if (proto_decodeOK(message, &icon)) {
+				handleOK(icon);
 			}
+			break;
+		case PROTO_GRID:
+			if (proto_decodeGrid(message, &n, &p)) {
+				handleGrid(n, p);
+			}
+			break;
+		case PROTO_GOLD:
+			if (proto_decodeGold(message, &n, &p, &r)) {
+				handleGold(n, p, r);
+			}
+			break;
+		case PROTO_DISPLAY:
+			// rows follow one another with no newlines
+			if (proto_decodeDisplay(message, &text) && strlen(text) >= NR * NC) {
+				handleFrame(0, text, NC);
+			}
+			break;
+		case PROTO_FRAME:
+			// a DISPLAY that says which of our keys it includes
+			if (proto_decodeFrame(message, &n, &text) && strlen(text) >= NR * NC) {
+				handleFrame(n, text, NC);
+			}
+			break;
+		case PROTO_SESSION:
+			proto_decodeSession(message, &token);
+			break;
+		case PROTO_QUIT:
+			if (proto_decodeText(message, PROTO_QUIT, &text)) {
+				return handleQuit(text);
+			}
+			break;
+		case PROTO_ERROR:
+			if (proto_decodeText(message, PROTO_ERROR, &text)) {
+				handleError(text);
+			}
+			break;
+		default:
+			fprintf(stderr, "Ignoring unknown binary message type %d\n", proto_type(message));
+			break;
+	}
+	return false;
+}
 
-		// if the client is a spectator, display game status for a spectator
-		} else {
-			mvprintw(0, 0, "Spectator: %d nuggets unclaimed", r);
+/**************** handleOK ****************/
+/* Remembers the player's letter */
+static void handleOK(char icon) {
+	letter = icon;
+}
+
+/**************** handleGrid ****************/
+/* Remembers the map size, sets up the frame buffer,
+ * and waits for the window to be big enough
+ */
+static void handleGrid(int nrows, int ncols) {
+	drawPending();
+	NR = nrows;
+	NC = ncols;
+
+	// nothing of the new map is on screen yet; a cell never holds
+	// '\0', so the first DISPLAY draws every cell
+	free(frame);
+	free(pendingMap);
+	free(predicted);
+	free(terrain);
+	frame = calloc(NR * NC, 1);
+	pendingMap = malloc(NR * NC);
+	predicted = malloc(NR * NC);
+	terrain = calloc(NR * NC, 1);
+	npredictions = 0;
+	if (frame == NULL || pendingMap == NULL || predicted == NULL || terrain == NULL) {
+		free(frame);
+		free(pendingMap);
+		free(predicted);
+		free(terrain);
+		frame = pendingMap = predicted = terrain = NULL;
+		NR = NC = 0;
+		fprintf(stderr, "Error: out of memory for a %d x %d map\n", nrows, ncols);
+		return;
+	}
+	
+	int rows, cols;
+	while (1) {
+		// get currect dimensions of ncurses display
+		getmaxyx(stdscr, rows, cols);
+
+		// if the dimensions of display are equal or greater than NR and NC, exit while loop
+		if (rows >= NR+1 && cols >= NC+1) {
+			break;
 		}
-		refresh();
+
+		// if the dimensions of display are smaller than NR and NC, tell client to resize window
+		mvprintw(0, 0, "Resize window for better results\n");
+        refresh();
+        napms(500);
 	}
 
-	// if client receives a message "DISPLAY string", display the string (map)
-	if (strncmp(message, "DISPLAY", 7) == 0) {
-		mvprintw(1, 0, "\n");
-		const char* map = message + 8;
+	refresh();
+}
+
+/**************** handleGold ****************/
+/* Shows the game status line, unless newer messages are waiting;
+ * then the newest status is shown after them, with the gold
+ * received adding up over the statuses not shown
+ */
+static void handleGold(int n, int p, int r) {
+	pendingN = goldPending ? pendingN + n : n;
+	pendingP = p;
+	pendingR = r;
+	goldPending = true;
+	if (!message_pending()) {
+		drawPending();
+	} else {
+		holdPending();
+	}
+}
+
+/**************** drawGold ****************/
+/* Draws the game status line */
+static void drawGold(int n, int p, int r) {
+	// redraw only the status line; the map below it is unchanged
+	move(0, 0);
+	clrtoeol();
+
+	// if the client is a player, display game status for a player
+	if (isPlayer) { 
+		mvprintw(0, 0, "Player %c has %d nuggets (%d nuggets unclaimed).", letter, p, r);
+		if (n > 0) {
+			mvprintw(0, 50, "GOLD received: %d  ", n);
+		}
 
-		fprintf(stderr, "Displaying map...\n");
-		for (int i = 0; map[i] != '\0'; i++) {
-			fprintf(stderr, "%c", map[i]);
+	// if the client is a spectator, display game status for a spectator
+	} else {
+		mvprintw(0, 0, "Spectator: %d nuggets unclaimed", r);
+	}
+}
+
+/**************** handleDisplay ****************/
+/* Draws the map; each of the NR rows has NC characters, and
+ * successive rows start 'stride' characters apart.
+ * If newer messages are already waiting, the map is kept to draw
+ * after them, unless one of them is a newer map.
+ */
+static void handleDisplay(const char *map, int stride) {
+	if (frame == NULL) {
+		return;		// no GRID yet
+	}
+	framesReceived++;
+	if (mapPending) {
+		framesSkipped++;	// replaced before it was drawn
+		mapPending = false;
+	}
+
+	if (message_pending()) {
+		for (int y = 0; y < NR; y++) {
+			memcpy(pendingMap + y * NC, map + y * stride, NC);
 		}
+		mapPending = true;
+		holdPending();
+		return;
+	}
+
+	// nothing waiting: draw the status, if held, and this map
+	drawPending();
+	drawMap(map, stride);
+	refresh();
+}
 
-		for (int i = 0; map[i] != '\0'; i++) {
-			printw("%c", map[i]);
+/**************** handleFrame ****************/
+/* Shows a DISPLAY or FRAME, which includes our keys up to number
+ * 'seq' (0 for a DISPLAY), with rows 'stride' characters apart; if
+ * we predict moves, the later ones are done again on top of it, and
+ * any that no longer fit the map are forgotten
+ */
+static void handleFrame(int seq, const char *grid, int stride) {
+	if (!predict || predicted == NULL) {
+		handleDisplay(grid, stride);
+		return;
+	}
+
+	if (unpredictedSeq != 0 && seq >= unpredictedSeq) {
+		unpredictedSeq = 0;		// the sprint is done; predict again
+	}
+	for (int r = 0; r < NR; r++) {
+		memcpy(predicted + r * NC, grid + r * stride, NC);
+	}
+	learnTerrain(predicted);
+
+	int kept = 0;
+	for (int i = 0; i < npredictions; i++) {
+		if (predictions[i].seq > seq && predictMove(predicted, predictions[i].key)) {
+			predictions[kept++] = predictions[i];
 		}
-		mvprintw(NR+2, 0, "\n");
-		refresh();
 	}
+	npredictions = kept;
+	handleDisplay(predicted, NC);
+}
 
-	// if client receives a message "QUIT summary", display the received summary
-	if (strncmp(message, "QUIT", 4) == 0) {
-		const char* summary = message + 5;
-		for (int i = 0; summary[i] != '\0'; i++) {
-			printw("%c", summary[i]);
+/**************** predictKey ****************/
+/* Draws the move for key number 'seq' at once, if it is a plain
+ * move onto open ground; after a sprint, or any other key we cannot
+ * predict, we wait for the server to deal with it first
+ */
+static void predictKey(char key, int seq) {
+	if (predicted == NULL) {
+		return;
+	}
+	if (isupper((unsigned char)key)) {
+		unpredictedSeq = seq;
+		return;
+	}
+	if (unpredictedSeq != 0 || npredictions == MaxPredictions
+	    || !predictMove(predicted, key)) {
+		return;
+	}
+	predictions[npredictions].seq = seq;
+	predictions[npredictions].key = key;
+	npredictions++;
+
+	// the prediction is newer than any map held back
+	mapPending = false;
+	drawPending();
+	drawMap(predicted, NC);
+	refresh();
+}
+
+/**************** predictMove ****************/
+/* Moves the '@' in map one step for key, if the step lands on
+ * room floor, passage, or gold; returns false if it cannot
+ */
+static bool predictMove(char *map, char key) {
+	int dx = 0, dy = 0;
+	switch (key) {
+		case 'h': dx = -1; break;
+		case 'l': dx = 1; break;
+		case 'k': dy = -1; break;
+		case 'j': dy = 1; break;
+		case 'y': dx = -1; dy = -1; break;
+		case 'u': dx = 1; dy = -1; break;
+		case 'b': dx = -1; dy = 1; break;
+		case 'n': dx = 1; dy = 1; break;
+		default: return false;
+	}
+
+	char *at = memchr(map, '@', NR * NC);
+	if (at == NULL) {
+		return false;
+	}
+	int from = at - map;
+	int x = from % NC + dx, y = from / NC + dy;
+	if (x < 0 || x >= NC || y < 0 || y >= NR) {
+		return false;
+	}
+	int to = y * NC + x;
+	if (map[to] != '.' && map[to] != '#' && map[to] != '*') {
+		return false;
+	}
+
+	// leave behind what was under us; gold, once taken, leaves floor
+	map[from] = (terrain[from] != '\0') ? terrain[from] : '.';
+	if (map[to] == '*') {
+		terrain[to] = '.';
+	}
+	map[to] = '@';
+	return true;
+}
+
+/**************** learnTerrain ****************/
+/* Remembers the floor and passages seen in a frame from the server,
+ * so a predicted move can restore what the '@' stood on
+ */
+static void learnTerrain(const char *map) {
+	for (int i = 0; i < NR * NC; i++) {
+		if (map[i] == '.' || map[i] == '#') {
+			terrain[i] = map[i];
+		} else if (map[i] == '*') {
+			terrain[i] = '.';
 		}
-		fprintf(stderr, "Quitting...\n");
-		refresh();
-		return true;
 	}
+}
 
-	// if client receives a message "ERROR explanation", display the explanation in the upper right corner
-	if (strncmp(message, "ERROR", 5) == 0) {
-		const char* explanation = message + 6;
-		move(0, 50);
-		for (int i = 0; explanation[i] != '\0'; i++) {
-			printw("%c", explanation[i]);
+/**************** drawPending ****************/
+/* Draws the status and map held back by handleGold and handleDisplay,
+ * if any, and stops the timeout set for them
+ */
+static void drawPending(void) {
+	message_setTimeout(0);
+	if (!goldPending && !mapPending) {
+		return;		// the screen is up to date
+	}
+	if (goldPending) {
+		drawGold(pendingN, pendingP, pendingR);
+		goldPending = false;
+	}
+	if (mapPending) {
+		drawMap(pendingMap, NC);
+		mapPending = false;
+	}
+	refresh();
+}
+
+/**************** holdPending ****************/
+/* Sets a timeout to draw what handleGold or handleDisplay held back,
+ * in case no later message draws it first
+ */
+static void holdPending(void) {
+	message_setTimeout(pendingTimeout);
+}
+
+/**************** drawMap ****************/
+/* Draws the cells of the map that differ from the frame on screen;
+ * successive rows of the map start 'stride' characters apart
+ */
+static void drawMap(const char *map, int stride) {
+#ifdef DEBUG
+	fprintf(stderr, "Displaying map...\n");
+	for (int y = 0; y < NR; y++) {
+		fprintf(stderr, "%.*s\n", NC, map + y * stride);
+	}
+#endif
+
+	for (int y = 0; y < NR; y++) {
+		const char *row = map + y * stride;
+		if (memcmp(row, frame + y * NC, NC) != 0) {
+			drawRow(y, row);
 		}
-		refresh();
 	}
+}
 
-    return false;
-}
\ No newline at end of file
+/**************** drawRow ****************/
+/* Draws the runs of cells in row y of the map that differ from the
+ * frame, and records them in the frame; runs separated by no more
+ * than runGap unchanged cells are drawn as one
+ */
+static void drawRow(int y, const char *row) {
+	char *old = frame + y * NC;
+	int x = 0;
+	while (x < NC) {
+		// skip to the start of a run of changes
+		while (x < NC && row[x] == old[x]) {
+			x++;
+		}
+		if (x == NC) {
+			break;
+		}
+
+		// find its end, taking in any run that follows closely
+		int start = x, end = x;
+		while (x < NC && x - end <= runGap) {
+			if (row[x] != old[x]) {
+				end = x + 1;
+			}
+			x++;
+		}
+
+		mvaddnstr(2 + y, start, row + start, end - start);
+		memcpy(old + start, row + start, end - start);
+		x = end;
+	}
+}
+
+/**************** handleQuit ****************/
+/* Shows the summary below the map; returns true, to end the message loop */
+static bool handleQuit(const char *summary) {
+	drawPending();
+	move(NR + 2, 0);	// drawMap leaves the cursor wherever it last drew
+	for (int i = 0; summary[i] != '\0'; i++) {
+		printw("%c", summary[i]);
+	}
+	fprintf(stderr, "Quitting...\n");
+	refresh();
+	return true;
+}
+
+/**************** handleError ****************/
+/* Shows the explanation in the upper right corner */
+static void handleError(const char *explanation) {
+	drawPending();
+	move(0, 50);
+	for (int i = 0; explanation[i] != '\0'; i++) {
+		printw("%c", explanation[i]);
+	}
+	refresh();
+}
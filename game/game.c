@@ -6,14 +6,20 @@
  *
  */
 
+#define _GNU_SOURCE       // clock_gettime
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <time.h>
 #include <assert.h>
 #include <ctype.h>
 #include <unistd.h>
-#include "hashtable.h"
+#include "hashmap.h"
+#include "vector.h"
 #include "message.h"
+#include "protocol.h"
+#include "session.h"
 #include "grid.h"
 #include "mem.h"
 #include "file.h"
@@ -37,6 +43,10 @@ static const char wallSpotVert = '|';
 static const char wallSpotHoriz = '-';
 static const char wallSpotCorn = '+';
 static const char blank = ' ';
+static const char displayHeader[] = "DISPLAY\n";
+static const int initialSpectators = 4; // room for spectators at first
+static const int arenaMaps = 8;         // a game's arena blocks hold this
+                                        // many maps' worth of bytes
 
 /**************** local types ****************/
 typedef struct player {
@@ -47,23 +57,59 @@ typedef struct player {
   char* name;       // player string name
   addr_t address;   // player client address
   char* visibleMap;   // map of what player can see
+  char* frame;        // DISPLAY rows for visibleMap, newlines pre-placed
   bool isSpectator;   // is player a spectator
   bool isActive;    // has player qut
+  bool isBinary;    // does client speak the binary protocol
+  int token;        // player's session token, 0 for the spectator
+  double keyTokens; // keys the player may send now, if keys are limited
+  long keyRefilled; // when keyTokens was last topped up, in ms
+  char heldKey;     // newest key over the limit, waiting; 0 if none
+  int heldSeq;      // sequence number of heldKey
+  int keySeq;       // sequence number of the last key dealt with; 0 if the
+                    // client does not number its keys (see protocol.h)
 } player_t;
 
+/* players by icon, and spectators, in typed containers (see hashmap.h
+ * and vector.h), so the loops over them in game_updateVisibility and
+ * game_sendDisplays are plain loops with no callbacks
+ */
+static inline uint32_t iconHash(char icon) { return (unsigned char) icon * 0x9e3779b1u; }
+static inline bool iconEq(char a, char b) { return a == b; }
+DEFINE_HASHMAP(iconmap, char, player_t*, iconHash, iconEq)
+DEFINE_VECTOR(spectatorvec, player_t*)
+
 /**************** global types ****************/
 typedef struct game {
-  hashtable_t* players;  // all players in game by string address
-  hashtable_t* icons;    // all players in game by icon
+  session_table_t* players;  // all players in game by address
+  iconmap_t icons;       // all players in game by icon, in order of joining
   grid_t* grid;          //  map parameters
   char* mapOG;           // unaltered map
   char* mapCurr;         // current map state
   int remainingGold;     // amount of gold left
   int remainingPiles;    // ammount of piles left
   int numPlayers;        // num of players
-  player_t* spectator;   // the game's spectator
+  int numActive;         // of those, players who have not quit
+  spectatorvec_t spectators; // the game's spectators, in no particular order
+  char* spectatorFrame;  // text DISPLAY rows of mapCurr, newlines pre-placed
+  mem_arena_t* arena;    // the game itself, its maps, and its players
+  mem_pool_t* spectatorPool; // spectators, recycled as they come and go
+  double keyRate;        // keys per second per player; 0 if unlimited
+  int keyBurst;          // most keys a player may send at once
+  bool keyCoalesce;      // hold the newest excess key, rather than drop it
+  int keysCoalesced;     // held keys replaced by newer ones
+  int keysDropped;       // excess keys dropped
+  int keysHeld;          // players with a key held
 } game_t;
 
+/* what takeHeld_helper is looking for, and what it found */
+typedef struct heldSearch {
+  game_t* game;          // game whose players to search
+  long now;              // time to top up their keys to
+  player_t* found;       // first player whose held key may go; or NULL
+  double due;            // seconds until the first held key may go; -1 if none
+} heldSearch_t;
+
 /**************** global functions ****************/
 /* that is, visible outside this file */
 /* see game.h for comments about exported functions */
@@ -72,16 +118,25 @@ typedef struct game {
 /**************** local functions ****************/
 /* not visible outside this file */
 static player_t* player_new(game_t* game, int x, int y, char icon, char* name, addr_t address, bool isSpectator);
-static player_t* player_get(game_t* game, char* address);
+static player_t* player_get(game_t* game, addr_t address, int token);
 static player_t* player_getFromIcon(game_t* game, char icon);
+static int spectator_find(game_t* game, addr_t address);
 static void player_swap(game_t* game, player_t* player1, player_t* player2);
-static void player_delete(void* item);
+static void player_delete(game_t* game, player_t* spectator);
 static void randomizePileLocations(game_t* game);
-static void getPlayerSummary(void *arg, const char *key, void *item);
-static void sendPlayerSummary(void* arg, const char* key, void* item);
-static void getGold(game_t* game, player_t* player);
-static void sendDisplay_helper(void* arg, const char* key, void* item);
-static void visibility_helper(void* arg, const char* key, void* item);
+static void getPlayerSummary(void *arg, const int token, void *item);
+static void sendPlayerSummary(void* arg, const int token, void* item);
+static bool player_step(game_t* game, player_t* player, int cx, int cy, int* collected);
+static int getGold(game_t* game, player_t* player);
+static void sendGold(player_t* player, int collected, int remaining);
+static void sendQuit(player_t* player, const char* explanation);
+static void sendDisplay_helper(void* arg, const int token, void* item);
+static void sendSpectatorDisplays(game_t* game);
+static void refillKeys(game_t* game, player_t* player, const long now);
+static void takeHeld_helper(void* arg, const int token, void* item);
+static void keyDue_helper(void* arg, const int token, void* item);
+static void ackKey(game_t* game, player_t* player, const int seq, const bool resend);
+static long nowMs(void);
 
 
 /**************************** game module functions **************************/
@@ -97,62 +152,113 @@ game_new(char* mapPath)
     return NULL;
   }
 
-  //create game struct
-  game_t* game = mem_malloc(sizeof(game_t));
-  if (game == NULL){
-    return NULL;
-  }
-
-  //initialize players hashtable
-  game->players = hashtable_new(maxPlayers);
-  if (game->players == NULL){
-    mem_free(game);
-    return NULL;
-  }
-
-  game->icons = hashtable_new(maxPlayers);
-  if (game->icons == NULL){
-    mem_free(game);
+  // read the whole map at once, then pack its rows together in place,
+  // dropping the newlines; this also finds the map size for the grid
+  char* mapText = file_readFile(fp);
+  fclose(fp);
+  if (mapText == NULL){
     return NULL;
   }
-
-
-  //malloc space for map
-  char *mapOG = malloc(messageMaxBytes);
-  mapOG[0] = '\0';   //added so can use strcat with blank string
-
-  //figure out map size for grid structure
   int height = 0;
   int width = 0;
 
+  char* cursor = mapText;
+  char* packed = mapText;
   char* line;
-  while ((line = file_readLine(fp)) != NULL){
-    strcat(mapOG, line);
+  while ((line = file_nextLine(&cursor)) != NULL){
+    size_t len = strlen(line);
     if (height == 0){
-      width = strlen(mapOG);
+      width = len;
     }
-    mem_free(line);
+    memmove(packed, line, len);
+    packed += len;
     height++;
   }
+  *packed = '\0';
   
+  // the whole map must fit in one DISPLAY message
+  size_t mapBytes = packed - mapText + 1;
+  if (mapBytes > messageMaxBytes){
+    free(mapText);
+    return NULL;
+  }
+
+  // everything the game allocates for itself comes from one arena,
+  // freed all at once in game_delete; spectators, who come and go,
+  // are recycled through a pool in it.  The game starts zeroed, so
+  // game_delete can undo a game_new that fails partway
+  mem_arena_t* arena = mem_arena_new(arenaMaps * mapBytes);
+  game_t* game = mem_arena_calloc(arena, 1, sizeof(game_t));
+  if (game == NULL){
+    free(mapText);
+    mem_arena_delete(arena);
+    return NULL;
+  }
+  game->arena = arena;
+  game->spectatorPool = mem_pool_new(arena, sizeof(player_t));
+
+  //initialize players session table
+  game->players = session_new(maxPlayers);
+  if (game->players == NULL){
+    goto fail;
+  }
+
+  if (!iconmap_init(&game->icons, maxPlayers)){
+    goto fail;
+  }
+
   // set up player maps and grid
-  char* mapCurr = malloc(messageMaxBytes);
-  strcpy(mapCurr, mapOG);
-  game->mapCurr = mapCurr;
-  game->mapOG = mapOG;
+  game->mapOG = mem_arena_alloc(arena, mapBytes);
+  game->mapCurr = mem_arena_alloc(arena, mapBytes);
+  if (game->spectatorPool == NULL || game->mapOG == NULL || game->mapCurr == NULL){
+    goto fail;
+  }
+  memcpy(game->mapOG, mapText, mapBytes);
+  memcpy(game->mapCurr, mapText, mapBytes);
+  free(mapText);
+  mapText = NULL;
   game->grid = grid_new(height, width);
+  if (game->grid == NULL){
+    goto fail;
+  }
 
-  // set gold, spectator and numPlayers
+  // set gold, spectators and numPlayers
   game->remainingGold = goldTotal;
   game->remainingPiles = (rand() % (goldMaxPiles - goldMinPiles)) + goldMinPiles;
   game->numPlayers = 0;
-  game->spectator = NULL;
+  game->numActive = 0;
+  if (!spectatorvec_init(&game->spectators, initialSpectators)){
+    goto fail;
+  }
+
+  // every spectator sees all of mapCurr; text spectators share one
+  // frame, with the newline at the end of each row put there now
+  game->spectatorFrame = mem_arena_alloc(game->arena, height * (width + 1));
+  if (game->spectatorFrame == NULL){
+    goto fail;
+  }
+  for (int y = 0; y < height; y++){
+    game->spectatorFrame[y * (width + 1) + width] = '\n';
+  }
+
+  // keys are unlimited until game_limitKeys
+  game->keyRate = 0;
+  game->keyBurst = 0;
+  game->keyCoalesce = true;
+  game->keysCoalesced = 0;
+  game->keysDropped = 0;
+  game->keysHeld = 0;
 
   // add gold to map
   randomizePileLocations(game);
 
-  fclose(fp);
   return game;
+
+ fail:
+  // free whatever was allocated before the failure
+  free(mapText);
+  game_delete(game);
+  return NULL;
 }
 
 /**************** game_addPlayer ****************/
@@ -171,7 +277,10 @@ game_addPlayer(game_t* game, char* name, addr_t address)
   }
   
   // truncate player name if needed 
-  char* shortenedName = malloc(sizeof(char)*(maxNameLength+1));
+  char* shortenedName = mem_arena_alloc(game->arena, maxNameLength+1);
+  if (shortenedName == NULL){
+    return false;
+  }
   strncpy(shortenedName, name, maxNameLength+1);
   shortenedName[maxNameLength] = '\0';
   for (int i = 0; i < strlen(shortenedName); i++){
@@ -198,7 +307,6 @@ game_addPlayer(game_t* game, char* name, addr_t address)
   //create the player struct
   player_t* player = player_new(game, x, y, icon, shortenedName, address, false);
   if (player == NULL){
-    free(shortenedName);
     return false;
   } 
 
@@ -217,23 +325,20 @@ game_addPlayer(game_t* game, char* name, addr_t address)
   sprintf(goldMsg, "GOLD %d %d %d", 0, player->gold, game->remainingGold);
   message_send(address, goldMsg);
   
-  // add player to hashtable
-  if (hashtable_insert(game->players, message_stringAddr(address), player) == false){
-    free(shortenedName);
+  // add player to session table
+  player->token = session_insert(game->players, address, player);
+  if (player->token == 0){
     return false;
   }
 
-  // add player to hashtable
-  char str[2];
-  str[0] = icon;
-  str[1] = '\0';
-  if (hashtable_insert(game->icons, str, player) == false){
-    free(shortenedName);
+  // add player to map of icons
+  if (iconmap_insert(&game->icons, icon, player) == false){
     return false;
   }
 
 
   game->numPlayers++;
+  game->numActive++;
 
   //update other players
   game_updateVisibility(game); 
@@ -245,22 +350,30 @@ game_addPlayer(game_t* game, char* name, addr_t address)
 /**************** game_deletePlayer ****************/
 /* see game.h for details */
 bool
-game_deletePlayer(game_t* game, char* addressStr)
+game_deletePlayer(game_t* game, addr_t address, int token)
 {
   if (game == NULL){
     return false;
   }
 
-  // get player by address and free address
-  player_t* player = player_get(game, addressStr);
+  // get player by address
+  player_t* player = player_get(game, address, token);
 
   if (player == NULL){
     return false;
   }
 
-  // make player inactive
+  // make player inactive, dropping any key it had held
+  if (player->isActive){
+    game->numActive--;
+  }
   player->isActive = false;
-  message_send(player->address, "QUIT Thanks for playing!");
+  if (player->heldKey != 0){
+    player->heldKey = 0;
+    game->keysHeld--;
+    game->keysDropped++;
+  }
+  sendQuit(player, "Thanks for playing!");
   return true; 
 }
 
@@ -273,21 +386,18 @@ game_addSpectator(game_t* game, addr_t address)
     return false;
   }
 
-  // handle case where game already has spectator
-  if (game->spectator != NULL){
-    player_t* prevSpectator = game->spectator;
-    addr_t spectatorAddr = prevSpectator->address;
-    message_send(spectatorAddr, "QUIT You have been replaced by a new spectator");
-    player_delete(prevSpectator);
+  // a spectator that asks again just starts over
+  if (spectator_find(game, address) < 0){
+    player_t* spectator = player_new(game, 0, 0, '\0', "", address, true);
+    if (spectator == NULL){
+      return false;
+    }
+    //not stored in session table with players
+    if (!spectatorvec_push(&game->spectators, spectator)){
+      player_delete(game, spectator);
+      return false;
+    }
   }
-
-  player_t* spectator = player_new(game, 0, 0, '\0', "", address, true);
-
-  // malloc space for spectator visible map
-  if (spectator == NULL){
-    return false;
-  } 
-  game->spectator = spectator; //not stored in hashtable with other players
   
   // send grid message
   char gridMsg[15]; // should there be any basis to this size?
@@ -299,99 +409,240 @@ game_addSpectator(game_t* game, addr_t address)
   sprintf(goldMsg, "GOLD %d %d %d", 0, 0, game->remainingGold);
   message_send(address, goldMsg);
 
-  // get the most current map for the spectator
+  // get the most current map for the spectators
   game_updateVisibility(game);
   game_sendDisplays(game);
 
   return true;
 }
 
-/**************** game_getSpectatorAddress ****************/
+/**************** game_deleteSpectator ****************/
 /* see game.h for details */
-addr_t*
-game_getSpectatorAddress(game_t* game)
+bool
+game_deleteSpectator(game_t* game, addr_t address)
 {
-  if (game->spectator == NULL){
-    return NULL;
+  if (game == NULL){
+    return false;
+  }
+  int i = spectator_find(game, address);
+  if (i < 0){
+    return false;
   }
-  return &(game->spectator->address);
+  // send quit message
+  sendQuit(game->spectators.items[i], "Thanks for watching!");
+
+  // free the spectator, and fill its slot with the last one
+  player_delete(game, game->spectators.items[i]);
+  spectatorvec_removeAt(&game->spectators, i);
+
+  return true; 
 }
 
-/**************** game_deleteSpectator ****************/
+/**************** game_setBinary ****************/
 /* see game.h for details */
 bool
-game_deleteSpectator(game_t* game)
+game_setBinary(game_t* game, addr_t address)
 {
   if (game == NULL){
     return false;
   }
-  if (game->spectator == NULL){
+
+  // find the player or spectator at that address
+  player_t* player = player_get(game, address, 0);
+  if (player == NULL){
+    int i = spectator_find(game, address);
+    player = (i < 0) ? NULL : game->spectators.items[i];
+  }
+  if (player == NULL){
     return false;
   }
-  // send quit message
-  message_send(game->spectator->address, "QUIT Thanks for watching!");
 
-  // free the spectator and set to null
-  player_delete(game->spectator);
-  game->spectator = NULL;
-  
+  // switch, and acknowledge with a binary GRID
+  player->isBinary = true;
+  char gridMsg[PROTO_MAXHEADER];
+  proto_encodeGrid(gridMsg, grid_getHeight(game->grid), grid_getWidth(game->grid));
+  message_send(address, gridMsg);
 
-  return true; 
+  // players also get a session token to echo in their KEYs
+  if (player->token > 0){
+    char sessionMsg[PROTO_MAXHEADER];
+    proto_encodeSession(sessionMsg, player->token);
+    message_send(address, sessionMsg);
+  }
+  return true;
 }
 
 /**************** game_move****************/
 /* see game.h for details */
 bool 
-game_move(game_t* game, char* addressStr, int cx, int cy)
+game_move(game_t* game, addr_t address, int token, int cx, int cy)
 {
-  player_t* player = player_get(game, addressStr);
+  player_t* player = player_get(game, address, token);
+  if (player == NULL){
+    return false;
+  }
 
-  char spot = grid_getChar(game->grid, game->mapCurr, player->x + cx, player->y + cy);
-  char oldSpot = grid_getChar(game->grid, game->mapOG, player->x, player->y);
+  int collected = 0;
+  if (!player_step(game, player, cx, cy, &collected)){
+    ackKey(game, player, player->keySeq, true);   // if it predicted the move
+    return false;
+  }
+
+  if (collected > 0){
+    sendGold(player, collected, game->remainingGold);
+  }
+
+  // update game
+  game_updateVisibility(game);
+  game_sendDisplays(game);
+  return true;
+}
 
-  if (spot == wallSpotHoriz || spot == wallSpotCorn || spot == wallSpotVert || spot == blank){
-    //printf("can't move there (game.c in move)"); i don't think we are meant to be printing at all? could log_e
+/**************** game_sprint ****************/
+/* see game.h for details */
+bool
+game_sprint(game_t* game, addr_t address, int token, int cx, int cy)
+{
+  player_t* player = player_get(game, address, token);
+  if (player == NULL){
     return false;
   }
 
-  if (spot == goldSpot){
-    getGold(game, player);
-    char goldMsg[20]; //also should there be any basis to this?
-    sprintf(goldMsg, "GOLD %d %d %d", 0, player->gold, game->remainingGold);
-    message_send(player->address, goldMsg);
+  // resolve the whole path first, collecting gold and swapping as we go;
+  // only the sprinting player's map is updated per step, so that it
+  // remembers everything seen along the way
+  int collected = 0;
+  int steps = 0;
+  while (player_step(game, player, cx, cy, &collected)){
+    grid_addVisiblePoints(game->grid, game->mapOG, game->mapCurr, player->visibleMap, player->x, player->y);
+    steps++;
+  }
 
+  if (steps == 0){
+    ackKey(game, player, player->keySeq, true);   // if it predicted the move
+    return false;
   }
 
-  // if trying to swap into another player
-  if (isalpha(spot)){
-    // swap positions
-    player_t* player2 = player_getFromIcon(game, spot);
-    player_swap(game, player, player2); 
-  } else {
-    // move the player and place old item back at spot
-    grid_putChar(game->grid, game->mapCurr, player->x + cx, player->y + cy, player->icon);
-    grid_putChar(game->grid, game->mapCurr, player->x, player->y, oldSpot);
-    player->x = player->x + cx;
-    player->y = player->y + cy;
+  if (collected > 0){
+    sendGold(player, collected, game->remainingGold);
   }
 
-  // update game
+  // one update and one broadcast for the whole sprint
   game_updateVisibility(game);
   game_sendDisplays(game);
   return true;
 }
 
+/**************** game_limitKeys ****************/
+/* see game.h for details */
+void
+game_limitKeys(game_t* game, double rate, int burst, bool coalesce)
+{
+  if (game == NULL){
+    return;
+  }
+  game->keyRate = (rate > 0) ? rate : 0;
+  game->keyBurst = (burst > 0) ? burst : 1;
+  game->keyCoalesce = coalesce;
+}
+
+/**************** game_admitKey ****************/
+/* see game.h for details */
+bool
+game_admitKey(game_t* game, addr_t address, int token, char key, int seq)
+{
+  if (game == NULL || (game->keyRate == 0 && seq == 0)){
+    return true;
+  }
+  player_t* player = player_get(game, address, token);
+  if (player == NULL || !player->isActive){
+    return true;    // not ours to limit; let the caller deal with it
+  }
+
+  // quitting is never held back
+  if (key == 'Q' || game->keyRate == 0){
+    ackKey(game, player, seq, false);
+    return true;
+  }
+
+  // a held key goes first, so a new key can only take its place
+  refillKeys(game, player, nowMs());
+  if (player->heldKey == 0 && player->keyTokens >= 1){
+    player->keyTokens -= 1;
+    ackKey(game, player, seq, false);
+    return true;
+  }
+  if (!game->keyCoalesce){
+    game->keysDropped++;
+    ackKey(game, player, seq, true);
+  } else if (player->heldKey != 0){
+    player->heldKey = key;
+    player->heldSeq = seq;
+    game->keysCoalesced++;
+  } else {
+    player->heldKey = key;
+    player->heldSeq = seq;
+    game->keysHeld++;
+  }
+  return false;
+}
+
+/**************** game_takeHeldKey ****************/
+/* see game.h for details */
+bool
+game_takeHeldKey(game_t* game, addr_t* address, int* token, char* key)
+{
+  if (game == NULL || game->keysHeld == 0){
+    return false;
+  }
+  heldSearch_t search = { .game = game, .now = nowMs(), .found = NULL };
+  session_iterate(game->players, &search, takeHeld_helper);
+  player_t* found = search.found;
+  if (found == NULL){
+    return false;
+  }
+  *address = found->address;
+  *token = found->token;
+  *key = found->heldKey;
+  found->heldKey = 0;
+  found->keyTokens -= 1;
+  ackKey(game, found, found->heldSeq, false);
+  game->keysHeld--;
+  return true;
+}
+
+/**************** game_nextKeyDue ****************/
+/* see game.h for details */
+double
+game_nextKeyDue(game_t* game)
+{
+  if (game == NULL || game->keysHeld == 0 || game->keyRate == 0){
+    return -1;
+  }
+  heldSearch_t search = { .game = game, .now = nowMs(), .found = NULL, .due = -1 };
+  session_iterate(game->players, &search, keyDue_helper);
+  return search.due;
+}
 
+/**************** game_getKeyStats ****************/
+/* see game.h for details */
+void
+game_getKeyStats(game_t* game, int* coalesced, int* dropped, int* held)
+{
+  *coalesced = (game == NULL) ? 0 : game->keysCoalesced;
+  *dropped = (game == NULL) ? 0 : game->keysDropped;
+  *held = (game == NULL) ? 0 : game->keysHeld;
+}
 
 /**************** game_sendDisplays ****************/
 /* see game.h for details */
 void
 game_sendDisplays(game_t* game)
 {
-  hashtable_iterate(game->players, game, sendDisplay_helper);
-  if (game->spectator != NULL){
-    sendDisplay_helper(game, "key", game->spectator);
+  HASHMAP_FOREACH(iconmap, &game->icons, entry){
+    sendDisplay_helper(game, entry->value->token, entry->value);
   }
+  sendSpectatorDisplays(game);
 }
 
 /**************** game_updateVisibility ****************/
@@ -399,10 +650,14 @@ game_sendDisplays(game_t* game)
 void
 game_updateVisibility(game_t* game)
 {
-  hashtable_iterate(game->players, game, visibility_helper);
-  if (game->spectator != NULL){
-    strcpy(game->spectator->visibleMap, game->mapCurr);
+  // add visible points to all active players visible maps
+  HASHMAP_FOREACH(iconmap, &game->icons, entry){
+    player_t* player = entry->value;
+    if (player->isActive == true){
+      grid_addVisiblePoints(game->grid, game->mapOG, game->mapCurr, player->visibleMap, player->x, player->y);
+    }
   }
+  // spectators see mapCurr itself; see sendSpectatorDisplays
 }
 
 /**************** game_getRemainingGold ****************/
@@ -417,30 +672,44 @@ game_getRemainingGold(game_t* game)
   return game->remainingGold;
 }
 
-/**************** game_delete ****************/
+/**************** game_getNumPlayers ****************/
 /* see game.h for details */
-void
-game_delete(game_t* game)
+int
+game_getNumPlayers(game_t* game)
 {
-  // delete hashtable with players
-  hashtable_delete(game->players, player_delete);
+  if (game == NULL){
+    return 0;
+  }
+  return game->numPlayers;
+}
 
-  // delete spectator if exists
-  if (game->spectator != NULL){
-    player_delete(game->spectator);
+/**************** game_getNumActive ****************/
+/* see game.h for details */
+int
+game_getNumActive(game_t* game)
+{
+  if (game == NULL){
+    return 0;
   }
+  return game->numActive;
+}
 
-  // delete hashtable with icons (players already deleted)
-  hashtable_delete(game->icons, NULL);
+/**************** game_delete ****************/
+/* see game.h for details */
+void
+game_delete(game_t* game)
+{
+  // delete the tables of players and spectators; the players
+  // themselves are in the arena
+  session_delete(game->players, NULL);
+  spectatorvec_free(&game->spectators);
+  iconmap_free(&game->icons);
 
   // delete grid
   grid_delete(game->grid);
 
-  // free the maps
-  mem_free(game->mapOG);
-  mem_free(game->mapCurr);
-
-  mem_free(game);
+  // free the players, the maps, and the game itself, all at once
+  mem_arena_delete(game->arena);
   game = NULL;
 }
 
@@ -450,20 +719,19 @@ void
 game_end(game_t* game)
 {
   char* message = "QUIT GAME OVER:\n\r";
-  char* summary = malloc(strlen(message)+(maxNameLength+15)*game->numPlayers+1);
+  char* summary = mem_arena_alloc(game->arena, strlen(message)+(maxNameLength+15)*game->numPlayers+1);
   strcpy(summary, message);
 
   // build player summary
-  hashtable_iterate(game->players, &summary, getPlayerSummary);
+  session_iterate(game->players, &summary, getPlayerSummary);
 
   // send player summary
-  hashtable_iterate(game->players, summary, sendPlayerSummary);
+  session_iterate(game->players, summary, sendPlayerSummary);
 
-  // send summary to spectator
-  if (game->spectator!=NULL) {
-    message_send(game->spectator->address, summary);
+  // send summary to spectators
+  VECTOR_FOREACH(spectatorvec, &game->spectators, spectator){
+    sendPlayerSummary(summary, 0, *spectator);
   }
-  free(summary);
   game_delete(game);
 }
 /**************************** player module functions **************************/
@@ -476,13 +744,15 @@ game_end(game_t* game)
  *  Can create a player or spectator
  *  Calls updateVisibility to create user specific map
  *  Players are turned inactive by game_deletePlayer, but freed
- *  in game_delete
+ *  with the game's arena in game_delete
  */
 static player_t*
 player_new(game_t* game, int x, int y, char icon, char* name, addr_t address, bool isSpectator)
 {
-  // initialize player
-  player_t* player = malloc(sizeof(player_t));
+  // initialize player; players stay until the game is deleted, but
+  // spectators can leave, so come from the pool
+  player_t* player = isSpectator ? mem_pool_alloc(game->spectatorPool)
+                                 : mem_arena_alloc(game->arena, sizeof(player_t));
   if (player == NULL){
     return NULL;
   }
@@ -496,33 +766,57 @@ player_new(game_t* game, int x, int y, char icon, char* name, addr_t address, bo
   player->address = address;
   player->isActive = true;
   player->isSpectator = isSpectator;
+  player->isBinary = false;
+  player->token = 0;
+  player->keyTokens = game->keyBurst;   // a full bucket to start
+  player->keyRefilled = nowMs();
+  player->heldKey = 0;
+  player->heldSeq = 0;
+  player->keySeq = 0;
+
+  // spectators see mapCurr, so need no map of their own
+  player->visibleMap = NULL;
+  player->frame = NULL;
+  if (isSpectator){
+    return player;
+  }
 
-  // malloc space for visible map
-  player->visibleMap = malloc(messageMaxBytes);
+  int height = grid_getHeight(game->grid);
+  int width = grid_getWidth(game->grid);
+
+  // space for visible map, just big enough for the grid
+  player->visibleMap = mem_arena_alloc(game->arena, height * width + 1);
   if (player->visibleMap == NULL){
     return NULL;
   }
 
-  // set up player map
-  if (isSpectator){
-    strcpy(player->visibleMap, game->mapCurr);
-  } else {
-    memset(player->visibleMap, ' ', 9998);
-    player->visibleMap[9999] = '\0';
+  // space for display frame, and put the newline at the end
+  // of each row now so that sending a frame only copies the rows
+  player->frame = mem_arena_alloc(game->arena, height * (width + 1));
+  if (player->frame == NULL){
+    return NULL;
+  }
+  for (int y = 0; y < height; y++){
+    player->frame[y * (width + 1) + width] = '\n';
   }
+
+  // set up player map
+  memset(player->visibleMap, ' ', height * width);
+  player->visibleMap[height * width] = '\0';
   
   return player;
 }
 
 /**************** player_get ****************/
 /*
- * return a player based on their addressStr
+ * return a player based on their address, using the session
+ * token they sent if it is valid (0 if none)
  *
  */
 static player_t*
-player_get(game_t* game, char* addressStr)
+player_get(game_t* game, addr_t address, int token)
 {
-  player_t* playerMatch = hashtable_find(game->players, addressStr);
+  player_t* playerMatch = session_findToken(game->players, token, address);
   return playerMatch;
 }
 
@@ -534,13 +828,25 @@ player_get(game_t* game, char* addressStr)
 static player_t*
 player_getFromIcon(game_t* game, char icon)
 {
-  // convert icon into string
-  char str[2];
-  str[0] = icon;
-  str[1] = '\0';
+  player_t** playerMatch = iconmap_find(&game->icons, icon);
+  return (playerMatch == NULL) ? NULL : *playerMatch;
+}
 
-  player_t* playerMatch = hashtable_find(game->icons, str);
-  return playerMatch;
+/**************** spectator_find ****************/
+/*
+ * return the index of the spectator at address in game->spectators,
+ * or -1 if none
+ *
+ */
+static int
+spectator_find(game_t* game, addr_t address)
+{
+  for (int i = 0; i < spectatorvec_count(&game->spectators); i++){
+    if (message_eqAddr(game->spectators.items[i]->address, address)){
+      return i;
+    }
+  }
+  return -1;
 }
 
 /**************** player_delete ****************/
@@ -564,22 +870,55 @@ player_swap(game_t* game, player_t* player1, player_t* player2)
 
 }
 
+/**************** player_step ****************/
+/* 
+ * Moves the player one step by (cx, cy) on mapCurr, picking up
+ * gold or swapping with another player as needed; adds any gold
+ * picked up to *collected. Does not update visibility or send
+ * anything to clients.
+ * Returns false if the step is blocked.
+ */
+static bool
+player_step(game_t* game, player_t* player, int cx, int cy, int* collected)
+{
+  char spot = grid_getChar(game->grid, game->mapCurr, player->x + cx, player->y + cy);
+  char oldSpot = grid_getChar(game->grid, game->mapOG, player->x, player->y);
+
+  if (spot == wallSpotHoriz || spot == wallSpotCorn || spot == wallSpotVert || spot == blank || spot == '\0'){
+    return false;
+  }
+
+  if (spot == goldSpot){
+    *collected += getGold(game, player);
+  }
+
+  // if trying to swap into another player
+  if (isalpha(spot)){
+    // swap positions
+    player_t* player2 = player_getFromIcon(game, spot);
+    player_swap(game, player, player2); 
+  } else {
+    // move the player and place old item back at spot
+    grid_putChar(game->grid, game->mapCurr, player->x + cx, player->y + cy, player->icon);
+    grid_putChar(game->grid, game->mapCurr, player->x, player->y, oldSpot);
+    player->x = player->x + cx;
+    player->y = player->y + cy;
+  }
+  return true;
+}
+
 /**************** player_delete ****************/
 /* 
- * Deletes a player structure
+ * Returns a spectator's structure to the game's pool
  *
  * Notes:
- *  Used in game_delete when it calls hashtable_delete
+ *  Players proper are never deleted one by one; they live in
+ *  the game's arena until game_delete frees it
  */
 static void
-player_delete(void* item)
+player_delete(game_t* game, player_t* spectator)
 {
-  player_t* player = (player_t*) item;
-  if (!player->isSpectator){
-    mem_free(player->name);
-  }
-  mem_free(player->visibleMap);
-  mem_free(player);
+  mem_pool_free(game->spectatorPool, spectator);
 }
 
 /**************************** local helper functions **************************/
@@ -611,73 +950,102 @@ randomizePileLocations(game_t* game)
   }
 }
 
-/**************** visibility_helper ****************/
+/**************** sendDisplay_helper ****************/
 /* 
- * Add visible points to all active players visible maps 
- *
+ * send displays to all active users 
  */
 static void
-visibility_helper(void* arg, const char* key, void* item)
+sendDisplay_helper(void* arg, const int token, void* item)
 {
   game_t* game = arg;
   player_t* player = item;
 
-  if (player->isActive == true){
-    grid_addVisiblePoints(game->grid, game->mapOG, game->mapCurr, player->visibleMap, player->x, player->y);
+  int height = grid_getHeight(game->grid);
+  int width = grid_getWidth(game->grid);
+
+  // if the player is active and speaks binary, the visible map is
+  // already in the form of a binary DISPLAY (or FRAME, for a player
+  // that numbers its keys); send it as it is
+  if (player->isActive == true && player->isBinary){
+    char header[PROTO_MAXHEADER];
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = (player->keySeq > 0) ? proto_encodeFrame(header, player->keySeq)
+                                          : proto_encodeDisplay(header);
+    iov[1].iov_base = player->visibleMap;
+    iov[1].iov_len = height * width;
+    message_sendv(player->address, iov, 2);
+
+  // if the player is active
+  } else if (player->isActive == true){
+    // copy each row of the visible map into the frame, between
+    // the newlines that are already in place
+    for (int y = 0; y < height; y++){
+      memcpy(player->frame + y * (width + 1), player->visibleMap + y * width, width);
+    }
+
+    // send header and frame as one message
+    struct iovec iov[2];
+    iov[0].iov_base = (void*) displayHeader;
+    iov[0].iov_len = sizeof(displayHeader) - 1;
+    iov[1].iov_base = player->frame;
+    iov[1].iov_len = height * (width + 1);
+    message_sendv(player->address, iov, 2);
   }
 }
 
-/**************** sendDisplay_helper ****************/
+/**************** sendSpectatorDisplays ****************/
 /* 
- * send displays to all active users 
+ * send mapCurr to every spectator; the binary DISPLAY is mapCurr
+ * itself, and the text DISPLAY is laid out once, in spectatorFrame,
+ * so each spectator costs only its send
  */
 static void
-sendDisplay_helper(void* arg, const char* key, void* item)
+sendSpectatorDisplays(game_t* game)
 {
-  game_t* game = arg;
-  player_t* player = item;
-
+  if (spectatorvec_count(&game->spectators) == 0){
+    return;
+  }
   int height = grid_getHeight(game->grid);
   int width = grid_getWidth(game->grid);
 
-  // if the player is active
-  if (player->isActive == true){
-    char displayMsg[10 + strlen(game->mapOG) + height];
-
-    // malloc space for display with new line chars
-    char *display = malloc(10 + strlen(game->mapOG) + height);
-
-    // make it so can cat to display
-    display[0] = '\0';
-    
-    // add new line chars
-    for(int y = 0; y < height; y++) {
-      char* line = mem_malloc(width + 2);
-      line[0] = '\0';
-      for (int x = 0; x < width; x++){
-        int c = (y * width) + x;
-        line[x] = player->visibleMap[c];
+  char header[PROTO_MAXHEADER];
+  struct iovec binary[2];
+  binary[0].iov_base = header;
+  binary[0].iov_len = proto_encodeDisplay(header);
+  binary[1].iov_base = game->mapCurr;
+  binary[1].iov_len = height * width;
+
+  struct iovec text[2];
+  text[0].iov_base = (void*) displayHeader;
+  text[0].iov_len = sizeof(displayHeader) - 1;
+  text[1].iov_base = game->spectatorFrame;
+  text[1].iov_len = height * (width + 1);
+  bool framed = false;    // is spectatorFrame up to date?
+
+  VECTOR_FOREACH(spectatorvec, &game->spectators, item){
+    player_t* spectator = *item;
+    if (spectator->isBinary){
+      message_sendv(spectator->address, binary, 2);
+    } else {
+      if (!framed){
+        for (int y = 0; y < height; y++){
+          memcpy(game->spectatorFrame + y * (width + 1), game->mapCurr + y * width, width);
+        }
+        framed = true;
       }
-      line[width] = '\n';
-      line[width + 1] = '\0';
-      strcat(display, line);
-      free(line);
+      message_sendv(spectator->address, text, 2);
     }
-
-    // send message
-    sprintf(displayMsg, "DISPLAY\n%s", display);
-    message_send(player->address, displayMsg);
-    free(display);
   }
 }
 
 /**************** getPlayerSummary ****************/
 /* 
- * hashtable_iterate helper which adds each players information
+ * session_iterate helper which adds each players information
  * into the summary char** passed as an arg
  */
 static void
-getPlayerSummary(void* arg, const char* key, void* item)
+getPlayerSummary(void* arg, const int token, void* item)
 {
   char** summary = arg;
   player_t* player = (player_t*) item;
@@ -691,22 +1059,22 @@ getPlayerSummary(void* arg, const char* key, void* item)
 
 /**************** sendPlayerSummary ****************/
 /* 
- * hashtable_iterate helper which sends the game over
+ * session_iterate helper which sends the game over
  * summary to all players in the game
  */
 static void
-sendPlayerSummary(void* arg, const char* key, void* item)
+sendPlayerSummary(void* arg, const int token, void* item)
 {
   char* summary = arg;
   player_t* player = (player_t*) item;
-  message_send(player->address, summary);
+  sendQuit(player, summary + strlen("QUIT "));
 }
 
 /**************** getGold ****************/
 /* 
- * add gold amount to player
+ * add gold amount to player, returning the amount added
  */
-static void getGold(game_t* game, player_t* player){
+static int getGold(game_t* game, player_t* player){
   int gold;
   // if one pile left
   if (game->remainingPiles == 1){
@@ -725,4 +1093,119 @@ static void getGold(game_t* game, player_t* player){
   // remove necessary gold and piles from game
   game->remainingGold -= gold;
   game->remainingPiles -= 1;
+  return gold;
+}
+
+/**************** sendGold ****************/
+/* 
+ * tell a player how much gold they just collected
+ */
+static void
+sendGold(player_t* player, int collected, int remaining)
+{
+  char goldMsg[40];
+  if (player->isBinary){
+    proto_encodeGold(goldMsg, collected, player->gold, remaining);
+  } else {
+    sprintf(goldMsg, "GOLD %d %d %d", collected, player->gold, remaining);
+  }
+  message_send(player->address, goldMsg);
+}
+
+/**************** sendQuit ****************/
+/* 
+ * tell a player or spectator that they are done, and why
+ */
+static void
+sendQuit(player_t* player, const char* explanation)
+{
+  char quitMsg[PROTO_MAXHEADER + strlen(explanation) + 1];
+  if (player->isBinary){
+    proto_encodeText(quitMsg, PROTO_QUIT, explanation);
+  } else {
+    sprintf(quitMsg, "QUIT %s", explanation);
+  }
+  message_send(player->address, quitMsg);
+}
+
+/**************** refillKeys ****************/
+/* 
+ * top up a player's key tokens for the time since the last top-up,
+ * to at most the burst size
+ */
+static void
+refillKeys(game_t* game, player_t* player, const long now)
+{
+  player->keyTokens += (now - player->keyRefilled) * game->keyRate / 1000;
+  if (player->keyTokens > game->keyBurst){
+    player->keyTokens = game->keyBurst;
+  }
+  player->keyRefilled = now;
+}
+
+/**************** ackKey ****************/
+/* 
+ * note that the key numbered seq (0 if none) has been dealt with;
+ * if 'resend', the key changed nothing, so send a player that numbers
+ * its keys a frame anyway, to undo any prediction it made
+ */
+static void
+ackKey(game_t* game, player_t* player, const int seq, const bool resend)
+{
+  if (seq > player->keySeq){
+    player->keySeq = seq;
+  }
+  if (resend && player->keySeq > 0){
+    sendDisplay_helper(game, player->token, player);
+  }
+}
+
+/**************** takeHeld_helper ****************/
+/* 
+ * find the first player whose held key may now be handled
+ */
+static void
+takeHeld_helper(void* arg, const int token, void* item)
+{
+  heldSearch_t* search = arg;
+  player_t* player = item;
+
+  if (search->found == NULL && player->heldKey != 0){
+    refillKeys(search->game, player, search->now);
+    if (player->keyTokens >= 1){
+      search->found = player;
+    }
+  }
+}
+
+/**************** keyDue_helper ****************/
+/* 
+ * find how soon the first held key may be handled
+ */
+static void
+keyDue_helper(void* arg, const int token, void* item)
+{
+  heldSearch_t* search = arg;
+  player_t* player = item;
+
+  if (player->heldKey != 0){
+    refillKeys(search->game, player, search->now);
+    double due = (player->keyTokens >= 1) ? 0
+                 : (1 - player->keyTokens) / search->game->keyRate;
+    if (search->due < 0 || due < search->due){
+      search->due = due;
+    }
+  }
+}
+
+/**************** nowMs ****************/
+/* 
+ * return a monotonic clock reading, in milliseconds
+ */
+static long
+nowMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
 }
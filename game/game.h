@@ -16,6 +16,7 @@
 #include <unistd.h>
 #include "hashtable.h"
 #include "message.h"
+#include "session.h"
 #include "grid.h"
 #include "mem.h"
 #include "file.h"
@@ -54,8 +55,8 @@ game_t* game_new(char* mapPath);
  *  True, if the player was successfully added
  *  False, if game is full or error in adding occured
  * Notes:
- *   Players are added to a hashtable and freed from this
- *   hashtable in game_delete
+ *   Players are added to a session table keyed by address,
+ *   and freed from it in game_delete
  */
 bool game_addPlayer(game_t* game, char* name, addr_t address);
 
@@ -67,48 +68,55 @@ bool game_addPlayer(game_t* game, char* name, addr_t address);
  *
  * Caller provides:
  *   Game
- *   String address of the player
+ *   Address of the player
+ *   Session token the player sent, or 0 if none
  * We return:
  *  True, if the player was successfully deleted
  *  False, if error in deletion occured
  */
-bool game_deletePlayer(game_t* game, char* addressStr);
+bool game_deletePlayer(game_t* game, addr_t address, int token);
 
 /**************** game_addSpectator ****************/
 /* 
- * Adds a spectator to game structure 
+ * Adds a spectator to game structure; a game may have
+ * any number of spectators, who all see the whole map
  *
  * Caller provides:
  *   Game
  *   Address of spectator
  * We return:
- *  True, if the spec was successfully added
- *  False, if game is full or error in adding occured
+ *  True, if the spec was successfully added (or already was one)
+ *  False, if error in adding occured
  */
 bool game_addSpectator(game_t* game, addr_t address);
 
-/**************** game_getSpectatorAddress ****************/
+/**************** game_deleteSpectator ****************/
 /* 
- * Returns the address of the spectator, if one 
+ * Deletes the spectator at an address from the game structure 
  *
  * Caller provides:
  *   Game
+ *   Address of spectator
  * We return:
- *  Address, if the spectator exists
- *  Null, if no spectator 
+ *  True, if the spectator was successfully deleted 
+ *  False, if no spectator has that address
  */
-addr_t* game_getSpectatorAddress(game_t* game);
-/**************** game_deleteSpectator ****************/
+bool game_deleteSpectator(game_t* game, addr_t address);
+
+/**************** game_setBinary ****************/
 /* 
- * Deletes a spectator from the game structure 
+ * Switches a player or spectator to the binary protocol
+ * (see protocol.h), acknowledging with a binary GRID;
+ * a player is also sent its session token
  *
  * Caller provides:
  *   Game
+ *   Address of the player or spectator
  * We return:
- *  True, if the spectator was successfully deleted 
- *  False, if error in deletion occured
+ *  True, if the client was switched
+ *  False, if no player or spectator has that address
  */
-bool game_deleteSpectator(game_t* game);
+bool game_setBinary(game_t* game, addr_t address);
 
 /**************** game_move ****************/
 /* 
@@ -117,14 +125,119 @@ bool game_deleteSpectator(game_t* game);
  *
  * Caller provides:
  *   Game
- *   String address of the player
+ *   Address of the player
+ *   Session token the player sent, or 0 if none
  *   Distance to move in x
  *   Distance to move in y
  * We return:
  *  True, if the move was executed 
  *  False, if the move was not possible
  */
-bool game_move(game_t* game, char* addressStr, int cx, int cy);
+bool game_move(game_t* game, addr_t address, int token, int cx, int cy);
+
+/**************** game_sprint ****************/
+/* 
+ * Moves the specified player repeatedly by (cx, cy) until
+ * blocked, collecting gold and swapping with other players
+ * along the way
+ *
+ * Caller provides:
+ *   Game
+ *   Address of the player
+ *   Session token the player sent, or 0 if none
+ *   Distance to move in x per step
+ *   Distance to move in y per step
+ * We return:
+ *  True, if the player moved at least one step
+ *  False, if the first step was not possible
+ * Notes:
+ *   The whole path is resolved before visibility is updated,
+ *   and clients are sent a single display for the sprint
+ */
+bool game_sprint(game_t* game, addr_t address, int token, int cx, int cy);
+
+/**************** game_limitKeys ****************/
+/* 
+ * Limits how fast each player's keys are handled, with a
+ * token bucket per player: a player may send up to 'burst'
+ * keys at once, and 'rate' keys per second after that
+ *
+ * Caller provides:
+ *   Game
+ *   Keys per second per player, or 0 for no limit (the default)
+ *   Most keys a player may send at once, >= 1
+ *   Whether to hold the newest key over the limit until the
+ *   player may send again (coalesce), or simply drop it
+ * Notes:
+ *   Excess keys are counted; see game_getKeyStats
+ */
+void game_limitKeys(game_t* game, double rate, int burst, bool coalesce);
+
+/**************** game_admitKey ****************/
+/* 
+ * Checks a key against the sender's limit (see game_limitKeys)
+ *
+ * Caller provides:
+ *   Game
+ *   Address of the player
+ *   Session token the player sent, or 0 if none
+ *   The key
+ *   Sequence number the player sent with it, or 0 if none
+ * We return:
+ *  True, if the key should be handled now
+ *  False, if it is over the limit; it has then been held,
+ *  replacing any key the player had held, or dropped
+ * Notes:
+ *   'Q' is always admitted, and so is a key from anyone
+ *   who is not an active player.
+ *   Call this for every key, even with no limit, so that the
+ *   player's binary displays echo the sequence number of its
+ *   newest key dealt with (see PROTO_FRAME in protocol.h)
+ */
+bool game_admitKey(game_t* game, addr_t address, int token, char key, int seq);
+
+/**************** game_takeHeldKey ****************/
+/* 
+ * Takes a held key that may now be handled, because its
+ * player's limit allows another key
+ *
+ * Caller provides:
+ *   Game
+ *   Where to put the player's address, token, and key
+ * We return:
+ *  True, if there was such a key
+ *  False, if not (none held, or none due yet)
+ * Notes:
+ *   Call this after each message, and from time to time
+ *   while keys are held, and handle the keys it returns
+ */
+bool game_takeHeldKey(game_t* game, addr_t* address, int* token, char* key);
+
+/**************** game_nextKeyDue ****************/
+/* 
+ * Says how soon a held key may be handled
+ *
+ * Caller provides:
+ *   Game, or NULL
+ * We return:
+ *  Seconds until the first held key is due (0 if one is due now),
+ *  or a negative number if no keys are held
+ * Notes:
+ *   Lets the caller sleep until then, rather than polling
+ *   game_takeHeldKey while keys are held
+ */
+double game_nextKeyDue(game_t* game);
+
+/**************** game_getKeyStats ****************/
+/* 
+ * Reports what the key limit has done in this game
+ *
+ * Caller provides:
+ *   Game, or NULL (for which all are 0)
+ *   Where to put the number of held keys replaced by newer
+ *   ones, of keys dropped, and of keys held right now
+ */
+void game_getKeyStats(game_t* game, int* coalesced, int* dropped, int* held);
 
 /**************** game_sendDisplays ****************/
 /* 
@@ -139,8 +252,8 @@ void game_sendDisplays(game_t* game);
 
 /**************** game_updateVisibility ****************/
 /* 
- * Updates every player in the game's visible map as well as 
- * the spectators map to be the most current
+ * Updates every player in the game's visible map to be the
+ * most current (spectators are sent the current map itself)
  *
  * Caller provides:
  *   Game
@@ -155,10 +268,29 @@ void game_updateVisibility(game_t* game);
  *   Game
  */
 int game_getRemainingGold(game_t* game);
+/**************** game_getNumPlayers ****************/
+/* 
+ * Getter method for the number of players who have joined
+ *
+ * Caller provides:
+ *   Game, or NULL (for which we return 0)
+ */
+int game_getNumPlayers(game_t* game);
+
+/**************** game_getNumActive ****************/
+/* 
+ * Getter method for the number of players who have joined
+ * and not quit
+ *
+ * Caller provides:
+ *   Game, or NULL (for which we return 0)
+ */
+int game_getNumActive(game_t* game);
+
 /**************** game_delete ****************/
 /* 
  * Cleans up the game data structure, including the
- * player ht, grid, and maps
+ * player table, grid, and maps
  *
  * Caller provides:
  *  Game
@@ -168,7 +300,7 @@ void game_delete(game_t* game);
 /**************** game_end ****************/
 /* 
  * Generates and sends game summary to all players
- * and spectator, calls game_delete to clean up game
+ * and spectators, calls game_delete to clean up game
  *
  * Caller provides:
  *  Game
@@ -1,8 +1,18 @@
-/* 
+/*
  * counters.c - CS50 module to support a set of counters
  *
  * see counters.h for more information.
  *
+ * Counters for small keys live in a plain array indexed by key, so
+ * counting is one memory access; keys beyond the array go in an open-
+ * addressing hash table.  The array grows to cover a larger key whenever
+ * at least a quarter of the enlarged array would then hold counters, and
+ * takes over any hashed counters it now covers.  Thus a dense range of
+ * keys ends up all in the array, while a few scattered large keys cost
+ * only their hash slots.
+ *
+ * Compile with -DUNIT_TEST for a standalone unit test; see below.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  * Xia Zhou, July 2017
  */
@@ -10,23 +20,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include "counters.h"
 #include "mem.h"
 
 /**************** file-local global variables ****************/
-/* none */
+static const int InitialDense = 64;     // keys the array covers at first
+static const int MaxDense = 1 << 24;    // most keys the array may cover
+static const int InitialSlots = 16;     // hash slots, once one is needed
 
 /**************** local types ****************/
-typedef struct countersnode {
-  int key;                    // search key for this counter
+typedef struct ctrslot {
+  int key;                    // search key for this counter; -1 if empty
   int count;                  // value of this counter
-  struct countersnode *next;  // pointer to next counter in list
-} countersnode_t;
+} ctrslot_t;
 
 /**************** global types ****************/
 typedef struct counters {
-  struct countersnode *head;  // head of the counters (UNSORTED list)
+  int* dense;                 // dense[key] for key < ndense; -1 if no counter
+  int ndense;                 // number of keys the array covers
+  ctrslot_t* slots;           // hashed counters, all with key >= ndense
+  int nslots;                 // number of slots, a power of two; 0 if none
+  int nhashed;                // number of slots in use
+  int ncounters;              // number of counters in all
 } counters_t;
 
 /**************** global functions ****************/
@@ -35,7 +53,10 @@ typedef struct counters {
 
 /**************** local functions ****************/
 /* not visible outside this file */
-static countersnode_t* countersnode_new(const int key);
+static int* counter(counters_t* ctrs, const int key, const bool create);
+static bool growDense(counters_t* ctrs, const int ndense);
+static bool rehash(counters_t* ctrs, const int nslots);
+static ctrslot_t* probe(ctrslot_t* slots, const int nslots, const int key);
 
 /**************** counters_new() ****************/
 /* see counters.h for description */
@@ -46,11 +67,20 @@ counters_new(void)
 
   if (ctrs == NULL) {
     return NULL;              // error allocating counters
-  } else {
-    // initialize contents of counters structure
-    ctrs->head = NULL;
-    return ctrs;
   }
+
+  // initialize contents of counters structure
+  ctrs->dense = NULL;
+  ctrs->ndense = 0;
+  ctrs->slots = NULL;
+  ctrs->nslots = 0;
+  ctrs->nhashed = 0;
+  ctrs->ncounters = 0;
+  if (!growDense(ctrs, InitialDense)) {
+    mem_free(ctrs);
+    return NULL;
+  }
+  return ctrs;
 }
 
 /**************** counters_add() ****************/
@@ -62,49 +92,38 @@ counters_add(counters_t* ctrs, const int key)
     return 0;                 // bad ctrs or bad key
   }
 
-  if (ctrs->head == NULL) {   // empty list: add new counter
-    ctrs->head = countersnode_new(key);
-    return 1;                 // return count value
-  }           
-
-  // non-empty list, look for the counter in the list
-  // it is an unsorted list, so scan until we find it, or reach the end
-  countersnode_t* prev = ctrs->head; // which we know not to be NULL
-  for (countersnode_t* node = prev; node != NULL; node = prev->next)
-    {
-      if (key == node->key) {
-        // counter exists: increment it
-        node->count++;
-        return node->count; 
-      }
-      prev = node;
-    }
-  // not on the list; insert new counter node at end of list
-  prev->next = countersnode_new(key);
-  return 1; 
+  int* count = counter(ctrs, key, true);
+  if (count == NULL) {
+    return 0;                 // out of memory
+  }
 
 #ifdef MEMTEST
   mem_report(stdout, "After counters_add");
 #endif
-}
 
+  return ++*count;
+}
 
-/**************** countersnode_new ****************/
-/* Allocate and initialize a countersnode */
-static countersnode_t*  // not visible outside this file
-countersnode_new(const int key)
+/**************** counters_addMany() ****************/
+/* see counters.h for description */
+bool
+counters_addMany(counters_t* ctrs, const int keys[], const int nkeys)
 {
-  countersnode_t* node = mem_malloc(sizeof(countersnode_t));
+  if (ctrs == NULL || keys == NULL || nkeys < 0) {
+    return false;             // bad parameters
+  }
 
-  if (node == NULL) {
-    // error allocating memory for node; return error
-    return NULL;
-  } else {
-    node->key = key;
-    node->count = 1;
-    node->next = NULL;
-    return node;
+  bool ok = true;
+  for (int i = 0; i < nkeys; i++) {
+    int key = keys[i];
+    // the common case, a key the array covers, needs no call
+    if (key >= 0 && key < ctrs->ndense && ctrs->dense[key] >= 0) {
+      ctrs->dense[key]++;
+    } else if (counters_add(ctrs, key) == 0) {
+      ok = false;
+    }
   }
+  return ok;
 }
 
 /**************** counters_get() ****************/
@@ -116,13 +135,8 @@ counters_get(counters_t* ctrs, const int key)
     return 0;                 // bad ctrs or bad key
   }
 
-  // scan the counters
-  for (countersnode_t* node = ctrs->head; node != NULL; node = node->next) {
-    if (key == node->key) {
-      return node->count;     // found!  return the node's count
-    }
-  }
-  return 0; // not found!
+  int* count = counter(ctrs, key, false);
+  return (count == NULL) ? 0 : *count;
 }
 
 /**************** counters_set() ****************/
@@ -134,34 +148,50 @@ counters_set(counters_t* ctrs, const int key, const int count)
     return false;             // bad parameters
   }
 
-  // scan the counters
-  countersnode_t* prev = ctrs->head;
-  for (countersnode_t* node = prev; node != NULL; node = prev->next) {
-    if (key == node->key) {
-      node->count = count;    // found!  update the node's count
-      return true;
-    }
-    prev = node; 
+  int* counterp = counter(ctrs, key, true);
+  if (counterp == NULL) {
+    return false;             // out of memory
+  }
+  *counterp = count;
+  return true;
+}
+
+/**************** counters_merge() ****************/
+/* see counters.h for description */
+bool
+counters_merge(counters_t* dest, counters_t* src)
+{
+  if (dest == NULL || src == NULL || dest == src) {
+    return false;             // bad parameters
   }
 
-  // not found: make a new node and insert to the end of list
-  countersnode_t* new = countersnode_new(key);
-  if (new == NULL) {
+  // make the array cover at least the keys src's array covers, so
+  // merging them is one pass over two arrays
+  if (src->ndense > dest->ndense && !growDense(dest, src->ndense)) {
     return false;
   }
-  new->count = count; 
-  if (prev == NULL) {         // if it's an empty list
-    ctrs->head = new; 
-  } else {
-    prev->next = new; 
-  }  
-
-  /* OLD VERSION: insert at head of list.
-     node->count = count;
-     node->next = ctrs->head;
-     ctrs->head = node;
-  */
-  return true;
+  for (int key = 0; key < src->ndense; key++) {
+    if (src->dense[key] >= 0) {
+      if (dest->dense[key] < 0) {
+        dest->dense[key] = 0;
+        dest->ncounters++;
+      }
+      dest->dense[key] += src->dense[key];
+    }
+  }
+
+  bool ok = true;
+  for (int s = 0; s < src->nslots; s++) {
+    if (src->slots[s].key >= 0) {
+      int* count = counter(dest, src->slots[s].key, true);
+      if (count == NULL) {
+        ok = false;
+      } else {
+        *count += src->slots[s].count;
+      }
+    }
+  }
+  return ok;
 }
 
 /**************** counters_print() ****************/
@@ -176,9 +206,15 @@ counters_print(counters_t* ctrs, FILE* fp)
     } else {
       // scan the counters
       fputc('{', fp);
-      for (countersnode_t* node = ctrs->head; node != NULL; node = node->next) {
-        // print the current node
-        fprintf(fp, "%d=%d, ", node->key, node->count);
+      for (int key = 0; key < ctrs->ndense; key++) {
+        if (ctrs->dense[key] >= 0) {
+          fprintf(fp, "%d=%d, ", key, ctrs->dense[key]);
+        }
+      }
+      for (int s = 0; s < ctrs->nslots; s++) {
+        if (ctrs->slots[s].key >= 0) {
+          fprintf(fp, "%d=%d, ", ctrs->slots[s].key, ctrs->slots[s].count);
+        }
       }
       fputc('}', fp);
     }
@@ -192,24 +228,29 @@ counters_iterate(counters_t* ctrs, void* arg,
                  void (*itemfunc)(void* arg, const int key, const int count))
 {
   if (ctrs != NULL && itemfunc != NULL) {
-    // scan the counters
-    for (countersnode_t* node = ctrs->head; node != NULL; node = node->next) {
-      (*itemfunc)(arg, node->key, node->count);
+    // scan the array, then the hash table
+    for (int key = 0; key < ctrs->ndense; key++) {
+      if (ctrs->dense[key] >= 0) {
+        (*itemfunc)(arg, key, ctrs->dense[key]);
+      }
+    }
+    for (int s = 0; s < ctrs->nslots; s++) {
+      if (ctrs->slots[s].key >= 0) {
+        (*itemfunc)(arg, ctrs->slots[s].key, ctrs->slots[s].count);
+      }
     }
   }
 }
 
 /**************** counters_delete() ****************/
 /* see counters.h for description */
-void 
+void
 counters_delete(counters_t* ctrs)
 {
   if (ctrs != NULL) {
-    countersnode_t* node = ctrs->head;
-    while (node != NULL) {
-      countersnode_t* next = node->next; // remember what's next
-      mem_free(node);                    // delete the current node
-      node = next;                       // move on to next
+    mem_free(ctrs->dense);
+    if (ctrs->slots != NULL) {
+      mem_free(ctrs->slots);
     }
     // delete the overall structure
     mem_free(ctrs);
@@ -218,3 +259,290 @@ counters_delete(counters_t* ctrs)
   mem_report(stdout, "End of counters_delete");
 #endif
 }
+
+/**************** counter() ****************/
+/* Return a pointer to the counter for key (>= 0), or NULL if it has
+ * none; if 'create', first give it a counter of 0 if it has none, and
+ * return NULL only if out of memory.
+ */
+static int*
+counter(counters_t* ctrs, const int key, const bool create)
+{
+  // a key past the array: enlarge the array, if it would then be
+  // dense enough, or else look in the hash table
+  if (key >= ctrs->ndense && create) {
+    int ndense = ctrs->ndense;
+    while (ndense <= key && ndense < MaxDense) {
+      ndense *= 2;
+    }
+    if (key < ndense && (ctrs->ncounters + 1) * 4 >= ndense) {
+      if (!growDense(ctrs, ndense)) {
+        return NULL;
+      }
+    }
+  }
+
+  if (key < ctrs->ndense) {
+    if (ctrs->dense[key] < 0) {
+      if (!create) {
+        return NULL;
+      }
+      ctrs->dense[key] = 0;
+      ctrs->ncounters++;
+    }
+    return &ctrs->dense[key];
+  }
+
+  if (ctrs->nslots > 0) {
+    ctrslot_t* slot = probe(ctrs->slots, ctrs->nslots, key);
+    if (slot->key == key) {
+      return &slot->count;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+
+  // new hashed counter; keep the table at most 3/4 full
+  if ((ctrs->nhashed + 1) * 4 > ctrs->nslots * 3) {
+    int nslots = (ctrs->nslots == 0) ? InitialSlots : 2 * ctrs->nslots;
+    if (!rehash(ctrs, nslots)) {
+      return NULL;
+    }
+  }
+  ctrslot_t* slot = probe(ctrs->slots, ctrs->nslots, key);
+  slot->key = key;
+  slot->count = 0;
+  ctrs->nhashed++;
+  ctrs->ncounters++;
+  return &slot->count;
+}
+
+/**************** growDense() ****************/
+/* Make the array cover keys below ndense (> ctrs->ndense), moving into
+ * it any hashed counters it now covers.  Return false if out of memory.
+ */
+static bool
+growDense(counters_t* ctrs, const int ndense)
+{
+  int* dense = mem_malloc(ndense * sizeof(int));
+  if (dense == NULL) {
+    return false;
+  }
+  if (ctrs->ndense > 0) {
+    memcpy(dense, ctrs->dense, ctrs->ndense * sizeof(int));
+  }
+  for (int key = ctrs->ndense; key < ndense; key++) {
+    dense[key] = -1;
+  }
+  if (ctrs->dense != NULL) {
+    mem_free(ctrs->dense);
+  }
+  ctrs->dense = dense;
+  ctrs->ndense = ndense;
+
+  // rebuilding the hash table moves over the counters the array covers
+  if (ctrs->nhashed > 0) {
+    return rehash(ctrs, ctrs->nslots);
+  }
+  return true;
+}
+
+/**************** rehash() ****************/
+/* Rebuild the hash table with nslots slots (a power of two), moving any
+ * counter whose key the array covers into the array.  Return false,
+ * leaving the table as it was, if out of memory.
+ */
+static bool
+rehash(counters_t* ctrs, const int nslots)
+{
+  ctrslot_t* slots = mem_malloc(nslots * sizeof(ctrslot_t));
+  if (slots == NULL) {
+    return false;
+  }
+  for (int s = 0; s < nslots; s++) {
+    slots[s].key = -1;
+  }
+
+  int nhashed = 0;
+  for (int s = 0; s < ctrs->nslots; s++) {
+    ctrslot_t* old = &ctrs->slots[s];
+    if (old->key >= ctrs->ndense) {
+      *probe(slots, nslots, old->key) = *old;
+      nhashed++;
+    } else if (old->key >= 0) {
+      ctrs->dense[old->key] = old->count;
+    }
+  }
+
+  if (ctrs->slots != NULL) {
+    mem_free(ctrs->slots);
+  }
+  ctrs->slots = slots;
+  ctrs->nslots = nslots;
+  ctrs->nhashed = nhashed;
+  return true;
+}
+
+/**************** probe() ****************/
+/* Return the slot holding key, or else the empty slot where it belongs.
+ * The table must have an empty slot.
+ */
+static ctrslot_t*
+probe(ctrslot_t* slots, const int nslots, const int key)
+{
+  // mix the key's bits (the finalizer of MurmurHash3), then probe linearly
+  uint32_t h = (uint32_t) key;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  for (uint32_t s = h & (nslots - 1); ; s = (s + 1) & (nslots - 1)) {
+    if (slots[s].key == key || slots[s].key < 0) {
+      return &slots[s];
+    }
+  }
+}
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test drives counters across the boundary between the array
+ * and the hash table.  Keys at and past MaxDense must stay hashed, yet
+ * count like any other; a few large keys stay hashed until enough small
+ * ones make the array grow over them, and then keep their counts; and
+ * counters_merge must add up counters whichever form each side holds
+ * them in.  Every count is checked against a plain array of the counts
+ * expected.
+ *
+ * Build and run with
+ *   make counterstest && ./counterstest
+ * It prints what it checks, and exits non-zero if any check fails.
+ */
+
+#ifdef UNIT_TEST
+
+static const int Small = 5000;           // keys 0..Small-1 fill the array
+
+static int failures;                     // checks failed
+
+static int countAll(counters_t* ctrs);
+static void countOne(void* arg, const int key, const int count);
+static void check(const bool ok, const char* what);
+
+int
+main(void)
+{
+  const int big[] = { MaxDense - 1, MaxDense, MaxDense + 7, INT_MAX };
+  const int nbig = sizeof(big) / sizeof(big[0]);
+  int expect[Small + 1];
+  bool ok;
+
+  // keys at and past the most the array may cover
+  counters_t* ctrs = counters_new();
+  check(ctrs != NULL, "counters_new");
+  for (int b = 0; b < nbig; b++) {
+    for (int n = 0; n <= b; n++) {
+      counters_add(ctrs, big[b]);
+    }
+  }
+  ok = true;
+  for (int b = 0; b < nbig; b++) {
+    ok = ok && counters_get(ctrs, big[b]) == b + 1;
+  }
+  check(ok, "keys near and past MaxDense count correctly");
+  check(ctrs->ndense == InitialDense && ctrs->nhashed == nbig,
+        "keys near and past MaxDense are hashed, not covered by the array");
+  check(counters_get(ctrs, MaxDense + 1) == 0 && counters_get(ctrs, -1) == 0,
+        "keys never added read as zero");
+  check(counters_add(ctrs, -1) == 0 && !counters_set(ctrs, -1, 3),
+        "negative keys are refused");
+
+  // a large key stays hashed until the array grows over it
+  check(counters_set(ctrs, Small, 9) && ctrs->ndense < Small,
+        "a lone large key is hashed");
+  for (int key = 0; key < Small; key++) {
+    expect[key] = key % 5 + 1;
+    for (int n = 0; n < expect[key]; n++) {
+      counters_add(ctrs, key);
+    }
+  }
+  expect[Small] = 9;
+  check(ctrs->ndense > Small && ctrs->nhashed == nbig,
+        "the array grows over the large key, and takes its counter");
+  ok = true;
+  for (int key = 0; key <= Small; key++) {
+    ok = ok && counters_get(ctrs, key) == expect[key];
+  }
+  for (int b = 0; b < nbig; b++) {
+    ok = ok && counters_get(ctrs, big[b]) == b + 1;
+  }
+  check(ok, "every count survives the array's growth");
+  check(countAll(ctrs) == Small + 1 + nbig, "iterate visits every counter once");
+
+  // merge a hashed key into the array of dest, and a large array of src
+  // into a small array of dest
+  counters_t* dest = counters_new();
+  counters_add(dest, 3);
+  counters_set(dest, Small, 1);          // hashed in dest, dense in ctrs
+  counters_set(dest, big[1], 100);
+  check(dest->ndense < Small && dest->nhashed == 2, "dest starts small and hashed");
+  check(counters_merge(dest, ctrs), "counters_merge");
+  ok = true;
+  for (int key = 0; key < Small; key++) {
+    ok = ok && counters_get(dest, key) == expect[key] + (key == 3 ? 1 : 0);
+  }
+  ok = ok && counters_get(dest, Small) == expect[Small] + 1;
+  for (int b = 0; b < nbig; b++) {
+    ok = ok && counters_get(dest, big[b]) == b + 1 + (b == 1 ? 100 : 0);
+  }
+  check(ok, "merge adds counts, dense into dense and hashed into hashed");
+  check(dest->ndense == ctrs->ndense && dest->nhashed == nbig,
+        "merge moves dest's hashed counters the array now covers");
+  check(countAll(dest) == Small + 1 + nbig, "merge makes no extra counters");
+
+  // merge hashed counters of src into the array of dest
+  counters_t* src = counters_new();
+  counters_set(src, Small - 1, 4);       // hashed in src, dense in dest
+  counters_set(src, INT_MAX, 6);
+  check(src->nhashed == 2, "src holds its counters hashed");
+  check(counters_merge(dest, src)
+        && counters_get(dest, Small - 1) == expect[Small - 1] + 4
+        && counters_get(dest, INT_MAX) == nbig + 6,
+        "merge adds hashed counters into dest's array and hash table");
+  check(!counters_merge(dest, dest) && !counters_merge(NULL, src)
+        && !counters_merge(dest, NULL), "merge refuses bad parameters");
+
+  counters_delete(src);
+  counters_delete(dest);
+  counters_delete(ctrs);
+  printf("%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/* Return the number of counters iterate visits. */
+static int
+countAll(counters_t* ctrs)
+{
+  int n = 0;
+  counters_iterate(ctrs, &n, countOne);
+  return n;
+}
+
+static void
+countOne(void* arg, const int key, const int count)
+{
+  (*(int*) arg)++;
+}
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
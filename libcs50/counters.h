@@ -7,6 +7,9 @@
  * empty. Each time `counters_add` is called on a given key, that key's
  * counter is incremented. The current counter value can be retrieved by
  * asking for the relevant key.
+ *
+ * Small keys are counted in an array indexed by key, larger or scattered
+ * ones in a hash table, so counting takes constant time either way.
  * 
  * David Kotz, April 2016, 2017, 2019, 2021
  * Xia Zhou, July 2017
@@ -52,6 +55,19 @@ counters_t* counters_new(void);
  */
 int counters_add(counters_t* ctrs, const int key);
 
+/**************** counters_addMany ****************/
+/* Increment the counter of each key in an array, as counters_add would.
+ *
+ * Caller provides:
+ *   valid pointer to counterset, array of nkeys keys (each must be >= 0),
+ *   nkeys >= 0; a key may appear any number of times.
+ * We return:
+ *   true if every key was counted;
+ *   false if any parameter is invalid, or any key was not counted
+ *   (it was negative, or out of memory); the others are still counted.
+ */
+bool counters_addMany(counters_t* ctrs, const int keys[], const int nkeys);
+
 /**************** counters_get ****************/
 /* Return current value of counter associated with the given key.
  *
@@ -82,6 +98,21 @@ int counters_get(counters_t* ctrs, const int key);
  */
 bool counters_set(counters_t* ctrs, const int key, const int count);
 
+/**************** counters_merge ****************/
+/* Add every counter of src to the counter with the same key in dest.
+ *
+ * Caller provides:
+ *   valid pointers to two different countersets.
+ * We return:
+ *   true if every counter was merged;
+ *   false if any parameter is invalid, or out of memory.
+ * We do:
+ *   create in dest a counter for each key it does not have yet.
+ * Note:
+ *   src is unchanged.
+ */
+bool counters_merge(counters_t* dest, counters_t* src);
+
 /**************** counters_print ****************/
 /* Print all counters; provide the output file.
  *
@@ -2,13 +2,26 @@
  * file utilities - reading a word, line, or entire file
  * 
  * See file.h for documentation.
+ *
+ * file_readUntil doubles its buffer as it fills, so reading a long line
+ * costs a few reallocs rather than one per character.  file_readFile maps
+ * a regular file into memory and copies the rest of it out in one go;
+ * for pipes and sockets it falls back to file_readUntil.
+ *
+ * Compile with -DUNIT_TEST for a standalone unit test; see below.
  * 
  * David Kotz - 2016, 2017, 2019, 2021
  */
 
+#define _POSIX_C_SOURCE 200809L   // for fileno, ftello, fseeko
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "file.h"
 
 
@@ -22,10 +35,12 @@ file_numLines(FILE* fp)
 
   rewind(fp);
 
+  // count newlines a buffer at a time
   int nlines = 0;
-  char c = '\0';
-  while ( (c = fgetc(fp)) != EOF) {
-    if (c == '\n') {
+  char buf[BUFSIZ];
+  size_t nread;
+  while ( (nread = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    for (char* c = buf; (c = memchr(c, '\n', buf + nread - c)) != NULL; c++) {
       nlines++;
     }
   }
@@ -42,7 +57,35 @@ static int isnewline(int c) { return (c == '\n'); }
 
 /**************** file_readFile ****************/
 /* See file.h for documentation. */
-char* file_readFile(FILE* fp) { return file_readUntil(fp, never); }
+char*
+file_readFile(FILE* fp)
+{
+  if (fp == NULL) {
+    return NULL;
+  }
+
+  // a regular file with something left to read: map it, and copy
+  // from the stream's position to the end
+  struct stat st;
+  off_t pos;
+  if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)
+      && (pos = ftello(fp)) >= 0 && pos < st.st_size) {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (map != MAP_FAILED) {
+      size_t len = st.st_size - pos;
+      char* buf = malloc(len + 1);
+      if (buf != NULL) {
+        memcpy(buf, (char*) map + pos, len);
+        buf[len] = '\0';
+        fseeko(fp, 0, SEEK_END);
+      }
+      munmap(map, st.st_size);
+      return buf;
+    }
+  }
+
+  return file_readUntil(fp, never);
+}
 
 /**************** file_readLine ****************/
 /* See file.h for documentation. */
@@ -52,6 +95,27 @@ char* file_readLine(FILE* fp) { return file_readUntil(fp, isnewline); }
 /* See file.h for documentation. */
 char* file_readWord(FILE* fp) { return file_readUntil(fp, isspace); }
 
+/**************** file_nextLine ****************/
+/* See file.h for documentation. */
+char*
+file_nextLine(char** cursor)
+{
+  if (cursor == NULL || *cursor == NULL || **cursor == '\0') {
+    return NULL;
+  }
+
+  char* line = *cursor;
+  char* newline = strchr(line, '\n');
+  if (newline == NULL) {
+    // last line, with no newline; leave the cursor at the end
+    *cursor = line + strlen(line);
+  } else {
+    *newline = '\0';
+    *cursor = newline + 1;
+  }
+  return line;
+}
+
 /**************** readuntil ****************/
 /* See file.h for documentation. */
 char* 
@@ -69,15 +133,16 @@ file_readUntil(FILE* fp, int (*stopfunc)(int c))
   }
 
   // Read characters from file until stop-character or EOF, 
-  // expanding the buffer when needed to hold more.
+  // doubling the buffer when needed to hold more.
   int pos;
-  char c;
-  for (pos = 0; (c = fgetc(fp)) != EOF && !(*stopfunc)(c); pos++) {
+  int c;
+  for (pos = 0; (c = getc(fp)) != EOF && !(*stopfunc)(c); pos++) {
     // We need to save buf[pos+1] for the terminating null
     // and buf[len-1] is the last usable slot, 
     // so if pos+1 is past that slot, we need to grow the buffer.
     if (pos+1 > len-1) {
-      char* newbuf = realloc(buf, ++len * sizeof(char));
+      len *= 2;
+      char* newbuf = realloc(buf, len * sizeof(char));
       if (newbuf == NULL) {
         free(buf);
         return NULL;
@@ -147,3 +212,137 @@ int main(int argc, char* argv[])
   }
 }
 #endif
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test checks file_readFile on the paths the old
+ * character-at-a-time version never had: a regular file mapped into
+ * memory from a stream already partway through it, from a position not
+ * on a page boundary, and at EOF; an empty file; and a pipe, which must
+ * fall back to reading.  It checks file_nextLine on text whose last line
+ * has no newline, on text that ends with one, and on empty lines.
+ *
+ * Build and run with
+ *   make filetest && ./filetest
+ * It prints what it checks, and exits non-zero if any check fails.
+ */
+
+#ifdef UNIT_TEST
+#include <stdbool.h>
+#include <unistd.h>
+
+static int failures;                     // checks failed
+
+static FILE* tempWith(const char* text);
+static void check(const bool ok, const char* what);
+
+int
+main(void)
+{
+  char* text;
+  char* cursor;
+
+  // a stream whose position is not zero
+  FILE* fp = tempWith("first line\nsecond line\nlast line");
+  char* line = file_readLine(fp);
+  check(line != NULL && strcmp(line, "first line") == 0, "read the first line");
+  free(line);
+  text = file_readFile(fp);
+  check(text != NULL && strcmp(text, "second line\nlast line") == 0,
+        "readFile copies from the stream's position");
+  check(getc(fp) == EOF, "readFile leaves the stream at EOF");
+  check(file_readFile(fp) == NULL, "readFile at EOF returns NULL");
+
+  // a last line with no newline
+  cursor = text;
+  check((line = file_nextLine(&cursor)) != NULL && strcmp(line, "second line") == 0,
+        "nextLine returns a line without its newline");
+  check((line = file_nextLine(&cursor)) != NULL && strcmp(line, "last line") == 0,
+        "nextLine returns a last line with no newline");
+  check(file_nextLine(&cursor) == NULL && file_nextLine(&cursor) == NULL,
+        "nextLine then returns NULL, and keeps returning it");
+  free(text);
+  fclose(fp);
+
+  // an empty file
+  fp = tempWith("");
+  check(file_readFile(fp) == NULL, "readFile of an empty file returns NULL");
+  fclose(fp);
+
+  // a position past the first page, not on a page boundary
+  const int nlines = 2000;
+  fp = tmpfile();
+  for (int i = 0; i < nlines; i++) {
+    fprintf(fp, "line %d\n", i);
+  }
+  rewind(fp);
+  const int skip = 1234;
+  for (int i = 0; i < skip; i++) {
+    free(file_readLine(fp));
+  }
+  text = file_readFile(fp);
+  bool ok = (text != NULL);
+  int i = skip;
+  char expect[20];
+  for (cursor = text; ok && (line = file_nextLine(&cursor)) != NULL; i++) {
+    sprintf(expect, "line %d", i);
+    ok = strcmp(line, expect) == 0;
+  }
+  check(ok && i == nlines,
+        "readFile from deep in a file, and nextLine over text ending in a newline");
+  free(text);
+  fclose(fp);
+
+  // empty lines
+  char lines[] = "\n\nx\n";
+  cursor = lines;
+  check((line = file_nextLine(&cursor)) != NULL && *line == '\0'
+        && (line = file_nextLine(&cursor)) != NULL && *line == '\0'
+        && (line = file_nextLine(&cursor)) != NULL && strcmp(line, "x") == 0
+        && file_nextLine(&cursor) == NULL, "nextLine returns empty lines as empty strings");
+  check(file_nextLine(NULL) == NULL, "nextLine with a NULL cursor returns NULL");
+
+  // a pipe, which cannot be mapped
+  int fds[2];
+  if (pipe(fds) == 0) {
+    const char* piped = "through\na pipe";
+    if (write(fds[1], piped, strlen(piped)) == (ssize_t) strlen(piped)) {
+      close(fds[1]);
+      fp = fdopen(fds[0], "r");
+      text = file_readFile(fp);
+      check(text != NULL && strcmp(text, piped) == 0, "readFile reads a pipe");
+      free(text);
+      fclose(fp);
+    }
+  }
+  check(file_readFile(NULL) == NULL, "readFile of NULL returns NULL");
+
+  printf("%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/* Return a temporary file holding text, rewound. */
+static FILE*
+tempWith(const char* text)
+{
+  FILE* fp = tmpfile();
+  if (fp == NULL) {
+    perror("tmpfile");
+    exit(2);
+  }
+  fputs(text, fp);
+  rewind(fp);
+  return fp;
+}
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
@@ -36,6 +36,7 @@ char* file_readUntil(FILE* fp,    int (*stopfunc)(int c) );
  * and return a pointer to it; caller must later free() the pointer.
  * Returns NULL if error, or if EOF reached without reading anything.
  * After the call, file pointer is at EOF.
+ * A regular file is read by mapping it into memory, in one copy.
  */
 char* file_readFile(FILE* fp);
 
@@ -60,4 +61,20 @@ char* file_readLine(FILE* fp);
  */
 char* file_readWord(FILE* fp);
 
+/**************** file_nextLine ****************/
+/* 
+ * Iterate over the lines of a null-terminated string in memory, such as
+ * one from file_readFile, without copying them.  *cursor starts at the
+ * beginning of the string; each call returns the line at *cursor, with
+ * its newline replaced by a null, and moves *cursor to the next line.
+ * The string returned points into the caller's buffer; do not free it.
+ * Returns empty string if an empty line is read.
+ * Returns NULL at the end of the string, or if cursor is NULL.
+ * For example:
+ *   char* cursor = text;
+ *   char* line;
+ *   while ( (line = file_nextLine(&cursor)) != NULL) { ... }
+ */
+char* file_nextLine(char** cursor);
+
 #endif // __FILE_H
@@ -0,0 +1,201 @@
+/*
+ * hashmap.h - typed hash maps, generated by macro, for CS50
+ *
+ * The hashtable module maps string keys to void* items, and reaches
+ * each item through a pointer and each callback through a function
+ * pointer.  DEFINE_HASHMAP instead generates a map for one key type
+ * and one value type, as static inline functions in the including
+ * file; values are stored in the map itself, and iteration is a plain
+ * loop that the compiler can see through and optimize.
+ *
+ *   DEFINE_HASHMAP(name, K, V, hash, eq)
+ *
+ * defines the types name_t (the map) and name_entry_t (one key, value,
+ * and cached hash), and the functions below, where 'hash' is a function
+ * or macro taking a K and returning a uint32_t, and 'eq' one taking two
+ * Ks and returning true iff they are equal.  For example,
+ *
+ *   static inline uint32_t charHash(char c) { return (unsigned char) c * 0x9e3779b1u; }
+ *   static inline bool charEq(char a, char b) { return a == b; }
+ *   DEFINE_HASHMAP(iconmap, char, player_t*, charHash, charEq)
+ *
+ *   iconmap_t icons;
+ *   iconmap_init(&icons, 26);
+ *   iconmap_insert(&icons, 'A', player);
+ *   player_t** found = iconmap_find(&icons, 'A');
+ *   HASHMAP_FOREACH(iconmap, &icons, entry) {
+ *     ... entry->key, entry->value ...
+ *   }
+ *   iconmap_free(&icons);
+ *
+ * Like the hashtable module, a map keeps its entries in a dense array,
+ * in the order they were inserted, indexed by a Robin Hood open-
+ * addressing table that doubles at 7/8 full; entries cannot be removed.
+ * The map copies keys and values as they are, so a key that is a
+ * pointer (say, a string) must outlive the map.
+ *
+ * Functions generated (all static inline):
+ *   bool name_init(name_t* map, int count);
+ *       make an empty map with room for count entries; false if error.
+ *   bool name_reserve(name_t* map, int count);
+ *       make room for count entries in all; false if out of memory.
+ *   bool name_insert(name_t* map, K key, V value);
+ *       add key -> value; false if key is present, or out of memory.
+ *   V* name_find(name_t* map, K key);
+ *       pointer to the value for key (valid until the next insert),
+ *       or NULL if key is not present.
+ *   int name_count(name_t* map);
+ *       number of entries.
+ *   void name_free(name_t* map);
+ *       free the map's memory (but not what its keys or values point to).
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#ifndef __HASHMAP_H
+#define __HASHMAP_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Loop over every entry of a map, in insertion order; 'entry' is a
+ * name_entry_t* declared by the loop.  Do not insert while looping.
+ */
+#define HASHMAP_FOREACH(name, map, entry)                                    \
+  for (name##_entry_t* entry = (map)->entries;                               \
+       entry < (map)->entries + (map)->count; entry++)
+
+#define DEFINE_HASHMAP(name, K, V, hash, eq)                                 \
+                                                                             \
+typedef struct name##_entry {                                                \
+  K key;                                                                     \
+  V value;                                                                   \
+  uint32_t hash;                  /* hash(key), cached */                    \
+} name##_entry_t;                                                            \
+                                                                             \
+typedef struct name {                                                        \
+  name##_entry_t* entries;        /* capacity entries, 'count' in use */     \
+  int count;                                                                 \
+  int capacity;                   /* entries before the index grows */       \
+  uint32_t* slots;                /* index: entry number + 1, or 0 */        \
+  uint32_t mask;                  /* number of slots - 1 */                  \
+} name##_t;                                                                  \
+                                                                             \
+/* put entry number e into the index, which must have room */               \
+static inline void                                                           \
+name##_place(name##_t* map, uint32_t e)                                      \
+{                                                                            \
+  uint32_t s = map->entries[e].hash & map->mask;                             \
+  uint32_t dist = 0;                                                         \
+  uint32_t slot = e + 1;                                                     \
+  while (map->slots[s] != 0) {                                               \
+    uint32_t theirs = (s - map->entries[map->slots[s] - 1].hash) & map->mask;\
+    if (theirs < dist) {                                                     \
+      uint32_t richer = map->slots[s];                                       \
+      map->slots[s] = slot;                                                  \
+      slot = richer;                                                         \
+      dist = theirs;                                                         \
+    }                                                                        \
+    s = (s + 1) & map->mask;                                                 \
+    dist++;                                                                  \
+  }                                                                          \
+  map->slots[s] = slot;                                                      \
+}                                                                            \
+                                                                             \
+static inline bool                                                           \
+name##_reserve(name##_t* map, int count)                                     \
+{                                                                            \
+  if (count <= map->capacity) {                                              \
+    return true;                                                             \
+  }                                                                          \
+  uint32_t nslots = 8;                                                       \
+  while (nslots / 8 * 7 < (uint32_t) count) {                                \
+    nslots *= 2;                                                             \
+  }                                                                          \
+  name##_entry_t* entries =                                                  \
+    realloc(map->entries, nslots / 8 * 7 * sizeof(name##_entry_t));          \
+  if (entries == NULL) {                                                     \
+    return false;                                                            \
+  }                                                                          \
+  map->entries = entries;                                                    \
+  uint32_t* slots = calloc(nslots, sizeof(uint32_t));                        \
+  if (slots == NULL) {                                                       \
+    return false;                                                            \
+  }                                                                          \
+  free(map->slots);                                                          \
+  map->slots = slots;                                                        \
+  map->mask = nslots - 1;                                                    \
+  map->capacity = nslots / 8 * 7;                                            \
+  for (int e = 0; e < map->count; e++) {                                     \
+    name##_place(map, e);                                                    \
+  }                                                                          \
+  return true;                                                               \
+}                                                                            \
+                                                                             \
+static inline bool                                                           \
+name##_init(name##_t* map, int count)                                        \
+{                                                                            \
+  map->entries = NULL;                                                       \
+  map->count = 0;                                                            \
+  map->capacity = 0;                                                         \
+  map->slots = NULL;                                                         \
+  map->mask = 0;                                                             \
+  return name##_reserve(map, count > 0 ? count : 1);                         \
+}                                                                            \
+                                                                             \
+static inline V*                                                             \
+name##_find(name##_t* map, K key)                                            \
+{                                                                            \
+  uint32_t h = hash(key);                                                    \
+  uint32_t home = h & map->mask;                                             \
+  for (uint32_t dist = 0; ; dist++) {                                        \
+    uint32_t slot = map->slots[(home + dist) & map->mask];                   \
+    if (slot == 0) {                                                         \
+      return NULL;                                                           \
+    }                                                                        \
+    name##_entry_t* entry = &map->entries[slot - 1];                         \
+    if (((home + dist - entry->hash) & map->mask) < dist) {                  \
+      return NULL;        /* key would have been placed before here */       \
+    }                                                                        \
+    if (entry->hash == h && eq(entry->key, key)) {                           \
+      return &entry->value;                                                  \
+    }                                                                        \
+  }                                                                          \
+}                                                                            \
+                                                                             \
+static inline bool                                                           \
+name##_insert(name##_t* map, K key, V value)                                 \
+{                                                                            \
+  if (name##_find(map, key) != NULL) {                                       \
+    return false;                                                            \
+  }                                                                          \
+  if (map->count == map->capacity                                            \
+      && !name##_reserve(map, 2 * map->capacity)) {                          \
+    return false;                                                            \
+  }                                                                          \
+  name##_entry_t* entry = &map->entries[map->count];                         \
+  entry->key = key;                                                          \
+  entry->value = value;                                                      \
+  entry->hash = hash(key);                                                   \
+  name##_place(map, map->count++);                                           \
+  return true;                                                               \
+}                                                                            \
+                                                                             \
+static inline int                                                            \
+name##_count(name##_t* map)                                                  \
+{                                                                            \
+  return map->count;                                                         \
+}                                                                            \
+                                                                             \
+static inline void                                                           \
+name##_free(name##_t* map)                                                   \
+{                                                                            \
+  free(map->entries);                                                        \
+  free(map->slots);                                                          \
+  map->entries = NULL;                                                       \
+  map->slots = NULL;                                                         \
+  map->count = map->capacity = 0;                                            \
+}
+
+#endif // __HASHMAP_H
@@ -1,30 +1,63 @@
-/* 
+/*
  * hashtable.c - CS50 hashtable module
  *
  * see hashtable.h for more information.
  *
+ * The (key,item) pairs live in a dense array, in the order they were
+ * inserted, each with its key's hash; iterating walks just that array.
+ * Lookups go through a separate open-addressing index, kept with Robin
+ * Hood hashing: a pair being inserted takes the slot of any pair that is
+ * closer to its home slot than the new one is to its own, and moves that
+ * one on instead.  Probe sequences thus stay short and even, and a
+ * search can stop as soon as it passes where its key would have been.
+ * The index doubles whenever it would be more than 7/8 full; since hashes
+ * are cached, growing never rehashes a key.
+ *
+ * A table made by hashtable_newInterned keeps the caller's interned keys
+ * as they are, hashes their addresses, and compares them with ==.
+ *
+ * Compile with -DUNIT_TEST for a standalone unit test; see below.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  * updated by Xia Zhou, July 2016
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include "hashtable.h"
 #include "hash.h"
-#include "set.h"
 #include "mem.h"
 
 /**************** file-local global variables ****************/
 /* none */
 
 /**************** local types ****************/
-/* none */
+typedef struct htentry {
+  unsigned long hash;     // hash of key
+  char* key;              // the module's copy of the key, or interned key
+  void* item;             // the caller's item
+} htentry_t;
+
+/* One slot of the index: the low bits of an entry's hash, so most
+ * mismatches are found without touching the entry, and the entry's
+ * number plus one (0 if the slot is empty).
+ */
+typedef struct htslot {
+  uint32_t hash;
+  uint32_t entry;
+} htslot_t;
 
 /**************** global types ****************/
 typedef struct hashtable {
-  int num_slots;          // number of slots in the table
-  set_t** table;          // table[num_slots] of set_t*
+  htentry_t* entries;     // entries[capacity], the first 'count' in use
+  int count;              // number of (key,item) pairs
+  int capacity;           // entries we may hold before the index grows
+  htslot_t* slots;        // slots[mask+1], the index
+  unsigned long mask;     // number of slots - 1, a power of two minus one
+  bool interned;          // keys are interned strings, compared by address
 } hashtable_t;
 
 /**************** global functions ****************/
@@ -33,7 +66,9 @@ typedef struct hashtable {
 
 /**************** local functions ****************/
 /* not visible outside this file */
-/* none */
+static bool grow(hashtable_t* ht, const int count);
+static void place(hashtable_t* ht, htslot_t slot);
+static unsigned long keyHash(hashtable_t* ht, const char* key);
 
 /**************** hashtable_new() ****************/
 /* see hashtable.h for description */
@@ -42,39 +77,52 @@ hashtable_new(const int num_slots)
 {
   if (num_slots <= 0) {
     return NULL;              // bad number of slots
-  } 
+  }
 
   hashtable_t* ht = mem_malloc(sizeof(hashtable_t));
   if (ht == NULL) {
     return NULL;              // error allocating hashtable
-  } 
+  }
 
   // initialize contents of hashtable structure
-  ht->num_slots = num_slots;
-  ht->table = mem_malloc(num_slots * sizeof(set_t*));
-  if (ht->table == NULL) {
-    mem_free(ht);           // error allocating table
-    return NULL;
-  } 
+  ht->entries = NULL;
+  ht->count = 0;
+  ht->capacity = 0;
+  ht->slots = NULL;
+  ht->mask = 0;
+  ht->interned = false;
 
-  // initialize each table entry to be a set
-  for (int slot = 0; slot < num_slots; slot++) {
-    set_t* new = set_new();
-    if (new != NULL) {
-      ht->table[slot] = new;
-    } else {
-      // malloc failure; unwind all we've created. [sigh]
-      while (--slot >= 0)
-        set_delete(ht->table[slot], NULL);
-      mem_free(ht->table);
-      mem_free(ht);
-      return NULL;
-    }
+  // make room for num_slots pairs
+  if (!grow(ht, num_slots)) {
+    mem_free(ht);
+    return NULL;
   }
+  return ht;
+}
 
+/**************** hashtable_newInterned() ****************/
+/* see hashtable.h for description */
+hashtable_t*
+hashtable_newInterned(const int num_slots)
+{
+  hashtable_t* ht = hashtable_new(num_slots);
+  if (ht != NULL) {
+    ht->interned = true;
+  }
   return ht;
 }
 
+/**************** hashtable_reserve() ****************/
+/* see hashtable.h for description */
+bool
+hashtable_reserve(hashtable_t* ht, const int count)
+{
+  if (ht == NULL || count < 0) {
+    return false;             // bad parameter
+  }
+  return count <= ht->capacity || grow(ht, count);
+}
+
 /**************** hashtable_insert() ****************/
 /* see hashtable.h for description */
 bool
@@ -83,16 +131,39 @@ hashtable_insert(hashtable_t* ht, const char* key, void* item)
   if (ht == NULL || key == NULL || item == NULL) {
     return false;             // bad parameter
   }
-  
-  int slot = hash_jenkins(key, ht->num_slots);
+  if (hashtable_find(ht, key) != NULL) {
+    return false;             // key already present
+  }
+  if (ht->count == ht->capacity && !grow(ht, 2 * ht->capacity)) {
+    return false;             // error growing
+  }
 
-  bool inserted = set_insert(ht->table[slot], key, item);
+  // copy the key, unless it is interned
+  char* keycopy;
+  if (ht->interned) {
+    keycopy = (char*) key;
+  } else {
+    keycopy = mem_malloc(strlen(key) + 1);
+    if (keycopy == NULL) {
+      return false;           // error allocating key
+    }
+    strcpy(keycopy, key);
+  }
+
+  // append the entry, and index it
+  htentry_t* entry = &ht->entries[ht->count];
+  entry->hash = keyHash(ht, key);
+  entry->key = keycopy;
+  entry->item = item;
+  ht->count++;
+  htslot_t slot = { .hash = (uint32_t) entry->hash, .entry = ht->count };
+  place(ht, slot);
 
 #ifdef MEMTEST
   mem_report(stdout, "After hashtable_insert");
 #endif
 
-  return inserted;
+  return true;
 }
 
 
@@ -103,16 +174,30 @@ hashtable_find(hashtable_t* ht, const char* key)
 {
   if (ht == NULL || key == NULL) {
     return NULL;              // bad ht or bad key
-  } else {
-    int slot = hash_jenkins(key, ht->num_slots);
-    return set_find(ht->table[slot], key);
+  }
+
+  uint32_t hash = (uint32_t) keyHash(ht, key);
+  unsigned long home = hash & ht->mask;
+  for (unsigned long dist = 0; ; dist++) {
+    htslot_t* slot = &ht->slots[(home + dist) & ht->mask];
+    // an empty slot, or a pair closer to its home than we are to ours,
+    // means the key would have been placed before here
+    if (slot->entry == 0 || ((home + dist - slot->hash) & ht->mask) < dist) {
+      return NULL;
+    }
+    if (slot->hash == hash) {
+      htentry_t* entry = &ht->entries[slot->entry - 1];
+      if (entry->key == key || (!ht->interned && strcmp(entry->key, key) == 0)) {
+        return entry->item;
+      }
+    }
   }
 }
 
 /**************** hashtable_print() ****************/
 /* see hashtable.h for description */
 void
-hashtable_print(hashtable_t* ht, FILE* fp, 
+hashtable_print(hashtable_t* ht, FILE* fp,
                 void (*itemprint)(FILE* fp, const char* key, void* item) )
 {
   if (fp != NULL) {
@@ -120,10 +205,15 @@ hashtable_print(hashtable_t* ht, FILE* fp,
       fputs("(null)", fp);    // bad hashtable
     } else {
       // print one line per slot
-      for (int slot = 0; slot < ht->num_slots; slot++) {
-        printf("%4d: ", slot);
-        set_print(ht->table[slot], fp, itemprint);
-        printf("\n");
+      for (unsigned long s = 0; s <= ht->mask; s++) {
+        fprintf(fp, "%4lu: {", s);
+        htslot_t* slot = &ht->slots[s];
+        if (slot->entry != 0 && itemprint != NULL) {
+          htentry_t* entry = &ht->entries[slot->entry - 1];
+          (*itemprint)(fp, entry->key, entry->item);
+          fputc(',', fp);
+        }
+        fputs("}\n", fp);
       }
     }
   }
@@ -132,34 +222,282 @@ hashtable_print(hashtable_t* ht, FILE* fp,
 /**************** hashtable_iterate() ****************/
 /* see hashtable.h for description */
 void
-hashtable_iterate(hashtable_t* ht, void* arg, 
+hashtable_iterate(hashtable_t* ht, void* arg,
                   void (*itemfunc)(void* arg, const char* key, void* item) )
 {
   if (ht != NULL && itemfunc != NULL) {
-    // iterate over each slot's set
-    for (int slot = 0; slot < ht->num_slots; slot++) {
-      set_iterate(ht->table[slot], arg, itemfunc);
+    // the entries are dense, so there are no empty slots to skip
+    for (int e = 0; e < ht->count; e++) {
+      (*itemfunc)(arg, ht->entries[e].key, ht->entries[e].item);
     }
   }
 }
 
 /**************** hashtable_delete() ****************/
 /* see hashtable.h for description */
-void 
+void
 hashtable_delete(hashtable_t* ht, void (*itemdelete)(void* item) )
 {
   if (ht == NULL) {
     return;                   // bad hashtable
   } else {
-    // delete set in each slot
-    for (int slot = 0; slot < ht->num_slots; slot++) {
-      set_delete(ht->table[slot], itemdelete);
+    // delete each entry's item and key
+    for (int e = 0; e < ht->count; e++) {
+      if (itemdelete != NULL) {
+        (*itemdelete)(ht->entries[e].item);
+      }
+      if (!ht->interned) {
+        mem_free(ht->entries[e].key);
+      }
     }
-    // delete the table, and the overall struct
-    mem_free(ht->table);
+    // delete the arrays, and the overall struct
+    free(ht->entries);        // from realloc, in grow()
+    mem_free(ht->slots);
     mem_free(ht);
   }
 #ifdef MEMTEST
   mem_report(stdout, "End of hashtable_delete");
 #endif
 }
+
+/**************** grow() ****************/
+/* Make room for at least 'count' pairs: enlarge the entry array, and
+ * rebuild the index at a size that keeps it at most 7/8 full.
+ * Return false, leaving the table as it was, if out of memory.
+ */
+static bool
+grow(hashtable_t* ht, const int count)
+{
+  // smallest power of two with count <= 7/8 of it
+  unsigned long nslots = 8;
+  while (nslots / 8 * 7 < (unsigned long) count) {
+    nslots *= 2;
+  }
+
+  htentry_t* entries = realloc(ht->entries, nslots / 8 * 7 * sizeof(htentry_t));
+  if (entries == NULL) {
+    return false;
+  }
+  ht->entries = entries;
+  htslot_t* slots = mem_calloc(nslots, sizeof(htslot_t));
+  if (slots == NULL) {
+    return false;
+  }
+
+  // reindex every entry from its cached hash
+  if (ht->slots != NULL) {
+    mem_free(ht->slots);
+  }
+  ht->slots = slots;
+  ht->mask = nslots - 1;
+  ht->capacity = nslots / 8 * 7;
+  for (int e = 0; e < ht->count; e++) {
+    htslot_t slot = { .hash = (uint32_t) ht->entries[e].hash, .entry = e + 1 };
+    place(ht, slot);
+  }
+  return true;
+}
+
+/**************** place() ****************/
+/* Put a slot into the index, which must have room: walking on from its
+ * home, it takes the place of the first slot whose occupant is closer
+ * to home than it is, and that occupant walks on in turn.
+ */
+static void
+place(hashtable_t* ht, htslot_t slot)
+{
+  unsigned long s = slot.hash & ht->mask;
+  unsigned long dist = 0;
+  while (ht->slots[s].entry != 0) {
+    unsigned long theirs = (s - ht->slots[s].hash) & ht->mask;
+    if (theirs < dist) {
+      htslot_t richer = ht->slots[s];
+      ht->slots[s] = slot;
+      slot = richer;
+      dist = theirs;
+    }
+    s = (s + 1) & ht->mask;
+    dist++;
+  }
+  ht->slots[s] = slot;
+}
+
+/**************** keyHash() ****************/
+/* Hash a key: its characters, or its address if keys are interned.
+ * Addresses are mixed (the finalizer of MurmurHash3's 64-bit variant),
+ * since their low bits alone are mostly alignment.
+ */
+static unsigned long
+keyHash(hashtable_t* ht, const char* key)
+{
+  if (!ht->interned) {
+    return hash_jenkins(key, ULONG_MAX);
+  }
+  uint64_t h = (uintptr_t) key;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return (unsigned long) h;
+}
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test checks the table against the behavior of the Lab 3
+ * hashtable it replaced: a duplicate key or a NULL parameter is refused,
+ * find returns the item for a key and NULL for any other, iterate visits
+ * every pair once (in insertion order, now), and delete hands every item
+ * to itemdelete.  It then grows a table far past its initial size, and
+ * checks that reserve makes room at once, so that inserts up to the
+ * reserved count never grow the table again.  Last, a table of interned
+ * keys finds an interned key but not an equal string that is not.
+ *
+ * Build and run with
+ *   make hashtabletest && ./hashtabletest
+ * It prints what it checks, and exits non-zero if any check fails.
+ */
+
+#ifdef UNIT_TEST
+
+#include "intern.h"
+
+static const int ManyKeys = 20000;
+
+typedef struct visit {
+  int count;                             // pairs visited
+  bool inOrder;                          // each had the next key in order?
+} visit_t;
+
+static int failures;                     // checks failed
+static int deleted;                      // items passed to countDelete
+
+static void visitPair(void* arg, const char* key, void* item);
+static void countDelete(void* item);
+static void check(const bool ok, const char* what);
+
+int
+main(void)
+{
+  int* items = malloc(ManyKeys * sizeof(int));
+  if (items == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 2;
+  }
+  for (int i = 0; i < ManyKeys; i++) {
+    items[i] = i;
+  }
+  char key[20];
+
+  // the basics, as the Lab 3 hashtable had them
+  hashtable_t* ht = hashtable_new(4);
+  check(ht != NULL, "hashtable_new");
+  check(hashtable_new(0) == NULL, "a table needs at least one slot");
+  check(hashtable_insert(ht, "cat", &items[1]), "insert a key");
+  check(hashtable_insert(ht, "dog", &items[2]), "insert another key");
+  check(!hashtable_insert(ht, "cat", &items[3]), "a duplicate key is refused");
+  check(hashtable_find(ht, "cat") == &items[1], "the duplicate left the item alone");
+  check(hashtable_find(ht, "dog") == &items[2], "find returns the key's item");
+  check(hashtable_find(ht, "cow") == NULL, "find returns NULL for a missing key");
+  strcpy(key, "cat");
+  check(hashtable_find(ht, key) == &items[1], "keys compare as strings");
+  check(!hashtable_insert(ht, "cow", NULL) && !hashtable_insert(ht, NULL, &items[4])
+        && !hashtable_insert(NULL, "cow", &items[4]), "NULL parameters are refused");
+  check(hashtable_find(NULL, "cat") == NULL && hashtable_find(ht, NULL) == NULL,
+        "find with NULL parameters returns NULL");
+  deleted = 0;
+  hashtable_delete(ht, countDelete);
+  check(deleted == 2, "delete passes each item to itemdelete");
+
+  // growth, far past the initial size
+  ht = hashtable_new(4);
+  bool inserted = true;
+  for (int i = 0; i < ManyKeys; i++) {
+    sprintf(key, "key%d", i);
+    inserted = hashtable_insert(ht, key, &items[i]) && inserted;
+  }
+  check(inserted, "insert many keys into a small table");
+  bool found = true;
+  for (int i = 0; i < ManyKeys; i++) {
+    sprintf(key, "key%d", i);
+    found = found && hashtable_find(ht, key) == &items[i];
+  }
+  check(found, "every key is found after growing");
+  sprintf(key, "key%d", ManyKeys);
+  check(hashtable_find(ht, key) == NULL, "a key never inserted is not found");
+  visit_t visit = { 0, true };
+  hashtable_iterate(ht, &visit, visitPair);
+  check(visit.count == ManyKeys && visit.inOrder,
+        "iterate visits every pair once, in insertion order");
+  deleted = 0;
+  hashtable_delete(ht, countDelete);
+  check(deleted == ManyKeys, "delete passes every item to itemdelete");
+
+  // reserve
+  ht = hashtable_new(1);
+  check(!hashtable_reserve(ht, -1) && !hashtable_reserve(NULL, 10),
+        "reserve refuses bad parameters");
+  check(hashtable_reserve(ht, ManyKeys) && ht->capacity >= ManyKeys,
+        "reserve makes room at once");
+  htslot_t* index = ht->slots;
+  for (int i = 0; i < ManyKeys; i++) {
+    sprintf(key, "key%d", i);
+    hashtable_insert(ht, key, &items[i]);
+  }
+  check(ht->slots == index, "inserts up to the reserved count do not grow the table");
+  check(hashtable_reserve(ht, 10) && ht->slots == index,
+        "reserving less than there is room for changes nothing");
+  sprintf(key, "key%d", ManyKeys / 2);
+  check(hashtable_find(ht, key) == &items[ManyKeys / 2], "keys are found after reserve");
+  hashtable_delete(ht, NULL);
+
+  // interned keys
+  intern_t* pool = intern_new(4);
+  ht = hashtable_newInterned(4);
+  const char* cat = intern_string(pool, "cat");
+  check(hashtable_insert(ht, cat, &items[1]), "insert an interned key");
+  check(!hashtable_insert(ht, intern_string(pool, "cat"), &items[2]),
+        "the same interned key is a duplicate");
+  check(hashtable_find(ht, intern_find(pool, "cat")) == &items[1],
+        "find returns the interned key's item");
+  strcpy(key, "cat");
+  check(hashtable_find(ht, key) == NULL, "a string that is not interned finds nothing");
+  hashtable_delete(ht, NULL);
+  intern_delete(pool);
+
+  free(items);
+  printf("%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/* Count a pair, and check that it is the next one inserted. */
+static void
+visitPair(void* arg, const char* key, void* item)
+{
+  visit_t* visit = arg;
+  char expect[20];
+  sprintf(expect, "key%d", visit->count);
+  if (strcmp(key, expect) != 0 || *(int*) item != visit->count) {
+    visit->inOrder = false;
+  }
+  visit->count++;
+}
+
+/* Count an item deleted; the items belong to main. */
+static void
+countDelete(void* item)
+{
+  deleted++;
+}
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
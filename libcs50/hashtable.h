@@ -2,7 +2,8 @@
  * hashtable.h - header file for CS50 hashtable module
  *
  * A *hashtable* is a set of (key,item) pairs.  It acts just like a set, 
- * but is far more efficient for large collections.
+ * but is far more efficient for large collections.  It grows as needed,
+ * and iterates over its pairs in the order they were inserted.
  *
  * David Kotz, April 2016, 2017, 2019, 2021
  * updated by Xia Zhou, July 2016
@@ -23,7 +24,8 @@ typedef struct hashtable hashtable_t;  // opaque to users of the module
 /* Create a new (empty) hashtable.
  *
  * Caller provides:
- *   number of slots to be used for the hashtable (must be > 0).
+ *   number of pairs to make room for at first (must be > 0);
+ *   the table grows past that as needed.
  * We return:
  *   pointer to the new hashtable; return NULL if error.
  * We guarantee:
@@ -33,6 +35,36 @@ typedef struct hashtable hashtable_t;  // opaque to users of the module
  */
 hashtable_t* hashtable_new(const int num_slots);
 
+/**************** hashtable_newInterned ****************/
+/* Create a new (empty) hashtable whose keys are interned strings.
+ *
+ * Caller provides:
+ *   number of pairs to make room for at first (must be > 0).
+ * We return:
+ *   pointer to the new hashtable; return NULL if error.
+ * Caller is responsible for:
+ *   passing only keys returned by intern_string (see intern.h), from
+ *   pools that outlive the table; later calling hashtable_delete.
+ * Notes:
+ *   The table keeps the key pointers themselves, without copying them,
+ *   and compares keys by address, so a lookup is one pointer compare;
+ *   looking up a string that is not interned finds nothing.
+ *   hashtable_delete does not free the keys.
+ */
+hashtable_t* hashtable_newInterned(const int num_slots);
+
+/**************** hashtable_reserve ****************/
+/* Make room for at least count pairs, so that inserting up to that many
+ * does not have to grow the table.
+ *
+ * Caller provides:
+ *   valid pointer to hashtable, count >= 0.
+ * We return:
+ *   true if the table has room for count pairs;
+ *   false if any parameter is invalid, or out of memory.
+ */
+bool hashtable_reserve(hashtable_t* ht, const int count);
+
 /**************** hashtable_insert ****************/
 /* Insert item, identified by key (string), into the given hashtable.
  *
@@ -73,7 +105,8 @@ void* hashtable_find(hashtable_t* ht, const char* key);
  *   nothing, if NULL fp.
  *   "(null)" if NULL ht.
  *   one line per hash slot, with no items, if NULL itemprint.
- *   otherwise, one line per hash slot, listing (key,item) pairs in that slot.
+ *   otherwise, one line per hash slot, listing the (key,item) pair, if any,
+ *   in that slot.
  * Note:
  *   the hashtable and its contents are not changed by this function,
  */
@@ -81,7 +114,7 @@ void hashtable_print(hashtable_t* ht, FILE* fp,
                      void (*itemprint)(FILE* fp, const char* key, void* item));
 
 /**************** hashtable_iterate ****************/
-/* Iterate over all items in the table; in undefined order.
+/* Iterate over all items in the table; in the order they were inserted.
  *
  * Caller provides:
  *   valid pointer to hashtable, 
@@ -91,7 +124,8 @@ void hashtable_print(hashtable_t* ht, FILE* fp,
  *   nothing, if ht==NULL or itemfunc==NULL.
  *   otherwise, call the itemfunc once for each item, with (arg, key, item).
  * Notes:
- *   the order in which hashtable items are handled is undefined.
+ *   items are handled in the order they were inserted.
+ *   the itemfunc must not insert into the hashtable.
  *   the hashtable and its contents are not changed by this function,
  *   but the itemfunc may change the contents of the item.
  */
@@ -0,0 +1,294 @@
+/*
+ * intern.c - CS50 'intern' module
+ *
+ * see intern.h for more information.
+ *
+ * The strings are packed one after another into blocks; a block is
+ * filled before the next is allocated, and a string too long for a
+ * block gets one of its own.  A typed hash map from hashmap.h indexes
+ * the strings by content, keyed by the pool's own copies.
+ *
+ * Compile with -DUNIT_TEST for a standalone unit test; see below.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include "intern.h"
+#include "hashmap.h"
+#include "hash.h"
+#include "mem.h"
+
+/**************** file-local global variables ****************/
+static const size_t BlockBytes = 4096;  // usual size of a block of strings
+
+/**************** local types ****************/
+/* the index maps each string to the canonical copy, which is also its key */
+static inline uint32_t
+stringHash(const char* str)
+{
+  return (uint32_t) hash_jenkins(str, ULONG_MAX);
+}
+
+static inline bool
+stringEq(const char* a, const char* b)
+{
+  return strcmp(a, b) == 0;
+}
+
+DEFINE_HASHMAP(internmap, const char*, const char*, stringHash, stringEq)
+
+typedef struct internblock {
+  struct internblock* next;   // the block filled before this one
+  size_t used;                // bytes of 'chars' in use
+  size_t size;                // bytes of 'chars'
+  char chars[];               // the strings, each with its '\0'
+} internblock_t;
+
+/**************** global types ****************/
+typedef struct intern {
+  internmap_t index;          // each string -> its canonical copy
+  internblock_t* blocks;      // the block being filled, and older ones
+} intern_t;
+
+/**************** global functions ****************/
+/* that is, visible outside this file */
+/* see intern.h for comments about exported functions */
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static char* store(intern_t* pool, const char* str, const size_t len);
+
+/**************** intern_new() ****************/
+/* see intern.h for description */
+intern_t*
+intern_new(const int count)
+{
+  if (count <= 0) {
+    return NULL;              // bad count
+  }
+
+  intern_t* pool = mem_malloc(sizeof(intern_t));
+  if (pool == NULL) {
+    return NULL;              // error allocating pool
+  }
+  pool->blocks = NULL;
+  if (!internmap_init(&pool->index, count)) {
+    internmap_free(&pool->index);
+    mem_free(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+/**************** intern_string() ****************/
+/* see intern.h for description */
+const char*
+intern_string(intern_t* pool, const char* str)
+{
+  if (pool == NULL || str == NULL) {
+    return NULL;              // bad parameters
+  }
+
+  const char** found = internmap_find(&pool->index, str);
+  if (found != NULL) {
+    return *found;
+  }
+
+  size_t len = strlen(str);
+  char* copy = store(pool, str, len);
+  if (copy == NULL || !internmap_insert(&pool->index, copy, copy)) {
+    return NULL;              // out of memory
+  }
+  return copy;
+}
+
+/**************** intern_find() ****************/
+/* see intern.h for description */
+const char*
+intern_find(intern_t* pool, const char* str)
+{
+  if (pool == NULL || str == NULL) {
+    return NULL;              // bad parameters
+  }
+
+  const char** found = internmap_find(&pool->index, str);
+  return (found == NULL) ? NULL : *found;
+}
+
+/**************** intern_count() ****************/
+/* see intern.h for description */
+int
+intern_count(intern_t* pool)
+{
+  return (pool == NULL) ? 0 : internmap_count(&pool->index);
+}
+
+/**************** intern_delete() ****************/
+/* see intern.h for description */
+void
+intern_delete(intern_t* pool)
+{
+  if (pool != NULL) {
+    internmap_free(&pool->index);
+    while (pool->blocks != NULL) {
+      internblock_t* next = pool->blocks->next;
+      mem_free(pool->blocks);
+      pool->blocks = next;
+    }
+    mem_free(pool);
+  }
+#ifdef MEMTEST
+  mem_report(stdout, "End of intern_delete");
+#endif
+}
+
+/**************** store() ****************/
+/* Copy str, of length len, into the current block, or a new one if it
+ * does not fit.  Return the copy, or NULL if out of memory.
+ */
+static char*
+store(intern_t* pool, const char* str, const size_t len)
+{
+  internblock_t* block = pool->blocks;
+  if (block == NULL || block->size - block->used < len + 1) {
+    size_t size = (len + 1 > BlockBytes) ? len + 1 : BlockBytes;
+    block = mem_malloc(sizeof(internblock_t) + size);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->used = 0;
+    block->size = size;
+    if (size == BlockBytes || pool->blocks == NULL) {
+      block->next = pool->blocks;
+      pool->blocks = block;
+    } else {
+      // a string of its own; keep filling the current block after it
+      block->next = pool->blocks->next;
+      pool->blocks->next = block;
+    }
+  }
+
+  char* copy = block->chars + block->used;
+  memcpy(copy, str, len + 1);
+  block->used += len + 1;
+  return copy;
+}
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test interns many distinct strings into a pool sized for
+ * two, so that both the index and the blocks grow many times over, and
+ * keeps every pointer it is given.  It checks that interning an equal
+ * string (from another buffer) gives back the same pointer, before and
+ * after all that growth; that different strings get different pointers;
+ * and that every string still reads as it did, including an empty one
+ * and one longer than a block.
+ *
+ * Build and run with
+ *   make interntest && ./interntest
+ * It prints what it checks, and exits non-zero if any check fails.
+ */
+
+#ifdef UNIT_TEST
+
+static const int Many = 20000;           // distinct strings to intern
+
+static int failures;                     // checks failed
+
+static void check(const bool ok, const char* what);
+
+int
+main(void)
+{
+  const char** words = malloc(Many * sizeof(char*));
+  char* longword = malloc(3 * BlockBytes);
+  if (words == NULL || longword == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 2;
+  }
+  memset(longword, 'x', 3 * BlockBytes - 1);
+  longword[3 * BlockBytes - 1] = '\0';
+  char buf[20];
+
+  intern_t* pool = intern_new(2);
+  check(pool != NULL, "intern_new");
+  check(intern_new(0) == NULL, "a pool needs a positive count");
+
+  // equal strings, different strings
+  const char* cat = intern_string(pool, "cat");
+  strcpy(buf, "cat");
+  check(cat != NULL && cat != buf && strcmp(cat, "cat") == 0,
+        "intern_string returns a copy");
+  check(intern_string(pool, buf) == cat, "an equal string gives the same pointer");
+  check(intern_find(pool, buf) == cat, "intern_find gives the same pointer");
+  const char* dog = intern_string(pool, "dog");
+  check(dog != NULL && dog != cat, "a different string gives a different pointer");
+  check(intern_find(pool, "cow") == NULL, "intern_find of a new string is NULL");
+  check(intern_count(pool) == 2, "intern_count counts distinct strings");
+  const char* empty = intern_string(pool, "");
+  check(empty != NULL && *empty == '\0' && empty != cat && empty != dog,
+        "the empty string is interned, apart from the others");
+  const char* lng = intern_string(pool, longword);
+  check(lng != NULL && strcmp(lng, longword) == 0,
+        "a string longer than a block is interned");
+
+  // many strings, so the pool grows
+  bool ok = true;
+  for (int i = 0; i < Many; i++) {
+    sprintf(buf, "word%d", i);
+    words[i] = intern_string(pool, buf);
+    ok = ok && words[i] != NULL;
+  }
+  check(ok, "intern many strings");
+  check(intern_count(pool) == Many + 4, "intern_count counts them all");
+
+  ok = true;
+  for (int i = 0; i < Many; i++) {
+    sprintf(buf, "word%d", i);
+    ok = ok && strcmp(words[i], buf) == 0;
+  }
+  check(ok, "every string reads as it did, after growth");
+  ok = true;
+  for (int i = 0; i < Many; i++) {
+    sprintf(buf, "word%d", i);
+    ok = ok && intern_string(pool, buf) == words[i] && intern_find(pool, buf) == words[i];
+  }
+  check(ok, "every equal string gives the same pointer, after growth");
+  // each pointer reads as its own string, so no two are the same
+  ok = true;
+  for (int i = 1; i < Many; i++) {
+    ok = ok && words[i] != words[i - 1] && words[i] != cat && words[i] != lng;
+  }
+  check(ok, "different strings keep different pointers");
+  check(intern_string(pool, "cat") == cat && intern_string(pool, "dog") == dog
+        && intern_string(pool, "") == empty && intern_string(pool, longword) == lng
+        && strcmp(cat, "cat") == 0 && strcmp(lng, longword) == 0,
+        "the first strings keep their pointers and contents");
+  check(intern_count(pool) == Many + 4, "re-interning adds nothing");
+  check(intern_string(NULL, "cat") == NULL && intern_string(pool, NULL) == NULL,
+        "NULL parameters give NULL");
+
+  intern_delete(pool);
+  free(longword);
+  free(words);
+  printf("%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
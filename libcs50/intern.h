@@ -0,0 +1,84 @@
+/*
+ * intern.h - header file for CS50 'intern' module
+ *
+ * An *intern pool* keeps one canonical copy of each string given to it:
+ * interning a string returns a pointer to the pool's copy, the same
+ * pointer every time for equal strings, valid until the pool is deleted.
+ * Two interned strings are thus equal iff their pointers are, and code
+ * holding interned strings can compare them with == and keep them
+ * without copying.  The hashtable and set modules can take interned keys
+ * that way; see hashtable_newInterned and set_newInterned.
+ *
+ * The pool stores its strings packed into large blocks, so interning a
+ * new string rarely allocates, and deleting the pool frees them all.
+ * A pool is not safe to share between threads without a lock.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#ifndef __INTERN_H
+#define __INTERN_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct intern intern_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** intern_new ****************/
+/* Create a new (empty) intern pool.
+ *
+ * Caller provides:
+ *   number of strings to make room for at first (must be > 0);
+ *   the pool grows past that as needed.
+ * We return:
+ *   pointer to a new pool, or NULL if error.
+ * Caller is responsible for:
+ *   later calling intern_delete.
+ */
+intern_t* intern_new(const int count);
+
+/**************** intern_string ****************/
+/* Return the pool's canonical copy of a string, adding it if need be.
+ *
+ * Caller provides:
+ *   valid pool pointer, valid string pointer.
+ * We return:
+ *   the canonical copy of str, equal to it, and the same pointer for
+ *   every call with an equal string; NULL if any parameter is NULL,
+ *   or out of memory.
+ * Caller is responsible for:
+ *   not modifying the copy, and not using it after intern_delete.
+ */
+const char* intern_string(intern_t* pool, const char* str);
+
+/**************** intern_find ****************/
+/* Return the pool's canonical copy of a string, without adding it.
+ *
+ * Caller provides:
+ *   valid pool pointer, valid string pointer.
+ * We return:
+ *   the canonical copy of str, or NULL if it has not been interned,
+ *   or any parameter is NULL.
+ */
+const char* intern_find(intern_t* pool, const char* str);
+
+/**************** intern_count ****************/
+/* Return the number of distinct strings in the pool (0 if pool is NULL).
+ */
+int intern_count(intern_t* pool);
+
+/**************** intern_delete ****************/
+/* Delete the pool, and every string in it.
+ *
+ * Caller provides:
+ *   valid pool pointer; a NULL pool is ignored.
+ * Notes:
+ *   every pointer the pool returned is then invalid; delete any
+ *   hashtable or set keyed by them first.
+ */
+void intern_delete(intern_t* pool);
+
+#endif // __INTERN_H
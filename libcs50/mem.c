@@ -8,18 +8,120 @@
  * 2. Variants that 'assert' the result is non-NULL;
  *    if NULL occurs, kick out an error and die.
  *
+ * 3. Arenas and pools.  An arena hands out space from the front of its
+ *    current block, rounding each request up to the strictest alignment,
+ *    and starts a new block when that one is full; a request too big to
+ *    share a block gets one of its own, linked in behind the current
+ *    block so the current one keeps filling.  A pool keeps its freed
+ *    objects on a list threaded through the objects themselves.
+ *
+ * 4. The profiler.  Tags live in a fixed table, found by hashing the
+ *    tag's address and claimed with compare-and-swap, so counting an
+ *    allocation takes no lock.  To charge a free to the right tag, each
+ *    tagged allocation is remembered, with its size, in a table keyed by
+ *    address, split into shards each under its own lock; mem_free looks
+ *    there only while some tagged allocation is live.
+ *
+ * Compile with -DUNIT_TEST for a standalone unit test; see below.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
+#define _POSIX_C_SOURCE 200809L   // for sigaction
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "mem.h"
 
+// this file defines the functions that MEMPROFILE's macros replace
+#undef mem_malloc
+#undef mem_calloc
+#undef mem_malloc_assert
+#undef mem_calloc_assert
+#undef mem_arena_alloc
+#undef mem_arena_calloc
+
+/**************** local types ****************/
+#define MaxTags 1024          // most distinct tags the profiler counts
+#define LiveShards 64         // locks the live-allocation table is split over
+
+/* one tag's counters */
+typedef struct memtag {
+  _Atomic(const char*) tag;   // NULL if this entry is unused
+  atomic_long allocs;         // allocations counted
+  atomic_long frees;          // of those, how many were freed
+  atomic_long bytes;          // bytes allocated
+  atomic_long liveBytes;      // of those, bytes not yet freed
+  atomic_long arenaBytes;     // bytes allocated from arenas
+} memtag_t;
+
+/* a snapshot of one tag's counters, for mem_profile_report */
+typedef struct tagcount {
+  const char* tag;
+  long allocs, frees, bytes, liveBytes, arenaBytes;
+} tagcount_t;
+
+/* a tagged allocation not yet freed; ptr is NULL if the slot is empty */
+typedef struct memlive {
+  void* ptr;
+  memtag_t* tag;
+  size_t size;
+} memlive_t;
+
+typedef struct memshard {
+  pthread_mutex_t lock;       // guards the rest
+  memlive_t* slots;           // open addressing, linear probing
+  size_t mask;                // number of slots - 1; slots NULL if none yet
+  size_t count;               // slots in use
+} memshard_t;
+
+typedef struct arenablock {
+  struct arenablock* next;    // the block filled before this one
+  size_t used;                // bytes of 'space' in use
+  size_t size;                // bytes of 'space'
+  max_align_t space[];        // the objects
+} arenablock_t;
+
+/**************** global types ****************/
+typedef struct mem_arena {
+  arenablock_t* blocks;       // the block being filled, and older ones
+  size_t blockSize;           // usual size of a block's space
+} mem_arena_t;
+
+typedef struct mem_pool {
+  mem_arena_t* arena;         // where new objects come from
+  size_t size;                // size of each object, rounded up
+  void* freed;                // freed objects, each pointing to the next
+} mem_pool_t;
+
 /**************** file-local global variables ****************/
-// track malloc and free across *all* calls within this program.
-static int nmalloc = 0;         // number of successful malloc calls
-static int nfree = 0;           // number of free calls
-static int nfreenull = 0;       // number of free(NULL) calls
+// track malloc and free across *all* calls within this program,
+// from any thread.
+static atomic_int nmalloc = 0;   // number of successful malloc calls
+static atomic_int nfree = 0;     // number of free calls
+static atomic_int nfreenull = 0; // number of free(NULL) calls
+
+// the profiler's tables; see the top of this file
+static memtag_t tags[MaxTags];
+static atomic_long tagsFull = 0;     // allocations not counted: no room
+static memshard_t shards[LiveShards];
+static pthread_once_t shardsOnce = PTHREAD_ONCE_INIT;
+static atomic_long ntracked = 0;     // tagged allocations now live
+
+/**************** local functions ****************/
+static memtag_t* findTag(const char* tag);
+static void track(void* ptr, memtag_t* tag, const size_t size);
+static memtag_t* untrack(void* ptr, size_t* size);
+static void initShards(void);
+static memshard_t* shardOf(const void* ptr, size_t* hash);
+static void dumpProfile(int signum);
 
 
 /**************** mem_assert ****************/
@@ -101,6 +203,14 @@ void
 mem_free(void* ptr)
 {
   if (ptr != NULL) {
+    if (atomic_load_explicit(&ntracked, memory_order_relaxed) > 0) {
+      size_t size;
+      memtag_t* tag = untrack(ptr, &size);
+      if (tag != NULL) {
+        atomic_fetch_add_explicit(&tag->frees, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&tag->liveBytes, size, memory_order_relaxed);
+      }
+    }
     free(ptr);
     nfree++;
   } else {
@@ -109,6 +219,269 @@ mem_free(void* ptr)
   }
 }
 
+/**************** mem_arena_new() ****************/
+/* see mem.h for description */
+mem_arena_t*
+mem_arena_new(const size_t blockSize)
+{
+  if (blockSize == 0) {
+    return NULL;
+  }
+  mem_arena_t* arena = mem_malloc(sizeof(mem_arena_t));
+  if (arena != NULL) {
+    arena->blocks = NULL;
+    arena->blockSize = blockSize;
+  }
+  return arena;
+}
+
+/**************** mem_arena_alloc() ****************/
+/* see mem.h for description */
+void*
+mem_arena_alloc(mem_arena_t* arena, const size_t size)
+{
+  if (arena == NULL) {
+    return NULL;
+  }
+
+  // keep every object aligned for any type
+  const size_t align = _Alignof(max_align_t);
+  size_t rounded = (size + align - 1) / align * align;
+  if (rounded == 0) {
+    rounded = align;
+  }
+
+  arenablock_t* block = arena->blocks;
+  if (block == NULL || block->size - block->used < rounded) {
+    size_t space = (rounded > arena->blockSize) ? rounded : arena->blockSize;
+    block = mem_malloc(sizeof(arenablock_t) + space);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->used = 0;
+    block->size = space;
+    if (space == arena->blockSize || arena->blocks == NULL) {
+      block->next = arena->blocks;
+      arena->blocks = block;
+    } else {
+      // an object of its own; keep filling the current block after it
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    }
+  }
+
+  void* ptr = (char*) block->space + block->used;
+  block->used += rounded;
+  return ptr;
+}
+
+/**************** mem_arena_calloc() ****************/
+/* see mem.h for description */
+void*
+mem_arena_calloc(mem_arena_t* arena, const size_t nmemb, const size_t size)
+{
+  if (size != 0 && nmemb > (size_t) -1 / size) {
+    return NULL;              // too big
+  }
+  void* ptr = mem_arena_alloc(arena, nmemb * size);
+  if (ptr != NULL) {
+    memset(ptr, 0, nmemb * size);
+  }
+  return ptr;
+}
+
+/**************** mem_arena_delete() ****************/
+/* see mem.h for description */
+void
+mem_arena_delete(mem_arena_t* arena)
+{
+  if (arena != NULL) {
+    while (arena->blocks != NULL) {
+      arenablock_t* next = arena->blocks->next;
+      mem_free(arena->blocks);
+      arena->blocks = next;
+    }
+    mem_free(arena);
+  }
+}
+
+/**************** mem_pool_new() ****************/
+/* see mem.h for description */
+mem_pool_t*
+mem_pool_new(mem_arena_t* arena, const size_t size)
+{
+  if (arena == NULL || size == 0) {
+    return NULL;
+  }
+  mem_pool_t* pool = mem_arena_alloc(arena, sizeof(mem_pool_t));
+  if (pool != NULL) {
+    pool->arena = arena;
+    // a freed object holds the free-list link
+    pool->size = (size < sizeof(void*)) ? sizeof(void*) : size;
+    pool->freed = NULL;
+  }
+  return pool;
+}
+
+/**************** mem_pool_alloc() ****************/
+/* see mem.h for description */
+void*
+mem_pool_alloc(mem_pool_t* pool)
+{
+  if (pool == NULL) {
+    return NULL;
+  }
+  if (pool->freed != NULL) {
+    void* ptr = pool->freed;
+    pool->freed = *(void**) ptr;
+    return ptr;
+  }
+  return mem_arena_alloc(pool->arena, pool->size);
+}
+
+/**************** mem_pool_free() ****************/
+/* see mem.h for description */
+void
+mem_pool_free(mem_pool_t* pool, void* ptr)
+{
+  if (pool != NULL && ptr != NULL) {
+    *(void**) ptr = pool->freed;
+    pool->freed = ptr;
+  }
+}
+
+/**************** mem_malloc_tagged() ****************/
+/* see mem.h for description */
+void*
+mem_malloc_tagged(const size_t size, const char* tag)
+{
+  void* ptr = mem_malloc(size);
+  memtag_t* counted = findTag(tag);
+  if (ptr != NULL && counted != NULL) {
+    atomic_fetch_add_explicit(&counted->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counted->bytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counted->liveBytes, size, memory_order_relaxed);
+    track(ptr, counted, size);
+  }
+  return ptr;
+}
+
+/**************** mem_calloc_tagged() ****************/
+/* see mem.h for description */
+void*
+mem_calloc_tagged(const size_t nmemb, const size_t size, const char* tag)
+{
+  if (size != 0 && nmemb > (size_t) -1 / size) {
+    return NULL;              // too big
+  }
+  void* ptr = mem_malloc_tagged(nmemb * size, tag);
+  if (ptr != NULL) {
+    memset(ptr, 0, nmemb * size);
+  }
+  return ptr;
+}
+
+/**************** mem_arena_alloc_tagged() ****************/
+/* see mem.h for description */
+void*
+mem_arena_alloc_tagged(mem_arena_t* arena, const size_t size, const char* tag)
+{
+  void* ptr = mem_arena_alloc(arena, size);
+  memtag_t* counted = findTag(tag);
+  if (ptr != NULL && counted != NULL) {
+    atomic_fetch_add_explicit(&counted->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counted->bytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counted->arenaBytes, size, memory_order_relaxed);
+  }
+  return ptr;
+}
+
+/**************** mem_arena_calloc_tagged() ****************/
+/* see mem.h for description */
+void*
+mem_arena_calloc_tagged(mem_arena_t* arena, const size_t nmemb,
+                        const size_t size, const char* tag)
+{
+  if (size != 0 && nmemb > (size_t) -1 / size) {
+    return NULL;              // too big
+  }
+  void* ptr = mem_arena_alloc_tagged(arena, nmemb * size, tag);
+  if (ptr != NULL) {
+    memset(ptr, 0, nmemb * size);
+  }
+  return ptr;
+}
+
+/**************** mem_profile_report() ****************/
+/* see mem.h for description */
+void
+mem_profile_report(FILE* fp, const char* message)
+{
+  if (fp == NULL) {
+    return;
+  }
+
+  // snapshot the tags, merging any whose strings are equal
+  static tagcount_t snap[MaxTags]; // too big for some threads' stacks
+  static pthread_mutex_t snapLock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_mutex_lock(&snapLock);
+  int nsnap = 0;
+  for (int t = 0; t < MaxTags; t++) {
+    const char* tag = atomic_load(&tags[t].tag);
+    if (tag == NULL) {
+      continue;
+    }
+    int s;
+    for (s = 0; s < nsnap && strcmp(snap[s].tag, tag) != 0; s++) {
+    }
+    if (s == nsnap) {
+      snap[s] = (tagcount_t) { .tag = tag };
+      nsnap++;
+    }
+    snap[s].allocs += atomic_load(&tags[t].allocs);
+    snap[s].frees += atomic_load(&tags[t].frees);
+    snap[s].bytes += atomic_load(&tags[t].bytes);
+    snap[s].liveBytes += atomic_load(&tags[t].liveBytes);
+    snap[s].arenaBytes += atomic_load(&tags[t].arenaBytes);
+  }
+
+  // busiest first: a simple insertion sort by bytes allocated
+  for (int i = 1; i < nsnap; i++) {
+    for (int j = i; j > 0 && snap[j].bytes > snap[j - 1].bytes; j--) {
+      tagcount_t tmp = snap[j];
+      snap[j] = snap[j - 1];
+      snap[j - 1] = tmp;
+    }
+  }
+
+  fprintf(fp, "%s: %d tags\n", message, nsnap);
+  fprintf(fp, "%10s %10s %12s %12s %12s  %s\n",
+          "allocs", "frees", "bytes", "live", "arena", "tag");
+  for (int s = 0; s < nsnap; s++) {
+    fprintf(fp, "%10ld %10ld %12ld %12ld %12ld  %s\n",
+            snap[s].allocs, snap[s].frees, snap[s].bytes,
+            snap[s].liveBytes, snap[s].arenaBytes, snap[s].tag);
+  }
+  if (atomic_load(&tagsFull) > 0) {
+    fprintf(fp, "(%ld allocations not counted: more than %d tags)\n",
+            (long) atomic_load(&tagsFull), MaxTags);
+  }
+  pthread_mutex_unlock(&snapLock);
+}
+
+/**************** mem_profile_signal() ****************/
+/* see mem.h for description */
+bool
+mem_profile_signal(const int signum)
+{
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = dumpProfile;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  return sigaction(signum, &action, NULL) == 0;
+}
+
 /**************** mem_report() ****************/
 /* see mem.h for description */
 void 
@@ -125,3 +498,444 @@ mem_net(void)
 {
   return nmalloc - nfree - nfreenull;
 }
+
+/**************** findTag() ****************/
+/* Return the counters for tag, claiming an unused entry for it if it
+ * has none; NULL if tag is NULL, or the table is full.
+ */
+static memtag_t*
+findTag(const char* tag)
+{
+  if (tag == NULL) {
+    return NULL;
+  }
+  uint64_t h = (uintptr_t) tag * 0x9e3779b97f4a7c15ull;
+  for (int i = 0; i < MaxTags; i++) {
+    memtag_t* entry = &tags[(h >> 32) % MaxTags];
+    const char* theirs = atomic_load_explicit(&entry->tag, memory_order_acquire);
+    if (theirs == NULL) {
+      // claim it, unless another thread claimed it first (maybe for us)
+      if (atomic_compare_exchange_strong(&entry->tag, &theirs, tag)) {
+        return entry;
+      }
+    }
+    if (theirs == tag) {
+      return entry;
+    }
+    h += 1ull << 32;
+  }
+  atomic_fetch_add_explicit(&tagsFull, 1, memory_order_relaxed);
+  return NULL;
+}
+
+/**************** track() ****************/
+/* Remember a live tagged allocation, so mem_free can charge it back.
+ * If out of memory, it is simply never charged back.
+ */
+static void
+track(void* ptr, memtag_t* tag, const size_t size)
+{
+  size_t hash;
+  memshard_t* shard = shardOf(ptr, &hash);
+  pthread_mutex_lock(&shard->lock);
+
+  // keep the shard's table at most 3/4 full
+  if (shard->slots == NULL || (shard->count + 1) * 4 > (shard->mask + 1) * 3) {
+    size_t nslots = (shard->slots == NULL) ? 64 : 2 * (shard->mask + 1);
+    memlive_t* slots = calloc(nslots, sizeof(memlive_t));
+    if (slots == NULL) {
+      pthread_mutex_unlock(&shard->lock);
+      return;
+    }
+    for (size_t s = 0; shard->slots != NULL && s <= shard->mask; s++) {
+      if (shard->slots[s].ptr != NULL) {
+        size_t h;
+        shardOf(shard->slots[s].ptr, &h);
+        size_t t = h & (nslots - 1);
+        while (slots[t].ptr != NULL) {
+          t = (t + 1) & (nslots - 1);
+        }
+        slots[t] = shard->slots[s];
+      }
+    }
+    free(shard->slots);
+    shard->slots = slots;
+    shard->mask = nslots - 1;
+  }
+
+  size_t s = hash & shard->mask;
+  while (shard->slots[s].ptr != NULL) {
+    s = (s + 1) & shard->mask;
+  }
+  shard->slots[s] = (memlive_t) { .ptr = ptr, .tag = tag, .size = size };
+  shard->count++;
+  atomic_fetch_add_explicit(&ntracked, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/**************** untrack() ****************/
+/* Forget a tagged allocation being freed; return its tag, and its size
+ * in *size, or NULL if ptr was not a tracked allocation.
+ */
+static memtag_t*
+untrack(void* ptr, size_t* size)
+{
+  size_t hash;
+  memshard_t* shard = shardOf(ptr, &hash);
+  pthread_mutex_lock(&shard->lock);
+  if (shard->slots == NULL) {
+    pthread_mutex_unlock(&shard->lock);
+    return NULL;
+  }
+
+  size_t s = hash & shard->mask;
+  while (shard->slots[s].ptr != ptr) {
+    if (shard->slots[s].ptr == NULL) {
+      pthread_mutex_unlock(&shard->lock);
+      return NULL;
+    }
+    s = (s + 1) & shard->mask;
+  }
+  memtag_t* tag = shard->slots[s].tag;
+  *size = shard->slots[s].size;
+
+  // close the gap: move back any later entry that the gap would
+  // otherwise hide from its home slot
+  size_t gap = s;
+  for (size_t next = (s + 1) & shard->mask; shard->slots[next].ptr != NULL;
+       next = (next + 1) & shard->mask) {
+    size_t h;
+    shardOf(shard->slots[next].ptr, &h);
+    size_t home = h & shard->mask;
+    if (((next - home) & shard->mask) >= ((next - gap) & shard->mask)) {
+      shard->slots[gap] = shard->slots[next];
+      gap = next;
+    }
+  }
+  shard->slots[gap].ptr = NULL;
+  shard->count--;
+  atomic_fetch_sub_explicit(&ntracked, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&shard->lock);
+  return tag;
+}
+
+/**************** initShards() ****************/
+/* Initialize the shards' locks, once.
+ */
+static void
+initShards(void)
+{
+  for (int i = 0; i < LiveShards; i++) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+  }
+}
+
+/**************** shardOf() ****************/
+/* Return the shard for an address, and set *hash to the address's hash;
+ * its low bits place it within the shard, its high bits pick the shard.
+ */
+static memshard_t*
+shardOf(const void* ptr, size_t* hash)
+{
+  pthread_once(&shardsOnce, initShards);
+  uint64_t h = (uintptr_t) ptr;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  *hash = (size_t) h;
+  return &shards[(h >> 58) % LiveShards];
+}
+
+/**************** dumpProfile() ****************/
+/* Signal handler: write each tag's counters to stderr.  Only write(2)
+ * is safe here, so numbers are formatted by hand.
+ */
+static void
+dumpProfile(int signum)
+{
+  char line[512];
+  const char heading[] = "mem profile: allocs frees bytes live arena tag\n";
+  if (write(STDERR_FILENO, heading, sizeof(heading) - 1) < 0) {
+    return;
+  }
+  for (int t = 0; t < MaxTags; t++) {
+    const char* tag = atomic_load(&tags[t].tag);
+    if (tag == NULL) {
+      continue;
+    }
+    long counts[] = { atomic_load(&tags[t].allocs), atomic_load(&tags[t].frees),
+                      atomic_load(&tags[t].bytes), atomic_load(&tags[t].liveBytes),
+                      atomic_load(&tags[t].arenaBytes) };
+    size_t len = 0;
+    for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+      char digits[24];
+      int n = 0;
+      long v = counts[c];
+      if (v < 0) {
+        line[len++] = '-';
+        v = -v;
+      }
+      do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+      } while (v > 0);
+      while (n > 0) {
+        line[len++] = digits[--n];
+      }
+      line[len++] = ' ';
+    }
+    for (const char* c = tag; *c != '\0' && len < sizeof(line) - 1; c++) {
+      line[len++] = *c;
+    }
+    line[len++] = '\n';
+    if (write(STDERR_FILENO, line, len) < 0) {
+      return;
+    }
+  }
+}
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test checks arenas and pools.  Every object an arena hands
+ * out must be aligned for any type and must not overlap another, however
+ * odd its size; the arena must grow block by block, counting one malloc
+ * per block; an object too big for a block must get one of its own
+ * without cutting short the block being filled; and deleting the arena
+ * must free every block.  A pool must hand back the objects freed to it,
+ * most recent first, before it takes more space from its arena.
+ *
+ * Built with -DMEMPROFILE as well, it then checks the profiler: it makes
+ * tagged allocations whose counts it knows, prints the profile report,
+ * and checks each tag's line in it, including a tag whose string is
+ * shared by two copies, and the dump on a signal.
+ *
+ * Build and run with
+ *   make memtest && ./memtest
+ *   make memprofiletest && ./memprofiletest
+ * Each prints what it checks, and exits non-zero if any check fails.
+ */
+
+#ifdef UNIT_TEST
+
+static const size_t BlockSize = 256;     // small, so the arena grows
+static const int Objects = 200;          // objects of sizes 1..Objects
+
+static int failures;                     // checks failed
+
+static int countBlocks(mem_arena_t* arena);
+#ifdef MEMPROFILE
+static void checkProfile(void);
+static bool reported(FILE* fp, const char* tag, const long expect[5]);
+#endif
+static void check(const bool ok, const char* what);
+
+int
+main(void)
+{
+  const size_t align = _Alignof(max_align_t);
+  const int net = mem_net();
+  check(mem_arena_new(0) == NULL, "an arena needs a positive block size");
+  mem_arena_t* arena = mem_arena_new(BlockSize);
+  check(arena != NULL, "mem_arena_new");
+  check(mem_arena_alloc(NULL, 8) == NULL, "alloc from a NULL arena is NULL");
+
+  // objects of many sizes, each filled with its own byte
+  unsigned char* objects[Objects + 1];
+  bool aligned = true;
+  for (int size = 1; size <= Objects; size++) {
+    objects[size] = mem_arena_alloc(arena, size);
+    aligned = aligned && objects[size] != NULL
+              && (uintptr_t) objects[size] % align == 0;
+    memset(objects[size], size, size);
+  }
+  check(aligned, "every arena object is aligned for any type");
+  bool intact = true;
+  for (int size = 1; size <= Objects; size++) {
+    for (int b = 0; b < size; b++) {
+      intact = intact && objects[size][b] == (unsigned char) size;
+    }
+  }
+  check(intact, "no arena object overlaps another");
+  int blocks = countBlocks(arena);
+  check(blocks > 1, "the arena grows into more blocks");
+  check(mem_net() - net == blocks + 1, "the arena counts one malloc per block");
+  check((uintptr_t) mem_arena_alloc(arena, 0) % align == 0,
+        "a zero-size object is aligned, too");
+
+  // a big object gets a block of its own, behind the current one
+  arenablock_t* current = arena->blocks;
+  size_t used = current->used;
+  void* big = mem_arena_alloc(arena, 4 * BlockSize);
+  check(big != NULL && arena->blocks == current && current->used == used
+        && arena->blocks->next->size == 4 * BlockSize,
+        "a big object gets its own block, and the current block is kept");
+  void* small = mem_arena_alloc(arena, 1);
+  check(small == (char*) current->space + used,
+        "the next small object comes from the current block");
+
+  // calloc
+  size_t* zeroed = mem_arena_calloc(arena, 50, sizeof(size_t));
+  bool zero = (zeroed != NULL);
+  for (int i = 0; zero && i < 50; i++) {
+    zero = zeroed[i] == 0;
+  }
+  check(zero, "mem_arena_calloc zeroes its object");
+  check(mem_arena_calloc(arena, (size_t) -1, 16) == NULL,
+        "mem_arena_calloc refuses a size that overflows");
+
+  // a pool reuses freed objects, most recent first
+  check(mem_pool_new(NULL, 8) == NULL && mem_pool_new(arena, 0) == NULL,
+        "mem_pool_new refuses bad parameters");
+  mem_pool_t* pool = mem_pool_new(arena, 40);
+  void* a = mem_pool_alloc(pool);
+  void* b = mem_pool_alloc(pool);
+  void* c = mem_pool_alloc(pool);
+  check(a != NULL && b != NULL && c != NULL && a != b && b != c && a != c
+        && (uintptr_t) a % align == 0 && (uintptr_t) b % align == 0,
+        "a pool hands out distinct, aligned objects");
+  mem_pool_free(pool, a);
+  mem_pool_free(pool, b);
+  check(mem_pool_alloc(pool) == b && mem_pool_alloc(pool) == a,
+        "a pool reuses its freed objects, most recent first");
+  void* d = mem_pool_alloc(pool);
+  check(d != a && d != b && d != c, "with none freed, a pool takes a new object");
+  mem_pool_free(pool, d);
+  int before = mem_net();
+  for (int i = 0; i < 10000; i++) {
+    void* e = mem_pool_alloc(pool);
+    mem_pool_free(pool, e);
+  }
+  check(mem_net() == before && mem_pool_alloc(pool) == d,
+        "allocating and freeing over and over needs no new space");
+  mem_pool_t* tiny = mem_pool_new(arena, 1);
+  void* t1 = mem_pool_alloc(tiny);
+  void* t2 = mem_pool_alloc(tiny);
+  mem_pool_free(tiny, t1);
+  mem_pool_free(tiny, t2);
+  check(mem_pool_alloc(tiny) == t2 && mem_pool_alloc(tiny) == t1,
+        "a pool of objects smaller than a pointer still keeps its free list");
+  mem_pool_free(NULL, a);
+  mem_pool_free(pool, NULL);
+  check(mem_pool_alloc(NULL) == NULL, "a NULL pool gives NULL");
+
+  mem_arena_delete(arena);
+  check(mem_net() == net, "deleting the arena frees every block");
+
+#ifdef MEMPROFILE
+  checkProfile();
+#endif
+
+  printf("%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/* Return the number of blocks in the arena. */
+static int
+countBlocks(mem_arena_t* arena)
+{
+  int n = 0;
+  for (arenablock_t* block = arena->blocks; block != NULL; block = block->next) {
+    n++;
+  }
+  return n;
+}
+
+#ifdef MEMPROFILE
+/* Make tagged allocations with known counts, print the report, and
+ * check that it shows those counts.
+ */
+static void
+checkProfile(void)
+{
+  static const char heap[] = "unit test: heap";
+  static const char heapCopy[] = "unit test: heap";  // same string, elsewhere
+  static const char arenaTag[] = "unit test: arena";
+  const char* site = MEM_SITE;
+
+  void* p1 = mem_malloc_tagged(100, heap);
+  void* p2 = mem_malloc_tagged(100, heap);
+  void* p3 = mem_calloc_tagged(4, 25, heap);
+  void* p4 = mem_malloc_tagged(50, heapCopy);
+  mem_free(p2);
+  mem_free(p4);
+  void* untagged = mem_malloc(1000);
+  mem_free(untagged);                    // counts against no tag
+
+  mem_arena_t* arena = mem_arena_new(BlockSize);
+  mem_arena_alloc_tagged(arena, 64, arenaTag);
+  mem_arena_calloc_tagged(arena, 2, 32, arenaTag);
+  void* p5 = mem_malloc_tagged(10, site);
+
+  FILE* fp = tmpfile();
+  if (fp == NULL) {
+    perror("tmpfile");
+    exit(2);
+  }
+  mem_profile_report(stdout, "profile");
+  mem_profile_report(fp, "profile");
+
+  // allocs, frees, bytes, live, arena
+  const long heapCounts[] = { 4, 2, 350, 200, 0 };
+  const long arenaCounts[] = { 2, 0, 128, 0, 128 };
+  const long siteCounts[] = { 1, 0, 10, 10, 0 };
+  check(reported(fp, heap, heapCounts),
+        "the report counts a tag's allocations and frees, both copies together");
+  check(reported(fp, arenaTag, arenaCounts),
+        "the report counts arena bytes apart from live bytes");
+  check(reported(fp, site, siteCounts), "the report counts a call site");
+
+  // busiest first
+  char line[200];
+  rewind(fp);
+  check(fgets(line, sizeof(line), fp) != NULL && fgets(line, sizeof(line), fp) != NULL
+        && fgets(line, sizeof(line), fp) != NULL && strstr(line, heap) != NULL,
+        "the busiest tag is reported first");
+  fclose(fp);
+
+  check(mem_profile_signal(SIGUSR1), "mem_profile_signal installs its handler");
+  fflush(stdout);
+  raise(SIGUSR1);                        // dumps the counts to stderr
+
+  mem_free(p1);
+  mem_free(p3);
+  mem_free(p5);
+  mem_arena_delete(arena);
+  long freedCounts[] = { 4, 4, 350, 0, 0 };
+  fp = tmpfile();
+  mem_profile_report(fp, "profile");
+  check(reported(fp, heap, freedCounts), "freeing the rest leaves nothing live");
+  fclose(fp);
+}
+
+/* Return true if the report in fp has a line for tag with the expected
+ * allocs, frees, bytes, live, and arena counts.
+ */
+static bool
+reported(FILE* fp, const char* tag, const long expect[5])
+{
+  char line[200];
+  rewind(fp);
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    long n[5];
+    int end = 0;
+    if (sscanf(line, "%ld %ld %ld %ld %ld %n", &n[0], &n[1], &n[2], &n[3], &n[4],
+               &end) == 5 && strncmp(line + end, tag, strlen(tag)) == 0
+        && line[end + strlen(tag)] == '\n') {
+      return memcmp(n, expect, sizeof(n)) == 0;
+    }
+  }
+  return false;
+}
+#endif // MEMPROFILE
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
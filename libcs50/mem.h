@@ -14,6 +14,17 @@
  *    that needs to defensively check function parameters that
  *    "should never be NULL".
  *
+ * 4. Arenas, from which many objects are allocated cheaply and then
+ *    freed all at once, and pools of same-sized objects, drawn from
+ *    an arena, that recycle freed objects through a free list.
+ *
+ * 5. An allocation profiler.  Compiled with -DMEMPROFILE, each call to
+ *    mem_malloc, mem_calloc, mem_arena_alloc and mem_arena_calloc, and
+ *    their _assert forms, is counted against its call site ("file.c:line",
+ *    or the _assert message), with the bytes it asked for and how many
+ *    of them are still live.  Callers may also name a tag of their own
+ *    with mem_malloc_tagged.  See mem_profile_report.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
@@ -22,6 +33,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 /**************** mem_assert **************************/
 /* If pointer p is NULL, print error message to stderr and die,
@@ -113,4 +125,139 @@ void mem_report(FILE* fp, const char* message);
  */
 int mem_net(void);
 
+/**************** arenas and pools ****************/
+typedef struct mem_arena mem_arena_t;  // opaque to users of the module
+typedef struct mem_pool mem_pool_t;    // opaque to users of the module
+
+/**************** mem_arena_new() ****************/
+/* Create a new, empty arena.
+ * Caller provides:
+ *   the size of the blocks the arena allocates its space in (> 0);
+ *   a larger request gets a block of its own.
+ * We return:
+ *   pointer to the new arena, or NULL if failure.
+ * Caller is responsible for:
+ *   later calling mem_arena_delete.
+ * Notes:
+ *   An arena is not safe to share between threads without a lock.
+ */
+mem_arena_t* mem_arena_new(const size_t blockSize);
+
+/**************** mem_arena_alloc() ****************/
+/* Like malloc(), but from the arena; the space is suitably aligned for
+ * any object, and is freed only when the whole arena is.
+ * We return:
+ *   pointer to allocated space, or NULL if arena is NULL, or failure.
+ * We track only the calls that allocate a new block - see mem_net().
+ */
+void* mem_arena_alloc(mem_arena_t* arena, const size_t size);
+
+/**************** mem_arena_calloc() ****************/
+/* Like calloc(), but from the arena; see mem_arena_alloc.
+ */
+void* mem_arena_calloc(mem_arena_t* arena, const size_t nmemb, const size_t size);
+
+/**************** mem_arena_delete() ****************/
+/* Free everything allocated from the arena, and the arena itself,
+ * with one free per block rather than one per object.
+ * We ignore a NULL arena.
+ */
+void mem_arena_delete(mem_arena_t* arena);
+
+/**************** mem_pool_new() ****************/
+/* Create a pool of objects of one size, drawn from the given arena.
+ * Caller provides:
+ *   a valid arena, and the size of each object (> 0).
+ * We return:
+ *   pointer to the new pool, or NULL if failure.
+ * Notes:
+ *   The pool lives in the arena, and is freed with it.
+ */
+mem_pool_t* mem_pool_new(mem_arena_t* arena, const size_t size);
+
+/**************** mem_pool_alloc() ****************/
+/* Return an object from the pool: the one most recently freed to it,
+ * if any, or else a new one from its arena.
+ * We return:
+ *   pointer to an object, or NULL if pool is NULL, or failure.
+ */
+void* mem_pool_alloc(mem_pool_t* pool);
+
+/**************** mem_pool_free() ****************/
+/* Return an object to the pool it came from, for reuse.
+ * We ignore a NULL pool or object.
+ */
+void mem_pool_free(mem_pool_t* pool, void* ptr);
+
+/**************** mem_malloc_tagged() ****************/
+/* Like mem_malloc(), but count the allocation against the given tag,
+ * until it is passed to mem_free.
+ * We assume:
+ *   caller provides a tag string that lives as long as the program,
+ *   such as a string literal; equal tags are counted together.
+ * We return:
+ *   pointer to allocated space, or NULL if failure.
+ */
+void* mem_malloc_tagged(const size_t size, const char* tag);
+
+/**************** mem_calloc_tagged() ****************/
+/* Like mem_calloc(), but count the allocation against the given tag;
+ * see mem_malloc_tagged.
+ */
+void* mem_calloc_tagged(const size_t nmemb, const size_t size, const char* tag);
+
+/**************** mem_arena_alloc_tagged() ****************/
+/* Like mem_arena_alloc(), but count the allocation against the given
+ * tag.  Arena space is freed only with its arena, so it never counts
+ * as freed; the report shows it under 'arena' rather than 'live'.
+ */
+void* mem_arena_alloc_tagged(mem_arena_t* arena, const size_t size,
+                             const char* tag);
+
+/**************** mem_arena_calloc_tagged() ****************/
+/* Like mem_arena_calloc(), counted; see mem_arena_alloc_tagged.
+ */
+void* mem_arena_calloc_tagged(mem_arena_t* arena, const size_t nmemb,
+                              const size_t size, const char* tag);
+
+/**************** mem_profile_report() ****************/
+/* Print the allocation profile: one line per tag, busiest first, with
+ * the number of allocations and frees, the bytes allocated, the bytes
+ * still live, and the bytes allocated from arenas.
+ * We assume:
+ *   caller provides a FILE open for writing, and a message to head it.
+ * Notes:
+ *   Counters are updated atomically, so the report may be taken while
+ *   other threads allocate; it is then a consistent-enough snapshot.
+ */
+void mem_profile_report(FILE* fp, const char* message);
+
+/**************** mem_profile_signal() ****************/
+/* Dump the allocation profile to stderr whenever the process receives
+ * the given signal (such as SIGUSR1), as by 'kill -USR1 pid'.
+ * We return:
+ *   true if the handler was installed.
+ * Notes:
+ *   The dump is written from the signal handler itself, with write(2),
+ *   so it is unsorted, and tags sharing a string appear once per copy.
+ */
+bool mem_profile_signal(const int signum);
+
+#ifdef MEMPROFILE
+// count every allocation against its call site
+#define MEM_STRING(x) #x
+#define MEM_SITE2(file, line) file ":" MEM_STRING(line)
+#define MEM_SITE MEM_SITE2(__FILE__, __LINE__)
+#define mem_malloc(size) mem_malloc_tagged((size), MEM_SITE)
+#define mem_calloc(nmemb, size) mem_calloc_tagged((nmemb), (size), MEM_SITE)
+#define mem_malloc_assert(size, message) \
+  mem_assert(mem_malloc_tagged((size), (message)), (message))
+#define mem_calloc_assert(nmemb, size, message) \
+  mem_assert(mem_calloc_tagged((nmemb), (size), (message)), (message))
+#define mem_arena_alloc(arena, size) \
+  mem_arena_alloc_tagged((arena), (size), MEM_SITE)
+#define mem_arena_calloc(arena, nmemb, size) \
+  mem_arena_calloc_tagged((arena), (nmemb), (size), MEM_SITE)
+#endif
+
 #endif // __MEM_H
@@ -26,6 +26,7 @@ typedef struct setnode {
 /**************** global types ****************/
 typedef struct set {
   struct setnode *head;       // head of the set
+  bool interned;              // keys are interned strings, compared by address
 } set_t;
 
 /**************** global functions ****************/
@@ -34,7 +35,7 @@ typedef struct set {
 
 /**************** local functions ****************/
 /* not visible outside this file */
-static setnode_t* setnode_new(const char* key, void* item);
+static setnode_t* setnode_new(const char* key, void* item, const bool interned);
 
 /**************** set_new() ****************/
 /* see set.h for description */
@@ -48,10 +49,23 @@ set_new(void)
   } else {
     // initialize contents of set structure
     set->head = NULL;
+    set->interned = false;
     return set;
   }
 }
 
+/**************** set_newInterned() ****************/
+/* see set.h for description */
+set_t*
+set_newInterned(void)
+{
+  set_t* set = set_new();
+  if (set != NULL) {
+    set->interned = true;
+  }
+  return set;
+}
+
 /**************** set_insert() ****************/
 /* see set.h for description */
 bool
@@ -65,7 +79,7 @@ set_insert(set_t* set, const char* key, void* item)
 
   // insert new node at the head of set if it's a new key
   if (set_find(set, key) == NULL) {
-    setnode_t* new = setnode_new(key, item);
+    setnode_t* new = setnode_new(key, item, set->interned);
     if (new != NULL) {
       new->next = set->head;
       set->head = new;
@@ -82,11 +96,12 @@ set_insert(set_t* set, const char* key, void* item)
 
 /**************** setnode_new ****************/
 /* see set.h for description */
-/* Allocate and initialize a setnode.
+/* Allocate and initialize a setnode, with a copy of key unless the
+ * key is interned.
  * Returns NULL on error, or key is NULL, or item is NULL.
  */
 static setnode_t*  // not visible outside this file
-setnode_new(const char* key, void* item)
+setnode_new(const char* key, void* item, const bool interned)
 {
   if (key == NULL || item == NULL) {
     return NULL;
@@ -98,6 +113,13 @@ setnode_new(const char* key, void* item)
     return NULL;
   }
 
+  if (interned) {
+    node->key = (char*) key;
+    node->item = item;
+    node->next = NULL;
+    return node;
+  }
+
   node->key = mem_malloc(strlen(key)+1);
   if (node->key == NULL) {
     // error allocating memory for key; 
@@ -120,9 +142,9 @@ set_find(set_t* set, const char* key)
   if (set == NULL || key == NULL) {
     return NULL;              // bad set or bad key
   } else {
-    // scan the set
+    // scan the set; interned keys are equal only if they are the same
     for (setnode_t* node = set->head; node != NULL; node = node->next) {
-      if (strcmp(key, node->key) == 0) {
+      if (key == node->key || (!set->interned && strcmp(key, node->key) == 0)) {
         return node->item;    // found!  return the node's item
       }
     }
@@ -183,7 +205,9 @@ set_delete(set_t* set, void (*itemdelete)(void* item) )
         (*itemdelete)(node->item);   // delete node's item
       }
       setnode_t* next = node->next;  // remember what's next
-      mem_free(node->key);           // delete current node's key
+      if (!set->interned) {
+        mem_free(node->key);         // delete current node's key
+      }
       mem_free(node);                // delete current node
       node = next;                   // move on to next
     }
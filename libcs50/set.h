@@ -34,6 +34,21 @@ typedef struct set set_t;  // opaque to users of the module
  */
 set_t* set_new(void);
 
+/**************** set_newInterned ****************/
+/* Create a new (empty) set whose keys are interned strings.
+ *
+ * We return:
+ *   pointer to a new set, or NULL if error.
+ * Caller is responsible for:
+ *   passing only keys returned by intern_string (see intern.h), from
+ *   pools that outlive the set; later calling set_delete.
+ * Notes:
+ *   The set keeps the key pointers themselves, without copying them,
+ *   and compares keys by address; looking up a string that is not
+ *   interned finds nothing.  set_delete does not free the keys.
+ */
+set_t* set_newInterned(void);
+
 /**************** set_insert ****************/
 /* Insert item, identified by a key (string), into the given set.
  *
@@ -0,0 +1,105 @@
+/*
+ * vector.h - typed growable arrays, generated by macro, for CS50
+ *
+ * A typed stand-in for the bag module: DEFINE_VECTOR generates an
+ * array of one element type that doubles as it fills, as static inline
+ * functions in the including file; elements are stored in the array
+ * itself, and iteration is a plain loop.
+ *
+ *   DEFINE_VECTOR(name, T)
+ *
+ * defines the type name_t and the functions below.  For example,
+ *
+ *   DEFINE_VECTOR(playervec, player_t*)
+ *
+ *   playervec_t players;
+ *   playervec_init(&players, 4);
+ *   playervec_push(&players, player);
+ *   VECTOR_FOREACH(playervec, &players, p) {
+ *     ... *p ...
+ *   }
+ *   playervec_free(&players);
+ *
+ * Functions generated (all static inline):
+ *   bool name_init(name_t* vec, int count);
+ *       make an empty vector with room for count elements; false if error.
+ *   bool name_push(name_t* vec, T item);
+ *       append item; false if out of memory.
+ *   void name_removeAt(name_t* vec, int i);
+ *       remove element i, moving the last element into its place.
+ *   int name_count(name_t* vec);
+ *       number of elements.
+ *   void name_free(name_t* vec);
+ *       free the vector's memory (but not what its elements point to).
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#ifndef __VECTOR_H
+#define __VECTOR_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* Loop over every element of a vector, in order; 'item' is a T*
+ * declared by the loop.  Do not push or remove while looping.
+ */
+#define VECTOR_FOREACH(name, vec, item)                                      \
+  for (name##_item_t* item = (vec)->items;                                   \
+       item < (vec)->items + (vec)->count; item++)
+
+#define DEFINE_VECTOR(name, T)                                               \
+                                                                             \
+typedef T name##_item_t;                                                     \
+                                                                             \
+typedef struct name {                                                        \
+  T* items;                       /* capacity items, 'count' in use */       \
+  int count;                                                                 \
+  int capacity;                                                              \
+} name##_t;                                                                  \
+                                                                             \
+static inline bool                                                           \
+name##_init(name##_t* vec, int count)                                        \
+{                                                                            \
+  vec->count = 0;                                                            \
+  vec->capacity = count > 0 ? count : 1;                                     \
+  vec->items = malloc(vec->capacity * sizeof(T));                            \
+  return vec->items != NULL;                                                 \
+}                                                                            \
+                                                                             \
+static inline bool                                                           \
+name##_push(name##_t* vec, T item)                                           \
+{                                                                            \
+  if (vec->count == vec->capacity) {                                         \
+    T* items = realloc(vec->items, 2 * vec->capacity * sizeof(T));           \
+    if (items == NULL) {                                                     \
+      return false;                                                          \
+    }                                                                        \
+    vec->items = items;                                                      \
+    vec->capacity *= 2;                                                      \
+  }                                                                          \
+  vec->items[vec->count++] = item;                                           \
+  return true;                                                               \
+}                                                                            \
+                                                                             \
+static inline void                                                           \
+name##_removeAt(name##_t* vec, int i)                                        \
+{                                                                            \
+  vec->items[i] = vec->items[--vec->count];                                  \
+}                                                                            \
+                                                                             \
+static inline int                                                            \
+name##_count(name##_t* vec)                                                  \
+{                                                                            \
+  return vec->count;                                                         \
+}                                                                            \
+                                                                             \
+static inline void                                                           \
+name##_free(name##_t* vec)                                                   \
+{                                                                            \
+  free(vec->items);                                                          \
+  vec->items = NULL;                                                         \
+  vec->count = vec->capacity = 0;                                            \
+}
+
+#endif // __VECTOR_H
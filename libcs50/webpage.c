@@ -20,9 +20,19 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <netdb.h>
-#include "file.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
 #include "webpage.h"
+#include "hashmap.h"
+#include "hash.h"
 #include "mem.h"
 
 /* ***************************************** */
@@ -46,11 +56,117 @@ typedef struct webpage {
   int depth;                               // depth of crawl
 } webpage_t;
 
+/* response_t: an HTTP response as it comes in.  On a connection that
+ * carries several requests at once (pipelined), the buffer may also
+ * hold the start of the next response.  A chunked body is decoded in
+ * place as its chunks arrive, into the bytes from bodyStart on, which
+ * the chunk-size lines leave free.
+ */
+typedef struct response {
+  char* buf;                               // bytes received, null-terminated
+  size_t len;                              // bytes of buf in use
+  size_t size;                             // bytes allocated for buf
+  size_t bodyStart;                        // start of body; 0 until known
+  size_t bodyLen;                          // bytes of body (so far, if chunked)
+  size_t end;                              // end of response; 0 until known
+  size_t chunkPos;                         // start of the next chunk-size line
+  long contentLength;                      // from Content-Length, or -1
+  int code;                                // the status code
+  bool chunked;                            // Transfer-Encoding: chunked?
+  bool trailer;                            // past the last chunk?
+  bool keepAlive;                          // may the connection carry more?
+} response_t;
+
+/* Types for webpage_fetchBatch.  Each page to fetch is a fetch_t, which
+ * waits in its host's queue until one of the host's connections (at
+ * most perHost of them) has room in its pipeline.  A connection sends
+ * its requests without waiting for the responses, which come back in
+ * the same order.  Its deadline is reset whenever a response is
+ * complete, so every request gets the same time once it is next to be
+ * answered, and the batch's in-flight list, kept in the order of those
+ * resets, is also in order of deadline.
+ */
+typedef struct fetch {
+  webpage_t* page;                         // the page to fill in
+  char* request;                           // the HTTP request
+  size_t requestLen;                       // length of request
+  int tries;                               // failed tries so far
+  struct fetch* next;                      // next in host queue or pipeline
+} fetch_t;
+
+typedef struct fetchconn {
+  struct fetchhost* host;                  // the host it is to
+  int fd;                                  // its socket
+  bool connecting;                         // not yet connected?
+  bool writing;                            // watching for room to send?
+  bool reused;                             // taken from the idle pool?
+  bool closing;                            // will the server close it?
+  fetch_t* first;                          // the request next answered
+  fetch_t* last;                           // the last request in the pipeline
+  fetch_t* sending;                        // the first not wholly sent
+  size_t sent;                             // bytes of that one sent
+  int pipelined;                           // requests in the pipeline
+  int answered;                            // responses read from it
+  response_t response;                     // the response coming in
+  long deadline;                           // when it times out, in ms
+  struct fetchconn* next;                  // next in flight
+  struct fetchconn* prev;                  // previous in flight
+} fetchconn_t;
+
+typedef struct fetchhost {
+  const char* key;                         // "hostname:port"
+  bool found;                              // did the hostname resolve?
+  struct sockaddr_storage addr;            // its address, if found
+  socklen_t addrLen;                       // length of addr
+  int conns;                               // connections open to it now
+  fetch_t* queue;                          // fetches waiting for it
+  fetch_t* queueTail;                      // the last of them
+  int queued;                              // how many are waiting
+} fetchhost_t;
+
+typedef struct fetchbatch {
+  int epfd;                                // epoll instance for the sockets
+  int perHost;                             // most connections per host
+  int timeoutMs;                           // time allowed each request
+  mem_pool_t* conns;                       // where connections come from
+  fetchconn_t* first;                      // in flight, soonest deadline
+  fetchconn_t* last;                       // in flight, latest deadline
+  int fetched;                             // pages fetched so far
+} fetchbatch_t;
+
+/* Connections kept alive are pooled, up to MaxIdle of them, under keys
+ * of up to IdleKeyBytes.
+ */
+#define MaxIdle 16
+#define IdleKeyBytes 256
+
+/* idleconn_t: a connection kept alive after its last response, for
+ * webpage_fetch or webpage_fetchBatch to reuse; key is "hostname:port".
+ */
+typedef struct idleconn {
+  char key[IdleKeyBytes];                  // the host it is to
+  int fd;                                  // its socket
+  long since;                              // when it went idle, in ms
+} idleconn_t;
+
+static inline uint32_t
+stringHash(const char* str)
+{
+  return (uint32_t) hash_jenkins(str, ULONG_MAX);
+}
+
+static inline bool
+stringEq(const char* a, const char* b)
+{
+  return strcmp(a, b) == 0;
+}
+
+DEFINE_HASHMAP(hostmap, const char*, fetchhost_t*, stringHash, stringEq)
+
 /* *********************************************************************** */
 /* Private function prototypes */
 
-static FILE* connectToHost(const char* hostname, const int port);
-static inline bool isBlankLine(const char* line);
+static int connectToHost(const char* hostname, const int port);
 static char* removeDotSegments(char* input);
 static void removeWhitespace(char* str);
 static char* fixRelativeURL(char* base, char* rel, size_t len);
@@ -58,6 +174,36 @@ static bool parseURL(const char* str, struct URL* url);
 static void freeURL(struct URL url);
 static bool burstURL(const char* url, char** hostname, 
                      int* port, char** pathname);
+static fetchhost_t* findHost(hostmap_t* hosts, mem_arena_t* arena,
+                             const char* hostname, const int port);
+static void enqueueFetch(fetchhost_t* host, fetch_t* fetch);
+static void startConns(fetchbatch_t* batch, fetchhost_t* host);
+static bool openConn(fetchbatch_t* batch, fetchhost_t* host);
+static bool fillConn(fetchconn_t* conn);
+static void advanceConn(fetchbatch_t* batch, fetchconn_t* conn);
+static int dropPenalty(const fetchconn_t* conn);
+static void deliver(fetchbatch_t* batch, fetchconn_t* conn);
+static void endConn(fetchbatch_t* batch, fetchconn_t* conn, const int penalty);
+static void closeConn(fetchbatch_t* batch, fetchconn_t* conn, const bool keep);
+static void touchConn(fetchbatch_t* batch, fetchconn_t* conn);
+static bool watchConn(fetchbatch_t* batch, fetchconn_t* conn, const bool writing);
+static bool exchange(const int sock, const char* request, const size_t length,
+                     response_t* response);
+static void initResponse(response_t* response);
+static void freeResponse(response_t* response);
+static bool growResponse(response_t* response);
+static int frameResponse(response_t* response, const bool eof);
+static bool parseHeader(response_t* response);
+static int frameChunks(response_t* response, const bool eof);
+static char* takeBody(response_t* response);
+static void nextResponse(response_t* response);
+static int takeConnection(const char* key);
+static void keepConnection(const char* key, const int fd);
+static bool setNonblocking(const int fd, const bool nonblocking);
+static bool sendAll(const int fd, const char* buf, const size_t length);
+static void quickAck(const int fd);
+static bool hasToken(const char* str, const char* end, const char* token);
+static long nowMs(void);
 #ifdef DEBUG
 static void printURL(struct URL url);
 #endif // DEBUG
@@ -68,6 +214,17 @@ static void printURL(struct URL url);
 static const int MAX_TRY = 3;    // maximum attempts to fetch
 static const int HTTP_PORT = 80; // default web server port
 
+static const size_t BatchArenaBytes = 16384; // arena block for a batch
+static const size_t ResponseBytes = 8192;    // first buffer for a response
+static const int PipelineDepth = 4;          // most requests sent ahead
+static const long IdleMs = 4000;             // longest to keep an idle connection
+#define MaxEvents 64                         // events per epoll_wait
+
+/* Connections kept alive for reuse, shared by all callers */
+static idleconn_t idleConns[MaxIdle];        // idleConns[nidle] are in use
+static int nidle = 0;
+static pthread_mutex_t idleLock = PTHREAD_MUTEX_INITIALIZER;
+
 static const char* EXTS[] = {  // valid extensions
   "html",
   "htm",     // added by DFK
@@ -136,10 +293,14 @@ webpage_delete(void* data)
  * Pseudocode:
  *     1. check for valid page 
  *     2. parse url into hostname, port, and filename
- *     3. open a connection to the given host
+ *     3. take a kept-alive connection to the host, or open one
  *     4. send http request
- *     5. fetch html response
- *     6. cleanup
+ *     5. read http response, to the end given by its Content-Length,
+ *        its last chunk, or the server's closing the connection;
+ *        if a kept-alive connection has been closed meanwhile,
+ *        open a new one and go back to 4
+ *     6. keep the connection for next time, if the server will
+ *     7. cleanup
  */
 bool 
 webpage_fetch(webpage_t* page)
@@ -158,70 +319,182 @@ webpage_fetch(webpage_t* page)
     return false;
   }
 
-  // attempt to connect to server 
-  FILE* http_fp = NULL; 
-  for (int try = 0;  http_fp == NULL && try < MAX_TRY; try++) {
-    // open connection - exit on error
-    http_fp = connectToHost(hostname, port);
+  // prepare the HTTP request; HTTP/1.1 connections stay open by default
+  char* request;
+  const char* httpFormat = "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n";
+  int requestLen = asprintf(&request, httpFormat, pathname, hostname);
+  char key[IdleKeyBytes];
+  bool keepable = snprintf(key, sizeof(key), "%s:%d", hostname, port)
+    < (int) sizeof(key);
+  if (requestLen < 0) {
+    free(hostname);
+    free(pathname);
+    return false;
+  }
 
+  // try a kept-alive connection first; the server may have closed it
+  // since, and if so, we open a new one
+  response_t response;
+  initResponse(&response);
+  bool answered = false;
+  int sock = keepable ? takeConnection(key) : -1;
+  if (sock >= 0) {
 #ifndef NOSLEEP // CS50 students: please don't turn off the sleep!
-    sleep(1);   // sleep one second between fetches, to lighten load on server
+    sleep(1);   // as for a new connection, below
 #endif
+    answered = exchange(sock, request, requestLen, &response);
+    if (!answered) {
+      close(sock);
+      freeResponse(&response);
+    }
   }
+  if (!answered) {
+    // attempt to connect to server 
+    sock = -1;
+    for (int try = 0; sock < 0 && try < MAX_TRY; try++) {
+      sock = connectToHost(hostname, port);
 
-  // failed to connect?
-  if (http_fp == NULL) {
-    return false;
-  }
-
-  // prepare and send HTTP request; receive response
-  char* httpResponse = NULL;
-  const char* httpFormat =
-    "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n";
-  if (fprintf(http_fp, httpFormat, pathname, hostname) >= 0) {
-    // ensure stdio buffer is flushed to socket
-    fflush(http_fp);
-    // read the server's response
-    httpResponse = file_readLine(http_fp);
+#ifndef NOSLEEP // CS50 students: please don't turn off the sleep!
+      sleep(1);   // sleep one second between fetches, to lighten load on server
+#endif
+    }
+    answered = (sock >= 0) && exchange(sock, request, requestLen, &response);
   }
 
   free(hostname);
   free(pathname);
+  free(request);
 
-  // did we succeed? check the response
+  // did we succeed? check the response code
   bool success = false;
+  if (answered && response.code == 200) {
+    char* html = takeBody(&response);
+    if (html != NULL) {
+      page->html = html;
+      page->html_len = response.bodyLen;
+      success = true;
+    }
+  }
+
+  // keep the connection, if the server will, and it has sent no more
+  if (sock >= 0) {
+    if (answered && keepable && response.keepAlive
+        && response.len == response.end) {
+      keepConnection(key, sock);
+    } else {
+      close(sock);
+    }
+  }
+  freeResponse(&response);
 
-  if (httpResponse != NULL) {
-    // check response code to see whether we succeeded
-    int httpResponseCode = 0;
-    if (sscanf(httpResponse, "HTTP/1.1 %d", &httpResponseCode) == 1
-        && httpResponseCode == 200) {
-      // success! ignore the rest of the header, then grab the page
-      // read lines until we read a blank line or fail to read a line
-      char* line = file_readLine(http_fp);
-      while (line != NULL && !isBlankLine(line)) {
-        free(line);
-        line = file_readLine(http_fp);
+  return success;
+}
+
+/* ************* webpage_fetchBatch ******************** */
+/* see webpage.h for usage documentation.
+ *
+ * Pseudocode:
+ *     1. for each valid page, parse its url and queue it on its host,
+ *        looking up each new hostname once
+ *     2. open up to perHost connections to each host, reusing kept-
+ *        alive ones, and give each requests from the host's queue
+ *     3. until none is in flight, wait for a socket to be ready and
+ *        move its connection along: connect, send its requests,
+ *        receive their responses; as each response completes, give
+ *        the connection another request; when a connection ends, or
+ *        times out, put back its unanswered requests and open another
+ *     4. cleanup, keeping connections that are still good
+ * All the per-batch bookkeeping comes from one arena.
+ */
+int
+webpage_fetchBatch(webpage_t* pages[], const int npages,
+                   const int perHost, const int timeoutMs)
+{
+  if (pages == NULL || npages <= 0 || perHost <= 0 || timeoutMs <= 0) {
+    return 0;
+  }
+
+  fetchbatch_t batch = { .epfd = -1, .perHost = perHost,
+                         .timeoutMs = timeoutMs, .conns = NULL,
+                         .first = NULL, .last = NULL, .fetched = 0 };
+  hostmap_t hosts;
+  bool ready = hostmap_init(&hosts, 16);
+  mem_arena_t* arena = mem_arena_new(BatchArenaBytes);
+  fetch_t* fetches = mem_arena_calloc(arena, npages, sizeof(fetch_t));
+  batch.conns = mem_pool_new(arena, sizeof(fetchconn_t));
+  batch.epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (ready && fetches != NULL && batch.conns != NULL && batch.epfd >= 0) {
+    // queue each page on its host
+    const char* httpFormat = "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n";
+    for (int i = 0; i < npages; i++) {
+      webpage_t* page = pages[i];
+      char* hostname;
+      int port;
+      char* pathname;
+      if (page == NULL || page->url == NULL || page->html != NULL
+          || !burstURL(page->url, &hostname, &port, &pathname)) {
+        continue;
       }
-      // did we exit the loop because we read an empty line?
-      if (line != NULL) {
-        free(line); // the blank line
-
-        // then grab everything else - that should be the page content
-        char* html = file_readFile(http_fp);
-        if (html != NULL) {
-          page->html = html;
-          success = true;
-        } 
+      fetch_t* fetch = &fetches[i];
+      fetchhost_t* host = findHost(&hosts, arena, hostname, port);
+      int length = snprintf(NULL, 0, httpFormat, pathname, hostname);
+      fetch->request = mem_arena_alloc(arena, length + 1);
+      if (host != NULL && fetch->request != NULL) {
+        sprintf(fetch->request, httpFormat, pathname, hostname);
+        fetch->requestLen = length;
+        fetch->page = page;
+        enqueueFetch(host, fetch);
       }
+      free(hostname);
+      free(pathname);
+    }
+
+    // start on each host, then run them all to the end
+    HASHMAP_FOREACH(hostmap, &hosts, entry) {
+      startConns(&batch, entry->value);
     }
-    free(httpResponse);
+    struct epoll_event events[MaxEvents];
+    while (batch.first != NULL) {
+      long wait = batch.first->deadline - nowMs();
+      int nevents = epoll_wait(batch.epfd, events, MaxEvents,
+                               wait > 0 ? (int) wait : 0);
+      if (nevents < 0 && errno != EINTR) {
+        break;
+      }
+      for (int i = 0; i < nevents; i++) {
+        advanceConn(&batch, events[i].data.ptr);
+      }
+      long now = nowMs();
+      while (batch.first != NULL && batch.first->deadline <= now) {
+        endConn(&batch, batch.first, MAX_TRY);   // timed out
+      }
+    }
+  }
+
+  // clean up; only an epoll error leaves any in flight
+  while (batch.first != NULL) {
+    closeConn(&batch, batch.first, false);
+  }
+  if (batch.epfd >= 0) {
+    close(batch.epfd);
   }
+  hostmap_free(&hosts);
+  mem_arena_delete(arena);
 
-  // clean up
-  fclose(http_fp);
+  return batch.fetched;
+}
 
-  return success;
+/**************** webpage_closeConnections ****************/
+/* see webpage.h for documentation */
+void
+webpage_closeConnections(void)
+{
+  pthread_mutex_lock(&idleLock);
+  for (int i = 0; i < nidle; i++) {
+    close(idleConns[i].fd);
+  }
+  nidle = 0;
+  pthread_mutex_unlock(&idleLock);
 }
 
 /**************** webpage_getNextWord ****************/
@@ -844,16 +1117,16 @@ burstURL(const char* url, char** hostname, int* port, char** pathname)
 
 /* ********************* connectToHost ************************** */
 /* Connect to the given hostname and port, 
- * returning an open FILE* for the socket,
- * or NULL on failure.
+ * returning the socket (a file descriptor),
+ * or -1 on failure.
  */
-static FILE* 
+static int
 connectToHost(const char* hostname, const int port)
 {
   // Look up the hostname specified on command line
   struct hostent *hostp = gethostbyname(hostname);
   if (hostp == NULL) {
-    return NULL;
+    return -1;
   }
 
   // Initialize fields of the server address
@@ -863,23 +1136,835 @@ connectToHost(const char* hostname, const int port)
   server.sin_port = htons(port);
 
   // Create socket (a file descriptor)
-  int comm_sock = socket(AF_INET, SOCK_STREAM, 0);
+  int comm_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (comm_sock < 0) {
-    return NULL;
+    return -1;
   }
 
   // And connect that socket to that server   
   if (connect(comm_sock, (struct sockaddr *) &server, sizeof(server)) < 0) {
+    close(comm_sock);
+    return -1;
+  }
+
+  return comm_sock;
+}
+
+/* ********************* findHost ************************** */
+/* Return the batch's entry for hostname:port, making it (and looking
+ * up the hostname) if this is the first page on it; NULL if out of
+ * memory.  A host whose name does not resolve gets an entry too, with
+ * found false, so that its pages fail without looking it up again.
+ */
+static fetchhost_t*
+findHost(hostmap_t* hosts, mem_arena_t* arena,
+         const char* hostname, const int port)
+{
+  int length = snprintf(NULL, 0, "%s:%d", hostname, port);
+  char* key = mem_arena_alloc(arena, length + 1);
+  if (key == NULL) {
     return NULL;
   }
+  sprintf(key, "%s:%d", hostname, port);
+  fetchhost_t** found = hostmap_find(hosts, key);
+  if (found != NULL) {
+    return *found;            // the key we made is left in the arena
+  }
 
-  // to make it easier to work with, switch to stdio
-  FILE* http_fp = fdopen(comm_sock, "r+");
-  if (http_fp == NULL) {
+  fetchhost_t* host = mem_arena_calloc(arena, 1, sizeof(fetchhost_t));
+  if (host == NULL || !hostmap_insert(hosts, key, host)) {
     return NULL;
   }
+  host->key = key;
+
+  // like connectToHost, we use the host's first IPv4 address
+  struct addrinfo hints = { .ai_family = AF_INET,
+                            .ai_socktype = SOCK_STREAM };
+  struct addrinfo* addrs;
+  char service[16];
+  snprintf(service, sizeof(service), "%d", port);
+  if (getaddrinfo(hostname, service, &hints, &addrs) == 0) {
+    memcpy(&host->addr, addrs->ai_addr, addrs->ai_addrlen);
+    host->addrLen = addrs->ai_addrlen;
+    host->found = true;
+    freeaddrinfo(addrs);
+  }
+  return host;
+}
+
+/* ********************* enqueueFetch ************************** */
+/* Put the request at the back of its host's queue. */
+static void
+enqueueFetch(fetchhost_t* host, fetch_t* fetch)
+{
+  fetch->next = NULL;
+  if (host->queue == NULL) {
+    host->queue = fetch;
+  } else {
+    host->queueTail->next = fetch;
+  }
+  host->queueTail = fetch;
+  host->queued++;
+}
+
+/* ********************* startConns ************************** */
+/* Open connections to the host, until it has perHost, or no requests
+ * are waiting for one.  Failing to connect counts as a try for the
+ * first request waiting, which goes to the back of the queue, until it
+ * has had MAX_TRY tries.
+ */
+static void
+startConns(fetchbatch_t* batch, fetchhost_t* host)
+{
+  while (host->conns < batch->perHost && host->queue != NULL) {
+    if (!openConn(batch, host)) {
+      fetch_t* fetch = host->queue;
+      host->queue = fetch->next;
+      host->queued--;
+      if (host->found && ++fetch->tries < MAX_TRY) {
+        enqueueFetch(host, fetch);
+      }
+    }
+  }
+}
+
+/* ********************* openConn ************************** */
+/* Open a connection to the host, or take a kept-alive one, give it
+ * requests from the host's queue, and add it to the batch's epoll set
+ * and in-flight list.  Return false if no connection could be opened.
+ */
+static bool
+openConn(fetchbatch_t* batch, fetchhost_t* host)
+{
+  if (!host->found) {
+    return false;
+  }
+  fetchconn_t* conn = mem_pool_alloc(batch->conns);
+  if (conn == NULL) {
+    return false;
+  }
+
+  int fd = takeConnection(host->key);
+  if (fd >= 0 && !setNonblocking(fd, true)) {
+    close(fd);
+    fd = -1;
+  }
+  conn->reused = (fd >= 0);
+  conn->connecting = false;
+  if (fd < 0) {
+    fd = socket(host->addr.ss_family,
+                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0
+        && connect(fd, (struct sockaddr*) &host->addr, host->addrLen) < 0) {
+      if (errno == EINPROGRESS) {
+        conn->connecting = true;  // writable when connected, or failed
+      } else {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  // watch for room to send; reading comes after
+  struct epoll_event event = { .events = EPOLLIN | EPOLLOUT,
+                               .data.ptr = conn };
+  if (fd < 0 || epoll_ctl(batch->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    mem_pool_free(batch->conns, conn);
+    return false;
+  }
+
+  conn->host = host;
+  conn->fd = fd;
+  conn->writing = true;
+  conn->closing = false;
+  conn->first = conn->last = conn->sending = NULL;
+  conn->sent = 0;
+  conn->pipelined = 0;
+  conn->answered = 0;
+  initResponse(&conn->response);
+  conn->next = conn->prev = NULL;
+  host->conns++;
+  fillConn(conn);
+  touchConn(batch, conn);
+  return true;
+}
+
+/* ********************* fillConn ************************** */
+/* Move requests from the host's queue into the connection's pipeline,
+ * while it has room.  We do not send a request ahead until we know the
+ * server keeps connections open, that is, until it has answered one on
+ * this connection (or one kept from before); nor take more than our
+ * share of the queue, which would leave the host's other connections
+ * idle while ours works through its pipeline.  Return true if any moved.
+ */
+static bool
+fillConn(fetchconn_t* conn)
+{
+  fetchhost_t* host = conn->host;
+  int depth = 1;
+  if (conn->answered > 0 || conn->reused) {
+    int share = (host->queued + host->conns - 1) / host->conns;
+    depth = (share < 1) ? 1 : (share < PipelineDepth) ? share : PipelineDepth;
+  }
+  bool filled = false;
+  while (!conn->closing && conn->pipelined < depth && host->queue != NULL) {
+    fetch_t* fetch = host->queue;
+    host->queue = fetch->next;
+    host->queued--;
+    fetch->next = NULL;
+    if (conn->last == NULL) {
+      conn->first = fetch;
+    } else {
+      conn->last->next = fetch;
+    }
+    conn->last = fetch;
+    if (conn->sending == NULL) {
+      conn->sending = fetch;
+      conn->sent = 0;
+    }
+    conn->pipelined++;
+    filled = true;
+  }
+  return filled;
+}
+
+/* ********************* advanceConn ************************** */
+/* The connection's socket is ready: finish connecting, send as much of
+ * its requests as it will take, and receive as much of their responses
+ * as has come, delivering each as it completes.
+ */
+static void
+advanceConn(fetchbatch_t* batch, fetchconn_t* conn)
+{
+  if (conn->connecting) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0
+        || error != 0) {
+      endConn(batch, conn, 1);    // refused, perhaps; try again
+      return;
+    }
+    conn->connecting = false;
+  }
+
+  // send the rest of the requests, telling the kernel when more follow
+  while (conn->sending != NULL) {
+    fetch_t* fetch = conn->sending;
+    int flags = MSG_NOSIGNAL | (fetch->next != NULL ? MSG_MORE : 0);
+    ssize_t n = send(conn->fd, fetch->request + conn->sent,
+                     fetch->requestLen - conn->sent, flags);
+    if (n >= 0) {
+      conn->sent += n;
+      if (conn->sent == fetch->requestLen) {
+        conn->sending = fetch->next;
+        conn->sent = 0;
+      }
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;                      // the rest when there is room
+    } else if (errno != EINTR) {
+      endConn(batch, conn, dropPenalty(conn));
+      return;
+    }
+  }
+  if (!watchConn(batch, conn, conn->sending != NULL)) {
+    endConn(batch, conn, 1);
+    return;
+  }
+
+  // receive what has come of the responses
+  response_t* response = &conn->response;
+  while (true) {
+    if (!growResponse(response)) {
+      endConn(batch, conn, 1);
+      return;
+    }
+    quickAck(conn->fd);
+    ssize_t n = recv(conn->fd, response->buf + response->len,
+                     response->size - response->len - 1, 0);
+    if (n > 0) {
+      response->len += n;
+      response->buf[response->len] = '\0';
+      int framed = 0;
+      while (conn->first != NULL
+             && (framed = frameResponse(response, false)) == 1) {
+        deliver(batch, conn);
+      }
+      if (framed < 0 || (conn->first == NULL && response->len > 0)) {
+        endConn(batch, conn, 1);  // garbled, or more than we asked for
+        return;
+      }
+      if (conn->closing || conn->first == NULL) {
+        // the server is done with it, or we are
+        endConn(batch, conn, 0);
+        return;
+      }
+      if (conn->sending != NULL && !conn->writing) {
+        // delivering added requests; send them when there is room
+        if (!watchConn(batch, conn, true)) {
+          endConn(batch, conn, 1);
+          return;
+        }
+      }
+    } else if (n == 0) {
+      // the server closed it, which ends a response with no length
+      if (conn->first != NULL && frameResponse(response, true) == 1) {
+        deliver(batch, conn);
+      }
+      conn->closing = true;
+      endConn(batch, conn, dropPenalty(conn));
+      return;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return;                     // the rest when it comes
+    } else if (errno != EINTR) {
+      endConn(batch, conn, dropPenalty(conn));
+      return;
+    }
+  }
+}
+
+/* ********************* dropPenalty ************************** */
+/* Return the tries to charge when the server closes or resets the
+ * connection.  A server may close a kept-alive connection at any time,
+ * losing what we sent ahead on it (and, if it resets it, perhaps a
+ * response too), so that is a failure only on a new connection that
+ * has not answered anything.
+ */
+static int
+dropPenalty(const fetchconn_t* conn)
+{
+  return (conn->answered == 0 && !conn->reused) ? 1 : 0;
+}
+
+/* ********************* deliver ************************** */
+/* The response to the connection's first request is complete: give it
+ * to the page, if it is a 200 (OK), move on to the next response,
+ * reset the timeout, and give the connection another request.
+ */
+static void
+deliver(fetchbatch_t* batch, fetchconn_t* conn)
+{
+  fetch_t* fetch = conn->first;
+  conn->first = fetch->next;
+  if (conn->first == NULL) {
+    conn->last = NULL;
+  }
+  conn->pipelined--;
+  conn->answered++;
+
+  response_t* response = &conn->response;
+  if (response->code == 200) {
+    char* html = takeBody(response);
+    if (html != NULL) {
+      fetch->page->html = html;
+      fetch->page->html_len = response->bodyLen;
+      batch->fetched++;
+    }
+  }
+  if (!response->keepAlive) {
+    conn->closing = true;         // it will send no more
+  }
+  nextResponse(response);
+  touchConn(batch, conn);
+  fillConn(conn);
+}
 
-  return http_fp;
+/* ********************* endConn ************************** */
+/* The connection is over, for good or ill: close it (or keep it, if it
+ * is still good and has no requests left), charge the first request
+ * still in its pipeline with 'penalty' failed tries, put back those
+ * that have tries left, and open more connections to the host.
+ */
+static void
+endConn(fetchbatch_t* batch, fetchconn_t* conn, const int penalty)
+{
+  fetchhost_t* host = conn->host;
+  fetch_t* fetch = conn->first;
+  bool keep = (fetch == NULL && !conn->closing && conn->response.len == 0);
+  closeConn(batch, conn, keep);
+
+  if (fetch != NULL) {
+    fetch->tries += penalty;
+    while (fetch != NULL) {
+      fetch_t* next = fetch->next;
+      if (fetch->tries < MAX_TRY) {
+        enqueueFetch(host, fetch);
+      }
+      fetch = next;
+    }
+  }
+  startConns(batch, host);
+}
+
+/* ********************* closeConn ************************** */
+/* Take the connection off the in-flight list, and close its socket,
+ * or (if 'keep') take it out of the epoll set and keep it for reuse.
+ */
+static void
+closeConn(fetchbatch_t* batch, fetchconn_t* conn, const bool keep)
+{
+  if (conn->prev == NULL) {
+    batch->first = conn->next;
+  } else {
+    conn->prev->next = conn->next;
+  }
+  if (conn->next == NULL) {
+    batch->last = conn->prev;
+  } else {
+    conn->next->prev = conn->prev;
+  }
+  conn->host->conns--;
+
+  if (keep && epoll_ctl(batch->epfd, EPOLL_CTL_DEL, conn->fd, NULL) == 0) {
+    keepConnection(conn->host->key, conn->fd);
+  } else {
+    close(conn->fd);              // which takes it out of the epoll set
+  }
+  freeResponse(&conn->response);
+  mem_pool_free(batch->conns, conn);
+}
+
+/* ********************* touchConn ************************** */
+/* Reset the connection's deadline, moving it to the end of the batch's
+ * in-flight list (or adding it there, if new).
+ */
+static void
+touchConn(fetchbatch_t* batch, fetchconn_t* conn)
+{
+  if (batch->last != conn) {
+    if (conn->prev != NULL || batch->first == conn) {
+      // on the list, not at its end: unlink it
+      if (conn->prev == NULL) {
+        batch->first = conn->next;
+      } else {
+        conn->prev->next = conn->next;
+      }
+      conn->next->prev = conn->prev;
+    }
+    conn->next = NULL;
+    conn->prev = batch->last;
+    if (batch->last == NULL) {
+      batch->first = conn;
+    } else {
+      batch->last->next = conn;
+    }
+    batch->last = conn;
+  }
+  conn->deadline = nowMs() + batch->timeoutMs;
+}
+
+/* ********************* watchConn ************************** */
+/* Watch the connection's socket for input, and also for room to send
+ * if 'writing'.  Return false on error.
+ */
+static bool
+watchConn(fetchbatch_t* batch, fetchconn_t* conn, const bool writing)
+{
+  if (conn->writing == writing) {
+    return true;
+  }
+  struct epoll_event event = { .events = EPOLLIN | (writing ? EPOLLOUT : 0),
+                               .data.ptr = conn };
+  if (epoll_ctl(batch->epfd, EPOLL_CTL_MOD, conn->fd, &event) < 0) {
+    return false;
+  }
+  conn->writing = writing;
+  return true;
+}
+
+/* ********************* exchange ************************** */
+/* Send the request on the (connected) socket and read the whole
+ * response, waiting as need be.  Return true if a response came.
+ */
+static bool
+exchange(const int sock, const char* request, const size_t length,
+         response_t* response)
+{
+  if (!setNonblocking(sock, false) || !sendAll(sock, request, length)) {
+    return false;
+  }
+  int framed;
+  while ((framed = frameResponse(response, false)) == 0) {
+    if (!growResponse(response)) {
+      return false;
+    }
+    quickAck(sock);
+    ssize_t n = recv(sock, response->buf + response->len,
+                     response->size - response->len - 1, 0);
+    if (n > 0) {
+      response->len += n;
+      response->buf[response->len] = '\0';
+    } else if (n == 0) {
+      return frameResponse(response, true) == 1;
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+  return framed == 1;
+}
+
+/* ********************* initResponse ************************** */
+/* Make the response empty, with no buffer. */
+static void
+initResponse(response_t* response)
+{
+  response->buf = NULL;
+  response->len = response->size = 0;
+  response->end = 0;
+  nextResponse(response);
+}
+
+/* ********************* freeResponse ************************** */
+/* Free the response's buffer, and make it empty again. */
+static void
+freeResponse(response_t* response)
+{
+  free(response->buf);
+  initResponse(response);
+}
+
+/* ********************* growResponse ************************** */
+/* Make sure the response's buffer has room for a good-sized read, and
+ * a terminating null; return false if out of memory.
+ */
+static bool
+growResponse(response_t* response)
+{
+  if (response->size - response->len < ResponseBytes / 8) {
+    size_t size = (response->size == 0) ? ResponseBytes : 2 * response->size;
+    char* buf = realloc(response->buf, size);
+    if (buf == NULL) {
+      return false;
+    }
+    response->buf = buf;
+    response->size = size;
+  }
+  return true;
+}
+
+/* ********************* frameResponse ************************** */
+/* Given the bytes received so far, and whether the server has closed
+ * the connection ('eof'), decide whether the response is complete.
+ * Its body ends after Content-Length bytes, after its last chunk, or,
+ * with neither, when the server closes the connection.  Return 1 if
+ * complete (and set response->end), 0 if more is to come, or -1 if the
+ * response is garbled or cut short.
+ */
+static int
+frameResponse(response_t* response, const bool eof)
+{
+  if (response->end != 0) {
+    return 1;
+  }
+
+  if (response->bodyStart == 0) {
+    if (response->len == 0) {
+      return eof ? -1 : 0;        // nothing yet
+    }
+    // skip header lines until a blank line (LF or CRLF)
+    char* buf = response->buf;
+    char* line = buf;
+    char* end;
+    while ((end = memchr(line, '\n', buf + response->len - line)) != NULL
+           && !(end == line || (end == line + 1 && *line == '\r'))) {
+      line = end + 1;
+    }
+    if (end == NULL) {
+      return eof ? -1 : 0;        // no end to the header, yet
+    }
+    response->bodyStart = end + 1 - buf;
+    if (!parseHeader(response)) {
+      return -1;
+    }
+  }
+
+  if (response->chunked) {
+    return frameChunks(response, eof);
+  }
+  size_t received = response->len - response->bodyStart;
+  if (response->contentLength >= 0) {
+    if (received < (size_t) response->contentLength) {
+      return eof ? -1 : 0;
+    }
+    response->bodyLen = response->contentLength;
+  } else if (eof) {
+    response->bodyLen = received;
+  } else {
+    return 0;
+  }
+  response->end = response->bodyStart + response->bodyLen;
+  return 1;
+}
+
+/* ********************* parseHeader ************************** */
+/* Read the status line and header of the response, which end at
+ * bodyStart: the status code, and how the body is framed.  Return
+ * false if there is no status line.
+ */
+static bool
+parseHeader(response_t* response)
+{
+  char* buf = response->buf;
+  int minor;
+  if (sscanf(buf, "HTTP/1.%d %d", &minor, &response->code) != 2) {
+    return false;
+  }
+  response->keepAlive = (minor >= 1);   // HTTP/1.0 closes by default
+
+  char* headerEnd = buf + response->bodyStart;
+  for (char* line = strchr(buf, '\n') + 1; line < headerEnd;
+       line = strchr(line, '\n') + 1) {
+    char* lineEnd = strchr(line, '\n');
+    if (strncasecmp(line, "Content-Length:", 15) == 0) {
+      response->contentLength = strtol(line + 15, NULL, 10);
+    } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+      response->chunked = hasToken(line + 18, lineEnd, "chunked");
+    } else if (strncasecmp(line, "Connection:", 11) == 0) {
+      if (hasToken(line + 11, lineEnd, "close")) {
+        response->keepAlive = false;
+      } else if (hasToken(line + 11, lineEnd, "keep-alive")) {
+        response->keepAlive = true;
+      }
+    }
+  }
+
+  if ((response->code >= 100 && response->code < 200)
+      || response->code == 204 || response->code == 304) {
+    response->chunked = false;  // these never have a body
+    response->contentLength = 0;
+  } else if (response->chunked) {
+    response->contentLength = -1;
+  } else if (response->contentLength < 0) {
+    response->keepAlive = false;  // the body ends when the server closes
+  }
+  response->chunkPos = response->bodyStart;
+  return true;
+}
+
+/* ********************* frameChunks ************************** */
+/* Decode the chunks of a chunked body that have come in full, moving
+ * their data down to follow the body so far.  Each chunk is a line
+ * with its size in hex (and perhaps extensions), the data, and CRLF;
+ * a chunk of size 0 is last, followed by trailer lines and a blank
+ * line.  Return as for frameResponse.
+ */
+static int
+frameChunks(response_t* response, const bool eof)
+{
+  char* buf = response->buf;
+  while (true) {
+    char* line = buf + response->chunkPos;
+    char* newline = memchr(line, '\n', response->len - response->chunkPos);
+    if (newline == NULL) {
+      return eof ? -1 : 0;
+    }
+    size_t next = newline + 1 - buf;
+
+    if (response->trailer) {
+      response->chunkPos = next;
+      if (newline == line || (newline == line + 1 && *line == '\r')) {
+        response->end = next;     // the blank line after the trailer
+        return 1;
+      }
+      continue;
+    }
+
+    if (!isxdigit((unsigned char) *line)) {
+      return -1;
+    }
+    unsigned long size = strtoul(line, NULL, 16);
+    if (size == 0) {
+      response->trailer = true;
+      response->chunkPos = next;
+      continue;
+    }
+    if (size > response->len - next || response->len - next - size < 2) {
+      return eof ? -1 : 0;        // the rest of the chunk is to come
+    }
+    if (buf[next + size] != '\r' || buf[next + size + 1] != '\n') {
+      return -1;
+    }
+    memmove(buf + response->bodyStart + response->bodyLen, buf + next, size);
+    response->bodyLen += size;
+    response->chunkPos = next + size + 2;
+  }
+}
+
+/* ********************* takeBody ************************** */
+/* Return a copy of the complete response's body, null-terminated, in
+ * new memory that the caller must free; NULL if out of memory.
+ */
+static char*
+takeBody(response_t* response)
+{
+  char* body = malloc(response->bodyLen + 1);
+  if (body != NULL) {
+    memcpy(body, response->buf + response->bodyStart, response->bodyLen);
+    body[response->bodyLen] = '\0';
+  }
+  return body;
+}
+
+/* ********************* nextResponse ************************** */
+/* Drop the complete response from the buffer, keeping any bytes that
+ * follow it (the next response), and get ready to read the next.
+ */
+static void
+nextResponse(response_t* response)
+{
+  if (response->end != 0) {
+    size_t rest = response->len - response->end;
+    memmove(response->buf, response->buf + response->end, rest + 1);
+    response->len = rest;
+  }
+  response->bodyStart = response->bodyLen = 0;
+  response->end = response->chunkPos = 0;
+  response->contentLength = -1;
+  response->code = 0;
+  response->chunked = response->trailer = false;
+  response->keepAlive = false;
+}
+
+/* ********************* takeConnection ************************** */
+/* Return a kept-alive connection to the host with the given key, taking
+ * it out of the idle pool, or -1 if there is none.  Connections idle
+ * too long are closed on the way, as is any the server has closed
+ * (or has sent something on, unasked).
+ */
+static int
+takeConnection(const char* key)
+{
+  while (true) {
+    long now = nowMs();
+    int fd = -1;
+    pthread_mutex_lock(&idleLock);
+    for (int i = 0; fd < 0 && i < nidle; ) {
+      if (now - idleConns[i].since > IdleMs) {
+        close(idleConns[i].fd);
+        idleConns[i] = idleConns[--nidle];
+      } else if (strcmp(idleConns[i].key, key) == 0) {
+        fd = idleConns[i].fd;
+        idleConns[i] = idleConns[--nidle];
+      } else {
+        i++;
+      }
+    }
+    pthread_mutex_unlock(&idleLock);
+
+    if (fd < 0) {
+      return -1;
+    }
+    char c;
+    if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0
+        && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return fd;                  // still open, and quiet
+    }
+    close(fd);
+  }
+}
+
+/* ********************* keepConnection ************************** */
+/* Put the connection to the host with the given key into the idle
+ * pool, closing the one idle longest if the pool is full.
+ */
+static void
+keepConnection(const char* key, const int fd)
+{
+  if (strlen(key) >= IdleKeyBytes) {
+    close(fd);
+    return;
+  }
+  pthread_mutex_lock(&idleLock);
+  int slot = nidle;
+  if (nidle == MaxIdle) {
+    slot = 0;
+    for (int i = 1; i < nidle; i++) {
+      if (idleConns[i].since < idleConns[slot].since) {
+        slot = i;
+      }
+    }
+    close(idleConns[slot].fd);
+  } else {
+    nidle++;
+  }
+  strcpy(idleConns[slot].key, key);
+  idleConns[slot].fd = fd;
+  idleConns[slot].since = nowMs();
+  pthread_mutex_unlock(&idleLock);
+}
+
+/* ********************* setNonblocking ************************** */
+/* Make I/O on the socket non-blocking, or blocking; false on error. */
+static bool
+setNonblocking(const int fd, const bool nonblocking)
+{
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0) {
+    return false;
+  }
+  flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  return fcntl(fd, F_SETFL, flags) == 0;
+}
+
+/* ********************* sendAll ************************** */
+/* Send all of buf on the (blocking) socket; false on error. */
+static bool
+sendAll(const int fd, const char* buf, const size_t length)
+{
+  size_t sent = 0;
+  while (sent < length) {
+    ssize_t n = send(fd, buf + sent, length - sent, MSG_NOSIGNAL);
+    if (n >= 0) {
+      sent += n;
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* ********************* quickAck ************************** */
+/* Have the socket acknowledge what it receives at once, until it next
+ * decides to delay (so we ask before every read).  On a kept-alive
+ * connection, a server that writes a response in pieces, without
+ * TCP_NODELAY, holds each last piece until the one before is
+ * acknowledged; our delaying that acknowledgment would cost tens of
+ * milliseconds a response.
+ */
+static void
+quickAck(const int fd)
+{
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+}
+
+/* ********************* hasToken ************************** */
+/* Return true if the header value from str up to end includes the
+ * token, ignoring case, as a whole comma-separated item.
+ */
+static bool
+hasToken(const char* str, const char* end, const char* token)
+{
+  size_t length = strlen(token);
+  for (const char* p = str; p + length <= end; p++) {
+    if (strncasecmp(p, token, length) == 0
+        && (p == str || p[-1] == ' ' || p[-1] == ',' || p[-1] == '\t')
+        && (p + length == end || strchr(" ,;\t\r\n", p[length]) != NULL)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* ********************* nowMs ************************** */
+/* Return the time, in milliseconds, on a clock that never goes back. */
+static long
+nowMs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000L + now.tv_nsec / 1000000;
 }
 
 
@@ -1140,17 +2225,339 @@ removeWhitespace(char* str)
   } while ((*prev++ = *cur++));            // condense to front of str
 }
 
-/* **************** isBlankLine ******************/
-/* Input: line, a non-NULL pointer to a string.
- * Return true if the string is pointing to a blank line, that is, 
- * an empty string, or
- * with only newline (LF), only carriage return (CR), or only CRLF.
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test runs a stand-in HTTP server on a thread of its own,
+ * listening on the loopback interface, and fetches pages from it:
+ * some one at a time with webpage_fetch, then batches with
+ * webpage_fetchBatch.  The server answers each connection on a new
+ * thread, after a short delay per request, like a distant server
+ * would.  It keeps each connection open for up to MaxPerConn requests,
+ * and answers requests sent ahead (pipelined) in order.  It counts the
+ * connections it accepts, to check that we reuse them, and how many it
+ * has open at once, to check the per-host limit; the elapsed time
+ * shows the requests overlapping.  The path asked for picks the form
+ * of the response:
+ *   /chunked...  - a chunked body, with a chunk extension and a trailer
+ *   /old...      - HTTP/1.0, ended by closing the connection
+ *   /drop...     - normal, but closes the connection on the next request
+ *   /missing...  - 404, with a body
+ *   /slow...     - after the batch's timeout
+ *   anything else - a body with Content-Length
+ *
+ * Build and run with
+ *   make webpagetest && ./webpagetest
+ * It prints what it checks, and exits non-zero if any check fails.
  */
-static inline bool
-isBlankLine(const char* line)
+
+#ifdef UNIT_TEST
+
+#include <stdatomic.h>
+#include <netinet/in.h>
+
+static const int LatencyMs = 100;        // server's delay for each page
+static const int SlowMs = 2000;          // its delay for /slow
+static const int MaxPerConn = 5;         // requests it takes per connection
+static atomic_int accepted;              // connections the server accepted
+static atomic_int openNow;               // connections it has open
+static atomic_int openMost;              // the most it has had open at once
+static int failures;                     // checks failed
+
+static void* serve(void* arg);
+static void* answer(void* arg);
+static bool respond(const int sock, const char* path, const bool keep);
+static void makeBody(char* body, const size_t size, const char* path);
+static bool fetchOne(const int port, const char* path);
+static void quiet(void);
+static int listenLocal(void);
+static void check(const bool ok, const char* what);
+
+int
+main(void)
 {
-  return (   (line[0] == '\0')
-             || (strcmp(line, "\n") == 0) 
-             || (strcmp(line, "\r") == 0) 
-             || (strcmp(line, "\r\n") == 0));
+  int listenSock = listenLocal();
+  if (listenSock < 0) {
+    fprintf(stderr, "cannot listen\n");
+    return 2;
+  }
+  struct sockaddr_in addr;
+  socklen_t length = sizeof(addr);
+  getsockname(listenSock, (struct sockaddr*) &addr, &length);
+  int port = ntohs(addr.sin_port);
+  pthread_t server;
+  pthread_create(&server, NULL, serve, &listenSock);
+
+  // a port where nothing listens
+  int closedSock = listenLocal();
+  getsockname(closedSock, (struct sockaddr*) &addr, &length);
+  int closedPort = ntohs(addr.sin_port);
+  close(closedSock);
+
+  char url[100];
+  char body[300];
+
+  // one page at a time, over kept-alive connections:
+  // a and chunked-b share one, which old-c ends; d and drop-e share the
+  // next, which the server closes when f is sent on it; f gets a third
+  int before = atomic_load(&accepted);
+  const char* paths[] = { "/a.html", "/chunked-b.html", "/old-c.html",
+                          "/d.html", "/drop-e.html", "/f.html", NULL };
+  bool right = true;
+  for (int i = 0; paths[i] != NULL; i++) {
+    right = fetchOne(port, paths[i]) && right;
+  }
+  check(right, "webpage_fetch gets each page, in each form");
+  printf("%d connections for 6 pages\n", atomic_load(&accepted) - before);
+  check(atomic_load(&accepted) - before == 3, "webpage_fetch reuses connections");
+
+  // many pages on two hosts (two names for the same server)
+  quiet();
+  const int npages = 48;
+  const int perHost = 4;
+  webpage_t* pages[npages];
+  for (int i = 0; i < npages; i++) {
+    snprintf(url, sizeof(url), "http://%s:%d/%spage%d.html",
+             (i % 2 == 0) ? "localhost" : "127.0.0.1", port,
+             (i % 3 == 0) ? "chunked-" : "", i);
+    pages[i] = webpage_new(strdup(url), 1, NULL);
+  }
+  before = atomic_load(&accepted);
+  long start = nowMs();
+  int fetched = webpage_fetchBatch(pages, npages, perHost, 5000);
+  long elapsed = nowMs() - start;
+  printf("batch of %d: %d fetched in %ld ms, on %d connections, "
+         "%d open at most\n", npages, fetched, elapsed,
+         atomic_load(&accepted) - before, atomic_load(&openMost));
+  check(fetched == npages, "batch fetches every page");
+  right = true;
+  for (int i = 0; i < npages; i++) {
+    char* html = webpage_getHTML(pages[i]);
+    makeBody(body, sizeof(body), strrchr(webpage_getURL(pages[i]), '/'));
+    right = right && html != NULL && strcmp(html, body) == 0;
+    webpage_delete(pages[i]);
+  }
+  check(right, "each page gets its own html");
+  check(atomic_load(&openMost) <= 2 * perHost, "at most perHost per host");
+  check(atomic_load(&openMost) > perHost, "hosts fetched together");
+  check(atomic_load(&accepted) - before < npages, "batch reuses connections");
+  check(elapsed < npages * LatencyMs / 2, "requests overlap");
+
+  // pages that fail, each in its own way, and one that does not
+  quiet();
+  const char* bad[] = { "http://localhost:%d/missing.html",
+                        "http://localhost:%d/slow.html",
+                        "http://nosuchhost.invalid:%d/",
+                        NULL };
+  webpage_t* mixed[5];
+  for (int i = 0; bad[i] != NULL; i++) {
+    snprintf(url, sizeof(url), bad[i], port);
+    mixed[i] = webpage_new(strdup(url), 1, NULL);
+  }
+  snprintf(url, sizeof(url), "http://localhost:%d/closed.html", closedPort);
+  mixed[3] = webpage_new(strdup(url), 1, NULL);
+  snprintf(url, sizeof(url), "http://localhost:%d/good.html", port);
+  mixed[4] = webpage_new(strdup(url), 1, NULL);
+  start = nowMs();
+  fetched = webpage_fetchBatch(mixed, 5, perHost, SlowMs / 4);
+  elapsed = nowMs() - start;
+  printf("mixed batch: %d fetched in %ld ms\n", fetched, elapsed);
+  check(fetched == 1 && webpage_getHTML(mixed[4]) != NULL,
+        "only the good page is fetched");
+  right = true;
+  for (int i = 0; i < 4; i++) {
+    right = right && webpage_getHTML(mixed[i]) == NULL;
+  }
+  check(right, "failed pages have no html");
+  check(elapsed < SlowMs, "slow page times out");
+  for (int i = 0; i < 5; i++) {
+    webpage_delete(mixed[i]);
+  }
+
+  webpage_closeConnections();
+  printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+  return failures == 0 ? 0 : 1;
 }
+
+/* Fetch one page from the server with webpage_fetch; return true if
+ * its html is just what the server sent.
+ */
+static bool
+fetchOne(const int port, const char* path)
+{
+  char url[100];
+  char body[300];
+  snprintf(url, sizeof(url), "http://localhost:%d%s", port, path);
+  webpage_t* page = webpage_new(strdup(url), 0, NULL);
+  makeBody(body, sizeof(body), path);
+  bool right = webpage_fetch(page) && strcmp(webpage_getHTML(page), body) == 0;
+  if (!right) {
+    char* html = webpage_getHTML(page);
+    printf("wrong html for %s: %s\n", path, html != NULL ? html : "(none)");
+  }
+  webpage_delete(page);
+  return right;
+}
+
+/* Close the connections kept from before, and let the server see them
+ * closed, so that it counts only the next batch's.
+ */
+static void
+quiet(void)
+{
+  webpage_closeConnections();
+  while (atomic_load(&openNow) > 0) {
+    usleep(1000);
+  }
+  atomic_store(&openMost, 0);
+}
+
+/* Accept connections forever, answering each on a new thread. */
+static void*
+serve(void* arg)
+{
+  int listenSock = *(int*) arg;
+  while (true) {
+    int sock = accept(listenSock, NULL, NULL);
+    if (sock >= 0) {
+      atomic_fetch_add(&accepted, 1);
+      pthread_t thread;
+      pthread_create(&thread, NULL, answer, (void*) (intptr_t) sock);
+      pthread_detach(thread);
+    }
+  }
+  return NULL;
+}
+
+/* Read requests from the connection, and answer each in turn, until
+ * it is closed, or we close it.
+ */
+static void*
+answer(void* arg)
+{
+  int sock = (int) (intptr_t) arg;
+  int now = atomic_fetch_add(&openNow, 1) + 1;
+  int most = atomic_load(&openMost);
+  while (now > most && !atomic_compare_exchange_weak(&openMost, &most, now)) {
+  }
+
+  char requests[2000];
+  size_t length = 0;
+  requests[0] = '\0';
+  bool open = true;
+  bool dropNext = false;
+  for (int served = 1; open; served++) {
+    // read until a whole request is in; there may be more behind it
+    char* end;
+    ssize_t n = 1;
+    while ((end = strstr(requests, "\r\n\r\n")) == NULL && n > 0
+           && length < sizeof(requests) - 1) {
+      n = read(sock, requests + length, sizeof(requests) - 1 - length);
+      length += (n > 0) ? n : 0;
+      requests[length] = '\0';
+    }
+    if (end == NULL || dropNext) {
+      break;
+    }
+    char path[100] = "";
+    sscanf(requests, "GET %99s", path);
+    size_t used = end + 4 - requests;
+    memmove(requests, end + 4, length - used + 1);
+    length -= used;
+
+    usleep(1000 * (strncmp(path, "/slow", 5) == 0 ? SlowMs : LatencyMs));
+    open = respond(sock, path, served < MaxPerConn);
+    dropNext = (strncmp(path, "/drop", 5) == 0);
+  }
+
+  atomic_fetch_sub(&openNow, 1);
+  close(sock);
+  return NULL;
+}
+
+/* Send the response for the path; return false if the connection is
+ * to close after it.
+ */
+static bool
+respond(const int sock, const char* path, const bool keep)
+{
+  char body[300];
+  char response[1000];
+  const char* connection = keep ? "" : "Connection: close\r\n";
+  makeBody(body, sizeof(body), path);
+  int length = 0;
+
+  if (strncmp(path, "/missing", 8) == 0) {
+    length = snprintf(response, sizeof(response),
+                      "HTTP/1.1 404 Not Found\r\nContent-Length: 10\r\n%s\r\n"
+                      "not found\n", connection);
+  } else if (strncmp(path, "/old", 4) == 0) {
+    length = snprintf(response, sizeof(response),
+                      "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n%s",
+                      body);
+    // the body ends when we close the connection
+    if (write(sock, response, length) != length) {
+      perror("write");
+    }
+    return false;
+  } else if (strncmp(path, "/chunked", 8) == 0) {
+    // the header, then chunks of up to 16 bytes, each written alone
+    length = snprintf(response, sizeof(response),
+                      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n"
+                      "%s\r\n", connection);
+    for (char* chunk = body; *chunk != '\0'; ) {
+      if (write(sock, response, length) != length) {
+        return false;
+      }
+      int size = strlen(chunk) < 16 ? strlen(chunk) : 16;
+      length = snprintf(response, sizeof(response), "%x;part=yes\r\n%.*s\r\n",
+                        size, size, chunk);
+      chunk += size;
+    }
+    if (write(sock, response, length) != length) {
+      return false;
+    }
+    length = snprintf(response, sizeof(response),
+                      "0\r\nX-Checked: yes\r\n\r\n");
+  } else {
+    length = snprintf(response, sizeof(response),
+                      "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n"
+                      "Content-Length: %zu\r\n%s\r\n%s",
+                      strlen(body), connection, body);
+  }
+  return write(sock, response, length) == length && keep;
+}
+
+/* Make the body the server sends for the path. */
+static void
+makeBody(char* body, const size_t size, const char* path)
+{
+  snprintf(body, size, "<html><a href=\"%s\">page %s</a></html>\n",
+           path, path);
+}
+
+/* Return a socket listening on a free loopback port, or -1. */
+static int
+listenLocal(void)
+{
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = 0,
+                              .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  if (sock < 0
+      || bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0
+      || listen(sock, 64) < 0) {
+    return -1;
+  }
+  return sock;
+}
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
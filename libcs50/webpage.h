@@ -99,6 +99,13 @@ void webpage_delete(void* data);
  *  }
  *  webpage_delete(page);
  *
+ * Notes:
+ *   The connection to the host is kept open afterward, if the server
+ *   allows, and the next fetch from the same host reuses it, saving
+ *   the time to connect; see webpage_closeConnections.  The response
+ *   may give its length (Content-Length), come in chunks, or end when
+ *   the server closes the connection.
+ *
  * Limitations:
  *   * can only handle http (not https or other schemes)
  *   * can only handle URLs of form http://host[:port][/pathname]
@@ -106,6 +113,55 @@ void webpage_delete(void* data);
  */
 bool webpage_fetch(webpage_t* page);
 
+/***************** webpage_fetchBatch ******************************/
+/* retrieve HTML for many pages at once, storing each into page->html
+ *
+ * Caller provides
+ *   pages, an array of npages valid webpage_t* as for webpage_fetch;
+ *   perHost, the most connections to have open at once to any one host, > 0;
+ *   timeoutMs, the most milliseconds to allow any one request, > 0.
+ *
+ * We return:
+ *   the number of pages fetched; for each page fetched, page->html
+ *   contains the content retrieved, and for each other page it is NULL.
+ *
+ * Caller is responsible for:
+ *   later freeing each page->html, as for webpage_fetch.
+ *
+ * Notes:
+ *   All the requests proceed together, over non-blocking sockets, so a
+ *   batch takes about as long as its slowest host's share of it rather
+ *   than the sum of its round trips.  The perHost limit takes the place
+ *   of webpage_fetch's one-second sleep as the politeness rule: each
+ *   host sees at most perHost connections from us at any moment.
+ *   Each connection carries one request after another, kept alive as
+ *   for webpage_fetch, and once the server has shown it keeps the
+ *   connection open, it sends a few requests ahead of their responses
+ *   (HTTP pipelining).  Hostnames are looked up (once each) before any
+ *   request is sent.  A page whose connection is refused is retried,
+ *   like webpage_fetch; one that times out is not.
+ *
+ * Usage example:
+ *  webpage_t* pages[2] = { webpage_new(url1, 1, NULL),
+ *                          webpage_new(url2, 1, NULL) };
+ *  int fetched = webpage_fetchBatch(pages, 2, 4, 10000);
+ *
+ * Limitations: as for webpage_fetch.
+ */
+int webpage_fetchBatch(webpage_t* pages[], const int npages,
+                       const int perHost, const int timeoutMs);
+
+/***************** webpage_closeConnections ******************************/
+/* close the connections that webpage_fetch and webpage_fetchBatch keep
+ * open for reuse.
+ *
+ * Notes:
+ *   Idle connections are closed anyway once a few seconds old, the
+ *   next time a fetch looks for one; call this when done fetching, to
+ *   close them now.
+ */
+void webpage_closeConnections(void);
+
 
 /**************** webpage_getNextWord ***********************************/
 /* return the next word from page->html[pos]
@@ -0,0 +1,559 @@
+/*
+ * workbag.c - CS50 'workbag' module
+ *
+ * see workbag.h for more information.
+ *
+ * The items live in a ring of slots, each with a sequence number that
+ * says whose turn it is: a slot at position 'pos' is free for the
+ * inserter that claims 'pos' when its sequence is pos, and full for the
+ * extractor that claims 'pos' when its sequence is pos+1.  Inserters
+ * claim positions by advancing 'tail' with compare-and-swap, extractors
+ * by advancing 'head'; a thread that finds a slot not yet its turn knows
+ * the bag is full (or empty) without looking at the other end.  After
+ * extracting, the slot's sequence moves on a whole lap, to pos+size, for
+ * the inserter that comes round to it next.
+ *
+ * Blocking calls spin briefly, then sleep on a condition variable.  The
+ * try calls take the lock only to wake a sleeper, and only when there is
+ * one, so threads that never wait never contend on it.
+ *
+ * Compile with -DUNIT_TEST for a standalone stress test; see below.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#ifdef UNIT_TEST
+#define _POSIX_C_SOURCE 200809L   // for nanosleep, in the unit test
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "workbag.h"
+#include "mem.h"
+
+/**************** file-local global variables ****************/
+static const int SpinTries = 64;    // tries before a blocking call sleeps
+#define CacheLine 64                // bytes; keeps head and tail apart
+
+/**************** local types ****************/
+typedef struct workslot {
+  atomic_size_t seq;          // whose turn it is; see above
+  void* item;                 // the item, while the slot is full
+} workslot_t;
+
+/**************** global types ****************/
+typedef struct workbag {
+  workslot_t* slots;          // slots[mask+1]
+  size_t mask;                // number of slots - 1, a power of two minus one
+  char pad1[CacheLine];
+  atomic_size_t tail;         // next position to insert at
+  char pad2[CacheLine];
+  atomic_size_t head;         // next position to extract from
+  char pad3[CacheLine];
+  atomic_bool closed;         // has workbag_close been called?
+  atomic_int sleepers;        // threads waiting on 'changed'
+  pthread_mutex_t lock;       // held while deciding to wait on 'changed'
+  pthread_cond_t changed;     // broadcast after an insert, extract, or close
+} workbag_t;
+
+/**************** global functions ****************/
+/* that is, visible outside this file */
+/* see workbag.h for comments about exported functions */
+
+/**************** local functions ****************/
+/* not visible outside this file */
+static bool put(workbag_t* bag, void* item);
+static void* take(workbag_t* bag);
+static void wake(workbag_t* bag);
+
+/**************** workbag_new() ****************/
+/* see workbag.h for description */
+workbag_t*
+workbag_new(const int capacity)
+{
+  if (capacity <= 0) {
+    return NULL;              // bad capacity
+  }
+
+  workbag_t* bag = mem_malloc(sizeof(workbag_t));
+  if (bag == NULL) {
+    return NULL;              // error allocating workbag
+  }
+  size_t size = 2;
+  while (size < (size_t) capacity) {
+    size *= 2;
+  }
+  bag->slots = mem_malloc(size * sizeof(workslot_t));
+  if (bag->slots == NULL) {
+    mem_free(bag);
+    return NULL;              // error allocating slots
+  }
+
+  // initialize contents of workbag structure
+  for (size_t pos = 0; pos < size; pos++) {
+    atomic_init(&bag->slots[pos].seq, pos);
+    bag->slots[pos].item = NULL;
+  }
+  bag->mask = size - 1;
+  atomic_init(&bag->tail, 0);
+  atomic_init(&bag->head, 0);
+  atomic_init(&bag->closed, false);
+  atomic_init(&bag->sleepers, 0);
+  pthread_mutex_init(&bag->lock, NULL);
+  pthread_cond_init(&bag->changed, NULL);
+  return bag;
+}
+
+/**************** workbag_tryInsert() ****************/
+/* see workbag.h for description */
+bool
+workbag_tryInsert(workbag_t* bag, void* item)
+{
+  if (bag == NULL || item == NULL || atomic_load(&bag->closed)) {
+    return false;             // bad parameters, or closed
+  }
+  if (!put(bag, item)) {
+    return false;             // full
+  }
+  wake(bag);
+  return true;
+}
+
+/**************** workbag_insert() ****************/
+/* see workbag.h for description */
+bool
+workbag_insert(workbag_t* bag, void* item)
+{
+  if (bag == NULL || item == NULL) {
+    return false;             // bad parameters
+  }
+
+  // a slot is usually freed soon; spin a little before sleeping
+  for (int i = 0; i < SpinTries; i++) {
+    if (atomic_load(&bag->closed)) {
+      return false;
+    }
+    if (put(bag, item)) {
+      wake(bag);
+      return true;
+    }
+  }
+
+  // count ourselves as a sleeper before the last try, so that any
+  // extract after that try sees us, and must wake us
+  bool inserted;
+  pthread_mutex_lock(&bag->lock);
+  atomic_fetch_add(&bag->sleepers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  while (true) {
+    if (atomic_load(&bag->closed)) {
+      inserted = false;
+      break;
+    }
+    if (put(bag, item)) {
+      inserted = true;
+      break;
+    }
+    pthread_cond_wait(&bag->changed, &bag->lock);
+  }
+  atomic_fetch_sub(&bag->sleepers, 1);
+  pthread_mutex_unlock(&bag->lock);
+
+  if (inserted) {
+    wake(bag);
+  }
+  return inserted;
+}
+
+/**************** workbag_tryExtract() ****************/
+/* see workbag.h for description */
+void*
+workbag_tryExtract(workbag_t* bag)
+{
+  if (bag == NULL) {
+    return NULL;              // bad bag
+  }
+  void* item = take(bag);
+  if (item != NULL) {
+    wake(bag);
+  }
+  return item;
+}
+
+/**************** workbag_extract() ****************/
+/* see workbag.h for description */
+void*
+workbag_extract(workbag_t* bag)
+{
+  if (bag == NULL) {
+    return NULL;              // bad bag
+  }
+
+  void* item;
+  for (int i = 0; i < SpinTries; i++) {
+    if ((item = take(bag)) != NULL) {
+      wake(bag);
+      return item;
+    }
+    if (atomic_load(&bag->closed)) {
+      return NULL;
+    }
+  }
+
+  // as in workbag_insert, announce ourselves before the last try
+  pthread_mutex_lock(&bag->lock);
+  atomic_fetch_add(&bag->sleepers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  while ((item = take(bag)) == NULL && !atomic_load(&bag->closed)) {
+    pthread_cond_wait(&bag->changed, &bag->lock);
+  }
+  atomic_fetch_sub(&bag->sleepers, 1);
+  pthread_mutex_unlock(&bag->lock);
+
+  if (item != NULL) {
+    wake(bag);
+  }
+  return item;
+}
+
+/**************** workbag_close() ****************/
+/* see workbag.h for description */
+void
+workbag_close(workbag_t* bag)
+{
+  if (bag != NULL) {
+    pthread_mutex_lock(&bag->lock);
+    atomic_store(&bag->closed, true);
+    pthread_cond_broadcast(&bag->changed);
+    pthread_mutex_unlock(&bag->lock);
+  }
+}
+
+/**************** workbag_delete() ****************/
+/* see workbag.h for description */
+void
+workbag_delete(workbag_t* bag, void (*itemdelete)(void* item) )
+{
+  if (bag != NULL) {
+    void* item;
+    while ((item = take(bag)) != NULL) {
+      if (itemdelete != NULL) {
+        (*itemdelete)(item);
+      }
+    }
+    pthread_cond_destroy(&bag->changed);
+    pthread_mutex_destroy(&bag->lock);
+    mem_free(bag->slots);
+    mem_free(bag);
+  }
+
+#ifdef MEMTEST
+  mem_report(stdout, "End of workbag_delete");
+#endif
+}
+
+/**************** put() ****************/
+/* Claim the next position for inserting and put the item in its slot.
+ * Return false if the bag is full.
+ */
+static bool
+put(workbag_t* bag, void* item)
+{
+  size_t pos = atomic_load_explicit(&bag->tail, memory_order_relaxed);
+  workslot_t* slot;
+  while (true) {
+    slot = &bag->slots[pos & bag->mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    ptrdiff_t turn = (ptrdiff_t) (seq - pos);
+    if (turn == 0) {
+      // the slot is free; claim it, unless another inserter beat us
+      if (atomic_compare_exchange_weak_explicit(&bag->tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (turn < 0) {
+      return false;           // the slot is still full from the last lap
+    } else {
+      pos = atomic_load_explicit(&bag->tail, memory_order_relaxed);
+    }
+  }
+  slot->item = item;
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+  return true;
+}
+
+/**************** take() ****************/
+/* Claim the next position for extracting and take the item from its
+ * slot.  Return NULL if the bag is empty.
+ */
+static void*
+take(workbag_t* bag)
+{
+  size_t pos = atomic_load_explicit(&bag->head, memory_order_relaxed);
+  workslot_t* slot;
+  while (true) {
+    slot = &bag->slots[pos & bag->mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    ptrdiff_t turn = (ptrdiff_t) (seq - (pos + 1));
+    if (turn == 0) {
+      // the slot is full; claim it, unless another extractor beat us
+      if (atomic_compare_exchange_weak_explicit(&bag->head, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (turn < 0) {
+      return NULL;            // the slot has not been filled yet
+    } else {
+      pos = atomic_load_explicit(&bag->head, memory_order_relaxed);
+    }
+  }
+  void* item = slot->item;
+  atomic_store_explicit(&slot->seq, pos + bag->mask + 1, memory_order_release);
+  return item;
+}
+
+/**************** wake() ****************/
+/* After an insert or extract, wake any threads waiting for one.  The
+ * fence pairs with the one a sleeper makes after counting itself, so
+ * either we see the sleeper or it sees our change.
+ */
+static void
+wake(workbag_t* bag)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&bag->sleepers, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&bag->lock);
+    pthread_cond_broadcast(&bag->changed);
+    pthread_mutex_unlock(&bag->lock);
+  }
+}
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test runs several producer threads inserting into a small
+ * workbag while several consumer threads extract from it, so both
+ * sides keep finding the bag full or empty and have to wait.  Each
+ * item is a distinct int; the consumers count how often each comes
+ * out, and every one must come out exactly once.  Half the producers
+ * use workbag_tryInsert, retrying when the bag is full, and half use
+ * workbag_insert.  Then it checks that closing a bag wakes threads
+ * blocked in workbag_extract on an empty bag and in workbag_insert on
+ * a full one, and that a closed bag still gives up what it holds.
+ *
+ * Build and run with
+ *   make workbagtest && ./workbagtest
+ * It prints what it checks, and exits non-zero if any check fails.
+ */
+
+#ifdef UNIT_TEST
+
+#include <time.h>
+
+static const int Producers = 4;
+static const int Consumers = 4;
+static const int PerProducer = 50000;
+static const int SmallBag = 8;           // capacity for the stress test
+
+typedef struct tester {
+  workbag_t* bag;                        // the bag under test
+  int id;                                // which producer or consumer
+  int* items;                            // Producers * PerProducer ints
+  atomic_int* taken;                     // times each item came out
+  atomic_int done;                       // has this thread returned?
+  bool result;                           // what its last call returned
+} tester_t;
+
+static int failures;                     // checks failed
+
+static void* produce(void* arg);
+static void* consume(void* arg);
+static void* blockedExtract(void* arg);
+static void* blockedInsert(void* arg);
+static void napMs(const int ms);
+static void check(const bool ok, const char* what);
+
+int
+main(void)
+{
+  // many producers and consumers sharing a small bag
+  const int nitems = Producers * PerProducer;
+  int* items = malloc(nitems * sizeof(int));
+  atomic_int* taken = malloc(nitems * sizeof(atomic_int));
+  if (items == NULL || taken == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 2;
+  }
+  for (int i = 0; i < nitems; i++) {
+    items[i] = i;
+    atomic_init(&taken[i], 0);
+  }
+  workbag_t* bag = workbag_new(SmallBag);
+  check(bag != NULL, "workbag_new");
+
+  pthread_t producers[Producers], consumers[Consumers];
+  tester_t ptesters[Producers], ctesters[Consumers];
+  for (int c = 0; c < Consumers; c++) {
+    ctesters[c] = (tester_t) { .bag = bag, .id = c, .items = items, .taken = taken };
+    pthread_create(&consumers[c], NULL, consume, &ctesters[c]);
+  }
+  for (int p = 0; p < Producers; p++) {
+    ptesters[p] = (tester_t) { .bag = bag, .id = p, .items = items, .taken = taken };
+    pthread_create(&producers[p], NULL, produce, &ptesters[p]);
+  }
+  bool inserted = true;
+  for (int p = 0; p < Producers; p++) {
+    pthread_join(producers[p], NULL);
+    inserted = inserted && ptesters[p].result;
+  }
+  check(inserted, "every insert succeeds");
+
+  // the consumers are blocked, or soon will be; closing ends them
+  workbag_close(bag);
+  for (int c = 0; c < Consumers; c++) {
+    pthread_join(consumers[c], NULL);
+  }
+  int missing = 0, repeated = 0;
+  for (int i = 0; i < nitems; i++) {
+    int n = atomic_load(&taken[i]);
+    missing += (n == 0);
+    repeated += (n > 1);
+  }
+  printf("%d items: %d missing, %d taken more than once\n",
+         nitems, missing, repeated);
+  check(missing == 0 && repeated == 0, "every item comes out exactly once");
+  check(workbag_tryExtract(bag) == NULL, "the bag ends empty");
+  check(!workbag_tryInsert(bag, &items[0]), "a closed bag takes no more");
+  workbag_delete(bag, NULL);
+
+  // closing wakes threads waiting on an empty bag
+  bag = workbag_new(2);
+  pthread_t waiters[Consumers];
+  tester_t wtesters[Consumers];
+  for (int c = 0; c < Consumers; c++) {
+    wtesters[c] = (tester_t) { .bag = bag, .id = c };
+    atomic_init(&wtesters[c].done, 0);
+    pthread_create(&waiters[c], NULL, blockedExtract, &wtesters[c]);
+  }
+  napMs(100);
+  int returned = 0;
+  for (int c = 0; c < Consumers; c++) {
+    returned += atomic_load(&wtesters[c].done);
+  }
+  check(returned == 0, "workbag_extract waits on an empty bag");
+  workbag_close(bag);
+  napMs(100);
+  returned = 0;
+  for (int c = 0; c < Consumers; c++) {
+    returned += atomic_load(&wtesters[c].done);
+  }
+  check(returned == Consumers, "closing wakes every waiting extract");
+  for (int c = 0; c < Consumers; c++) {
+    pthread_join(waiters[c], NULL);
+  }
+  workbag_delete(bag, NULL);
+
+  // closing wakes a thread waiting on a full bag
+  bag = workbag_new(2);
+  check(workbag_tryInsert(bag, &items[0]) && workbag_tryInsert(bag, &items[1]),
+        "a bag of 2 takes 2 items");
+  check(!workbag_tryInsert(bag, &items[2]), "a full bag takes no more");
+  tester_t inserter = { .bag = bag, .items = items };
+  atomic_init(&inserter.done, 0);
+  pthread_t thread;
+  pthread_create(&thread, NULL, blockedInsert, &inserter);
+  napMs(100);
+  check(atomic_load(&inserter.done) == 0, "workbag_insert waits on a full bag");
+  workbag_close(bag);
+  napMs(100);
+  check(atomic_load(&inserter.done) == 1 && !inserter.result,
+        "closing wakes a waiting insert, which fails");
+  pthread_join(thread, NULL);
+  int* first = workbag_extract(bag);
+  int* second = workbag_extract(bag);
+  check(first == &items[0] && second == &items[1] && workbag_extract(bag) == NULL,
+        "a closed bag gives up its items, in order, then NULL");
+  workbag_delete(bag, NULL);
+
+  free(items);
+  free(taken);
+  printf("%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/* Insert this producer's items; even-numbered producers use
+ * workbag_insert, odd ones retry workbag_tryInsert.
+ */
+static void*
+produce(void* arg)
+{
+  tester_t* tester = arg;
+  tester->result = true;
+  for (int k = 0; k < PerProducer; k++) {
+    int* item = &tester->items[tester->id * PerProducer + k];
+    if (tester->id % 2 == 0) {
+      tester->result = workbag_insert(tester->bag, item) && tester->result;
+    } else {
+      while (!workbag_tryInsert(tester->bag, item)) {
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Extract items until the bag is closed and empty, counting each. */
+static void*
+consume(void* arg)
+{
+  tester_t* tester = arg;
+  int* item;
+  while ((item = workbag_extract(tester->bag)) != NULL) {
+    atomic_fetch_add(&tester->taken[*item], 1);
+  }
+  return NULL;
+}
+
+/* Wait for an item that never comes. */
+static void*
+blockedExtract(void* arg)
+{
+  tester_t* tester = arg;
+  tester->result = (workbag_extract(tester->bag) != NULL);
+  atomic_store(&tester->done, 1);
+  return NULL;
+}
+
+/* Wait for room that never comes. */
+static void*
+blockedInsert(void* arg)
+{
+  tester_t* tester = arg;
+  tester->result = workbag_insert(tester->bag, &tester->items[3]);
+  atomic_store(&tester->done, 1);
+  return NULL;
+}
+
+/* Sleep for ms milliseconds. */
+static void
+napMs(const int ms)
+{
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
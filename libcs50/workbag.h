@@ -0,0 +1,114 @@
+/*
+ * workbag.h - header file for CS50 'workbag' module
+ *
+ * A 'workbag' is a bag that many threads may share: any number of them
+ * may insert items while any number of others extract them, with no
+ * locks.  Unlike a bag, a workbag holds at most a fixed number of items,
+ * chosen when it is made, in a ring of slots allocated once; inserting
+ * and extracting allocate nothing.  Items come out in about the order
+ * they went in, which makes a workbag a fair work queue for a pool of
+ * threads.
+ *
+ * Each operation comes in two forms: a 'try' form that returns at once
+ * if the bag is full (or empty), and a blocking form that waits until
+ * it is not, or until the bag is closed.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#ifndef __WORKBAG_H
+#define __WORKBAG_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct workbag workbag_t;  // opaque to users of the module
+
+/**************** functions ****************/
+
+/**************** workbag_new ****************/
+/* Create a new (empty) workbag.
+ *
+ * Caller provides:
+ *   the most items the bag must hold at once, > 0.
+ * We return:
+ *   pointer to a new workbag, or NULL if error.
+ * We guarantee:
+ *   The bag is initialized empty, and holds at least 'capacity' items
+ *   (the capacity is rounded up to a power of two).
+ * Caller is responsible for:
+ *   later calling workbag_delete.
+ */
+workbag_t* workbag_new(const int capacity);
+
+/**************** workbag_tryInsert ****************/
+/* Add new item to the workbag, if there is room.
+ *
+ * Caller provides:
+ *   a valid workbag pointer and a valid item pointer.
+ * We return:
+ *   true if the item was added; false if the bag is full or closed,
+ *   or bag or item is NULL.
+ * Caller is responsible for:
+ *   not free-ing the item as long as it remains in the bag.
+ */
+bool workbag_tryInsert(workbag_t* bag, void* item);
+
+/**************** workbag_insert ****************/
+/* Add new item to the workbag, waiting for room if it is full.
+ *
+ * Caller provides:
+ *   a valid workbag pointer and a valid item pointer.
+ * We return:
+ *   true if the item was added; false if the bag is (or becomes) closed,
+ *   or bag or item is NULL.
+ */
+bool workbag_insert(workbag_t* bag, void* item);
+
+/**************** workbag_tryExtract ****************/
+/* Return an item from the workbag, if it has one.
+ *
+ * Caller provides:
+ *   valid workbag pointer.
+ * We return:
+ *   pointer to an item, or NULL if bag is NULL or empty.
+ * We guarantee:
+ *   the item is no longer in the bag, and no other thread extracted it.
+ */
+void* workbag_tryExtract(workbag_t* bag);
+
+/**************** workbag_extract ****************/
+/* Return an item from the workbag, waiting for one if it is empty.
+ *
+ * Caller provides:
+ *   valid workbag pointer.
+ * We return:
+ *   pointer to an item, or NULL if bag is NULL, or is closed and empty.
+ * Note:
+ *   items still in a closed bag are returned before NULL is.
+ */
+void* workbag_extract(workbag_t* bag);
+
+/**************** workbag_close ****************/
+/* Close the workbag: no more items may be inserted, and every thread
+ * waiting in workbag_insert or workbag_extract returns.
+ *
+ * Caller provides:
+ *   valid workbag pointer; a NULL bag is ignored.
+ */
+void workbag_close(workbag_t* bag);
+
+/**************** workbag_delete ****************/
+/* Delete the whole workbag.
+ *
+ * Caller provides:
+ *   a valid workbag pointer, which no other thread is still using.
+ *   a function that will delete one item (may be NULL).
+ * We guarantee:
+ *   we call itemdelete() on each item still in the bag.
+ *   we ignore NULL bag.
+ */
+void workbag_delete(workbag_t* bag, void (*itemdelete)(void* item) );
+
+#endif // __WORKBAG_H
@@ -5,19 +5,131 @@
  * JL3, CS50 Final Project 11/14/24
  */
 
+#define _GNU_SOURCE       // pthread_barrier_t
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
 
 #include "game.h"
 #include "message.h"
+#include "protocol.h"
+#include "session.h"
+#include "workpool.h"
 #include "log.h"
+#include "mem.h"
+
+//********************* constants *********************
+static const int clientsPerGame = 64;  // lobby sessions to allow per game
+static const int batchMessages = 32;   // most messages a game handles per task
+static const float minTick = 0.001;    // shortest wait for held keys, seconds
+
+//********************* types *********************
+/* Settings from the command line; see parseArgs. */
+typedef struct options {
+  int shards;             // games to run on separate sockets (-t)
+  int workers;            // threads in the lobby's pool (-w)
+  int nmaps;              // number of games in the lobby, one per map
+  char** maps;            // the maps, the first being the required one
+  double keyRate;         // keys per second per player, 0 if unlimited (-r)
+  int keyBurst;           // most keys a player may send at once (-b)
+  bool keyDrop;           // drop excess keys instead of holding one (-d)
+} options_t;
+
+/* One of several threads sharing the server's port, each with its own
+ * socket, message loop, and game; see runShards.
+ */
+typedef struct shard {
+  pthread_t thread;       // thread running this shard
+  char* mapPath;          // map for each new game
+  game_t* game;           // the current game
+  int port;               // port shared by all shards
+  pthread_barrier_t* bound; // wait here until all sockets are bound
+} shard_t;
+
+/* A message waiting for a hosted game to handle it. */
+typedef struct inbox {
+  struct inbox* next;     // next message, in order of arrival
+  addr_t from;            // who sent it
+  char message[];         // the message itself
+} inbox_t;
+
+/* One of the lobby's games. Only one worker at a time runs a game:
+ * messages for it wait in its inbox, and the game is submitted to the
+ * pool only when it is not already 'scheduled'.
+ */
+typedef struct hosted {
+  struct lobby* lobby;    // lobby hosting this game
+  int id;                 // index in the lobby
+  char* mapPath;          // map for each new game
+  game_t* game;           // the current game; touched only by its worker
+  pthread_mutex_t lock;   // guards the fields below
+  inbox_t* first;         // oldest message waiting
+  inbox_t* last;          // newest message waiting
+  bool scheduled;         // is the game queued or running in the pool?
+  atomic_int players;     // players still playing, for LOBBY listings
+  atomic_int gold;        // gold remaining, for LOBBY listings
+  atomic_int held;        // keys held back by the key limit
+  atomic_int coalesced;   // keys replaced by newer ones, for LOBBY listings
+  atomic_int dropped;     // keys dropped, for LOBBY listings
+  atomic_long due;        // when (ms) the first held key is due; 0 if none
+  atomic_int ended;       // games on this map played to the end
+} hosted_t;
+
+/* A client of the lobby, and the game its messages go to. */
+typedef struct client {
+  addr_t addr;            // the client's address
+  int game;               // index of the game it joined
+  int round;              // that game's 'ended' count when it joined
+} client_t;
+
+/* Several games in one process, sharing one socket: the main thread
+ * reads every message and routes it, by the sender's session, to the
+ * game the sender joined; a pool of workers runs the games.
+ */
+typedef struct lobby {
+  int ngames;             // number of games
+  hosted_t* games;        // the games
+  session_table_t* clients; // client_t for each client, by address
+  int released;           // games ended whose clients have been let go
+  workpool_t* pool;       // workers that run the games
+} lobby_t;
+
+//********************* global variables *********************
+static options_t* settings;  // every new game gets the key limit from here
 
 //********************* prototypes *********************
-static void parseArgs(const int argc, char* argv[], game_t** game);
+static void parseArgs(const int argc, char* argv[], game_t** game, options_t* opts);
+static game_t* newGame(char* mapPath);
+static float tickSeconds(void);
+static int runShards(char* mapPath, game_t* game, const int nshards);
+static int runLobby(game_t* game, options_t* opts);
+static bool handleLobbyMessage(void* arg, const addr_t from, const char* message);
+static bool handleLobbyTick(void* arg);
+static void sendLobby(lobby_t* lobby, const addr_t to);
+static void sendGame(game_t* game, const addr_t to);
+static int formatGame(char* buf, const int id, const char* mapPath, const int players,
+                      const int gold, const int coalesced, const int dropped);
+static client_t* addClient(lobby_t* lobby, const addr_t from, const int id);
+static void releaseClients(lobby_t* lobby);
+static void releaseClient_helper(void* arg, const int token, void* item);
+static bool isQuitKey(const char* message);
+static void deliver(hosted_t* hosted, const addr_t from, const char* message);
+static void runHosted(void* arg);
+static void* shardThread(void* arg);
+static void shardLoop(shard_t* shard);
 static bool handleMessage(void* arg, const addr_t from, const char* message);
-static bool handleKeypress(addr_t from, char key, game_t* game);
+static bool isCode(const char* message, const size_t codeLen, const char* code);
+static bool handleTick(void* arg);
+static bool handleKey(addr_t from, char key, int token, int seq, game_t* game);
+static bool releaseKeys(game_t* game);
+static bool handleKeypress(addr_t from, char key, int token, game_t* game);
+static long nowMs(void);
 
 //********************* main *********************
 
@@ -25,8 +137,21 @@ int
 main(int argc, char* argv[]) 
 {
   game_t* game = NULL;
+  options_t opts;
   log_init(stderr);
-  parseArgs(argc, argv, &game);
+  log_startAsync();
+#ifdef MEMPROFILE
+  // 'kill -USR1' dumps who has allocated what (see mem.h)
+  mem_profile_signal(SIGUSR1);
+#endif
+  parseArgs(argc, argv, &game, &opts);
+
+  if (opts.shards > 1){
+    return runShards(argv[1], game, opts.shards);
+  }
+  if (opts.nmaps > 1){
+    return runLobby(game, &opts);
+  }
 
   int port = message_init(stderr);
   fprintf(stdout, "Server initialized, waiting at port %d\n", port);
@@ -36,7 +161,8 @@ main(int argc, char* argv[])
     return 4;
   } else {
     bool gameOn;
-    gameOn = message_loop(game, 0, NULL, NULL, handleMessage);
+    float tick = tickSeconds();
+    gameOn = message_loop(game, tick, tick > 0 ? handleTick : NULL, NULL, handleMessage);
     if (!gameOn){
       game_end(game);
       return 5;
@@ -52,40 +178,660 @@ main(int argc, char* argv[])
  * 
  * Caller provides:
  *   argc and argv[] from main
- *   a pointer to a null game_t* to initialize
+ *   a pointer to a null game_t* to initialize, with the first map
+ *   a pointer to the options to fill in
+ * 
+ * Usage: ./server map.txt [seed] [-m mtu] [-t threads] [-g map]... [-w workers]
+ *                 [-r rate] [-b burst] [-d]
+ *   -m mtu      fragment messages longer than mtu bytes (see message_setMTU)
+ *   -t threads  run that many games at once, one per thread, all on the
+ *               same port (see runShards)
+ *   -g map      host another game, on that map, in a lobby (see runLobby)
+ *   -w workers  threads to run the lobby's games (default: one per CPU)
+ *   -r rate     handle at most rate keys per second from each player
+ *               (default: no limit; see game_limitKeys)
+ *   -b burst    but let a player send up to burst keys at once
+ *               (default: rate, rounded up)
+ *   -d          drop keys over the limit, rather than holding the
+ *               newest one until the player may send again
  * 
  * We exit non-zero if any errors are encountered,
  * logging to stderr as well
  */
 static void
-parseArgs(const int argc, char* argv[], game_t** game)
+parseArgs(const int argc, char* argv[], game_t** game, options_t* opts)
 {
-  if (argc == 1 || argc > 3){ // incorrect number of arg
-    log_e("Usage: ./server map.txt [seed]\n");
+  const char* usage = "Usage: ./server map.txt [seed] [-m mtu] [-t threads]"
+                      " [-g map]... [-w workers] [-r rate] [-b burst] [-d]\n";
+  if (argc == 1){ // incorrect number of arg
+    log_e(usage);
     exit(1);
   }
-  if (argc == 3){ // yes optional seed arg
-    // handle seed arg
-    char* seedStr = argv[2];
-    int seed;
-    if (sscanf(seedStr, "%d", &seed) != 1){
-      log_e("Error: invalid seed argument, not an int\n");
-      exit(2);
+
+  opts->shards = 1;
+  opts->workers = sysconf(_SC_NPROCESSORS_ONLN);
+  opts->nmaps = 1;
+  opts->maps = malloc(argc * sizeof(char*));
+  if (opts->maps == NULL){
+    exit(3);
+  }
+  opts->maps[0] = argv[1];
+  opts->keyRate = 0;
+  opts->keyBurst = 0;
+  opts->keyDrop = false;
+
+  bool haveSeed = false;
+  for (int i = 2; i < argc; i++){
+    char* arg = argv[i];
+    if (strcmp(arg, "-m") == 0 && i + 1 < argc){
+      // handle mtu option
+      int mtu;
+      if (sscanf(argv[++i], "%d", &mtu) != 1 || mtu < 0){
+        log_e("Error: invalid mtu argument, not a non-negative int\n");
+        exit(2);
+      }
+      message_setMTU(mtu);
+    } else if (strcmp(arg, "-t") == 0 && i + 1 < argc){
+      // handle threads option
+      if (sscanf(argv[++i], "%d", &opts->shards) != 1 || opts->shards < 1){
+        log_e("Error: invalid threads argument, not a positive int\n");
+        exit(2);
+      }
+    } else if (strcmp(arg, "-g") == 0 && i + 1 < argc){
+      // handle another game's map
+      opts->maps[opts->nmaps++] = argv[++i];
+    } else if (strcmp(arg, "-w") == 0 && i + 1 < argc){
+      // handle workers option
+      if (sscanf(argv[++i], "%d", &opts->workers) != 1 || opts->workers < 1){
+        log_e("Error: invalid workers argument, not a positive int\n");
+        exit(2);
+      }
+    } else if (strcmp(arg, "-r") == 0 && i + 1 < argc){
+      // handle key rate option
+      if (sscanf(argv[++i], "%lf", &opts->keyRate) != 1 || opts->keyRate < 0){
+        log_e("Error: invalid rate argument, not a non-negative number\n");
+        exit(2);
+      }
+    } else if (strcmp(arg, "-b") == 0 && i + 1 < argc){
+      // handle key burst option
+      if (sscanf(argv[++i], "%d", &opts->keyBurst) != 1 || opts->keyBurst < 1){
+        log_e("Error: invalid burst argument, not a positive int\n");
+        exit(2);
+      }
+    } else if (strcmp(arg, "-d") == 0){
+      // handle drop option
+      opts->keyDrop = true;
+    } else if (arg[0] != '-' && !haveSeed){ // yes optional seed arg
+      // handle seed arg
+      int seed;
+      if (sscanf(arg, "%d", &seed) != 1){
+        log_e("Error: invalid seed argument, not an int\n");
+        exit(2);
+      }
+      srand(seed);
+      haveSeed = true;
+    } else {
+      log_e(usage);
+      exit(1);
     }
-    srand(seed);
-  } else { // no seed, generate randomly
+  }
+  if (!haveSeed){ // no seed, generate randomly
     srand(time(NULL));
   }
+  if (opts->shards > 1 && opts->nmaps > 1){ // a lobby shares one socket
+    log_e("Error: -t cannot be used with -g\n");
+    exit(1);
+  }
+  if (opts->workers < 1){
+    opts->workers = 1;
+  }
+  if (opts->keyBurst == 0){ // default burst: a second's worth of keys
+    opts->keyBurst = (opts->keyRate > 1) ? (int) (opts->keyRate + 0.999) : 1;
+  }
+  settings = opts;
 
   // handle map.txt arg: assign to game pointer
   char* filename = argv[1];
-  *game = game_new(filename);
+  *game = newGame(filename);
   if (*game == NULL){
     log_e("Error: could not initialize game\n");
     exit(3);
   }
 }
 
+/**************** newGame ****************/
+/* 
+ * Creates a game on the given map, with the key limit
+ * from the command line; NULL if game_new fails
+ */
+static game_t*
+newGame(char* mapPath)
+{
+  game_t* game = game_new(mapPath);
+  game_limitKeys(game, settings->keyRate, settings->keyBurst, !settings->keyDrop);
+  return game;
+}
+
+/**************** tickSeconds ****************/
+/* 
+ * How long a message loop should first wait, when idle, before
+ * looking for keys held back by the key limit; after that, the wait
+ * is set to when the next held key is due (see releaseKeys and
+ * handleLobbyTick), and there are no ticks while none is held.
+ * We return 0 (no ticks) if keys are unlimited or dropped
+ */
+static float
+tickSeconds(void)
+{
+  if (settings->keyRate <= 0 || settings->keyDrop){
+    return 0;
+  }
+  return minTick;
+}
+
+/**************** runShards ****************/
+/* 
+ * Runs nshards games at once, each in its own thread with its own
+ * socket and message loop, all bound to the same port with
+ * SO_REUSEPORT (see message_initShard). The kernel sends all of a
+ * client's messages to the same socket, so each client plays in
+ * whichever game its address hashes to, and the games share nothing.
+ *
+ * Caller (main) provides:
+ *   path of the map, for every game
+ *   the first game, already created by parseArgs
+ *   the number of shards, > 1
+ * 
+ * When a shard's game ends, the shard starts a new game on the same
+ * map rather than closing its socket, since that would move other
+ * shards' clients; the server runs until killed.
+ * We return non-zero if any errors are encountered
+ */
+static int
+runShards(char* mapPath, game_t* game, const int nshards)
+{
+  shard_t* shards = calloc(nshards, sizeof(shard_t));
+  pthread_barrier_t bound;
+  if (shards == NULL || pthread_barrier_init(&bound, NULL, nshards) != 0){
+    log_e("Error: could not allocate shards\n");
+    return 3;
+  }
+
+  // this thread runs the first shard, and picks the port for the others
+  int port = message_initShard(stderr, 0);
+  if (port == 0){ // error initializing server
+    log_e("Error: message_init failed to assign port\n");
+    return 4;
+  }
+  shards[0].mapPath = mapPath;
+  shards[0].game = game;
+  shards[0].port = port;
+  shards[0].bound = &bound;
+
+  for (int i = 1; i < nshards; i++){
+    shards[i].mapPath = mapPath;
+    shards[i].game = newGame(mapPath);
+    shards[i].port = port;
+    shards[i].bound = &bound;
+    if (shards[i].game == NULL){
+      log_e("Error: could not initialize game\n");
+      exit(3);
+    }
+    if (pthread_create(&shards[i].thread, NULL, shardThread, &shards[i]) != 0){
+      log_e("Error: could not start shard thread\n");
+      exit(4);
+    }
+  }
+
+  // don't announce the port until every socket is bound to it
+  pthread_barrier_wait(&bound);
+  log_d("running %d games on one port", nshards);
+  fprintf(stdout, "Server initialized, waiting at port %d\n", port);
+
+  shardLoop(&shards[0]);
+  for (int i = 1; i < nshards; i++){
+    pthread_join(shards[i].thread, NULL);
+  }
+  pthread_barrier_destroy(&bound);
+  free(shards);
+  return 0;
+}
+
+/**************** shardThread ****************/
+/* 
+ * Start routine for every shard but the first: binds this thread's
+ * socket to the shared port, waits for the other shards to do the
+ * same, and then runs the shard
+ */
+static void*
+shardThread(void* arg)
+{
+  shard_t* shard = arg;
+  int port = message_initShard(stderr, shard->port);
+  pthread_barrier_wait(shard->bound);
+  if (port == 0){
+    log_e("Error: shard could not bind the server port\n");
+    return NULL;
+  }
+  shardLoop(shard);
+  return NULL;
+}
+
+/**************** shardLoop ****************/
+/* 
+ * Runs one shard's games, one after another, on this thread's socket
+ */
+static void
+shardLoop(shard_t* shard)
+{
+  float tick = tickSeconds();
+  while (shard->game != NULL){
+    if (!message_loop(shard->game, tick, tick > 0 ? handleTick : NULL, NULL,
+                      handleMessage)){
+      game_end(shard->game);
+      break;
+    }
+    // that game is over (and deleted); start a fresh one
+    shard->game = newGame(shard->mapPath);
+  }
+  message_done();
+}
+
+/**************** runLobby ****************/
+/* 
+ * Hosts one game per map, all on one socket. The main thread runs
+ * the message loop and routes each message to the game its sender
+ * joined (see handleLobbyMessage); a pool of worker threads runs the
+ * games, each game on one worker at a time, with idle workers
+ * stealing games that are waiting on busy ones.
+ *
+ * Caller (main) provides:
+ *   the first game, already created by parseArgs
+ *   the options, with at least two maps
+ * 
+ * When a game ends, a new game starts on the same map; the server
+ * runs until killed.
+ * We return non-zero if any errors are encountered
+ */
+static int
+runLobby(game_t* game, options_t* opts)
+{
+  lobby_t lobby;
+  lobby.ngames = opts->nmaps;
+  lobby.games = calloc(lobby.ngames, sizeof(hosted_t));
+  lobby.clients = session_new(lobby.ngames * clientsPerGame);
+  lobby.released = 0;
+  if (lobby.games == NULL || lobby.clients == NULL){
+    log_e("Error: could not allocate lobby\n");
+    return 3;
+  }
+
+  for (int i = 0; i < lobby.ngames; i++){
+    hosted_t* hosted = &lobby.games[i];
+    hosted->lobby = &lobby;
+    hosted->id = i;
+    hosted->mapPath = opts->maps[i];
+    hosted->game = (i == 0) ? game : newGame(opts->maps[i]);
+    if (hosted->game == NULL){
+      log_e("Error: could not initialize game\n");
+      return 3;
+    }
+    pthread_mutex_init(&hosted->lock, NULL);
+    hosted->first = NULL;
+    hosted->last = NULL;
+    hosted->scheduled = false;
+    atomic_init(&hosted->players, 0);
+    atomic_init(&hosted->gold, game_getRemainingGold(hosted->game));
+    atomic_init(&hosted->held, 0);
+    atomic_init(&hosted->coalesced, 0);
+    atomic_init(&hosted->dropped, 0);
+    atomic_init(&hosted->due, 0);
+    atomic_init(&hosted->ended, 0);
+  }
+
+  int port = message_init(stderr);
+  if (port == 0){ // error initializing server
+    log_e("Error: message_init failed to assign port\n");
+    return 4;
+  }
+  lobby.pool = workpool_new(opts->workers);
+  if (lobby.pool == NULL){
+    log_e("Error: could not start workers\n");
+    return 4;
+  }
+  log_d("hosting %d games", lobby.ngames);
+  fprintf(stdout, "Server initialized, waiting at port %d\n", port);
+
+  float tick = tickSeconds();
+  bool gameOn = message_loop(&lobby, tick, tick > 0 ? handleLobbyTick : NULL,
+                             NULL, handleLobbyMessage);
+
+  // only on error: finish what was queued, then end every game
+  workpool_delete(lobby.pool);
+  for (int i = 0; i < lobby.ngames; i++){
+    hosted_t* hosted = &lobby.games[i];
+    if (hosted->game != NULL){
+      game_end(hosted->game);
+    }
+    while (hosted->first != NULL){
+      inbox_t* item = hosted->first;
+      hosted->first = item->next;
+      free(item);
+    }
+    pthread_mutex_destroy(&hosted->lock);
+  }
+  session_delete(lobby.clients, free);
+  free(lobby.games);
+  message_done();
+  return gameOn ? 0 : 5;
+}
+
+/**************** handleLobbyMessage ****************/
+/* 
+ * Handles a message for the lobby: LOBBY lists the games, JOIN id
+ * picks the game for the sender's later messages, and any other
+ * message goes to the sender's game, to be handled by handleMessage.
+ * Clients that never JOIN play in the first game, so clients written
+ * for a single-game server work unchanged.  A client's session ends
+ * when it quits, or when its game ends (see releaseClients).
+ *
+ * Caller (messageLoop) provides:
+ *   arg, containing a pointer to the lobby
+ *   the address the message was sent from
+ *   the message itself
+ * 
+ * We return false, to keep looping
+ */
+static bool
+handleLobbyMessage(void* arg, const addr_t from, const char* message)
+{
+  lobby_t* lobby = arg;
+  releaseClients(lobby);
+  if (strcmp(message, "LOBBY") == 0){
+    sendLobby(lobby, from);
+    return false;
+  }
+
+  client_t* joined = session_find(lobby->clients, from);
+  if (strncmp(message, "JOIN ", strlen("JOIN ")) == 0){
+    int id;
+    char extra;
+    if (sscanf(message + strlen("JOIN "), "%d%c", &id, &extra) != 1
+        || id < 0 || id >= lobby->ngames){
+      message_send(from, "ERROR no such game; send LOBBY for a list");
+      return false;
+    }
+    if (joined == NULL && (joined = addClient(lobby, from, id)) == NULL){
+      message_send(from, "QUIT server is full");
+      return false;
+    }
+    // a player should QUIT one game before joining another
+    joined->game = id;
+    joined->round = atomic_load(&lobby->games[id].ended);
+    char reply[20];
+    sprintf(reply, "JOINED %d", id);
+    message_send(from, reply);
+    return false;
+  }
+
+  if (joined == NULL && (joined = addClient(lobby, from, 0)) == NULL){
+    message_send(from, "QUIT server is full");
+    return false;
+  }
+  deliver(&lobby->games[joined->game], from, message);
+  if (isQuitKey(message)){
+    free(session_remove(lobby->clients, from));
+  }
+  // once the game has handled it, see whether it holds a key back
+  message_setTimeout(tickSeconds());
+  return false;
+}
+
+/**************** handleLobbyTick ****************/
+/* 
+ * Called when the lobby's socket has been idle for a tick: sends
+ * a tick (an empty message) to each game with a held key now due,
+ * so it can handle it (see releaseKeys), then sets the next tick
+ * for when the next held key is due.  A game still handling
+ * messages may yet hold a key, so it is looked at again shortly;
+ * when no game is busy or holding keys, there are no more ticks.
+ * 
+ * We return false, to keep looping
+ */
+static bool
+handleLobbyTick(void* arg)
+{
+  lobby_t* lobby = arg;
+  long now = nowMs();
+  long wait = -1;             // ms until the next tick; -1 for none
+  for (int i = 0; i < lobby->ngames; i++){
+    hosted_t* hosted = &lobby->games[i];
+    long due = atomic_load(&hosted->due);
+    if (due != 0 && due <= now){
+      deliver(hosted, message_noAddr(), "");
+    }
+    pthread_mutex_lock(&hosted->lock);
+    bool busy = hosted->scheduled;
+    pthread_mutex_unlock(&hosted->lock);
+
+    long next = busy ? 0 : (due != 0 ? due - now : -1);
+    if (next >= 0 && (wait < 0 || next < wait)){
+      wait = next;
+    }
+  }
+  message_setTimeout(wait < 0 ? 0 : (wait / 1000.0 < minTick ? minTick : wait / 1000.0));
+  return false;
+}
+
+/**************** sendLobby ****************/
+/* 
+ * Sends the list of games: "LOBBY n", then one line per game with
+ * its id, map, number of players who have not quit, gold remaining, and the keys the
+ * key limit has coalesced and dropped in it
+ */
+static void
+sendLobby(lobby_t* lobby, const addr_t to)
+{
+  size_t size = 20;
+  for (int i = 0; i < lobby->ngames; i++){
+    size += strlen(lobby->games[i].mapPath) + 60;
+  }
+  char* reply = malloc(size);
+  if (reply == NULL){
+    return;
+  }
+
+  int len = sprintf(reply, "LOBBY %d", lobby->ngames);
+  for (int i = 0; i < lobby->ngames; i++){
+    hosted_t* hosted = &lobby->games[i];
+    len += formatGame(reply + len, i, hosted->mapPath,
+                      atomic_load(&hosted->players), atomic_load(&hosted->gold),
+                      atomic_load(&hosted->coalesced), atomic_load(&hosted->dropped));
+  }
+  message_send(to, reply);
+  free(reply);
+}
+
+/**************** sendGame ****************/
+/* 
+ * Answers LOBBY outside a lobby: "LOBBY 1", then the line sendLobby
+ * would send for this thread's game, so the key limit's counts can be
+ * watched while a game runs in every mode (with -t, a client hears
+ * about the game of the shard it reaches)
+ */
+static void
+sendGame(game_t* game, const addr_t to)
+{
+  int coalesced, dropped, held;
+  game_getKeyStats(game, &coalesced, &dropped, &held);
+  char reply[strlen(settings->maps[0]) + 80];
+  int len = sprintf(reply, "LOBBY 1");
+  formatGame(reply + len, 0, settings->maps[0], game_getNumActive(game),
+             game_getRemainingGold(game), coalesced, dropped);
+  message_send(to, reply);
+}
+
+/**************** formatGame ****************/
+/* 
+ * Writes one game's line of a LOBBY reply into buf: a newline, then
+ * its id, map (without its directory), players who have not quit,
+ * gold remaining, and keys coalesced and dropped; buf needs room for
+ * the map's name and 70 more characters
+ * We return the length written
+ */
+static int
+formatGame(char* buf, const int id, const char* mapPath, const int players,
+           const int gold, const int coalesced, const int dropped)
+{
+  const char* map = strrchr(mapPath, '/');
+  map = (map == NULL) ? mapPath : map + 1;
+  return sprintf(buf, "\n%d %s %d %d %d %d", id, map, players, gold,
+                 coalesced, dropped);
+}
+
+/**************** addClient ****************/
+/* 
+ * Starts a lobby session for a client, in game 'id'
+ * We return the new client, or NULL if the lobby is full
+ * or out of memory
+ */
+static client_t*
+addClient(lobby_t* lobby, const addr_t from, const int id)
+{
+  client_t* client = malloc(sizeof(client_t));
+  if (client == NULL){
+    return NULL;
+  }
+  client->addr = from;
+  client->game = id;
+  client->round = atomic_load(&lobby->games[id].ended);
+  if (session_insert(lobby->clients, from, client) == 0){
+    free(client);
+    return NULL;
+  }
+  return client;
+}
+
+/**************** releaseClients ****************/
+/* 
+ * Ends the lobby sessions of the clients of each game that has
+ * ended since we last looked, making room for new clients; their
+ * later messages, if any, go to the first game, like a new client's
+ */
+static void
+releaseClients(lobby_t* lobby)
+{
+  int ended = 0;
+  for (int i = 0; i < lobby->ngames; i++){
+    ended += atomic_load(&lobby->games[i].ended);
+  }
+  if (ended != lobby->released){
+    session_iterate(lobby->clients, lobby, releaseClient_helper);
+    lobby->released = ended;
+  }
+}
+
+/**************** releaseClient_helper ****************/
+/* 
+ * Ends one client's session if the game it joined has ended
+ */
+static void
+releaseClient_helper(void* arg, const int token, void* item)
+{
+  lobby_t* lobby = arg;
+  client_t* client = item;
+  if (client->round != atomic_load(&lobby->games[client->game].ended)){
+    free(session_remove(lobby->clients, client->addr));
+  }
+}
+
+
+/**************** deliver ****************/
+/* 
+ * Queues a copy of the message in the game's inbox, and submits the
+ * game to the pool if it is not already waiting or running there
+ */
+static void
+deliver(hosted_t* hosted, const addr_t from, const char* message)
+{
+  size_t len = strlen(message);
+  inbox_t* item = malloc(sizeof(inbox_t) + len + 1);
+  if (item == NULL){
+    log_v("Error: out of memory for message\n");
+    return;
+  }
+  item->next = NULL;
+  item->from = from;
+  memcpy(item->message, message, len + 1);
+
+  pthread_mutex_lock(&hosted->lock);
+  if (hosted->last != NULL){
+    hosted->last->next = item;
+  } else {
+    hosted->first = item;
+  }
+  hosted->last = item;
+  bool submit = !hosted->scheduled;
+  hosted->scheduled = true;
+  pthread_mutex_unlock(&hosted->lock);
+
+  if (submit && !workpool_submit(hosted->lobby->pool, hosted->id, runHosted, hosted)){
+    log_v("Error: could not schedule game\n");
+    pthread_mutex_lock(&hosted->lock);
+    hosted->scheduled = false;
+    pthread_mutex_unlock(&hosted->lock);
+  }
+}
+
+/**************** runHosted ****************/
+/* 
+ * Pool task: handles the messages waiting for one game, in order.
+ * After a batch of them, the game goes to the back of the queue so
+ * other games get a turn; when none are left, it is unscheduled.
+ */
+static void
+runHosted(void* arg)
+{
+  hosted_t* hosted = arg;
+  for (int n = 0; n < batchMessages; n++){
+    pthread_mutex_lock(&hosted->lock);
+    inbox_t* item = hosted->first;
+    if (item == NULL){
+      hosted->scheduled = false;
+      pthread_mutex_unlock(&hosted->lock);
+      return;
+    }
+    hosted->first = item->next;
+    if (hosted->first == NULL){
+      hosted->last = NULL;
+    }
+    pthread_mutex_unlock(&hosted->lock);
+
+    if (handleMessage(hosted->game, item->from, item->message)){
+      // that game is over (and deleted); start a fresh one
+      hosted->game = newGame(hosted->mapPath);
+      atomic_fetch_add(&hosted->ended, 1);
+    }
+    int coalesced, dropped, held;
+    game_getKeyStats(hosted->game, &coalesced, &dropped, &held);
+    double due = game_nextKeyDue(hosted->game);
+    atomic_store(&hosted->players, game_getNumActive(hosted->game));
+    atomic_store(&hosted->gold, game_getRemainingGold(hosted->game));
+    atomic_store(&hosted->held, held);
+    atomic_store(&hosted->coalesced, coalesced);
+    atomic_store(&hosted->dropped, dropped);
+    atomic_store(&hosted->due, (due < 0) ? 0 : nowMs() + (long)(due * 1000) + 1);
+    free(item);
+  }
+
+  if (!workpool_submit(hosted->lobby->pool, hosted->id, runHosted, hosted)){
+    log_v("Error: could not reschedule game\n");
+    pthread_mutex_lock(&hosted->lock);
+    hosted->scheduled = false;
+    pthread_mutex_unlock(&hosted->lock);
+  }
+}
+
 /**************** handleMessage ****************/
 /* 
  * Handles message obtained by the messageLoop function,
@@ -109,49 +855,142 @@ handleMessage(void* arg, const addr_t from, const char* message) //check how mes
     return true;  //end looping -not sure if this logic makes sense
   }
 
-  // get code from message by splitting string on space
-  char* messageCpy = malloc(strlen(message) + 1); //message copy for tokenization
-  if (messageCpy == NULL) {
-    return true; //end looping
+  // an empty message is a tick (see handleLobbyTick)
+  if (*message == '\0'){
+    return releaseKeys(game);
   }
-  strcpy(messageCpy, message);
 
-  // split messageCpy into code and params
-  char* code = messageCpy;
-  char* messagePos = messageCpy;
-  while (*messagePos != ' ' && *messagePos != '\0') {
-    messagePos++;
-  }
-  if (*messagePos == ' ') {
-    *messagePos = '\0';
-    messagePos++;
+  // binary clients send only KEY messages; see protocol.h
+  if (proto_type(message) != 0){
+    char key;
+    int token, seq;
+    if (proto_decodeKey(message, &key, &token, &seq)){
+      gameOver = handleKey(from, key, token, seq, game);
+    } else {
+      log_e("Error: binary message from client not a KEY\n");
+    }
+    return gameOver || releaseKeys(game);
   }
-  char* params = messagePos; // points to the rest of the message
 
-  if (strcmp(code, "PLAY") == 0 && game != NULL){
+  // split message into code and params on the first space, in place,
+  // rather than copying it to put a null there
+  const char* params = strchr(message, ' ');
+  size_t codeLen = (params == NULL) ? strlen(message) : params - message;
+  params = (params == NULL) ? "" : params + 1; // points to the rest of the message
+
+  if (isCode(message, codeLen, "PLAY") && game != NULL){
     char name[strlen(params)+1];
     strcpy(name, params);
     game_addPlayer(game, name, from);
     // add some kind of error handling if addplayer doesn't work
 
-  } else if (strcmp(code, "SPECTATE") == 0){
+  } else if (isCode(message, codeLen, "SPECTATE")){
     game_addSpectator(game, from);
     // add some kind of error handling if addspec doesn't work
 
-  } else if (strcmp(code, "KEY") == 0){
+  } else if (isCode(message, codeLen, "PROTO")){
+    if (strcmp(params, "BINARY") == 0){
+      game_setBinary(game, from);
+    }
+
+  } else if (isCode(message, codeLen, "KEY")){
     if (strlen(params) == 1){
       char key = *params;
-      gameOver = handleKeypress(from, key, game); //returns true if game over, false otherwise
+      gameOver = handleKey(from, key, 0, 0, game); //returns true if game over, false otherwise
     }
+  } else if (isCode(message, codeLen, "LOBBY") && *params == '\0'){
+    // a lobby answers this itself; see handleLobbyMessage
+    sendGame(game, from);
   } else { // not correct message type
-    log_e("Error: message from client not PLAY, SPECTATE, or KEY\n");
+    log_e("Error: message from client not PLAY, SPECTATE, PROTO, KEY, or LOBBY\n");
   }
 
   if (game == NULL) {
     game_sendDisplays(game);
   }
-  free(messageCpy);
-  return gameOver;   
+  return gameOver || releaseKeys(game);
+}
+
+/**************** isCode ****************/
+/* 
+ * Return true if the message's code, its first codeLen characters,
+ * is the given code
+ */
+static bool
+isCode(const char* message, const size_t codeLen, const char* code)
+{
+  return strlen(code) == codeLen && strncmp(message, code, codeLen) == 0;
+}
+
+/**************** isQuitKey ****************/
+/* 
+ * Return true if the message is a KEY Q, text or binary
+ */
+static bool
+isQuitKey(const char* message)
+{
+  if (proto_type(message) != 0){
+    char key;
+    int token, seq;
+    return proto_decodeKey(message, &key, &token, &seq) && key == 'Q';
+  }
+  return strcmp(message, "KEY Q") == 0;
+}
+
+/**************** handleTick ****************/
+/* 
+ * Called when the game's socket has been idle for a tick:
+ * handles any held keys that are now due
+ *
+ * We return true if one of them ends the game
+ */
+static bool
+handleTick(void* arg)
+{
+  return releaseKeys(arg);
+}
+
+/**************** handleKey ****************/
+/* 
+ * Handles a key from a client, with the sequence number it sent
+ * (0 if none), if the key limit allows it now (see game_admitKey);
+ * otherwise the game holds or drops it
+ *
+ * We return true if the key causes the game to end
+ */
+static bool
+handleKey(addr_t from, char key, int token, int seq, game_t* game)
+{
+  if (!game_admitKey(game, from, token, key, seq)){
+    return false;
+  }
+  return handleKeypress(from, key, token, game);
+}
+
+/**************** releaseKeys ****************/
+/* 
+ * Handles every held key that the key limit now allows, and
+ * sets this thread's message loop to tick when the next held key
+ * is due, or not at all if none is held (a lobby worker runs no
+ * loop; handleLobbyTick sets the lobby's ticks)
+ *
+ * We return true if one of them ends the game (which is
+ * then deleted, so we stop there)
+ */
+static bool
+releaseKeys(game_t* game)
+{
+  addr_t from;
+  int token;
+  char key;
+  while (game_takeHeldKey(game, &from, &token, &key)){
+    if (handleKeypress(from, key, token, game)){
+      return true;
+    }
+  }
+  double due = game_nextKeyDue(game);
+  message_setTimeout(due < 0 ? 0 : (due < minTick ? minTick : due));
+  return false;
 }
 
 
@@ -162,56 +1001,66 @@ handleMessage(void* arg, const addr_t from, const char* message) //check how mes
  *
  * Caller (messageLoop) provides:
  *   the address the message was sent from
- *   the message itself
+ *   the key pressed
+ *   the session token sent with the key, or 0 if none
  *   the game data structure
  * 
  * We return true if the keyPress causes the game to end,
  * else we return false. There is logging to stderr
- * addCpy must be freed after it is used outside of handleKeypress
  */
 static bool
-handleKeypress(addr_t from, char key, game_t* game)
+handleKeypress(addr_t from, char key, int token, game_t* game)
 {
-  const char* add = message_stringAddr(from);
-  char addCpy[strlen(add)+1];
-  strcpy(addCpy, add);
-
-  // handle only possible spectator action first
-  addr_t* spectatorAddress = game_getSpectatorAddress(game);
-  if (key == 'Q' && spectatorAddress != NULL && message_eqAddr(from, *spectatorAddress)){
-    game_deleteSpectator(game);
-  }
-  else if (spectatorAddress == NULL || (spectatorAddress != NULL && !message_eqAddr(from, *spectatorAddress)))
-  { // otherwise handle player actions, as long as they aren't from the spectator
+  // a spectator can only quit; any other key it sends finds no
+  // player to move, so only 'Q' needs to look for spectators
+  bool spectatorQuit = (key == 'Q' && game_deleteSpectator(game, from));
+  if (!spectatorQuit)
+  { // otherwise handle player actions
     switch (key) {
-      case 'Q': game_deletePlayer(game, addCpy);
-      case 'h': game_move(game, addCpy, -1, 0); break;
-      case 'l': game_move(game, addCpy, 1, 0); break;
-      case 'k': game_move(game, addCpy, 0, -1); break;
-      case 'j': game_move(game, addCpy, 0, 1); break;
-      case 'y': game_move(game, addCpy, -1, -1); break;
-      case 'u': game_move(game, addCpy, 1, -1); break;
-      case 'b': game_move(game, addCpy, -1, 1); break;
-      case 'n': game_move(game, addCpy, 1, 1); break;
-
-      case 'H': while(game_move(game, addCpy, -1, 0)); break;
-      case 'L': while(game_move(game, addCpy, 1, 0)); break;
-      case 'K': while(game_move(game, addCpy, 0, -1)); break;
-      case 'J': while(game_move(game, addCpy, 0, 1)); break;
-      case 'Y': while(game_move(game, addCpy, -1, -1)); break;
-      case 'U': while(game_move(game, addCpy, 1, -1)); break;
-      case 'B': while(game_move(game, addCpy, -1, 1)); break;
-      case 'N': while(game_move(game, addCpy, 1, 1)); break;
+      case 'Q': game_deletePlayer(game, from, token);
+      case 'h': game_move(game, from, token, -1, 0); break;
+      case 'l': game_move(game, from, token, 1, 0); break;
+      case 'k': game_move(game, from, token, 0, -1); break;
+      case 'j': game_move(game, from, token, 0, 1); break;
+      case 'y': game_move(game, from, token, -1, -1); break;
+      case 'u': game_move(game, from, token, 1, -1); break;
+      case 'b': game_move(game, from, token, -1, 1); break;
+      case 'n': game_move(game, from, token, 1, 1); break;
+
+      case 'H': game_sprint(game, from, token, -1, 0); break;
+      case 'L': game_sprint(game, from, token, 1, 0); break;
+      case 'K': game_sprint(game, from, token, 0, -1); break;
+      case 'J': game_sprint(game, from, token, 0, 1); break;
+      case 'Y': game_sprint(game, from, token, -1, -1); break;
+      case 'U': game_sprint(game, from, token, 1, -1); break;
+      case 'B': game_sprint(game, from, token, -1, 1); break;
+      case 'N': game_sprint(game, from, token, 1, 1); break;
       default: log_e("Error: KEY message from client has invalid key\n"); break;
     }
   }
-  game_sendDisplays(game);
 
   // check if game has ended
   if (game_getRemainingGold(game) == 0) {
+    int coalesced, dropped, held;
+    game_getKeyStats(game, &coalesced, &dropped, &held);
+    if (coalesced > 0 || dropped > 0){
+      log_d("key limit: %d keys coalesced", coalesced);
+      log_d("key limit: %d keys dropped", dropped);
+    }
     game_end(game);
     return true;
   }
   return false;
 }
 
+/**************** nowMs ****************/
+/* 
+ * return a monotonic clock reading, in milliseconds
+ */
+static long
+nowMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
@@ -1,15 +1,55 @@
-/* 
+/*
  * log module - a simple way to log messages to a file
- * 
+ *
  * David Kotz, May 2019
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <sys/errno.h>
 #include "log.h"
 
+/**************** file-local constants ****************/
+#define LogSlots 1024           // lines the ring buffer can hold (power of 2)
+#define LogLineBytes 512        // longest line kept, including the null
+
+/**************** file-local types ****************/
+/* One line waiting to be written.  'seq' tells producers and the writer
+ * whose turn it is to use the slot; see logClaim and logPublish.
+ */
+typedef struct logslot {
+  atomic_size_t seq;            // ticket for this slot
+  FILE* fp;                     // where to write the line
+  char line[LogLineBytes];      // the line, without its newline
+} logslot_t;
+
+/**************** file-local global variables ****************/
+/* The ring buffer is a bounded multi-producer queue in the style of
+ * Dmitry Vyukov's: producers claim a slot by advancing 'tail' with a
+ * compare-and-swap, so logging threads never take a lock; the single
+ * writer thread takes slots in order from 'head'.
+ */
+static logslot_t ring[LogSlots];
+static atomic_size_t tail;          // next slot for a producer to claim
+static size_t head;                 // next slot for the writer to take
+static atomic_bool async = false;   // are producers using the ring?
+static atomic_bool stopping = false;// should the writer drain and exit?
+static atomic_int dropped = 0;      // lines lost because the ring was full
+static sem_t ready;                 // counts lines waiting in the ring
+static bool readyInit = false;      // has 'ready' been initialized?
+static pthread_t writer;            // the background writer thread
+static bool atexitDone = false;     // have we registered log_stopAsync?
+
+/**************** file-local functions ****************/
+static logslot_t* logClaim(FILE* fp);
+static void logPublish(logslot_t* slot);
+static void* logWriter(void* arg);
+
 /**************** flog_init ****************/
 /* Initialize the logging module.
  */
@@ -19,7 +59,7 @@ void flog_init(FILE* fp)
 }
 
 /**************** flog_s ****************/
-/* 
+/*
  * log a string to the logfile, if logging is enabled.
  * The string `format` can reference '%s' to incorporate `str`.
  */
@@ -27,14 +67,20 @@ void
 flog_s(FILE* fp, const char* format, const char* str)
 {
   if (fp != NULL && format != NULL && str != NULL) {
-    fprintf(fp, format, str);
-    fputc('\n', fp);
-    fflush(fp);
+    logslot_t* slot = logClaim(fp);
+    if (slot != NULL) {
+      snprintf(slot->line, LogLineBytes, format, str);
+      logPublish(slot);
+    } else if (!atomic_load(&async)) {
+      fprintf(fp, format, str);
+      fputc('\n', fp);
+      fflush(fp);
+    }
   }
 }
 
 /**************** flog_d ****************/
-/* 
+/*
  * log an integer to the logfile, if logging is enabled.
  * The string `format` can reference '%d' to incorporate `num`.
  */
@@ -42,14 +88,20 @@ void
 flog_d(FILE* fp, const char* format, const int num)
 {
   if (fp != NULL && format != NULL) {
-    fprintf(fp, format, num);
-    fputc('\n', fp);
-    fflush(fp);
+    logslot_t* slot = logClaim(fp);
+    if (slot != NULL) {
+      snprintf(slot->line, LogLineBytes, format, num);
+      logPublish(slot);
+    } else if (!atomic_load(&async)) {
+      fprintf(fp, format, num);
+      fputc('\n', fp);
+      fflush(fp);
+    }
   }
 }
 
 /**************** flog_c ****************/
-/* 
+/*
  * log a character to the logfile, if logging is enabled.
  * The string `format` can reference '%c' to incorporate `ch`.
  */
@@ -57,28 +109,40 @@ void
 flog_c(FILE* fp, const char* format, const char ch)
 {
   if (fp != NULL && format != NULL) {
-    fprintf(fp, format, ch);
-    fputc('\n', fp);
-    fflush(fp);
+    logslot_t* slot = logClaim(fp);
+    if (slot != NULL) {
+      snprintf(slot->line, LogLineBytes, format, ch);
+      logPublish(slot);
+    } else if (!atomic_load(&async)) {
+      fprintf(fp, format, ch);
+      fputc('\n', fp);
+      fflush(fp);
+    }
   }
 }
 
 /**************** flog_v ****************/
-/* 
+/*
  * log a message to the logfile, if logging is enabled.
  */
 void
 flog_v(FILE* fp, const char* str)
 {
   if (fp != NULL && str != NULL) {
-    fputs(str, fp);
-    fputc('\n', fp);
-    fflush(fp);
+    logslot_t* slot = logClaim(fp);
+    if (slot != NULL) {
+      snprintf(slot->line, LogLineBytes, "%s", str);
+      logPublish(slot);
+    } else if (!atomic_load(&async)) {
+      fputs(str, fp);
+      fputc('\n', fp);
+      fflush(fp);
+    }
   }
 }
 
 /**************** flog_e ****************/
-/* 
+/*
  * log an error to the logfile, if logging is enabled.
  * Expects the global variable errno (sys/errno.h) to indicate the error,
  * so this is best used immediately after a system call.
@@ -87,17 +151,165 @@ void
 flog_e(FILE* fp, const char* str)
 {
   if (fp != NULL && str != NULL) {
-    fprintf(fp, "%s: %s\n", str, strerror(errno));
-    fflush(fp);
+    const char* error = strerror(errno);   // before anything changes errno
+    logslot_t* slot = logClaim(fp);
+    if (slot != NULL) {
+      snprintf(slot->line, LogLineBytes, "%s: %s", str, error);
+      logPublish(slot);
+    } else if (!atomic_load(&async)) {
+      fprintf(fp, "%s: %s\n", str, error);
+      fflush(fp);
+    }
   }
 }
 
 /**************** flog_done ****************/
-/* 
- * Done with logging.  Notes this, then disables logging. 
+/*
+ * Done with logging.  Notes this, then disables logging.
  */
 void
 flog_done(FILE* fp)
 {
   flog_v(fp, "END OF LOG");
 }
+
+/**************** log_startAsync ****************/
+/* see log.h for description */
+bool
+log_startAsync(void)
+{
+  if (atomic_load(&async)) {
+    return true;              // already running
+  }
+
+  // every slot starts out free for the producer holding its index
+  for (size_t i = 0; i < LogSlots; i++) {
+    atomic_store(&ring[i].seq, i);
+  }
+  atomic_store(&tail, 0);
+  head = 0;
+  atomic_store(&stopping, false);
+  // 'ready' lives as long as the process: a producer that claimed a
+  // slot just before log_stopAsync may post to it after the writer exits
+  if (!readyInit) {
+    if (sem_init(&ready, 0, 0) != 0) {
+      return false;
+    }
+    readyInit = true;
+  }
+  if (pthread_create(&writer, NULL, logWriter, NULL) != 0) {
+    return false;
+  }
+  atomic_store(&async, true);
+
+  // make sure queued lines are not lost when the program exits
+  if (!atexitDone) {
+    atexit(log_stopAsync);
+    atexitDone = true;
+  }
+  return true;
+}
+
+/**************** log_stopAsync ****************/
+/* see log.h for description */
+void
+log_stopAsync(void)
+{
+  if (!atomic_exchange(&async, false)) {
+    return;                   // not running
+  }
+  atomic_store(&stopping, true);
+  sem_post(&ready);           // wake the writer so it notices
+  pthread_join(writer, NULL);
+}
+
+/**************** logClaim ****************/
+/*
+ * Claim a free slot in the ring buffer for a line bound for fp.
+ * Returns NULL if not logging asynchronously, or if the ring is full
+ * (in which case the line is counted as dropped).
+ */
+static logslot_t*
+logClaim(FILE* fp)
+{
+  if (!atomic_load_explicit(&async, memory_order_acquire)) {
+    return NULL;
+  }
+
+  size_t pos = atomic_load_explicit(&tail, memory_order_relaxed);
+  while (true) {
+    logslot_t* slot = &ring[pos & (LogSlots - 1)];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq == pos) {
+      // the slot is free; try to take it
+      if (atomic_compare_exchange_weak_explicit(&tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        slot->fp = fp;
+        return slot;
+      }
+      // another producer got there first; 'pos' now holds the new tail
+    } else if (seq < pos) {
+      // the writer has not yet emptied this slot: the ring is full
+      atomic_fetch_add(&dropped, 1);
+      return NULL;
+    } else {
+      // another producer took this slot; try again at the new tail
+      pos = atomic_load_explicit(&tail, memory_order_relaxed);
+    }
+  }
+}
+
+/**************** logPublish ****************/
+/*
+ * Hand a filled-in slot to the writer thread.
+ */
+static void
+logPublish(logslot_t* slot)
+{
+  size_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+  sem_post(&ready);
+}
+
+/**************** logWriter ****************/
+/*
+ * The background writer: write each line as it is published, flushing
+ * only when the ring is empty, until log_stopAsync asks us to finish.
+ */
+static void*
+logWriter(void* arg)
+{
+  while (true) {
+    sem_wait(&ready);
+
+    // write every line that is ready, in order
+    while (true) {
+      logslot_t* slot = &ring[head & (LogSlots - 1)];
+      size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+      if (seq != head + 1) {
+        break;                // next line is not published yet
+      }
+      fputs(slot->line, slot->fp);
+      fputc('\n', slot->fp);
+      atomic_store_explicit(&slot->seq, head + LogSlots, memory_order_release);
+      head++;
+    }
+
+    // report any lines we had to drop
+    int lost = atomic_exchange(&dropped, 0);
+    if (lost > 0) {
+      fprintf(stderr, "log: %d lines dropped, queue full\n", lost);
+    }
+    fflush(NULL);
+
+    if (atomic_load(&stopping)) {
+      // producers may still be finishing lines they claimed; wait for them
+      size_t claimed = atomic_load(&tail);
+      if (head == claimed) {
+        return NULL;
+      }
+      sem_post(&ready);       // come back around for the rest
+    }
+  }
+}
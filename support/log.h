@@ -16,6 +16,16 @@
  * its own logging fp and thus can independently control whether to log and
  * where to log.
  * 
+ * Logging is synchronous by default: each line is written and flushed
+ * before the log_x call returns.  A program that logs on a hot path can
+ * call log_startAsync() once; after that, each log_x call just copies its
+ * line into a ring buffer, and a background thread does the writing.
+ * 
+ * Each log statement may be given a severity by wrapping it in 
+ *   if (LOG_ENABLED(LOG_DEBUG)) { log_s(...); }
+ * Statements above the compile-time LOG_LEVEL are removed by the compiler,
+ * so they cost nothing at run time.  Build with -DLOG_LEVEL=3 to keep them.
+ * 
  * David Kotz, May 2019
  */
 
@@ -24,6 +34,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+
+/*********** severity levels ****************/
+#define LOG_ERROR 1     // something went wrong
+#define LOG_INFO  2     // occasional events, like startup and shutdown
+#define LOG_DEBUG 3     // per-message detail, including message contents
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+/* LOG_ENABLED: true iff statements of the given severity are compiled in. */
+#define LOG_ENABLED(level) ((level) <= LOG_LEVEL)
 
 /*********** file-local global variable ****************/
 /* Here is an example of a judicious use of a global variable.
@@ -90,4 +113,20 @@ static inline void log_done(void) { flog_done(logFP); logFP = NULL; }
  * It is the caller's responsibility to close the file, if desired.
  */
 
+/*********** asynchronous logging ****************/
+
+bool log_startAsync(void);
+/* log_startAsync: from now on, queue log lines for a background writer
+ * thread instead of writing them in the caller.  Lines are truncated to
+ * a few hundred characters, and if the queue fills up, further lines are
+ * dropped (and counted) rather than making the caller wait.
+ * Returns true if the writer is running (including if already started).
+ * The queued lines are written at exit, or by log_stopAsync().
+ */
+
+void log_stopAsync(void);
+/* log_stopAsync: write out everything queued, stop the writer thread,
+ * and go back to writing synchronously.  Does nothing if not started.
+ */
+
 #endif // _LOG_H_
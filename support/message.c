@@ -13,6 +13,8 @@
  * David Kotz - May 2019
  */
 
+#define _GNU_SOURCE       // clock_gettime
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -20,10 +22,16 @@
 #include <errno.h>
 #include <string.h>
 #include <strings.h>
+#include <stdint.h>
+#include <time.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <poll.h>
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <math.h>
+#include <pthread.h>
 #include "message.h"
 #include "log.h"
 
@@ -35,6 +43,27 @@
 static const int MinPort = 1024;
 static const int MaxPort = 65535;
 
+/* Large messages may be split into fragments; see message_setMTU.
+ * Each fragment begins with an 11-byte header:
+ *   FragMagic, message id (4 bytes), fragment index (2), count (2),
+ *   and the number of payload bytes carried by every fragment but the last (2).
+ * A receiver missing some fragments replies with a NACK:
+ *   NackMagic, message id (4 bytes), then the index (2) of each missing one.
+ * All fields are in network byte order.  Neither magic byte can start a
+ * text message, so fragments and NACKs never reach the caller's handler.
+ */
+static const unsigned char FragMagic = 0x01;
+static const unsigned char NackMagic = 0x02;
+#define FragHeaderBytes 11
+#define MinMTU 64                                // smallest MTU we accept
+#define MaxFragments ((65507 + MinMTU - FragHeaderBytes - 1) \
+                      / (MinMTU - FragHeaderBytes))
+#define MaxNackIndices 512   // most indices listed in one NACK
+#define RetainSlots 16       // recently fragmented messages kept for resending
+#define ReassemblySlots 8    // messages being reassembled at once
+static const int NackDelayMs = 20; // wait this long for missing fragments
+static const int MaxNacks = 3;     // then NACK this many times, then give up
+
 /**************** file-local global variables ****************/
 /* This is an example of a judicious use of a global variable.
  * This module provides init() and done() functions that allow it
@@ -45,8 +74,96 @@ static const int MaxPort = 65535;
  * One disadvantage to this approach is that all users of this module
  * must work with the same socket, and thus the same port number,
  * but a more flexible approach would require a much more complex interface.
+ *
+ * The socket, and the reassembly state below that goes with it, are
+ * per thread.  A single-threaded program never notices; a server that
+ * wants one socket per thread calls message_initShard in each thread.
+ * The socket opened by message_init is also used for sending by any
+ * thread that has no socket of its own, such as a pool of workers
+ * serving messages received by one message_loop.
+ */
+static _Thread_local int ourSocket = 0;  // socket on which to receive messages
+static int sharedSocket = 0;             // socket opened by message_init
+static int openSockets = 0;              // sockets open, in all threads
+
+/**************** file-local types ****************/
+/* A fragmented message we sent recently, kept in case some is NACKed. */
+typedef struct retained {
+  addr_t to;                  // where it was sent
+  uint32_t id;                // its message id; zero if slot is unused
+  int len;                    // its length
+  char* data;                 // copy of the message (message_MaxBytes)
+} retained_t;
+
+/* A fragmented message we are receiving. */
+typedef struct reassembly {
+  bool inUse;                 // is a message being reassembled here?
+  addr_t from;                // who is sending it
+  uint32_t id;                // its message id
+  int count;                  // number of fragments in the message
+  int chunk;                  // bytes in every fragment but the last
+  int len;                    // total length; -1 until last fragment arrives
+  int received;               // number of distinct fragments received
+  int highest;                // highest fragment index received
+  int nacks;                  // number of NACKs sent for missing fragments
+  long deadline;              // when (ms) to NACK whatever is still missing
+  unsigned char have[MaxFragments/8 + 1];  // bitmap of fragments received
+  char* data;                 // the message (message_MaxBytes+1)
+} reassembly_t;
+
+/* Fragmentation state; mtu == 0 means we never fragment what we send,
+ * but we always reassemble what we receive.  Messages we sent are
+ * retained for all threads, under retainLock, because a NACK reaches
+ * whichever thread reads the socket, not necessarily the one that sent;
+ * messages being reassembled belong to the thread reading the socket.
+ */
+static int mtu = 0;
+static pthread_mutex_t retainLock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t nextFragId = 1;
+static retained_t retained[RetainSlots];
+static int nextRetained = 0;
+static _Thread_local reassembly_t reassembly[ReassemblySlots];
+
+/* The running message_loop's timeout, in seconds (0 if none); handlers
+ * may change it with message_setTimeout.
  */
-static int ourSocket = 0;     // socket on which to receive messages
+static _Thread_local float loopTimeout = 0;
+
+/**************** file-local functions ****************/
+static int openSocket(const int port, const bool shared);
+static int sendSocket(void);
+static long nowMs(void);
+static void sendFragmented(const addr_t to, const struct iovec* iov,
+                           const int iovcnt, const int len);
+static void sendFragment(const addr_t to, const uint32_t id, const int index,
+                         const int count, const int chunk,
+                         const char* data, const int len);
+static bool handleDatagram(void* arg,
+                           bool (*handleMessage)(void* arg, const addr_t from,
+                                                 const char* buf),
+                           const addr_t sender, char* buf, const int nbytes);
+static void handleNack(const addr_t from, const unsigned char* buf,
+                       const int nbytes);
+static char* handleFragment(const addr_t from, const unsigned char* buf,
+                            const int nbytes);
+static void sendNack(reassembly_t* r, const bool all);
+static void nackOverdue(void);
+static long nextNackDelay(void);
+#ifdef MESSAGE_URING
+typedef struct uring uring_t;
+static _Thread_local uring_t* uring;
+static bool uringSend(const addr_t to, const struct iovec* iov,
+                      const int iovcnt, const int len);
+static void uringFlush(void);
+static bool uringPending(void);
+static uring_t* uringNew(void);
+static void uringDelete(uring_t* u);
+static bool uringLoop(void* arg,
+                      bool (*handleTimeout)(void* arg),
+                      bool (*handleInput)  (void* arg),
+                      bool (*handleMessage)(void* arg,
+                                            const addr_t from, const char* buf));
+#endif
 
 /***********************************************************************/
 /**************** message_init ****************/
@@ -60,7 +177,46 @@ int
 message_init(FILE* logFP)
 {
   log_init(logFP);
+  int port = openSocket(0, false);
+  if (port != 0) {
+    sharedSocket = ourSocket;
+  }
+  return port;
+}
+
+/**************** message_initShard ****************/
+/* 
+ * Set up this thread's socket, sharing the port with other threads.
+ * Log error and return zero if any error.
+ * See message.h for detailed description.
+ */
+int
+message_initShard(FILE* fp, const int port)
+{
+  // the first thread starts the log; the others only read logFP
+  if (fp != logFP) {
+    log_init(fp);
+  }
 
+  if (port != 0 && (port < MinPort || port > MaxPort)) {
+    log_d("message_initShard: illegal port number '%d'", port);
+    return 0;
+  }
+  return openSocket(port, true);
+}
+
+/**************** openSocket ****************/
+/* 
+ * Open this thread's socket and bind it to the given port, or to any
+ * free port if port is 0.  If 'shared', the socket is opened with
+ * SO_REUSEPORT, so other sockets may bind the same port; the kernel
+ * then spreads incoming datagrams among them by a hash of the sender's
+ * address, so each sender's messages always reach the same socket.
+ * Return the port number, or zero on error.
+ */
+static int
+openSocket(const int port, const bool shared)
+{
   // Have we already been initialized?
   if (ourSocket != 0) {
     log_v("message_init: called again, when already initialized");
@@ -75,11 +231,20 @@ message_init(FILE* logFP)
     return 0;
   }
 
+  // Allow other threads' sockets to share the port
+  int on = 1;
+  if (shared && setsockopt(ourSocket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+    log_e("message_init: setting SO_REUSEPORT");
+    close(ourSocket);
+    ourSocket = 0;
+    return 0;
+  }
+
   // Name socket using wildcards
   struct sockaddr_in self;  // our address
   self.sin_family = AF_INET;
   self.sin_addr.s_addr = INADDR_ANY;
-  self.sin_port = 0;
+  self.sin_port = htons(port);
   if (bind(ourSocket, (struct sockaddr *) &self, sizeof(self))) {
     log_e("message_init: binding socket name");
     close(ourSocket);
@@ -96,10 +261,24 @@ message_init(FILE* logFP)
     return 0;
   }
   // extract our port number
-  int port = ntohs(self.sin_port);
-  log_d("message_init: ready at port '%d'", port);
+  int ourPort = ntohs(self.sin_port);
+  log_d("message_init: ready at port '%d'", ourPort);
 
-  return port;
+  pthread_mutex_lock(&retainLock);
+  openSockets++;
+  pthread_mutex_unlock(&retainLock);
+  return ourPort;
+}
+
+/**************** sendSocket ****************/
+/* 
+ * Return the socket this thread should send on: its own, if it has one,
+ * or else the one opened by message_init; zero if neither.
+ */
+static int
+sendSocket(void)
+{
+  return ourSocket != 0 ? ourSocket : sharedSocket;
 }
 
 /**************** message_noAddr ****************/
@@ -191,7 +370,8 @@ message_setAddr(const char* hostname, const char* portString, addr_t* addr)
 /**************** message_stringAddr ****************/
 /* Produce a string representation of the address.
  * Returns pointer to static storage that should not be retained
- * (because every call to this function returns the same pointer).
+ * (because every call to this function, in the same thread,
+ * returns the same pointer).
  * See message.h for detailed description.
  */
 const char*
@@ -199,7 +379,7 @@ message_stringAddr(const addr_t addr)
 {
   // Maximum string length to hold an IP address and port, plus null.
   // e.g., 255.255.255.255:65507
-  static char addrString[22]; // constant appears in snprintf below
+  static _Thread_local char addrString[22]; // constant appears in snprintf below
 
   snprintf(addrString, 22, "%s:%05d",
 	   inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
@@ -207,6 +387,24 @@ message_stringAddr(const addr_t addr)
   return addrString;
 }
 
+/**************** message_setMTU ****************/
+/* 
+ * Set the size above which outgoing messages are fragmented.
+ * See message.h for detailed description.
+ */
+void
+message_setMTU(const int newMTU)
+{
+  if (newMTU <= 0) {
+    mtu = 0;
+  } else if (newMTU < MinMTU) {
+    log_d("message_setMTU: raising MTU to minimum of %d", MinMTU);
+    mtu = MinMTU;
+  } else {
+    mtu = newMTU;
+  }
+}
+
 /**************** numLines ****************/
 /*
  * Return number of lines needed to print the string:
@@ -245,7 +443,8 @@ numLines(const char* string)
 void
 message_send(const addr_t to, const char* message)
 {
-  if (ourSocket == 0) {
+  const int sock = sendSocket();
+  if (sock == 0) {
     log_v("message_send: called before message_init");
     return; // error in usage of this function.
   }
@@ -253,16 +452,99 @@ message_send(const addr_t to, const char* message)
     log_v("message_send: called with null message");
     return; // error in usage of this function.
   }
-  if (sendto(ourSocket, message, strlen(message), 0,
+  const int len = strlen(message);
+  struct iovec iov = { .iov_base = (void*) message, .iov_len = len };
+  if (mtu > 0 && len > mtu) {
+#ifdef MESSAGE_URING
+    uringFlush();             // keep messages in order
+#endif
+    sendFragmented(to, &iov, 1, len);
+    if (LOG_ENABLED(LOG_DEBUG)) {
+      log_s("message_send: TO %s (fragmented)", message_stringAddr(to));
+      log_d("message_send: %d lines:", numLines(message));
+      log_s("%s", message);
+    }
+    return;
+  }
+#ifdef MESSAGE_URING
+  if (uringSend(to, &iov, 1, len)) {
+    if (LOG_ENABLED(LOG_DEBUG)) {
+      log_s("message_send: TO %s (queued)", message_stringAddr(to));
+      log_d("message_send: %d lines:", numLines(message));
+      log_s("%s", message);
+    }
+    return;
+  }
+#endif
+  if (sendto(sock, message, len, 0,
              (struct sockaddr *) &to, sizeof(to)) < 0) {
     log_e("message_send: error sending to datagram socket");
-  } else {
+  } else if (LOG_ENABLED(LOG_DEBUG)) {
     log_s("message_send: TO %s", message_stringAddr(to));
     log_d("message_send: %d lines:", numLines(message));
     log_s("%s", message);
   }
 }
 
+/**************** message_sendv ****************/
+/* 
+ * Send a message, gathered from several buffers, to the correspondent.
+ * See message.h for detailed description.
+ */
+void
+message_sendv(const addr_t to, const struct iovec* iov, const int iovcnt)
+{
+  const int sock = sendSocket();
+  if (sock == 0) {
+    log_v("message_sendv: called before message_init");
+    return; // error in usage of this function.
+  }
+  if (iov == NULL || iovcnt <= 0) {
+    log_v("message_sendv: called with no buffers");
+    return; // error in usage of this function.
+  }
+
+  int len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+  if (mtu > 0 && len > mtu) {
+#ifdef MESSAGE_URING
+    uringFlush();             // keep messages in order
+#endif
+    sendFragmented(to, iov, iovcnt, len);
+    if (LOG_ENABLED(LOG_DEBUG)) {
+      log_s("message_sendv: TO %s (fragmented)", message_stringAddr(to));
+      log_d("message_sendv: %d bytes", len);
+    }
+    return;
+  }
+#ifdef MESSAGE_URING
+  if (uringSend(to, iov, iovcnt, len)) {
+    if (LOG_ENABLED(LOG_DEBUG)) {
+      log_s("message_sendv: TO %s (queued)", message_stringAddr(to));
+      log_d("message_sendv: %d bytes", len);
+    }
+    return;
+  }
+#endif
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = (void*) &to;
+  msg.msg_namelen = sizeof(to);
+  msg.msg_iov = (struct iovec*) iov;
+  msg.msg_iovlen = iovcnt;
+
+  ssize_t nbytes = sendmsg(sock, &msg, 0);
+  if (nbytes < 0) {
+    log_e("message_sendv: error sending to datagram socket");
+  } else if (LOG_ENABLED(LOG_DEBUG)) {
+    log_s("message_sendv: TO %s", message_stringAddr(to));
+    log_d("message_sendv: %d bytes", (int) nbytes);
+  }
+}
+
 /**************** message_loop ****************/
 /* 
  * Loop forever, calling handler functions for stdin or socket,
@@ -297,17 +579,27 @@ message_loop(void* arg, const float timeout,
     return false; // error in usage of this function.
   }
 
+  loopTimeout = timeout;
+
+#ifdef MESSAGE_URING
+  // use this thread's ring, if the kernel lets us have one
+  if (uring == NULL) {
+    uring = uringNew();
+  }
+  if (uring != NULL) {
+    return uringLoop(arg, handleTimeout, handleInput, handleMessage);
+  }
+#endif
+
   // set up for timeouts, if desired
   struct timeval* timerp = NULL; // stays null if no timeout desired
   struct timeval  timer;          // timerp = &timer if timeout desired
-  struct timeval  timeoutval;     // timeval equivalent of parameter 'timeout'
-  if (timeout > 0.0) {
-    timeoutval.tv_sec  = (int)timeout;
-    timeoutval.tv_usec = timeout - (int)timeout;
-  }
 
   // loop until error or some handler indicates time to quit looping
   while (true) {
+    // ask again for any fragments that are overdue
+    nackOverdue();
+
     // for use with select()
     fd_set rfds;        // set of file descriptors we want to read
     
@@ -322,13 +614,26 @@ message_loop(void* arg, const float timeout,
       FD_SET(ourSocket, &rfds); // monitor the socket
       nfds = ourSocket+1;       // highest-numbered fd in rfds
     }
-    if (timeout > 0.0) {      // is timeout desired?
-      timer = timeoutval;     // set the timer to the timeout value
+    if (loopTimeout > 0.0) {  // is timeout desired?
+      timer.tv_sec  = (int)loopTimeout;   // set the timer to the timeout
+      timer.tv_usec = (suseconds_t)((loopTimeout - (int)loopTimeout) * 1e6);
       timerp = &timer;        // pass that timer to select
     } else {
       timerp = NULL;          // no timeout is desired
     }
 
+    // wake up in time to NACK missing fragments, if any are pending;
+    // that wake-up is ours, and is not reported to handleTimeout
+    bool nackTimer = false;
+    long nackDelay = nextNackDelay();
+    if (nackDelay >= 0 && (timerp == NULL 
+        || nackDelay < timer.tv_sec * 1000 + timer.tv_usec / 1000)) {
+      timer.tv_sec = nackDelay / 1000;
+      timer.tv_usec = (nackDelay % 1000) * 1000;
+      timerp = &timer;
+      nackTimer = true;
+    }
+
     // Wait for input on either source
     int select_response = select(nfds, &rfds, NULL, NULL, timerp);
     // note: 'rfds' updated
@@ -343,9 +648,14 @@ message_loop(void* arg, const float timeout,
 	log_e("message_loop: select()");
 	return false; // error
       }
+    } else if (select_response == 0 && nackTimer) {
+      // time to NACK missing fragments; done at the top of the loop
+      continue;
     } else if (select_response == 0) {
       // timeout occurred
-      log_v("message_loop: select() timed out");
+      if (LOG_ENABLED(LOG_DEBUG)) {
+        log_v("message_loop: select() timed out");
+      }
       if (handleTimeout != NULL && (*handleTimeout)(arg)) {
         break; // handler says to exit loop 
       }
@@ -354,14 +664,18 @@ message_loop(void* arg, const float timeout,
 
       if (FD_ISSET(0, &rfds)) {
         // stdin has input ready
-        log_v("message_loop: input ready on stdin");
+        if (LOG_ENABLED(LOG_DEBUG)) {
+          log_v("message_loop: input ready on stdin");
+        }
         if (handleInput != NULL && (*handleInput)(arg)) {
           break; // handler says to exit loop 
         }
       }
       if (FD_ISSET(ourSocket, &rfds)) {
         // socket has input ready
-        log_v("message_loop: message ready on socket");
+        if (LOG_ENABLED(LOG_DEBUG)) {
+          log_v("message_loop: message ready on socket");
+        }
         struct sockaddr_in sender;     // sender of this message
         struct sockaddr *senderp = (struct sockaddr *) &sender;
         socklen_t senderlen = sizeof(sender);  // must pass address to length
@@ -371,23 +685,8 @@ message_loop(void* arg, const float timeout,
         if (nbytes < 0) {
           // error, ignore it
           log_e("message_loop: receiving from socket");
-        } else {
-          buf[nbytes] = '\0';     // null terminate message string
-          // where was it from?
-          if (sender.sin_family != AF_INET) {
-            // ignore it
-            log_d("message_loop: non-Internet family %d\n", sender.sin_family);
-          } else {
-	    // record it
-	    log_s("message_loop: FROM %s", message_stringAddr(sender));
-	    log_d("message_loop: %d lines:", numLines(buf));
-	    log_s("%s", buf);
-
-            // handle it
-            if (handleMessage != NULL && (*handleMessage)(arg, sender, buf)) {
-              break; // handler says to exit loop 
-            }
-          }
+        } else if (handleDatagram(arg, handleMessage, sender, buf, nbytes)) {
+          break; // handler says to exit loop 
         }
       }
     }
@@ -395,6 +694,83 @@ message_loop(void* arg, const float timeout,
   return true;
 }
 
+/**************** message_setTimeout ****************/
+/* 
+ * Change the running message_loop's timeout.
+ * See message.h for detailed description.
+ */
+void
+message_setTimeout(const float timeout)
+{
+  loopTimeout = (timeout > 0.0) ? timeout : 0;
+}
+
+/**************** message_pending ****************/
+/* 
+ * Is a message waiting to be read by message_loop?
+ * See message.h for detailed description.
+ */
+bool
+message_pending(void)
+{
+  if (ourSocket == 0) {
+    return false;
+  }
+#ifdef MESSAGE_URING
+  if (uringPending()) {
+    return true;
+  }
+#endif
+  struct pollfd pfd = { .fd = ourSocket, .events = POLLIN };
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+/**************** handleDatagram ****************/
+/* 
+ * Deal with one datagram received from 'sender' into buf, which has
+ * room for a null after its 'nbytes' bytes: a NACK or a fragment is
+ * handled here, and anything else (or a message completed by this
+ * fragment) is passed to handleMessage.
+ * Returns true if handleMessage says to exit the loop.
+ */
+static bool
+handleDatagram(void* arg,
+               bool (*handleMessage)(void* arg,
+                                     const addr_t from, const char* buf),
+               const addr_t sender, char* buf, const int nbytes)
+{
+  buf[nbytes] = '\0';     // null terminate message string
+  const char* message = buf;
+  // where was it from?
+  if (sender.sin_family != AF_INET) {
+    // ignore it
+    log_d("message_loop: non-Internet family %d\n", sender.sin_family);
+    message = NULL;
+  } else if (nbytes > 0 && (unsigned char) buf[0] == NackMagic) {
+    // peer is missing fragments of something we sent
+    handleNack(sender, (unsigned char*) buf, nbytes);
+    message = NULL;
+  } else if (nbytes > 0 && (unsigned char) buf[0] == FragMagic) {
+    // one piece of a larger message; NULL until it is complete
+    message = handleFragment(sender, (unsigned char*) buf, nbytes);
+  }
+
+  if (message != NULL) {
+    // record it
+    if (LOG_ENABLED(LOG_DEBUG)) {
+      log_s("message_loop: FROM %s", message_stringAddr(sender));
+      log_d("message_loop: %d lines:", numLines(message));
+      log_s("%s", message);
+    }
+
+    // handle it
+    if (handleMessage != NULL && (*handleMessage)(arg, sender, message)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 /**************** message_done ****************/
 /* 
  * Clean up the message module, prior to exit.
@@ -403,13 +779,935 @@ message_loop(void* arg, const float timeout,
 void
 message_done(void)
 {
+#ifdef MESSAGE_URING
+  uringDelete(uring);
+  uring = NULL;
+#endif
+  pthread_mutex_lock(&retainLock);
   if (ourSocket != 0) {
+    if (ourSocket == sharedSocket) {
+      sharedSocket = 0;
+    }
     close(ourSocket);
     ourSocket = 0;
+    openSockets--;
+  }
+  // the last thread out frees the retained messages
+  if (openSockets == 0) {
+    for (int i = 0; i < RetainSlots; i++) {
+      free(retained[i].data);
+      retained[i].data = NULL;
+      retained[i].id = 0;
+    }
+  }
+  pthread_mutex_unlock(&retainLock);
+  for (int i = 0; i < ReassemblySlots; i++) {
+    free(reassembly[i].data);
+    reassembly[i].data = NULL;
+    reassembly[i].inUse = false;
   }
   log_v("message_done: message module closing down.");
 }
 
+/**************** nowMs ****************/
+/* Return a monotonic clock reading, in milliseconds. */
+static long
+nowMs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+/**************** sendFragmented ****************/
+/* 
+ * Send a message of 'len' bytes, gathered from the given buffers, as a 
+ * series of fragments no bigger than the MTU.  A copy of the message is
+ * retained so that fragments can be resent if the receiver NACKs them.
+ * Threads sending fragmented messages take turns.
+ */
+static void
+sendFragmented(const addr_t to, const struct iovec* iov, const int iovcnt,
+               const int len)
+{
+  if (len > message_MaxBytes) {
+    log_d("message_send: message of %d bytes is too long", len);
+    return;
+  }
+
+  // retain a copy in the oldest slot
+  pthread_mutex_lock(&retainLock);
+  retained_t* r = &retained[nextRetained];
+  nextRetained = (nextRetained + 1) % RetainSlots;
+  if (r->data == NULL && (r->data = malloc(message_MaxBytes)) == NULL) {
+    pthread_mutex_unlock(&retainLock);
+    log_v("message_send: out of memory for fragments");
+    return;
+  }
+  int pos = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(r->data + pos, iov[i].iov_base, iov[i].iov_len);
+    pos += iov[i].iov_len;
+  }
+  r->to = to;
+  r->len = len;
+  r->id = nextFragId++;
+  if (nextFragId == 0) {
+    nextFragId = 1;         // zero marks an unused slot
+  }
+
+  // send every fragment
+  const int chunk = mtu - FragHeaderBytes;
+  const int count = (len + chunk - 1) / chunk;
+  for (int index = 0; index < count; index++) {
+    sendFragment(to, r->id, index, count, chunk, r->data, len);
+  }
+  pthread_mutex_unlock(&retainLock);
+}
+
+/**************** sendFragment ****************/
+/* 
+ * Send fragment number 'index' of the message 'data' of 'len' bytes.
+ */
+static void
+sendFragment(const addr_t to, const uint32_t id, const int index,
+             const int count, const int chunk, const char* data, const int len)
+{
+  unsigned char header[FragHeaderBytes];
+  const uint32_t netId = htonl(id);
+  const uint16_t netIndex = htons(index);
+  const uint16_t netCount = htons(count);
+  const uint16_t netChunk = htons(chunk);
+  header[0] = FragMagic;
+  memcpy(header + 1, &netId, 4);
+  memcpy(header + 5, &netIndex, 2);
+  memcpy(header + 7, &netCount, 2);
+  memcpy(header + 9, &netChunk, 2);
+
+  const int offset = index * chunk;
+  const int fragLen = (index == count - 1) ? len - offset : chunk;
+  struct iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = FragHeaderBytes;
+  iov[1].iov_base = (void*) (data + offset);
+  iov[1].iov_len = fragLen;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = (void*) &to;
+  msg.msg_namelen = sizeof(to);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  if (sendmsg(sendSocket(), &msg, 0) < 0) {
+    log_e("message_send: error sending fragment");
+  }
+}
+
+/**************** handleNack ****************/
+/* 
+ * A receiver has NACKed some fragments; resend them if we still can.
+ */
+static void
+handleNack(const addr_t from, const unsigned char* buf, const int nbytes)
+{
+  if (nbytes < 5) {
+    return;                   // malformed
+  }
+  uint32_t id;
+  memcpy(&id, buf + 1, 4);
+  id = ntohl(id);
+
+  pthread_mutex_lock(&retainLock);
+  for (int i = 0; i < RetainSlots; i++) {
+    retained_t* r = &retained[i];
+    if (r->id == id && r->id != 0 && message_eqAddr(r->to, from)) {
+      const int chunk = mtu - FragHeaderBytes;
+      const int count = (r->len + chunk - 1) / chunk;
+      for (int pos = 5; pos + 2 <= nbytes; pos += 2) {
+        uint16_t index;
+        memcpy(&index, buf + pos, 2);
+        index = ntohs(index);
+        if (index < count) {
+          sendFragment(r->to, r->id, index, count, chunk, r->data, r->len);
+        }
+      }
+      if (LOG_ENABLED(LOG_DEBUG)) {
+        log_d("message_loop: resent fragments of message %d", (int) id);
+      }
+      pthread_mutex_unlock(&retainLock);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&retainLock);
+  log_d("message_loop: NACK for message %d no longer retained", (int) id);
+}
+
+/**************** handleFragment ****************/
+/* 
+ * Add a fragment to the message it belongs to.
+ * Returns the whole (null-terminated) message once every fragment has
+ * arrived, otherwise NULL.  The returned string is reused by later calls.
+ */
+static char*
+handleFragment(const addr_t from, const unsigned char* buf, const int nbytes)
+{
+  if (nbytes < FragHeaderBytes) {
+    return NULL;              // malformed
+  }
+  uint32_t id;
+  uint16_t index, count, chunk;
+  memcpy(&id, buf + 1, 4);
+  memcpy(&index, buf + 5, 2);
+  memcpy(&count, buf + 7, 2);
+  memcpy(&chunk, buf + 9, 2);
+  id = ntohl(id);
+  index = ntohs(index);
+  count = ntohs(count);
+  chunk = ntohs(chunk);
+  const int fragLen = nbytes - FragHeaderBytes;
+  if (count == 0 || count > MaxFragments || index >= count || chunk == 0
+      || (count - 1) * chunk + fragLen > message_MaxBytes
+      || fragLen > chunk || (index < count - 1 && fragLen != chunk)) {
+    log_v("message_loop: ignoring malformed fragment");
+    return NULL;
+  }
+
+  // find the message this fragment belongs to
+  reassembly_t* r = NULL;
+  for (int i = 0; i < ReassemblySlots && r == NULL; i++) {
+    if (reassembly[i].inUse && reassembly[i].id == id
+        && message_eqAddr(reassembly[i].from, from)) {
+      r = &reassembly[i];
+    }
+  }
+
+  if (r == NULL) {
+    // a new message; it supersedes any unfinished one from the same sender,
+    // else take a free slot, else the one that has waited longest
+    for (int i = 0; i < ReassemblySlots && r == NULL; i++) {
+      if (reassembly[i].inUse && message_eqAddr(reassembly[i].from, from)) {
+        r = &reassembly[i];
+      }
+    }
+    for (int i = 0; i < ReassemblySlots && r == NULL; i++) {
+      if (!reassembly[i].inUse) {
+        r = &reassembly[i];
+      }
+    }
+    if (r == NULL) {
+      r = &reassembly[0];
+      for (int i = 1; i < ReassemblySlots; i++) {
+        if (reassembly[i].deadline < r->deadline) {
+          r = &reassembly[i];
+        }
+      }
+    }
+    if (r->data == NULL && (r->data = malloc(message_MaxBytes + 1)) == NULL) {
+      log_v("message_loop: out of memory for fragments");
+      return NULL;
+    }
+    r->inUse = true;
+    r->from = from;
+    r->id = id;
+    r->count = count;
+    r->chunk = chunk;
+    r->len = -1;
+    r->received = 0;
+    r->highest = -1;
+    r->nacks = 0;
+    memset(r->have, 0, sizeof(r->have));
+  } else if (r->count != count || r->chunk != chunk) {
+    log_v("message_loop: ignoring inconsistent fragment");
+    return NULL;
+  }
+
+  if (r->have[index / 8] & (1 << (index % 8))) {
+    return NULL;              // duplicate
+  }
+  r->have[index / 8] |= (1 << (index % 8));
+  r->received++;
+  memcpy(r->data + index * chunk, buf + FragHeaderBytes, fragLen);
+  if (index == count - 1) {
+    r->len = index * chunk + fragLen;
+  }
+
+  if (r->received == r->count) {
+    r->data[r->len] = '\0';
+    r->inUse = false;
+    return r->data;
+  }
+
+  // a gap means earlier fragments were lost; ask for them right away
+  if (index > r->highest + 1) {
+    r->highest = index;
+    sendNack(r, false);
+  } else if (index > r->highest) {
+    r->highest = index;
+  }
+  r->deadline = nowMs() + NackDelayMs;
+  return NULL;
+}
+
+/**************** sendNack ****************/
+/* 
+ * Ask the sender to resend missing fragments: all of them if 'all',
+ * otherwise only those below the highest index received so far.
+ */
+static void
+sendNack(reassembly_t* r, const bool all)
+{
+  unsigned char nack[5 + 2 * MaxNackIndices];
+  const uint32_t netId = htonl(r->id);
+  nack[0] = NackMagic;
+  memcpy(nack + 1, &netId, 4);
+
+  int len = 5;
+  const int limit = all ? r->count : r->highest;
+  for (int index = 0; index < limit && len + 2 <= sizeof(nack); index++) {
+    if ((r->have[index / 8] & (1 << (index % 8))) == 0) {
+      const uint16_t netIndex = htons(index);
+      memcpy(nack + len, &netIndex, 2);
+      len += 2;
+    }
+  }
+
+  if (len > 5 && sendto(ourSocket, nack, len, 0,
+                        (struct sockaddr *) &r->from, sizeof(r->from)) < 0) {
+    log_e("message_loop: error sending NACK");
+  }
+}
+
+/**************** nackOverdue ****************/
+/* 
+ * NACK the missing fragments of every message that has stalled,
+ * giving up on those that have been NACKed too often.
+ */
+static void
+nackOverdue(void)
+{
+  const long now = nowMs();
+  for (int i = 0; i < ReassemblySlots; i++) {
+    reassembly_t* r = &reassembly[i];
+    if (r->inUse && now >= r->deadline) {
+      if (r->nacks >= MaxNacks) {
+        log_d("message_loop: gave up on fragmented message %d", (int) r->id);
+        r->inUse = false;
+      } else {
+        sendNack(r, true);
+        r->nacks++;
+        r->deadline = now + NackDelayMs * (r->nacks + 1);
+      }
+    }
+  }
+}
+
+/**************** nextNackDelay ****************/
+/* 
+ * Return milliseconds until the next stalled message is due to be
+ * NACKed (zero if overdue), or -1 if nothing is being reassembled.
+ */
+static long
+nextNackDelay(void)
+{
+  long delay = -1;
+  const long now = nowMs();
+  for (int i = 0; i < ReassemblySlots; i++) {
+    if (reassembly[i].inUse) {
+      long d = reassembly[i].deadline - now;
+      if (d < 0) {
+        d = 0;
+      }
+      if (delay < 0 || d < delay) {
+        delay = d;
+      }
+    }
+  }
+  return delay;
+}
+
+
+#ifdef MESSAGE_URING
+/* ****************************************************************** */
+/* ************************* io_uring backend *********************** */
+/*
+ * When compiled with -DMESSAGE_URING, message_loop uses an io_uring
+ * (Linux 6.0 or later) for the thread's socket instead of select():
+ *  - one multishot recvmsg stays armed on the socket, and the kernel
+ *    places each datagram in one of a ring of provided buffers, so a
+ *    single io_uring_enter can deliver many datagrams;
+ *  - message_send and message_sendv, called from a handler, copy the
+ *    message into one of a set of send buffers and queue a send;
+ *    all the sends queued by a handler go to the kernel together, with
+ *    the io_uring_enter that waits for the next input;
+ *  - stdin is watched with a poll request, re-armed after each call to
+ *    handleInput, and timeouts are passed to io_uring_enter itself.
+ * Handlers see exactly what they would see with select().  Sends made
+ * outside message_loop, by threads without a ring, or too long for a
+ * send buffer, and all fragments, go out directly as before.  If the
+ * kernel cannot provide what we need, message_loop falls back to select().
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/**************** io_uring constants ****************/
+#define UringEntries 256      // submission queue entries
+#define RecvBuffers 16        // provided receive buffers (a power of 2)
+#define RecvGroup 1           // buffer group id of the receive buffers
+#define SendSlots 128         // send buffers, one per send in flight
+#define SendSlotBytes 4096    // longest message sent through the ring
+static const __u64 TagRecv = 1;   // user_data of the multishot recvmsg
+static const __u64 TagPoll = 2;   // user_data of the stdin poll
+static const __u64 TagSend = 16;  // user_data of a send, plus its slot
+
+/**************** io_uring types ****************/
+struct uring {
+  int fd;                     // the ring's file descriptor
+  // submission queue, shared with the kernel
+  unsigned* sqHeadp;          // kernel's head
+  unsigned* sqTailp;          // our tail
+  unsigned sqTail;            // our copy of the tail
+  unsigned sqMask;
+  unsigned sqEntries;
+  struct io_uring_sqe* sqes;
+  unsigned toSubmit;          // SQEs queued but not yet submitted
+  // completion queue, shared with the kernel
+  unsigned* cqHeadp;          // our head
+  unsigned* cqTailp;          // kernel's tail
+  unsigned cqMask;
+  struct io_uring_cqe* cqes;
+  // the mappings of the above
+  void* ringMap;
+  size_t ringMapBytes;
+  size_t sqesBytes;
+  // receiving
+  struct io_uring_buf_ring* bufRing;  // provided buffers, shared with kernel
+  size_t bufRingBytes;
+  unsigned short bufTail;     // our copy of the buffer ring's tail
+  char* recvBufs;             // RecvBuffers buffers of recvBufBytes each
+  size_t recvBufBytes;
+  struct msghdr recvTemplate; // tells the kernel how much name to keep
+  bool recvArmed;             // is the multishot recvmsg active?
+  bool pollArmed;             // is the stdin poll active?
+  // sending
+  char* sendBufs;             // SendSlots buffers of SendSlotBytes each
+  addr_t sendTo[SendSlots];   // destination of each send in flight
+  int freeSlots[SendSlots];   // stack of send buffers not in flight
+  int nfree;
+};
+
+/**************** io_uring variables ****************/
+/* Like the socket, each thread has its own ring; uringLooping is true
+ * while the thread is inside message_loop, when sends may be queued.
+ */
+static _Thread_local uring_t* uring = NULL;
+static _Thread_local bool uringLooping = false;
+
+/**************** io_uring functions ****************/
+/* uringNew, uringDelete, uringLoop, uringSend, uringFlush: see above */
+static struct io_uring_sqe* uringSqe(uring_t* u);
+static void uringQueue(uring_t* u);
+static int uringEnter(uring_t* u, const unsigned minComplete, const long waitMs);
+static bool uringNextCqe(uring_t* u, struct io_uring_cqe* cqe);
+static void uringArmRecv(uring_t* u);
+static void uringArmPoll(uring_t* u);
+static void uringRecycle(uring_t* u, const int bid);
+
+/**************** uringNew ****************/
+/* 
+ * Set up a ring for this thread's socket, with its provided receive
+ * buffers and send buffers.  Return NULL (having logged why)
+ * if the kernel does not support what we need.
+ */
+static uring_t*
+uringNew(void)
+{
+  uring_t* u = calloc(1, sizeof(uring_t));
+  if (u == NULL) {
+    return NULL;
+  }
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  u->fd = syscall(__NR_io_uring_setup, UringEntries, &params);
+  if (u->fd < 0) {
+    log_e("message_loop: io_uring_setup");
+    free(u);
+    return NULL;
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)
+      || !(params.features & IORING_FEAT_EXT_ARG)) {
+    log_v("message_loop: io_uring too old; using select");
+    close(u->fd);
+    free(u);
+    return NULL;
+  }
+
+  // map the submission and completion rings, which share one mapping
+  size_t sqBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cqBytes = params.cq_off.cqes
+                   + params.cq_entries * sizeof(struct io_uring_cqe);
+  u->ringMapBytes = sqBytes > cqBytes ? sqBytes : cqBytes;
+  u->ringMap = mmap(NULL, u->ringMapBytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  u->sqesBytes = params.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(NULL, u->sqesBytes, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->ringMap == MAP_FAILED || u->sqes == MAP_FAILED) {
+    log_e("message_loop: mapping io_uring");
+    u->ringMap = (u->ringMap == MAP_FAILED) ? NULL : u->ringMap;
+    u->sqes = (u->sqes == MAP_FAILED) ? NULL : u->sqes;
+    uringDelete(u);
+    return NULL;
+  }
+  char* ring = u->ringMap;
+  u->sqHeadp = (unsigned*) (ring + params.sq_off.head);
+  u->sqTailp = (unsigned*) (ring + params.sq_off.tail);
+  u->sqTail = *u->sqTailp;
+  u->sqMask = *(unsigned*) (ring + params.sq_off.ring_mask);
+  u->sqEntries = params.sq_entries;
+  unsigned* sqArray = (unsigned*) (ring + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; i++) {
+    sqArray[i] = i;           // SQE i always sits in slot i
+  }
+  u->cqHeadp = (unsigned*) (ring + params.cq_off.head);
+  u->cqTailp = (unsigned*) (ring + params.cq_off.tail);
+  u->cqMask = *(unsigned*) (ring + params.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe*) (ring + params.cq_off.cqes);
+
+  // provide the receive buffers: each holds the recvmsg header, the
+  // sender's address, and the largest datagram, plus a null
+  u->recvBufBytes = sizeof(struct io_uring_recvmsg_out) + sizeof(addr_t)
+                    + message_MaxBytes + 1;
+  u->recvBufs = malloc(RecvBuffers * u->recvBufBytes);
+  u->bufRingBytes = RecvBuffers * sizeof(struct io_uring_buf);
+  u->bufRing = mmap(NULL, u->bufRingBytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (u->recvBufs == NULL || u->bufRing == MAP_FAILED) {
+    log_v("message_loop: out of memory for io_uring buffers");
+    u->bufRing = (u->bufRing == MAP_FAILED) ? NULL : u->bufRing;
+    uringDelete(u);
+    return NULL;
+  }
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (__u64) (uintptr_t) u->bufRing;
+  reg.ring_entries = RecvBuffers;
+  reg.bgid = RecvGroup;
+  if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING,
+              &reg, 1) < 0) {
+    log_e("message_loop: registering io_uring receive buffers");
+    uringDelete(u);
+    return NULL;
+  }
+  u->bufTail = 0;
+  for (int bid = 0; bid < RecvBuffers; bid++) {
+    uringRecycle(u, bid);
+  }
+  memset(&u->recvTemplate, 0, sizeof(u->recvTemplate));
+  u->recvTemplate.msg_namelen = sizeof(addr_t);
+
+  // the send buffers; the kernel copies from them when it sends
+  u->sendBufs = malloc(SendSlots * SendSlotBytes);
+  if (u->sendBufs == NULL) {
+    log_v("message_loop: out of memory for io_uring buffers");
+    uringDelete(u);
+    return NULL;
+  }
+  for (int slot = 0; slot < SendSlots; slot++) {
+    u->freeSlots[slot] = SendSlots - 1 - slot;
+  }
+  u->nfree = SendSlots;
+
+  log_v("message_loop: using io_uring");
+  return u;
+}
+
+/**************** uringDelete ****************/
+/* 
+ * Submit any queued sends, wait briefly for sends in flight (dropping
+ * anything received meanwhile), and tear the ring down.
+ */
+static void
+uringDelete(uring_t* u)
+{
+  if (u == NULL) {
+    return;
+  }
+  if (u->cqes != NULL && u->sqes != NULL) {
+    for (int tries = 0; tries < 10 && u->nfree < SendSlots; tries++) {
+      uringEnter(u, 1, 10);
+      struct io_uring_cqe cqe;
+      while (uringNextCqe(u, &cqe)) {
+        if (cqe.user_data >= TagSend) {
+          u->freeSlots[u->nfree++] = cqe.user_data - TagSend;
+        } else if (cqe.user_data == TagRecv && (cqe.flags & IORING_CQE_F_BUFFER)) {
+          uringRecycle(u, cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+      }
+    }
+  }
+  close(u->fd);               // also cancels the recvmsg and poll
+  if (u->ringMap != NULL) {
+    munmap(u->ringMap, u->ringMapBytes);
+  }
+  if (u->sqes != NULL) {
+    munmap(u->sqes, u->sqesBytes);
+  }
+  if (u->bufRing != NULL) {
+    munmap(u->bufRing, u->bufRingBytes);
+  }
+  free(u->recvBufs);
+  free(u->sendBufs);
+  free(u);
+}
+
+/**************** uringLoop ****************/
+/* 
+ * message_loop, for a thread with a ring; see message.h.
+ */
+static bool
+uringLoop(void* arg,
+          bool (*handleTimeout)(void* arg),
+          bool (*handleInput)  (void* arg),
+          bool (*handleMessage)(void* arg,
+                                const addr_t from, const char* buf))
+{
+  uring_t* u = uring;
+  bool result = true;
+  bool quit = false;
+  uringLooping = true;
+
+  while (!quit) {
+    // ask again for any fragments that are overdue
+    nackOverdue();
+
+    // (re)arm the receive and, if wanted, the stdin poll
+    if (handleMessage != NULL && !u->recvArmed) {
+      uringArmRecv(u);
+    }
+    if (handleInput != NULL && !u->pollArmed) {
+      uringArmPoll(u);
+    }
+
+    // wait no longer than the timeout, or until fragments must be NACKed;
+    // that wake-up is ours, and is not reported to handleTimeout
+    long waitMs = (loopTimeout > 0.0) ? (long) (loopTimeout * 1000) : -1;
+    bool nackTimer = false;
+    long nackDelay = nextNackDelay();
+    if (nackDelay >= 0 && (waitMs < 0 || nackDelay < waitMs)) {
+      waitMs = nackDelay;
+      nackTimer = true;
+    }
+
+    // submit every queued send and arm, and wait for something to happen
+    if (uringEnter(u, 1, waitMs) < 0 && errno != ETIME && errno != EINTR) {
+      log_e("message_loop: io_uring_enter");
+      result = false;
+      break;
+    }
+
+    struct io_uring_cqe cqe;
+    bool any = false;
+    while (!quit && uringNextCqe(u, &cqe)) {
+      any = true;
+      if (cqe.user_data >= TagSend) {
+        // a send finished; its buffer is free again
+        if (cqe.res < 0) {
+          errno = -cqe.res;
+          log_e("message_send: error sending to datagram socket");
+        }
+        u->freeSlots[u->nfree++] = cqe.user_data - TagSend;
+
+      } else if (cqe.user_data == TagPoll) {
+        // stdin has input ready
+        u->pollArmed = false;
+        if (LOG_ENABLED(LOG_DEBUG)) {
+          log_v("message_loop: input ready on stdin");
+        }
+        if (handleInput != NULL && (*handleInput)(arg)) {
+          quit = true; // handler says to exit loop
+        }
+
+      } else if (cqe.user_data == TagRecv) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+          u->recvArmed = false;   // e.g., ran out of buffers; re-arm
+        }
+        if (cqe.res < 0) {
+          if (cqe.res != -ENOBUFS) {
+            errno = -cqe.res;
+            log_e("message_loop: receiving from socket");
+          }
+          continue;
+        }
+        // the buffer holds the header, the sender's address, the data
+        int bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        char* buf = u->recvBufs + bid * u->recvBufBytes;
+        struct io_uring_recvmsg_out out;
+        memcpy(&out, buf, sizeof(out));
+        addr_t sender = message_noAddr();
+        memcpy(&sender, buf + sizeof(out),
+               out.namelen < sizeof(sender) ? out.namelen : sizeof(sender));
+        char* data = buf + sizeof(out) + u->recvTemplate.msg_namelen;
+        int nbytes = out.payloadlen;
+        if (nbytes > message_MaxBytes) {
+          nbytes = message_MaxBytes;   // cannot happen for UDP
+        }
+        if (LOG_ENABLED(LOG_DEBUG)) {
+          log_v("message_loop: message ready on socket");
+        }
+        if (handleDatagram(arg, handleMessage, sender, data, nbytes)) {
+          quit = true; // handler says to exit loop
+        }
+        uringRecycle(u, bid);
+      }
+    }
+
+    if (!quit && !any && nackTimer) {
+      // time to NACK missing fragments; done at the top of the loop
+      continue;
+    } else if (!quit && !any && waitMs >= 0) {
+      // timeout occurred
+      if (LOG_ENABLED(LOG_DEBUG)) {
+        log_v("message_loop: io_uring timed out");
+      }
+      if (handleTimeout != NULL && (*handleTimeout)(arg)) {
+        quit = true; // handler says to exit loop
+      }
+    }
+  }
+
+  // send whatever the last handler queued; completions are reaped later
+  uringEnter(u, 0, -1);
+  uringLooping = false;
+  return result;
+}
+
+/**************** uringSend ****************/
+/* 
+ * Queue a send of the len bytes gathered from iov, if we are in the
+ * message loop and have a free send buffer big enough.  Return false if
+ * the caller should send it directly instead.
+ */
+static bool
+uringSend(const addr_t to, const struct iovec* iov, const int iovcnt,
+          const int len)
+{
+  uring_t* u = uring;
+  if (!uringLooping || u == NULL) {
+    return false;
+  }
+  struct io_uring_sqe* sqe;
+  if (len > SendSlotBytes || u->nfree == 0 || (sqe = uringSqe(u)) == NULL) {
+    // send directly, but after whatever is queued, to keep the order
+    uringEnter(u, 0, -1);
+    return false;
+  }
+
+  // copy the message into a send buffer
+  int slot = u->freeSlots[--u->nfree];
+  char* buf = u->sendBufs + slot * SendSlotBytes;
+  int pos = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(buf + pos, iov[i].iov_base, iov[i].iov_len);
+    pos += iov[i].iov_len;
+  }
+  u->sendTo[slot] = to;
+
+  // a send with a destination address is like sendto()
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = ourSocket;
+  sqe->addr = (__u64) (uintptr_t) buf;
+  sqe->len = len;
+  sqe->addr2 = (__u64) (uintptr_t) &u->sendTo[slot];
+  sqe->addr_len = sizeof(addr_t);
+  sqe->user_data = TagSend + slot;
+  uringQueue(u);
+  return true;
+}
+
+/**************** uringFlush ****************/
+/* 
+ * Submit any sends queued by this thread, without waiting for them, so
+ * that a message sent directly cannot overtake them.
+ */
+static void
+uringFlush(void)
+{
+  if (uringLooping && uring != NULL) {
+    uringEnter(uring, 0, -1);
+  }
+}
+
+/**************** uringPending ****************/
+/* 
+ * Has the ring already received a datagram that this thread's
+ * message_loop has not yet handled?
+ */
+static bool
+uringPending(void)
+{
+  uring_t* u = uring;
+  if (u == NULL) {
+    return false;
+  }
+  unsigned tail = __atomic_load_n(u->cqTailp, __ATOMIC_ACQUIRE);
+  for (unsigned head = *u->cqHeadp; head != tail; head++) {
+    struct io_uring_cqe* cqe = &u->cqes[head & u->cqMask];
+    if (cqe->user_data == TagRecv && cqe->res >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** uringSqe ****************/
+/* 
+ * Return a cleared SQE to fill in, submitting what is queued if the
+ * submission queue is full; NULL if it is still full.
+ */
+static struct io_uring_sqe*
+uringSqe(uring_t* u)
+{
+  unsigned head = __atomic_load_n(u->sqHeadp, __ATOMIC_ACQUIRE);
+  if (u->sqTail - head >= u->sqEntries) {
+    uringEnter(u, 0, -1);
+    head = __atomic_load_n(u->sqHeadp, __ATOMIC_ACQUIRE);
+    if (u->sqTail - head >= u->sqEntries) {
+      return NULL;
+    }
+  }
+  struct io_uring_sqe* sqe = &u->sqes[u->sqTail & u->sqMask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/**************** uringQueue ****************/
+/* 
+ * Make the SQE just filled in visible to the kernel, for the next submit.
+ */
+static void
+uringQueue(uring_t* u)
+{
+  u->sqTail++;
+  __atomic_store_n(u->sqTailp, u->sqTail, __ATOMIC_RELEASE);
+  u->toSubmit++;
+}
+
+/**************** uringEnter ****************/
+/* 
+ * Submit whatever is queued and, if minComplete > 0, wait until that
+ * many completions are ready or waitMs milliseconds pass (forever, if
+ * waitMs < 0).  Returns io_uring_enter's result; errno is ETIME if the
+ * wait timed out.
+ */
+static int
+uringEnter(uring_t* u, const unsigned minComplete, const long waitMs)
+{
+  unsigned flags = 0;
+  struct io_uring_getevents_arg ext;
+  struct __kernel_timespec ts;
+  void* argp = NULL;
+  size_t argBytes = 0;
+  if (minComplete > 0) {
+    flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    memset(&ext, 0, sizeof(ext));
+    if (waitMs >= 0) {
+      ts.tv_sec = waitMs / 1000;
+      ts.tv_nsec = (waitMs % 1000) * 1000000L;
+      ext.ts = (__u64) (uintptr_t) &ts;
+    }
+    argp = &ext;
+    argBytes = sizeof(ext);
+  } else if (u->toSubmit == 0) {
+    return 0;                 // nothing to do
+  }
+
+  int ret = syscall(__NR_io_uring_enter, u->fd, u->toSubmit, minComplete,
+                    flags, argp, argBytes);
+  if (ret > 0) {
+    u->toSubmit -= (ret < (int) u->toSubmit) ? ret : (int) u->toSubmit;
+  }
+  return ret;
+}
+
+/**************** uringNextCqe ****************/
+/* 
+ * Copy the next completion into *cqe and consume it; false if none.
+ */
+static bool
+uringNextCqe(uring_t* u, struct io_uring_cqe* cqe)
+{
+  unsigned head = *u->cqHeadp;
+  if (head == __atomic_load_n(u->cqTailp, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  *cqe = u->cqes[head & u->cqMask];
+  __atomic_store_n(u->cqHeadp, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**************** uringArmRecv ****************/
+/* 
+ * Queue a multishot recvmsg on the socket, taking provided buffers.
+ */
+static void
+uringArmRecv(uring_t* u)
+{
+  struct io_uring_sqe* sqe = uringSqe(u);
+  if (sqe == NULL) {
+    return;                   // try again next time around the loop
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = ourSocket;
+  sqe->addr = (__u64) (uintptr_t) &u->recvTemplate;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = RecvGroup;
+  sqe->user_data = TagRecv;
+  uringQueue(u);
+  u->recvArmed = true;
+}
+
+/**************** uringArmPoll ****************/
+/* 
+ * Queue a one-shot poll of stdin; re-arming it after each handleInput
+ * makes it level-triggered, like select().
+ */
+static void
+uringArmPoll(uring_t* u)
+{
+  struct io_uring_sqe* sqe = uringSqe(u);
+  if (sqe == NULL) {
+    return;                   // try again next time around the loop
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = 0;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = TagPoll;
+  uringQueue(u);
+  u->pollArmed = true;
+}
+
+/**************** uringRecycle ****************/
+/* 
+ * Give receive buffer 'bid' back to the kernel.
+ */
+static void
+uringRecycle(uring_t* u, const int bid)
+{
+  struct io_uring_buf* buf = &u->bufRing->bufs[u->bufTail & (RecvBuffers - 1)];
+  buf->addr = (__u64) (uintptr_t) (u->recvBufs + bid * u->recvBufBytes);
+  buf->len = u->recvBufBytes - 1;   // leave room for a null
+  buf->bid = bid;
+  u->bufTail++;
+  __atomic_store_n(&u->bufRing->tail, u->bufTail, __ATOMIC_RELEASE);
+}
+
+#endif // MESSAGE_URING
+
 
 /* ****************************************************************** */
 /* ************************* UNIT_TEST ****************************** */
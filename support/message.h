@@ -9,6 +9,8 @@
  *   message_init(stderr);
  *   message_loop(arg, timeout, handleTimeout, handleStdin, handleMessage);
  *   message_done();
+ * A server may instead run one message_loop per thread, each thread
+ * calling message_initShard on a shared port; see below.
  * Typical client sequence looks like this:
  *   message_init(stderr);
  *   message_setAddr(serverHost, serverPort, &serverAddress);
@@ -30,6 +32,7 @@
 #include <stdbool.h>
 #include <arpa/inet.h>  // These two includes are not needed for this file, 
 #include <sys/select.h> // but is needed for users of this file.
+#include <sys/uio.h>    // struct iovec, for message_sendv
 
 /****************** types *********************/
 /* A type representing an Internet address, suitable for use in message_send().
@@ -64,6 +67,27 @@ static const int message_MaxBytes = 65507;
  */
 int message_init(FILE* logFP);
 
+/******************************************/
+/* message_initShard: initialize the module for this thread, on a shared port.
+ * Caller provides:
+ *   file pointer(fp), passed through to log_init().  May be NULL.
+ *   the port number to share, or 0 to pick a free one.
+ * Function returns:
+ *   port number where messages can be sent; zero on error.
+ * Caller expectations:
+ *   call message_done() later, in the same thread.
+ * Notes:
+ *   Each thread that calls this gets its own socket, bound with
+ *   SO_REUSEPORT to the same port, and its own message_loop.  The kernel
+ *   delivers all messages from one sender address to the same socket, and
+ *   message_send from a thread uses that thread's socket.  The first
+ *   thread passes 0 and the others pass the port it returns.
+ *   Adding or closing a socket on the port changes which socket each
+ *   sender's messages reach, so open all of them before clients connect.
+ * Logs: information about errors; the port number.
+ */
+int message_initShard(FILE* logFP, const int port);
+
 /******************************************/
 /* message_noAddr: return an addr_t representing "no address".
  * Logs: nothing.
@@ -115,11 +139,28 @@ bool message_setAddr(const char* hostname, const char* portStr, addr_t* addr);
  * Returns:
  *   a string representation of the address,
  *   which is a pointer to static storage that cannot be retained!
+ *   (Each thread has its own, so threads do not overwrite each other's.)
  * Logs:
  *   nothing.
  */
 const char* message_stringAddr(const addr_t addr);
 
+/******************************************/
+/* message_setMTU: fragment outgoing messages longer than the MTU.
+ * Caller provides:
+ *   the largest datagram to send, in bytes (e.g., 1472 for Ethernet),
+ *   or zero to send every message as a single datagram (the default).
+ * Function returns: none
+ * Notes:
+ *   A longer message is sent as numbered fragments, and the receiver's
+ *   message_loop reassembles it before calling handleMessage; fragments
+ *   the receiver finds missing are NACKed and resent.  Any receiver using
+ *   this module reassembles, whatever its own MTU setting, but older
+ *   programs will not, so only turn this on when all peers understand it.
+ * Logs: nothing, unless the MTU is raised to the minimum supported.
+ */
+void message_setMTU(const int mtu);
+
 /******************************************/
 /* message_send: send a message.
  * Caller provides:
@@ -127,12 +168,33 @@ const char* message_stringAddr(const addr_t addr);
  *   a string containing the message.
  * Function returns: none
  * Assumptions: message_init() has already been called.
+ * Notes:
+ *   A thread sends on its own socket (see message_initShard) if it has
+ *   one, and otherwise on the socket opened by message_init, so worker
+ *   threads may reply to messages received by another thread's loop.
  * Logs:
  *   errors in arguments,
  *   errors in sending the message.
  */
 void message_send(const addr_t to, const char* message);
 
+/******************************************/
+/* message_sendv: send a message gathered from several buffers.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   an array of iovcnt buffers whose contents, concatenated in order,
+ *     form the message; the buffers need not be null-terminated.
+ * Function returns: none
+ * Assumptions: message_init() has already been called.
+ * Notes:
+ *   The pieces go out as a single datagram, exactly as if they had been
+ *   concatenated and passed to message_send, but without the copy.
+ * Logs:
+ *   errors in arguments,
+ *   errors in sending the message.
+ */
+void message_sendv(const addr_t to, const struct iovec* iov, const int iovcnt);
+
 /******************************************/
 /* message_loop: loop, handling input and incoming messages.
  * Caller provides:
@@ -166,6 +228,37 @@ bool message_loop(void* arg, const float timeout,
                                         const addr_t from, 
                                         const char* message));
 
+/******************************************/
+/* message_setTimeout: change the timeout of this thread's message_loop.
+ * Caller provides:
+ *   a time duration (in seconds) after which to call "timeout",
+ *   or 0 to stop calling it until a later message_setTimeout.
+ * Function returns: nothing.
+ * Notes:
+ *   Meant for the handlers, so that a loop with nothing to do later
+ *   can sleep until a message arrives, and one with something due
+ *   can wake up just in time for it.  Takes effect the next time the
+ *   loop waits; message_loop starts with its 'timeout' parameter.
+ *   Has no effect unless message_loop was given a handleTimeout.
+ * Logs: nothing.
+ */
+void message_setTimeout(const float timeout);
+
+/******************************************/
+/* message_pending: is another message already waiting?
+ * Caller provides: nothing.
+ * Function returns:
+ *   true if a datagram has arrived on this thread's socket that
+ *   message_loop has not yet passed to handleMessage; false otherwise.
+ * Notes:
+ *   Meant for handleMessage, which can skip work that the next message
+ *   would undo, such as drawing a frame about to be replaced.  The
+ *   datagram may be a fragment, or not meant for handleMessage at all,
+ *   so a handler that defers work should also set a timeout to finish it.
+ * Logs: nothing.
+ */
+bool message_pending(void);
+
 /******************************************/
 /* message_done: shut down the module.
  * Caller provides: nothing.
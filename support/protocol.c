@@ -0,0 +1,493 @@
+/*
+ * protocol - compact binary encoding of Nuggets messages
+ *
+ * See protocol.h for the wire format and interface.
+ *
+ * Compile with -DUNIT_TEST for a standalone unit test; see below.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+#include "protocol.h"
+
+/**************** file-local functions ****************/
+static int putHeader(char* buf, const proto_type_t type);
+static int putVarint(char* buf, const int value);
+static const char* getVarint(const char* p, int* value);
+static const char* getHeader(const char* message, const proto_type_t type);
+
+/**************** proto_type ****************/
+/* see protocol.h for description */
+int
+proto_type(const char* message)
+{
+  if (message == NULL) {
+    return 0;
+  }
+  unsigned char header = (unsigned char) message[0];
+  if ((header & PROTO_MAGIC) == 0) {
+    return 0;                 // text, or empty
+  }
+  return header & ~PROTO_MAGIC;
+}
+
+/**************** proto_encodeOK ****************/
+/* see protocol.h for description */
+int
+proto_encodeOK(char* buf, const char icon)
+{
+  int len = putHeader(buf, PROTO_OK);
+  buf[len++] = icon;
+  buf[len] = '\0';
+  return len;
+}
+
+/**************** proto_encodeGrid ****************/
+/* see protocol.h for description */
+int
+proto_encodeGrid(char* buf, const int nrows, const int ncols)
+{
+  int len = putHeader(buf, PROTO_GRID);
+  len += putVarint(buf + len, nrows);
+  len += putVarint(buf + len, ncols);
+  buf[len] = '\0';
+  return len;
+}
+
+/**************** proto_encodeGold ****************/
+/* see protocol.h for description */
+int
+proto_encodeGold(char* buf, const int n, const int p, const int r)
+{
+  int len = putHeader(buf, PROTO_GOLD);
+  len += putVarint(buf + len, n);
+  len += putVarint(buf + len, p);
+  len += putVarint(buf + len, r);
+  buf[len] = '\0';
+  return len;
+}
+
+/**************** proto_encodeKey ****************/
+/* see protocol.h for description */
+int
+proto_encodeKey(char* buf, const char key, const int token, const int seq)
+{
+  int len = putHeader(buf, PROTO_KEY);
+  buf[len++] = key;
+  if (token > 0 || seq > 0) {
+    len += putVarint(buf + len, token);
+  }
+  if (seq > 0) {
+    len += putVarint(buf + len, seq);
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+/**************** proto_encodeSession ****************/
+/* see protocol.h for description */
+int
+proto_encodeSession(char* buf, const int token)
+{
+  int len = putHeader(buf, PROTO_SESSION);
+  len += putVarint(buf + len, token);
+  buf[len] = '\0';
+  return len;
+}
+
+/**************** proto_encodeText ****************/
+/* see protocol.h for description */
+int
+proto_encodeText(char* buf, const proto_type_t type, const char* text)
+{
+  int len = putHeader(buf, type);
+  strcpy(buf + len, text);
+  return len + strlen(text);
+}
+
+/**************** proto_encodeDisplay ****************/
+/* see protocol.h for description */
+int
+proto_encodeDisplay(char* buf)
+{
+  int len = putHeader(buf, PROTO_DISPLAY);
+  buf[len] = '\0';
+  return len;
+}
+
+/**************** proto_encodeFrame ****************/
+/* see protocol.h for description */
+int
+proto_encodeFrame(char* buf, const int seq)
+{
+  int len = putHeader(buf, PROTO_FRAME);
+  len += putVarint(buf + len, seq);
+  buf[len] = '\0';
+  return len;
+}
+
+/**************** proto_decodeOK ****************/
+/* see protocol.h for description */
+bool
+proto_decodeOK(const char* message, char* icon)
+{
+  const char* p = getHeader(message, PROTO_OK);
+  if (p == NULL || *p == '\0') {
+    return false;
+  }
+  *icon = *p;
+  return true;
+}
+
+/**************** proto_decodeGrid ****************/
+/* see protocol.h for description */
+bool
+proto_decodeGrid(const char* message, int* nrows, int* ncols)
+{
+  int r, c;
+  const char* p = getHeader(message, PROTO_GRID);
+  if ((p = getVarint(p, &r)) == NULL || (p = getVarint(p, &c)) == NULL) {
+    return false;
+  }
+  *nrows = r;
+  *ncols = c;
+  return true;
+}
+
+/**************** proto_decodeGold ****************/
+/* see protocol.h for description */
+bool
+proto_decodeGold(const char* message, int* n, int* p, int* r)
+{
+  int vn, vp, vr;
+  const char* pos = getHeader(message, PROTO_GOLD);
+  if ((pos = getVarint(pos, &vn)) == NULL || (pos = getVarint(pos, &vp)) == NULL
+      || (pos = getVarint(pos, &vr)) == NULL) {
+    return false;
+  }
+  *n = vn;
+  *p = vp;
+  *r = vr;
+  return true;
+}
+
+/**************** proto_decodeKey ****************/
+/* see protocol.h for description */
+bool
+proto_decodeKey(const char* message, char* key, int* token, int* seq)
+{
+  const char* p = getHeader(message, PROTO_KEY);
+  if (p == NULL || *p == '\0') {
+    return false;
+  }
+  int t = 0, s = 0;
+  const char* q = p + 1;
+  if (*q != '\0' && (q = getVarint(q, &t)) == NULL) {
+    return false;
+  }
+  if (*q != '\0' && getVarint(q, &s) == NULL) {
+    return false;
+  }
+  *key = *p;
+  *token = t;
+  *seq = s;
+  return true;
+}
+
+/**************** proto_decodeSession ****************/
+/* see protocol.h for description */
+bool
+proto_decodeSession(const char* message, int* token)
+{
+  int t;
+  if (getVarint(getHeader(message, PROTO_SESSION), &t) == NULL) {
+    return false;
+  }
+  *token = t;
+  return true;
+}
+
+/**************** proto_decodeText ****************/
+/* see protocol.h for description */
+bool
+proto_decodeText(const char* message, const proto_type_t type,
+                 const char** text)
+{
+  const char* p = getHeader(message, type);
+  if (p == NULL) {
+    return false;
+  }
+  *text = p;
+  return true;
+}
+
+/**************** proto_decodeDisplay ****************/
+/* see protocol.h for description */
+bool
+proto_decodeDisplay(const char* message, const char** grid)
+{
+  const char* p = getHeader(message, PROTO_DISPLAY);
+  if (p == NULL) {
+    return false;
+  }
+  *grid = p;
+  return true;
+}
+
+/**************** proto_decodeFrame ****************/
+/* see protocol.h for description */
+bool
+proto_decodeFrame(const char* message, int* seq, const char** grid)
+{
+  int s;
+  const char* p = getVarint(getHeader(message, PROTO_FRAME), &s);
+  if (p == NULL) {
+    return false;
+  }
+  *seq = s;
+  *grid = p;
+  return true;
+}
+
+/**************** putHeader ****************/
+/* Write the header byte for the given type; return its length. */
+static int
+putHeader(char* buf, const proto_type_t type)
+{
+  buf[0] = (char) (PROTO_MAGIC | type);
+  return 1;
+}
+
+/**************** putVarint ****************/
+/* Write value+1 as a varint, 7 bits per byte, low bits first, with the
+ * high bit set on every byte but the last.  Negative values are written
+ * as zero.  Return the number of bytes written.
+ */
+static int
+putVarint(char* buf, const int value)
+{
+  unsigned int v = (value < 0 ? 0 : (unsigned int) value) + 1;
+  int len = 0;
+  while (v >= 0x80) {
+    buf[len++] = (char) ((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  buf[len++] = (char) v;      // nonzero, since value+1 > 0
+  return len;
+}
+
+/**************** getVarint ****************/
+/* Read a varint written by putVarint at p into *value.
+ * Return a pointer just past it, or NULL if p is NULL or malformed
+ * (cut short, or too big for an int).
+ */
+static const char*
+getVarint(const char* p, int* value)
+{
+  if (p == NULL) {
+    return NULL;
+  }
+  unsigned int v = 0;
+  for (int shift = 0; shift < 32; shift += 7) {
+    unsigned char byte = (unsigned char) *p++;
+    if (byte == 0) {
+      return NULL;            // ran off the end of the message
+    }
+    if (shift == 28 && (byte & 0x70) != 0) {
+      return NULL;            // more than 32 bits
+    }
+    v |= (unsigned int) (byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      if (v - 1 > INT_MAX) {
+        return NULL;          // too big for an int
+      }
+      *value = (int) (v - 1);
+      return p;
+    }
+  }
+  return NULL;                // too long
+}
+
+/**************** getHeader ****************/
+/* Return a pointer to the fields of message, if it is of the given type;
+ * otherwise NULL.
+ */
+static const char*
+getHeader(const char* message, const proto_type_t type)
+{
+  if (proto_type(message) != type) {
+    return NULL;
+  }
+  return message + 1;
+}
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test encodes every type of message and decodes it again,
+ * checking that what comes out is what went in.  Varints are tried at
+ * each boundary where their length changes, from one byte up to the five
+ * that INT_MAX takes.  Then it feeds the decoders messages cut short,
+ * messages of the wrong type, and varints that never end or are too big
+ * for an int, and checks that each is refused and leaves the caller's
+ * variables alone.
+ *
+ * Build and run with
+ *   make protocoltest && ./protocoltest
+ * It prints what it checks, and exits non-zero if any check fails.
+ */
+
+#ifdef UNIT_TEST
+
+static int failures;                     // checks failed
+
+static void check(const bool ok, const char* what);
+
+int
+main(void)
+{
+  char buf[PROTO_MAXHEADER + 100];
+  char what[100];
+  int n, p, r;
+  char icon, key;
+  const char* text;
+
+  // varints at each length boundary: value+1 below 2^7, 2^14, 2^21, 2^28
+  const struct { int value; int bytes; } varints[] = {
+    { 0, 1 }, { 126, 1 }, { 127, 2 }, { 16382, 2 }, { 16383, 3 },
+    { 2097150, 3 }, { 2097151, 4 }, { 268435454, 4 }, { 268435455, 5 },
+    { INT_MAX - 1, 5 }, { INT_MAX, 5 },
+  };
+  for (int i = 0; i < sizeof(varints) / sizeof(varints[0]); i++) {
+    int value = varints[i].value;
+    int len = proto_encodeSession(buf, value);
+    int token = -1;
+    sprintf(what, "SESSION %d, a %d-byte varint, round trip", value,
+            varints[i].bytes);
+    check(len == 1 + varints[i].bytes && strlen(buf) == len
+          && proto_decodeSession(buf, &token) && token == value, what);
+  }
+  proto_encodeSession(buf, -5);
+  check(proto_decodeSession(buf, &n) && n == 0, "a negative varint is sent as 0");
+
+  // each type of message, encoded and decoded
+  check(proto_encodeOK(buf, 'Q') == 2 && proto_type(buf) == PROTO_OK
+        && proto_decodeOK(buf, &icon) && icon == 'Q', "OK round trip");
+  check(proto_encodeGrid(buf, 21, 79) > 0 && proto_type(buf) == PROTO_GRID
+        && proto_decodeGrid(buf, &n, &p) && n == 21 && p == 79, "GRID round trip");
+  check(proto_encodeGold(buf, 0, 127, INT_MAX) > 0 && proto_type(buf) == PROTO_GOLD
+        && proto_decodeGold(buf, &n, &p, &r) && n == 0 && p == 127 && r == INT_MAX,
+        "GOLD round trip");
+  check(proto_encodeText(buf, PROTO_QUIT, "GAME OVER:\nA 12 Alice") > 0
+        && proto_type(buf) == PROTO_QUIT && proto_decodeText(buf, PROTO_QUIT, &text)
+        && strcmp(text, "GAME OVER:\nA 12 Alice") == 0, "QUIT round trip");
+  check(proto_encodeText(buf, PROTO_ERROR, "") == 1
+        && proto_decodeText(buf, PROTO_ERROR, &text) && *text == '\0',
+        "ERROR round trip, with empty text");
+
+  // KEY with and without its optional token and sequence number
+  int token, seq;
+  check(proto_encodeKey(buf, 'h', 0, 0) == 2 && proto_type(buf) == PROTO_KEY
+        && proto_decodeKey(buf, &key, &token, &seq) && key == 'h' && token == 0
+        && seq == 0, "KEY round trip, with neither token nor sequence");
+  check(proto_encodeKey(buf, 'L', 12345, 0) > 2
+        && proto_decodeKey(buf, &key, &token, &seq) && key == 'L' && token == 12345
+        && seq == 0, "KEY round trip, with a token");
+  check(proto_encodeKey(buf, 'k', 0, 300) > 2
+        && proto_decodeKey(buf, &key, &token, &seq) && key == 'k' && token == 0
+        && seq == 300, "KEY round trip, with a sequence number and no token");
+  check(proto_encodeKey(buf, 'Q', INT_MAX, INT_MAX) == 12
+        && proto_decodeKey(buf, &key, &token, &seq) && key == 'Q'
+        && token == INT_MAX && seq == INT_MAX, "KEY round trip, with both at most");
+
+  // DISPLAY and FRAME: a header, then the grid sent after it
+  const char* grid = "+--+|..||*.|+--+";
+  int len = proto_encodeDisplay(buf);
+  strcpy(buf + len, grid);
+  check(len == 1 && proto_type(buf) == PROTO_DISPLAY
+        && proto_decodeDisplay(buf, &text) && strcmp(text, grid) == 0,
+        "DISPLAY round trip");
+  len = proto_encodeFrame(buf, 16383);
+  strcpy(buf + len, grid);
+  check(len == 4 && proto_type(buf) == PROTO_FRAME
+        && proto_decodeFrame(buf, &n, &text) && n == 16383 && strcmp(text, grid) == 0,
+        "FRAME round trip");
+  len = proto_encodeFrame(buf, 0);
+  check(proto_decodeFrame(buf, &n, &text) && n == 0 && *text == '\0',
+        "FRAME round trip, with an empty grid");
+
+  // text, empty, and NULL messages are not binary
+  check(proto_type("KEY h") == 0 && proto_type("") == 0 && proto_type(NULL) == 0,
+        "text, empty and NULL messages have type 0");
+
+  // messages cut short are refused, leaving the variables alone
+  n = p = r = -7;
+  icon = key = '?';
+  token = seq = -7;
+  text = NULL;
+  const char okShort[] = { (char) (PROTO_MAGIC | PROTO_OK), 0 };
+  check(!proto_decodeOK(okShort, &icon) && icon == '?', "an OK with no icon is refused");
+  proto_encodeGrid(buf, 21, 79);
+  buf[2] = '\0';
+  check(!proto_decodeGrid(buf, &n, &p) && n == -7 && p == -7,
+        "a GRID with one varint is refused");
+  proto_encodeGold(buf, 1, 2, 300);
+  buf[4] = '\0';                         // cut inside the last varint
+  check(!proto_decodeGold(buf, &n, &p, &r) && n == -7 && p == -7 && r == -7,
+        "a GOLD cut inside a varint is refused");
+  const char keyShort[] = { (char) (PROTO_MAGIC | PROTO_KEY), 0 };
+  check(!proto_decodeKey(keyShort, &key, &token, &seq) && key == '?' && token == -7,
+        "a KEY with no key is refused");
+  proto_encodeKey(buf, 'h', 5, 300);
+  buf[4] = '\0';                         // cut inside the sequence number
+  check(!proto_decodeKey(buf, &key, &token, &seq) && key == '?' && seq == -7,
+        "a KEY cut inside its sequence number is refused");
+  const char sessionShort[] = { (char) (PROTO_MAGIC | PROTO_SESSION), 0 };
+  check(!proto_decodeSession(sessionShort, &token) && token == -7,
+        "a SESSION with no token is refused");
+  const char frameShort[] = { (char) (PROTO_MAGIC | PROTO_FRAME), (char) 0x85, 0 };
+  check(!proto_decodeFrame(frameShort, &seq, &text) && seq == -7 && text == NULL,
+        "a FRAME cut inside its sequence number is refused");
+
+  // malformed varints are refused
+  const char endless[] = { (char) (PROTO_MAGIC | PROTO_SESSION), (char) 0x81,
+                           (char) 0x81, (char) 0x81, (char) 0x81, (char) 0x81,
+                           (char) 0x01, 0 };
+  check(!proto_decodeSession(endless, &token) && token == -7,
+        "a varint longer than five bytes is refused");
+  const char tooBig[] = { (char) (PROTO_MAGIC | PROTO_SESSION), (char) 0x81,
+                          (char) 0x81, (char) 0x81, (char) 0x81, (char) 0x7f, 0 };
+  check(!proto_decodeSession(tooBig, &token) && token == -7,
+        "a varint of more than 32 bits is refused");
+  const char pastMax[] = { (char) (PROTO_MAGIC | PROTO_SESSION), (char) 0x82,
+                           (char) 0x80, (char) 0x80, (char) 0x80, (char) 0x08, 0 };
+  check(!proto_decodeSession(pastMax, &token) && token == -7,
+        "a varint past INT_MAX is refused");
+
+  // the wrong type is refused
+  proto_encodeGrid(buf, 21, 79);
+  check(!proto_decodeGold(buf, &n, &p, &r) && !proto_decodeDisplay(buf, &text)
+        && !proto_decodeText(buf, PROTO_QUIT, &text) && !proto_decodeKey(buf, &key, &token, &seq)
+        && n == -7 && text == NULL && key == '?', "a message of another type is refused");
+  check(!proto_decodeGrid("GRID 21 79", &n, &p) && n == -7,
+        "a text message is refused");
+
+  printf("%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,111 @@
+/*
+ * protocol - compact binary encoding of Nuggets messages
+ *
+ * Clients and servers normally speak the text protocol ("GOLD 3 10 240").
+ * A client that understands this module sends "PROTO BINARY" right after
+ * its PLAY or SPECTATE; a server that understands it then sends that client
+ * binary messages, starting with a GRID, and the client answers with binary
+ * KEYs from then on.  A player is also sent a SESSION token, which it
+ * echoes in each KEY so the server can find it without hashing its address
+ * (see session.h).  Older programs ignore or never send "PROTO BINARY",
+ * so they keep speaking text, and both kinds of client can share a game.
+ *
+ * A player that predicts its own moves numbers its KEYs.  The server then
+ * sends it FRAMEs instead of DISPLAYs, each echoing the number of the last
+ * KEY the server has dealt with, so the player knows which of its
+ * predictions the frame already includes.
+ *
+ * A binary message is one header byte, PROTO_MAGIC | type, followed by
+ * the fields for that type:
+ *   OK       icon (1 byte)
+ *   GRID     nrows, ncols (varints)
+ *   GOLD     n, p, r (varints)
+ *   DISPLAY  the grid, nrows*ncols bytes, row by row with no newlines
+ *   QUIT     explanation (text)
+ *   ERROR    explanation (text)
+ *   KEY      key (1 byte), then optionally the client's session token
+ *            (varint, 0 if none), then optionally its sequence number (varint)
+ *   SESSION  token (varint)
+ *   FRAME    sequence number of the last KEY dealt with (varint), then the
+ *            grid as in DISPLAY
+ * Varints are little-endian base-128, storing value+1 so that no byte is
+ * ever zero; thus every binary message is also a valid C string, and can
+ * travel through message_send and message_loop unchanged.  No header byte
+ * is a printable character, so binary and text messages cannot be confused.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#ifndef _PROTOCOL_H_
+#define _PROTOCOL_H_
+
+#include <stdbool.h>
+
+/****************** constants *********************/
+#define PROTO_MAGIC 0x80      // set in the header byte of every binary message
+#define PROTO_MAXHEADER 16    // longest header + fixed fields of any message
+
+typedef enum {
+  PROTO_OK = 1,
+  PROTO_GRID,
+  PROTO_GOLD,
+  PROTO_DISPLAY,
+  PROTO_QUIT,
+  PROTO_ERROR,
+  PROTO_KEY,
+  PROTO_SESSION,
+  PROTO_FRAME,
+} proto_type_t;
+
+/****************** global functions *********************/
+
+/**************** proto_type ****************/
+/* Return the type of a binary message, or 0 if the message is text
+ * (or NULL, or empty).
+ */
+int proto_type(const char* message);
+
+/**************** proto_encode* ****************/
+/* Encode a message into buf, which must hold at least PROTO_MAXHEADER bytes
+ * (plus the length of the text, for proto_encodeText).
+ * We return:
+ *   the length of the message; buf is null-terminated.
+ */
+int proto_encodeOK(char* buf, const char icon);
+int proto_encodeGrid(char* buf, const int nrows, const int ncols);
+int proto_encodeGold(char* buf, const int n, const int p, const int r);
+int proto_encodeKey(char* buf, const char key, const int token, const int seq);
+int proto_encodeSession(char* buf, const int token);
+int proto_encodeText(char* buf, const proto_type_t type, const char* text);
+
+/**************** proto_encodeDisplay, proto_encodeFrame ****************/
+/* Encode only the header of a DISPLAY or FRAME message into buf; the caller
+ * sends the nrows*ncols bytes of the grid right after it (e.g., with
+ * message_sendv).
+ * We return:
+ *   the length of the header.
+ */
+int proto_encodeDisplay(char* buf);
+int proto_encodeFrame(char* buf, const int seq);
+
+/**************** proto_decode* ****************/
+/* Decode a binary message of the given type into the caller's variables.
+ * We return:
+ *   true if the message is of that type and well formed;
+ *   false otherwise, in which case the variables are unchanged.
+ * Notes:
+ *   proto_decodeText and proto_decodeDisplay set *text or *grid to point
+ *   into the message itself; nothing is copied.
+ *   proto_decodeKey sets *token and *seq to 0 if the KEY carries none.
+ */
+bool proto_decodeOK(const char* message, char* icon);
+bool proto_decodeGrid(const char* message, int* nrows, int* ncols);
+bool proto_decodeGold(const char* message, int* n, int* p, int* r);
+bool proto_decodeKey(const char* message, char* key, int* token, int* seq);
+bool proto_decodeSession(const char* message, int* token);
+bool proto_decodeText(const char* message, const proto_type_t type,
+                      const char** text);
+bool proto_decodeDisplay(const char* message, const char** grid);
+bool proto_decodeFrame(const char* message, int* seq, const char** grid);
+
+#endif // _PROTOCOL_H_
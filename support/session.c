@@ -0,0 +1,470 @@
+/*
+ * session - a table of client sessions keyed by network address
+ *
+ * See session.h for interface and usage notes.
+ *
+ * Compile with -DUNIT_TEST for a standalone unit test; see below.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "message.h"
+#include "session.h"
+
+/**************** file-local types ****************/
+typedef struct entry {
+  uint64_t key;               // session_key of the client's address
+  void* item;                 // the caller's item
+} entry_t;
+
+/* Entries are stored densely, in insertion order, so that a token can
+ * index them directly; a removed entry is left empty (NULL item, key 0)
+ * until an insert reuses it.  The hash index is a separate
+ * open-addressing array with linear probing; each slot holds an entry
+ * number plus one, or zero if the slot is empty.  It has at least twice
+ * as many slots as the table can hold entries, so probe sequences stay
+ * short.  Removal shifts later slots of the probe sequence back into the
+ * emptied one, so no tombstones build up.
+ */
+struct session_table {
+  entry_t* entries;           // capacity entries, the first 'count' in use
+  atomic_int count;           // number of entries published
+  int capacity;               // most entries we can hold
+  atomic_int sessions;        // number of entries not removed
+  int* free;                  // removed entries, to be reused
+  int nfree;                  // number of them
+  atomic_int* index;          // hash index, mask+1 slots
+  uint64_t mask;              // number of index slots - 1
+};
+
+/**************** file-local functions ****************/
+static uint64_t hashKey(const uint64_t key);
+
+/**************** session_new ****************/
+/* see session.h for description */
+session_table_t*
+session_new(const int capacity)
+{
+  if (capacity <= 0) {
+    return NULL;
+  }
+
+  session_table_t* table = malloc(sizeof(session_table_t));
+  if (table == NULL) {
+    return NULL;
+  }
+
+  // smallest power of two that is at least twice the capacity
+  uint64_t slots = 2;
+  while (slots < 2 * (uint64_t) capacity) {
+    slots <<= 1;
+  }
+
+  table->entries = calloc(capacity, sizeof(entry_t));
+  table->free = calloc(capacity, sizeof(int));
+  table->index = calloc(slots, sizeof(atomic_int));
+  if (table->entries == NULL || table->free == NULL || table->index == NULL) {
+    free(table->entries);
+    free(table->free);
+    free(table->index);
+    free(table);
+    return NULL;
+  }
+  for (uint64_t i = 0; i < slots; i++) {
+    atomic_init(&table->index[i], 0);
+  }
+  atomic_init(&table->count, 0);
+  atomic_init(&table->sessions, 0);
+  table->nfree = 0;
+  table->capacity = capacity;
+  table->mask = slots - 1;
+  return table;
+}
+
+/**************** session_key ****************/
+/* see session.h for description */
+uint64_t
+session_key(const addr_t addr)
+{
+  return ((uint64_t) ntohl(addr.sin_addr.s_addr) << 16) | ntohs(addr.sin_port);
+}
+
+/**************** session_insert ****************/
+/* see session.h for description */
+int
+session_insert(session_table_t* table, const addr_t addr, void* item)
+{
+  if (table == NULL || item == NULL || !message_isAddr(addr)) {
+    return 0;
+  }
+  if (session_find(table, addr) != NULL) {
+    return 0;                 // already has a session
+  }
+
+  // reuse a removed entry, if any; otherwise take the next one
+  int n = atomic_load_explicit(&table->count, memory_order_relaxed);
+  bool reused = (table->nfree > 0);
+  if (reused) {
+    n = table->free[--table->nfree];
+  } else if (n >= table->capacity) {
+    return 0;                 // full
+  }
+
+  // fill in the entry, then publish it: first to iterators, then to lookups
+  uint64_t key = session_key(addr);
+  table->entries[n].key = key;
+  table->entries[n].item = item;
+  if (!reused) {
+    atomic_store_explicit(&table->count, n + 1, memory_order_release);
+  }
+  atomic_fetch_add_explicit(&table->sessions, 1, memory_order_release);
+
+  uint64_t slot = hashKey(key) & table->mask;
+  while (atomic_load_explicit(&table->index[slot], memory_order_relaxed) != 0) {
+    slot = (slot + 1) & table->mask;
+  }
+  atomic_store_explicit(&table->index[slot], n + 1, memory_order_release);
+
+  return n + 1;
+}
+
+/**************** session_remove ****************/
+/* see session.h for description */
+void*
+session_remove(session_table_t* table, const addr_t addr)
+{
+  if (table == NULL) {
+    return NULL;
+  }
+
+  uint64_t key = session_key(addr);
+  uint64_t hole = hashKey(key) & table->mask;
+  int e;
+  while ((e = atomic_load_explicit(&table->index[hole], memory_order_relaxed)) != 0
+         && table->entries[e - 1].key != key) {
+    hole = (hole + 1) & table->mask;
+  }
+  if (e == 0) {
+    return NULL;              // no such session
+  }
+  void* item = table->entries[e - 1].item;
+  table->entries[e - 1].key = 0;
+  table->entries[e - 1].item = NULL;
+  table->free[table->nfree++] = e - 1;
+  atomic_fetch_sub_explicit(&table->sessions, 1, memory_order_relaxed);
+
+  // move back each later slot in this probe sequence whose entry hashes
+  // to the hole or before it, so none is ever past an empty slot
+  uint64_t slot = (hole + 1) & table->mask;
+  while ((e = atomic_load_explicit(&table->index[slot], memory_order_relaxed)) != 0) {
+    uint64_t home = hashKey(table->entries[e - 1].key) & table->mask;
+    if (((slot - home) & table->mask) >= ((slot - hole) & table->mask)) {
+      atomic_store_explicit(&table->index[hole], e, memory_order_relaxed);
+      hole = slot;
+    }
+    slot = (slot + 1) & table->mask;
+  }
+  atomic_store_explicit(&table->index[hole], 0, memory_order_relaxed);
+  return item;
+}
+
+/**************** session_find ****************/
+/* see session.h for description */
+void*
+session_find(session_table_t* table, const addr_t addr)
+{
+  if (table == NULL) {
+    return NULL;
+  }
+
+  uint64_t key = session_key(addr);
+  uint64_t slot = hashKey(key) & table->mask;
+  int e;
+  // the index is never full, so this reaches an empty slot eventually
+  while ((e = atomic_load_explicit(&table->index[slot], memory_order_acquire)) != 0) {
+    if (table->entries[e - 1].key == key) {
+      return table->entries[e - 1].item;
+    }
+    slot = (slot + 1) & table->mask;
+  }
+  return NULL;
+}
+
+/**************** session_findToken ****************/
+/* see session.h for description */
+void*
+session_findToken(session_table_t* table, const int token, const addr_t addr)
+{
+  if (table == NULL) {
+    return NULL;
+  }
+
+  int n = atomic_load_explicit(&table->count, memory_order_acquire);
+  if (token > 0 && token <= n && table->entries[token - 1].item != NULL
+      && table->entries[token - 1].key == session_key(addr)) {
+    return table->entries[token - 1].item;
+  }
+  return session_find(table, addr);
+}
+
+/**************** session_count ****************/
+/* see session.h for description */
+int
+session_count(session_table_t* table)
+{
+  if (table == NULL) {
+    return 0;
+  }
+  return atomic_load_explicit(&table->sessions, memory_order_acquire);
+}
+
+/**************** session_iterate ****************/
+/* see session.h for description */
+void
+session_iterate(session_table_t* table, void* arg,
+                void (*itemfunc)(void* arg, const int token, void* item))
+{
+  if (table == NULL || itemfunc == NULL) {
+    return;
+  }
+
+  int n = atomic_load_explicit(&table->count, memory_order_acquire);
+  for (int e = 0; e < n; e++) {
+    void* item = table->entries[e].item;
+    if (item != NULL) {         // not removed
+      (*itemfunc)(arg, e + 1, item);
+    }
+  }
+}
+
+/**************** session_delete ****************/
+/* see session.h for description */
+void
+session_delete(session_table_t* table, void (*itemdelete)(void* item))
+{
+  if (table == NULL) {
+    return;
+  }
+
+  if (itemdelete != NULL) {
+    int n = atomic_load(&table->count);
+    for (int e = 0; e < n; e++) {
+      if (table->entries[e].item != NULL) {
+        (*itemdelete)(table->entries[e].item);
+      }
+    }
+  }
+  free(table->entries);
+  free(table->free);
+  free(table->index);
+  free(table);
+}
+
+/**************** hashKey ****************/
+/* Mix all 48 bits of an address key into the low bits used by the index
+ * (the finalizer of splitmix64).
+ */
+static uint64_t
+hashKey(const uint64_t key)
+{
+  uint64_t h = key;
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test fills a table, then removes sessions from the middle of
+ * runs of occupied index slots, where the removal has to shift later
+ * entries back; after each removal it checks that every session left is
+ * still found and every one removed is not.  It then refills the table,
+ * reusing the removed entries, and checks that a stale token (one whose
+ * entry now belongs to another address) finds the item by address, or
+ * nothing, but never the other address's item.
+ *
+ * Build and run with
+ *   make sessiontest && ./sessiontest
+ * It prints what it checks, and exits non-zero if any check fails.
+ */
+
+#ifdef UNIT_TEST
+#include <string.h>
+
+static const int Capacity = 500;
+
+static int failures;                     // checks failed
+
+static addr_t clientAddr(const int n);
+static bool allFound(session_table_t* table, const bool* present,
+                     int* items, const int nitems);
+static void check(const bool ok, const char* what);
+
+int
+main(void)
+{
+  const int nitems = 2 * Capacity;
+  int* items = malloc(nitems * sizeof(int));
+  bool* present = calloc(nitems, sizeof(bool));
+  int* tokens = calloc(nitems, sizeof(int));
+  if (items == NULL || present == NULL || tokens == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 2;
+  }
+  for (int i = 0; i < nitems; i++) {
+    items[i] = i;
+  }
+
+  check(session_new(0) == NULL, "a table needs a positive capacity");
+  session_table_t* table = session_new(Capacity);
+  check(table != NULL, "session_new");
+
+  // fill the table
+  bool ok = true;
+  for (int i = 0; i < Capacity; i++) {
+    tokens[i] = session_insert(table, clientAddr(i), &items[i]);
+    present[i] = true;
+    ok = ok && tokens[i] == i + 1;
+  }
+  check(ok, "fill the table, with tokens 1, 2, 3, ...");
+  check(session_count(table) == Capacity, "session_count counts them all");
+  check(session_insert(table, clientAddr(Capacity), &items[Capacity]) == 0,
+        "a full table refuses another session");
+  check(session_insert(table, clientAddr(0), &items[0]) == 0,
+        "an address with a session cannot have another");
+  check(session_insert(table, message_noAddr(), &items[0]) == 0
+        && session_insert(table, clientAddr(Capacity), NULL) == 0,
+        "bad parameters are refused");
+  check(allFound(table, present, items, nitems), "every session is found");
+
+  // remove from the middle of runs of occupied slots, again and again
+  int removed = 0, chained = 0;
+  bool stillFound = true;
+  for (int pass = 0; pass < 3; pass++) {
+    for (uint64_t slot = 0; slot <= table->mask; slot++) {
+      uint64_t next = (slot + 1) & table->mask;
+      uint64_t after = (slot + 2) & table->mask;
+      int e = atomic_load(&table->index[next]);
+      if (atomic_load(&table->index[slot]) == 0 || e == 0
+          || atomic_load(&table->index[after]) == 0) {
+        continue;                        // not the middle of a run
+      }
+      // is the slot after this one there only because of a collision?
+      int later = atomic_load(&table->index[after]);
+      if ((hashKey(table->entries[later - 1].key) & table->mask) != after) {
+        chained++;
+      }
+      int i = *(int*) table->entries[e - 1].item;
+      ok = session_remove(table, clientAddr(i)) == &items[i];
+      present[i] = false;
+      removed++;
+      stillFound = stillFound && ok && allFound(table, present, items, nitems);
+    }
+  }
+  check(removed > 0 && chained > 0,
+        "found sessions in the middle of colliding probe sequences");
+  check(stillFound, "after each removal, every remaining session is found");
+  check(session_count(table) == Capacity - removed, "session_count drops with each");
+  check(session_remove(table, clientAddr(nitems - 1)) == NULL,
+        "removing an address with no session gives NULL");
+
+  // a removed session's token finds nothing
+  int gone = -1;
+  for (int i = 0; i < Capacity && gone < 0; i++) {
+    if (!present[i]) {
+      gone = i;
+    }
+  }
+  check(session_findToken(table, tokens[gone], clientAddr(gone)) == NULL,
+        "a removed session's token finds nothing");
+
+  // refill; new sessions reuse the removed entries and their tokens
+  ok = true;
+  for (int i = Capacity; i < Capacity + removed; i++) {
+    tokens[i] = session_insert(table, clientAddr(i), &items[i]);
+    present[i] = true;
+    ok = ok && tokens[i] > 0 && tokens[i] <= Capacity;
+  }
+  check(ok, "refilling reuses the removed entries");
+  check(session_count(table) == Capacity
+        && session_insert(table, clientAddr(nitems - 1), &items[nitems - 1]) == 0,
+        "the table is full again");
+  check(allFound(table, present, items, nitems), "every session is found after refilling");
+
+  // stale tokens fall back to the address
+  int stale = tokens[gone];              // now some other address's token
+  int owner = -1;
+  for (int i = Capacity; i < Capacity + removed; i++) {
+    if (tokens[i] == stale) {
+      owner = i;
+    }
+  }
+  check(owner >= 0 && session_findToken(table, stale, clientAddr(owner)) == &items[owner],
+        "a reused token finds its new session");
+  check(session_findToken(table, stale, clientAddr(gone)) == NULL,
+        "a stale token for an address with no session finds nothing");
+  session_remove(table, clientAddr(owner));
+  present[owner] = false;
+  int fresh = session_insert(table, clientAddr(gone), &items[gone]);
+  present[gone] = true;
+  check(fresh == stale, "the removed address starts a new session in the same entry");
+  int other = (gone == 0) ? 1 : 0;       // some other address
+  check(session_findToken(table, tokens[other], clientAddr(gone)) == &items[gone],
+        "another session's token falls back to finding by address");
+  check(session_findToken(table, 0, clientAddr(gone)) == &items[gone]
+        && session_findToken(table, Capacity + 1, clientAddr(gone)) == &items[gone]
+        && session_findToken(table, -3, clientAddr(gone)) == &items[gone],
+        "no token, or one out of range, falls back to finding by address");
+  check(allFound(table, present, items, nitems), "every session is found at the end");
+
+  session_delete(table, NULL);
+  free(tokens);
+  free(present);
+  free(items);
+  printf("%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/* Return the address of client number n: 10.0.x.y, on a port from n. */
+static addr_t
+clientAddr(const int n)
+{
+  addr_t addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(0x0a000000 | (n / 7));
+  addr.sin_port = htons(20000 + n % 7);
+  return addr;
+}
+
+/* Return true if every client present is found, with its own item,
+ * and no other client is.
+ */
+static bool
+allFound(session_table_t* table, const bool* present, int* items, const int nitems)
+{
+  for (int i = 0; i < nitems; i++) {
+    void* found = session_find(table, clientAddr(i));
+    if (found != (present[i] ? &items[i] : NULL)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,111 @@
+/*
+ * session - a table of client sessions keyed by network address
+ *
+ * Maps each client address to an item (e.g., a player), without turning
+ * the address into a string: the key is the IP address and port packed
+ * into one 64-bit integer, looked up in an open-addressing hash table.
+ *
+ * Each session also gets a small token, which is the session's index in
+ * the table plus one.  A client that echoes its token back lets
+ * session_findToken go straight to its entry, with no hashing at all; the
+ * address is still checked, so a wrong or forged token finds nothing more
+ * than the address alone would.
+ *
+ * The table has a fixed capacity, but a session may be removed to make
+ * room for another, which may then get the removed session's token.
+ * One thread may insert while any number of threads look up or iterate:
+ * lookups take no locks and keep no static state, and an entry is
+ * published only after it is complete.  Removing moves other sessions
+ * within the hash index, so that thread must not remove while others
+ * look up.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "message.h"
+
+/****************** types *********************/
+typedef struct session_table session_table_t;  // opaque to users
+
+/****************** global functions *********************/
+
+/**************** session_new ****************/
+/* Create a new (empty) session table.
+ * Caller provides:
+ *   the largest number of sessions it will hold, > 0.
+ * We return:
+ *   pointer to the new table; NULL if error.
+ * Caller is responsible for:
+ *   later calling session_delete.
+ */
+session_table_t* session_new(const int capacity);
+
+/**************** session_key ****************/
+/* Return the 64-bit key for an address: its IP address and port. */
+uint64_t session_key(const addr_t addr);
+
+/**************** session_insert ****************/
+/* Start a session for the given address.
+ * Caller provides:
+ *   valid pointer to table, a valid address, non-NULL item.
+ * We return:
+ *   the new session's token, which is > 0;
+ *   0 if the address already has a session, the table is full,
+ *   or any parameter is invalid.
+ * Notes:
+ *   the item pointer is stored, not copied.
+ */
+int session_insert(session_table_t* table, const addr_t addr, void* item);
+
+/**************** session_remove ****************/
+/* End the session for the given address.
+ * Caller provides:
+ *   valid pointer to table, an address.
+ * We return:
+ *   the session's item, or NULL if the address has no session.
+ * Notes:
+ *   the item is not freed; that is up to the caller.
+ *   May be called from session_iterate's itemfunc, for the item it has.
+ */
+void* session_remove(session_table_t* table, const addr_t addr);
+
+/**************** session_find ****************/
+/* Return the item for the given address, or NULL if it has no session. */
+void* session_find(session_table_t* table, const addr_t addr);
+
+/**************** session_findToken ****************/
+/* Return the item for the given address, using its token if possible.
+ * Caller provides:
+ *   valid pointer to table, the token the client sent (0 if none),
+ *   and the address the client sent it from.
+ * We return:
+ *   the session's item if the token belongs to that address;
+ *   otherwise the result of session_find.
+ */
+void* session_findToken(session_table_t* table, const int token,
+                        const addr_t addr);
+
+/**************** session_count ****************/
+/* Return the number of sessions in the table (0 if table is NULL). */
+int session_count(session_table_t* table);
+
+/**************** session_iterate ****************/
+/* Call itemfunc(arg, token, item) on each session, in the order they
+ * were inserted (a session may take the place of one removed earlier).
+ * Does nothing if table or itemfunc is NULL.
+ */
+void session_iterate(session_table_t* table, void* arg,
+                     void (*itemfunc)(void* arg, const int token, void* item));
+
+/**************** session_delete ****************/
+/* Delete the table, calling itemdelete on each item if itemdelete is
+ * not NULL.  Does nothing if table is NULL.
+ */
+void session_delete(session_table_t* table, void (*itemdelete)(void* item));
+
+#endif // _SESSION_H_
@@ -0,0 +1,444 @@
+/*
+ * swarm - a headless load generator for the Nuggets server
+ *
+ * Opens many simulated clients in one process, each with its own UDP
+ * socket: players that join with PLAY and then send KEYs at a steady
+ * rate, and spectators that only watch.  Every client asks for the binary
+ * protocol (see protocol.h).  Players number their KEYs, so each FRAME
+ * the server sends back says which keys it includes; the time from
+ * sending a key to receiving the first frame that includes it is that
+ * key's latency.  At the end, swarm prints the latency percentiles and a
+ * histogram, and the frames and bytes received per second.
+ *
+ * usage: swarm [-p players] [-s spectators] [-r rate] [-t seconds]
+ *              [-k keys] hostname port
+ *   players     number of players (default 10)
+ *   spectators  number of spectators (default 0)
+ *   rate        KEYs per second sent by each player (default 10)
+ *   seconds     how long to send keys (default 10)
+ *   keys        the keys each player sends, in turn (player i starting
+ *               with the i'th); by default, random moves
+ *
+ * The server must not fragment its messages (no -m option).
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#define _GNU_SOURCE           // for ppoll
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include "message.h"
+#include "protocol.h"
+
+/**************** file-local constants ****************/
+#define MaxDatagram 65536     // larger than any UDP payload
+#define Window 4096           // keys a player may have awaiting a frame
+#define SubBuckets 16         // histogram buckets per power of two
+#define Buckets (SubBuckets * 40)
+static const char* RandomKeys = "hjklyubn";
+static const double QuitWait = 1.0;   // seconds to wait for QUITs at the end
+
+/**************** file-local types ****************/
+typedef struct bot {
+  int fd;                     // socket connected to the server
+  bool isPlayer;              // player, or spectator?
+  bool joined;                // has the server sent our GRID?
+  bool done;                  // has the server sent QUIT?
+  int token;                  // session token, 0 until SESSION arrives
+  int seq;                    // number of the last key sent
+  int acked;                  // number of the last key a frame included
+  int script;                 // index of the next scripted key
+  uint64_t rng;               // state for random keys
+  double nextKey;             // when to send the next key
+  double sentAt[Window];      // when key number n was sent, at n % Window
+} bot_t;
+
+/* Latencies, in microseconds, counted in buckets that are exact below
+ * SubBuckets and otherwise split each power of two into SubBuckets
+ * equal parts, so every bucket is within about 6% of its values.
+ */
+typedef struct histogram {
+  long counts[Buckets];
+  long total;
+  long max;
+} histogram_t;
+
+typedef struct stats {
+  histogram_t latency;
+  long keysSent;
+  long keysAnswered;
+  long frames;
+  long bytes;
+} stats_t;
+
+/**************** file-local functions ****************/
+static double now(void);
+static bool botStart(bot_t* bot, const addr_t server, const int i,
+                     const bool isPlayer);
+static void botSendKey(bot_t* bot, const char* keys, const double when,
+                       stats_t* stats);
+static void botReceive(bot_t* bot, stats_t* stats);
+static void histAdd(histogram_t* hist, const long us);
+static long histPercentile(const histogram_t* hist, const double q);
+static long bucketLow(const int b);
+static int bucketOf(const long us);
+static void report(const stats_t* stats, const int nplayers,
+                   const int nspectators, const double elapsed);
+
+/***************** main *******************************/
+int
+main(const int argc, char* argv[])
+{
+  int nplayers = 10, nspectators = 0;
+  double rate = 10, seconds = 10;
+  const char* keys = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:s:r:t:k:")) != -1) {
+    switch (opt) {
+    case 'p': nplayers = atoi(optarg); break;
+    case 's': nspectators = atoi(optarg); break;
+    case 'r': rate = atof(optarg); break;
+    case 't': seconds = atof(optarg); break;
+    case 'k': keys = optarg; break;
+    default: optind = argc + 1; break;
+    }
+  }
+  if (optind != argc - 2 || nplayers < 0 || nspectators < 0
+      || nplayers + nspectators == 0 || rate <= 0 || seconds <= 0
+      || (keys != NULL && *keys == '\0')) {
+    fprintf(stderr, "usage: %s [-p players] [-s spectators] [-r rate] "
+            "[-t seconds] [-k keys] hostname port\n", argv[0]);
+    return 3;
+  }
+
+  addr_t server;
+  if (!message_setAddr(argv[optind], argv[optind + 1], &server)) {
+    fprintf(stderr, "can't form address from %s %s\n",
+            argv[optind], argv[optind + 1]);
+    return 4;
+  }
+
+  int nbots = nplayers + nspectators;
+  bot_t* bots = calloc(nbots, sizeof(bot_t));
+  struct pollfd* fds = calloc(nbots, sizeof(struct pollfd));
+  stats_t* stats = calloc(1, sizeof(stats_t));
+  if (bots == NULL || fds == NULL || stats == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 2;
+  }
+  for (int i = 0; i < nbots; i++) {
+    if (!botStart(&bots[i], server, i, i < nplayers)) {
+      perror("swarm: socket");
+      return 2;
+    }
+    fds[i].fd = bots[i].fd;
+    fds[i].events = POLLIN;
+  }
+
+  // spread the players' first keys over one key interval
+  double start = now();
+  double interval = 1 / rate;
+  for (int i = 0; i < nplayers; i++) {
+    bots[i].nextKey = start + interval * i / nplayers;
+  }
+  double stop = start + seconds;
+
+  // send keys until time is up, then ask to quit and wait for the QUITs
+  bool quitting = false;
+  double deadline = stop;
+  while (true) {
+    double t = now();
+    if (!quitting && t >= stop) {
+      for (int i = 0; i < nbots; i++) {
+        if (!bots[i].done) {
+          char message[PROTO_MAXHEADER];
+          proto_encodeKey(message, 'Q', bots[i].token, 0);
+          send(bots[i].fd, message, strlen(message), 0);
+        }
+      }
+      quitting = true;
+      deadline = t + QuitWait;
+    }
+    if (t >= deadline) {
+      break;
+    }
+
+    // send every key that is due, and find when the next one is
+    double wake = deadline;
+    int active = 0;
+    for (int i = 0; i < nbots; i++) {
+      bot_t* bot = &bots[i];
+      if (bot->done) {
+        continue;
+      }
+      active++;
+      if (quitting || !bot->isPlayer || !bot->joined) {
+        continue;
+      }
+      while (bot->nextKey <= t) {
+        botSendKey(bot, keys, t, stats);
+        bot->nextKey += interval;
+      }
+      if (bot->nextKey < wake) {
+        wake = bot->nextKey;
+      }
+    }
+    if (active == 0) {
+      break;                  // the game is over for everyone
+    }
+
+    double wait = wake - t;
+    struct timespec timeout = {
+      .tv_sec = (time_t) wait,
+      .tv_nsec = (long) ((wait - (time_t) wait) * 1e9),
+    };
+    if (ppoll(fds, nbots, &timeout, NULL) < 0) {
+      perror("swarm: ppoll");
+      break;
+    }
+    for (int i = 0; i < nbots; i++) {
+      if (fds[i].revents & POLLIN) {
+        botReceive(&bots[i], stats);
+      }
+    }
+  }
+
+  report(stats, nplayers, nspectators, now() - start);
+
+  for (int i = 0; i < nbots; i++) {
+    close(bots[i].fd);
+  }
+  free(bots);
+  free(fds);
+  free(stats);
+  return 0;
+}
+
+/**************** now ****************/
+/* Return the time in seconds, from a clock that never jumps. */
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**************** botStart ****************/
+/* Open bot number i's socket, and join the game as a player or
+ * spectator, asking for the binary protocol.  Return false on error.
+ */
+static bool
+botStart(bot_t* bot, const addr_t server, const int i, const bool isPlayer)
+{
+  bot->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (bot->fd < 0
+      || connect(bot->fd, (const struct sockaddr*) &server, sizeof(server)) < 0) {
+    return false;
+  }
+  bot->isPlayer = isPlayer;
+  bot->script = i;
+  bot->rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+
+  char join[32];
+  if (isPlayer) {
+    snprintf(join, sizeof(join), "PLAY swarm%d", i);
+  } else {
+    strcpy(join, "SPECTATE");
+  }
+  send(bot->fd, join, strlen(join), 0);
+  send(bot->fd, "PROTO BINARY", strlen("PROTO BINARY"), 0);
+  return true;
+}
+
+/**************** botSendKey ****************/
+/* Send the bot's next key, numbered, and note when it was sent. */
+static void
+botSendKey(bot_t* bot, const char* keys, const double when, stats_t* stats)
+{
+  char key;
+  if (keys != NULL) {
+    key = keys[bot->script++ % strlen(keys)];
+  } else {
+    // xorshift64
+    bot->rng ^= bot->rng << 13;
+    bot->rng ^= bot->rng >> 7;
+    bot->rng ^= bot->rng << 17;
+    key = RandomKeys[bot->rng % strlen(RandomKeys)];
+  }
+
+  char message[PROTO_MAXHEADER];
+  int seq = ++bot->seq;
+  int len = proto_encodeKey(message, key, bot->token, seq);
+  bot->sentAt[seq % Window] = when;
+  send(bot->fd, message, len, 0);
+  stats->keysSent++;
+}
+
+/**************** botReceive ****************/
+/* Read every datagram waiting on the bot's socket; for each FRAME,
+ * count the latency of the keys it is the first to include.
+ */
+static void
+botReceive(bot_t* bot, stats_t* stats)
+{
+  static char buf[MaxDatagram + 1];
+  ssize_t len;
+  while ((len = recv(bot->fd, buf, MaxDatagram, MSG_DONTWAIT)) >= 0) {
+    buf[len] = '\0';
+    stats->bytes += len;
+    double t = now();
+
+    int seq, token;
+    const char* grid;
+    switch (proto_type(buf)) {
+    case PROTO_GRID:
+      bot->joined = true;
+      break;
+    case PROTO_SESSION:
+      if (proto_decodeSession(buf, &token)) {
+        bot->token = token;
+      }
+      break;
+    case PROTO_DISPLAY:
+      stats->frames++;
+      break;
+    case PROTO_FRAME:
+      stats->frames++;
+      if (proto_decodeFrame(buf, &seq, &grid)) {
+        // keys older than the window have been counted as lost
+        if (bot->acked < seq - Window) {
+          bot->acked = seq - Window;
+        }
+        for (int n = bot->acked + 1; n <= seq && n <= bot->seq; n++) {
+          histAdd(&stats->latency, (long) ((t - bot->sentAt[n % Window]) * 1e6));
+          stats->keysAnswered++;
+        }
+        if (seq > bot->acked) {
+          bot->acked = seq;
+        }
+      }
+      break;
+    case PROTO_QUIT:
+      bot->done = true;
+      break;
+    case 0:
+      // text; a server that ignored PROTO BINARY, or refused us
+      if (strncmp(buf, "QUIT", 4) == 0) {
+        bot->done = true;
+      }
+      break;
+    }
+  }
+}
+
+/**************** histAdd ****************/
+/* Count one latency of 'us' microseconds. */
+static void
+histAdd(histogram_t* hist, const long us)
+{
+  long v = us < 0 ? 0 : us;
+  hist->counts[bucketOf(v)]++;
+  hist->total++;
+  if (v > hist->max) {
+    hist->max = v;
+  }
+}
+
+/**************** histPercentile ****************/
+/* Return the least latency, to bucket precision, that at least
+ * fraction q of the counted latencies do not exceed; 0 if none.
+ */
+static long
+histPercentile(const histogram_t* hist, const double q)
+{
+  long want = (long) (q * hist->total + 0.5);
+  if (want < 1) {
+    want = 1;
+  }
+  long seen = 0;
+  for (int b = 0; b < Buckets; b++) {
+    seen += hist->counts[b];
+    if (seen >= want) {
+      long high = bucketLow(b + 1) - 1;
+      return high < hist->max ? high : hist->max;
+    }
+  }
+  return hist->max;
+}
+
+/**************** bucketOf ****************/
+/* Return the bucket for a latency of 'us' microseconds. */
+static int
+bucketOf(const long us)
+{
+  if (us < SubBuckets) {
+    return (int) us;
+  }
+  int e = 63 - __builtin_clzll((unsigned long long) us);  // us >= 2^e
+  int sub = (int) ((us >> (e - 4)) & (SubBuckets - 1));
+  int b = (e - 3) * SubBuckets + sub;
+  return b < Buckets ? b : Buckets - 1;
+}
+
+/**************** bucketLow ****************/
+/* Return the smallest latency in bucket b; the inverse of bucketOf. */
+static long
+bucketLow(const int b)
+{
+  if (b < SubBuckets) {
+    return b;
+  }
+  int e = b / SubBuckets + 3;
+  return (long) (SubBuckets + b % SubBuckets) << (e - 4);
+}
+
+/**************** report ****************/
+/* Print the results of the run to stdout. */
+static void
+report(const stats_t* stats, const int nplayers, const int nspectators,
+       const double elapsed)
+{
+  const histogram_t* hist = &stats->latency;
+  printf("%d players, %d spectators, %.1f s\n", nplayers, nspectators, elapsed);
+  printf("keys sent %ld, answered %ld\n", stats->keysSent, stats->keysAnswered);
+  printf("latency ms: p50 %.3f  p99 %.3f  p999 %.3f  max %.3f\n",
+         histPercentile(hist, 0.50) / 1e3, histPercentile(hist, 0.99) / 1e3,
+         histPercentile(hist, 0.999) / 1e3, hist->max / 1e3);
+  printf("frames %ld (%.1f/s), bytes %ld (%.1f KB/s)\n",
+         stats->frames, stats->frames / elapsed,
+         stats->bytes, stats->bytes / elapsed / 1024);
+
+  // one line per power of two, with a bar scaled to the fullest line
+  if (hist->total == 0) {
+    return;
+  }
+  long lines[Buckets / SubBuckets] = {0};
+  long most = 0;
+  for (int b = 0; b < Buckets; b++) {
+    lines[b / SubBuckets] += hist->counts[b];
+  }
+  for (int l = 0; l < Buckets / SubBuckets; l++) {
+    if (lines[l] > most) {
+      most = lines[l];
+    }
+  }
+  printf("latency histogram (us):\n");
+  for (int l = 0; l < Buckets / SubBuckets; l++) {
+    if (lines[l] == 0) {
+      continue;
+    }
+    int bar = (int) (lines[l] * 50 / most);
+    printf("%10ld .. %-10ld %8ld %.*s\n",
+           bucketLow(l * SubBuckets), bucketLow((l + 1) * SubBuckets) - 1,
+           lines[l], bar, "##################################################");
+  }
+}
@@ -0,0 +1,428 @@
+/*
+ * workpool - a pool of worker threads that share tasks by work stealing
+ *
+ * See workpool.h for interface and usage notes.
+ * Compile with -DUNIT_TEST for a standalone stress test; see below.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#ifdef UNIT_TEST
+#define _POSIX_C_SOURCE 200809L   // for nanosleep, in the unit test
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "workpool.h"
+#include "workbag.h"
+
+/**************** file-local constants ****************/
+#define MaxTasks 4096         // most tasks queued at once, over all queues
+
+/**************** file-local types ****************/
+typedef struct task {
+  void (*func)(void* arg);
+  void* arg;
+} task_t;
+
+typedef struct worker {
+  workpool_t* pool;           // pool this worker belongs to
+  int index;                  // which worker this is
+  pthread_t thread;           // thread running it
+} worker_t;
+
+/* Tasks live in one array, allocated with the pool; the unused ones
+ * wait in 'spare', and queued ones in some worker's queue.  Each queue
+ * is a workbag, so pushing and popping take no lock, and each can hold
+ * every task, so a push never finds its queue full.
+ */
+struct workpool {
+  int nworkers;               // number of workers and of queues
+  workbag_t** queues;         // one per worker
+  worker_t* workers;          // one per worker
+  task_t* tasks;              // MaxTasks of them
+  workbag_t* spare;           // tasks not in any queue
+  atomic_int pending;         // tasks queued, over all queues
+  atomic_int sleepers;        // workers waiting on 'wake'
+  pthread_mutex_t lock;       // guards 'stopping', and waits on 'wake'
+  pthread_cond_t wake;        // signalled when a task is queued, or stopping
+  bool stopping;              // has workpool_delete been called?
+};
+
+/**************** file-local functions ****************/
+static void* workerMain(void* arg);
+static bool findTask(workpool_t* pool, const int index, task_t* task);
+static void freePool(workpool_t* pool);
+
+/**************** workpool_new ****************/
+/* see workpool.h for description */
+workpool_t*
+workpool_new(const int nworkers)
+{
+  if (nworkers <= 0) {
+    return NULL;
+  }
+  workpool_t* pool = calloc(1, sizeof(workpool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->nworkers = nworkers;
+  pool->queues = calloc(nworkers, sizeof(workbag_t*));
+  pool->workers = calloc(nworkers, sizeof(worker_t));
+  pool->tasks = calloc(MaxTasks, sizeof(task_t));
+  pool->spare = workbag_new(MaxTasks);
+  bool ok = pool->queues != NULL && pool->workers != NULL
+    && pool->tasks != NULL && pool->spare != NULL;
+  for (int i = 0; ok && i < nworkers; i++) {
+    ok = (pool->queues[i] = workbag_new(MaxTasks)) != NULL;
+  }
+  if (!ok) {
+    freePool(pool);
+    return NULL;
+  }
+  for (int t = 0; t < MaxTasks; t++) {
+    workbag_tryInsert(pool->spare, &pool->tasks[t]);
+  }
+  atomic_init(&pool->pending, 0);
+  atomic_init(&pool->sleepers, 0);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pool->stopping = false;
+
+  // start the workers; if any fails, stop those already started
+  for (int i = 0; i < nworkers; i++) {
+    worker_t* worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i;
+    if (pthread_create(&worker->thread, NULL, workerMain, worker) != 0) {
+      // queues of workers never started are empty; drop them now
+      for (int j = i; j < nworkers; j++) {
+        workbag_delete(pool->queues[j], NULL);
+      }
+      pool->nworkers = i;
+      workpool_delete(pool);
+      return NULL;
+    }
+  }
+  return pool;
+}
+
+/**************** workpool_submit ****************/
+/* see workpool.h for description */
+bool
+workpool_submit(workpool_t* pool, const int hint,
+                void (*func)(void* arg), void* arg)
+{
+  if (pool == NULL || func == NULL) {
+    return false;
+  }
+
+  task_t* task = workbag_tryExtract(pool->spare);
+  if (task == NULL) {
+    return false;             // MaxTasks already queued
+  }
+  task->func = func;
+  task->arg = arg;
+  unsigned int which = (unsigned int) hint % pool->nworkers;
+  workbag_tryInsert(pool->queues[which], task);
+
+  // count the task before looking for sleepers; the fence pairs with
+  // the one a worker makes after counting itself as a sleeper, so
+  // either we see it and wake it, or it sees the task
+  atomic_fetch_add(&pool->pending, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&pool->sleepers) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return true;
+}
+
+/**************** workpool_delete ****************/
+/* see workpool.h for description */
+void
+workpool_delete(workpool_t* pool)
+{
+  if (pool == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->nworkers; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+  freePool(pool);
+}
+
+/**************** workerMain ****************/
+/*
+ * Each worker runs tasks from its own queue, or stolen from others,
+ * and sleeps when there are none, until the pool is stopping and
+ * every queue is empty.
+ */
+static void*
+workerMain(void* arg)
+{
+  worker_t* worker = arg;
+  workpool_t* pool = worker->pool;
+  task_t task;
+
+  while (true) {
+    if (findTask(pool, worker->index, &task)) {
+      (*task.func)(task.arg);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->sleepers, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (atomic_load(&pool->pending) == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    atomic_fetch_sub(&pool->sleepers, 1);
+    bool done = atomic_load(&pool->pending) == 0 && pool->stopping;
+    pthread_mutex_unlock(&pool->lock);
+    if (done) {
+      return NULL;
+    }
+  }
+}
+
+/**************** findTask ****************/
+/*
+ * Take a task for worker 'index': the oldest in its own queue, if any,
+ * or else the oldest from the next worker that has one, and put its
+ * slot back among the spares.  Return false if none.
+ */
+static bool
+findTask(workpool_t* pool, const int index, task_t* task)
+{
+  if (atomic_load(&pool->pending) == 0) {
+    return false;
+  }
+  for (int i = 0; i < pool->nworkers; i++) {
+    task_t* found = workbag_tryExtract(pool->queues[(index + i) % pool->nworkers]);
+    if (found != NULL) {
+      *task = *found;
+      atomic_fetch_sub(&pool->pending, 1);
+      workbag_tryInsert(pool->spare, found);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** freePool ****************/
+/*
+ * Free the pool's memory, as much of it as was allocated.
+ */
+static void
+freePool(workpool_t* pool)
+{
+  if (pool->queues != NULL) {
+    for (int i = 0; i < pool->nworkers; i++) {
+      workbag_delete(pool->queues[i], NULL);
+    }
+  }
+  workbag_delete(pool->spare, NULL);
+  free(pool->tasks);
+  free(pool->queues);
+  free(pool->workers);
+  free(pool);
+}
+
+/* ************************* UNIT_TEST ****************************** */
+/*
+ * This unit test has several threads submit tasks to one pool at once,
+ * some of the tasks submitting another in turn, and counts how often
+ * each task runs: every one must run exactly once, including those
+ * still queued when workpool_delete is called.  Then it submits a few
+ * slow tasks, all to the same worker's queue, and checks that they
+ * finish in about the time of one, because idle workers steal them.
+ *
+ * Build and run with
+ *   make workpooltest && ./workpooltest
+ * It prints what it checks, and exits non-zero if any check fails.
+ */
+
+#ifdef UNIT_TEST
+
+#include <time.h>
+
+static const int Workers = 4;
+static const int Submitters = 4;
+static const int PerSubmitter = 50000;
+static const int SlowTasks = 8;
+static const int SlowMs = 50;
+
+typedef struct tester {
+  workpool_t* pool;                      // the pool under test
+  int id;                                // which submitter
+  atomic_int* ran;                       // times each task ran
+  int followers;                         // tasks 'ran' has room for, at the end
+} tester_t;
+
+typedef struct job {
+  tester_t* tester;                      // shared state
+  int index;                             // which counter to bump
+} job_t;
+
+static int failures;                     // checks failed
+static job_t* jobs;                      // one per task
+
+static void* submitTasks(void* arg);
+static void countTask(void* arg);
+static void slowTask(void* arg);
+static void submitRetrying(workpool_t* pool, const int hint,
+                           void (*func)(void* arg), void* arg);
+static long nowMs(void);
+static void napMs(const int ms);
+static void check(const bool ok, const char* what);
+
+int
+main(void)
+{
+  // every other task of each submitter submits one more task, so the
+  // tasks are 1.5 times the submissions
+  const int nsubmitted = Submitters * PerSubmitter;
+  const int ntasks = nsubmitted + nsubmitted / 2;
+  atomic_int* ran = malloc(ntasks * sizeof(atomic_int));
+  jobs = malloc(ntasks * sizeof(job_t));
+  if (ran == NULL || jobs == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 2;
+  }
+  for (int i = 0; i < ntasks; i++) {
+    atomic_init(&ran[i], 0);
+  }
+  workpool_t* pool = workpool_new(Workers);
+  check(pool != NULL, "workpool_new");
+
+  pthread_t threads[Submitters];
+  tester_t testers[Submitters];
+  for (int t = 0; t < Submitters; t++) {
+    testers[t] = (tester_t) { .pool = pool, .id = t, .ran = ran,
+                              .followers = nsubmitted };
+    pthread_create(&threads[t], NULL, submitTasks, &testers[t]);
+  }
+  for (int t = 0; t < Submitters; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  // some tasks are surely still queued; delete runs them first
+  workpool_delete(pool);
+
+  int missing = 0, repeated = 0;
+  for (int i = 0; i < ntasks; i++) {
+    int n = atomic_load(&ran[i]);
+    missing += (n == 0);
+    repeated += (n > 1);
+  }
+  printf("%d tasks: %d never ran, %d ran more than once\n",
+         ntasks, missing, repeated);
+  check(missing == 0 && repeated == 0, "every task runs exactly once");
+
+  // slow tasks all queued for worker 0 are stolen by the others
+  pool = workpool_new(Workers);
+  long start = nowMs();
+  for (int i = 0; i < SlowTasks; i++) {
+    submitRetrying(pool, 0, slowTask, NULL);
+  }
+  workpool_delete(pool);
+  long elapsed = nowMs() - start;
+  printf("%d tasks of %d ms on %d workers took %ld ms\n",
+         SlowTasks, SlowMs, Workers, elapsed);
+  check(elapsed < SlowTasks * SlowMs / 2, "idle workers steal queued tasks");
+
+  check(!workpool_submit(NULL, 0, slowTask, NULL), "a NULL pool takes no tasks");
+  check(workpool_new(0) == NULL, "a pool needs a worker");
+
+  free(ran);
+  free(jobs);
+  printf("%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/* Submit this thread's share of the tasks, with a spread of hints. */
+static void*
+submitTasks(void* arg)
+{
+  tester_t* tester = arg;
+  for (int k = 0; k < PerSubmitter; k++) {
+    int index = tester->id * PerSubmitter + k;
+    jobs[index] = (job_t) { .tester = tester, .index = index };
+    submitRetrying(tester->pool, k, countTask, &jobs[index]);
+  }
+  return NULL;
+}
+
+/* Count a run of this task; an even-numbered one submitted by a
+ * thread then submits a follower, numbered after all of those.
+ */
+static void
+countTask(void* arg)
+{
+  job_t* job = arg;
+  tester_t* tester = job->tester;
+  atomic_fetch_add(&tester->ran[job->index], 1);
+  if (job->index < tester->followers && job->index % 2 == 0) {
+    int index = tester->followers + job->index / 2;
+    jobs[index] = (job_t) { .tester = tester, .index = index };
+    submitRetrying(tester->pool, job->index, countTask, &jobs[index]);
+  }
+}
+
+/* Take a while. */
+static void
+slowTask(void* arg)
+{
+  napMs(SlowMs);
+}
+
+/* Submit a task, waiting for room if the pool is full. */
+static void
+submitRetrying(workpool_t* pool, const int hint,
+               void (*func)(void* arg), void* arg)
+{
+  while (!workpool_submit(pool, hint, func, arg)) {
+    napMs(1);
+  }
+}
+
+/* Return a monotonic clock reading, in milliseconds. */
+static long
+nowMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* Sleep for ms milliseconds. */
+static void
+napMs(const int ms)
+{
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+/* Print the result of one check, and count it if it failed. */
+static void
+check(const bool ok, const char* what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+#endif // UNIT_TEST
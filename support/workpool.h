@@ -0,0 +1,57 @@
+/*
+ * workpool - a pool of worker threads that share tasks by work stealing
+ *
+ * Each worker has its own queue of tasks, a lock-free workbag.  A task is
+ * submitted to the queue of the worker chosen by a hint (e.g., the id of
+ * the thing the task works on), so related tasks tend to run on the same
+ * worker; a worker with nothing to do takes the oldest task from another
+ * worker's queue.  The pool holds a fixed number of tasks, allocated when
+ * it is made, so submitting allocates nothing.
+ * Tasks must not assume which thread runs them, nor in what order tasks
+ * submitted separately will run.
+ *
+ * JL3, CS 50, Fall 2024
+ */
+
+#ifndef _WORKPOOL_H_
+#define _WORKPOOL_H_
+
+#include <stdbool.h>
+
+/****************** types *********************/
+typedef struct workpool workpool_t;  // opaque to users
+
+/****************** global functions *********************/
+
+/**************** workpool_new ****************/
+/* Create a pool and start its workers.
+ * Caller provides:
+ *   the number of worker threads, > 0.
+ * We return:
+ *   pointer to the new pool; NULL if error.
+ * Caller is responsible for:
+ *   later calling workpool_delete.
+ */
+workpool_t* workpool_new(const int nworkers);
+
+/**************** workpool_submit ****************/
+/* Queue func(arg) to be run by some worker.
+ * Caller provides:
+ *   valid pointer to pool, a hint (any int) choosing the worker whose
+ *   queue the task joins, and a non-NULL func; arg may be NULL.
+ * We return:
+ *   true if the task was queued; false on error, or if the pool
+ *   already holds as many queued tasks as it can (several thousand).
+ * Notes:
+ *   Tasks may submit more tasks.
+ */
+bool workpool_submit(workpool_t* pool, const int hint,
+                     void (*func)(void* arg), void* arg);
+
+/**************** workpool_delete ****************/
+/* Run every task already queued, stop the workers, and free the pool.
+ * Does nothing if pool is NULL.  Must not be called from a task.
+ */
+void workpool_delete(workpool_t* pool);
+
+#endif // _WORKPOOL_H_